@@ -4,11 +4,12 @@
 #include <deque>
 #include <initializer_list>
 #include <memory>
-#include <stdlib.h> /* srand, rand */
+#include <stdlib.h> /* rand */
 #include <time.h>   /* time */
 
 #include "base/Condition.hpp"
 #include "base/Mutex.hpp"
+#include "base/TimeStamp.hpp"
 
 namespace tsdb {
 namespace base {
@@ -27,6 +28,27 @@ public:
     {
         base::MutexLockGuard lock(mutex_);
         if (buf_.empty()) buf_.push_back(v);
+        condition_.notifyAll();
+    }
+
+    // Block until a value is sent, or at most seconds when seconds >= 0.
+    // Return false on timeout.
+    bool recv_wait(double seconds, T* v)
+    {
+        TimeStamp deadline = addTime(TimeStamp::now(), seconds);
+        base::MutexLockGuard lock(mutex_);
+        while (buf_.empty()) {
+            if (seconds < 0) {
+                condition_.wait();
+                continue;
+            }
+            double left = timeDifference(deadline, TimeStamp::now());
+            if (left <= 0) return false;
+            condition_.waitForSeconds(left);
+        }
+        *v = buf_.front();
+        buf_.pop_front();
+        return true;
     }
 
     T recv()
@@ -74,8 +96,6 @@ int channel_select(const std::deque<std::shared_ptr<Channel<T>>>& chans)
         if (!chans[i]->empty()) d.push_back(i);
     }
     if (d.empty()) return -1;
-    // Seed the random number generator
-    srand(time(0));
     return d[rand() % d.size()];
 }
 
@@ -90,8 +110,6 @@ int channel_select(
         ++i;
     }
     if (d.empty()) return -1;
-    // Seed the random number generator
-    srand(time(0));
     return d[rand() % d.size()];
 }
 
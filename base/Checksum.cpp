@@ -1,8 +1,214 @@
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
 #include "base/Checksum.hpp"
 
 namespace tsdb{
 namespace base{
 
+namespace{
+
+// Bytes copied at a time out of a std::deque.
+const int DEQUE_CHUNK = 4096;
+
+const uint32_t CRC32C_POLY = 0x82f63b78; // Reflected.
+
+uint32_t crc32c_table[8][256];
+
+void init_crc32c_table(){
+    for(int i = 0; i < 256; i ++){
+        uint32_t crc = i;
+        for(int j = 0; j < 8; j ++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[0][i] = crc;
+    }
+    for(int i = 0; i < 256; i ++){
+        for(int k = 1; k < 8; k ++)
+            crc32c_table[k][i] = (crc32c_table[k - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[k - 1][i] & 0xff];
+    }
+}
+
+uint32_t crc32c_software(uint32_t crc, const uint8_t * p, size_t size){
+    while(size >= 8){
+        uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24));
+        uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | (static_cast<uint32_t>(p[7]) << 24);
+        crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+              crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+              crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while(size --)
+        crc = crc32c_table[0][(crc ^ *p ++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+// a * b modulo the polynomial, bit 31 being x^0.
+uint32_t multmodp(uint32_t a, uint32_t b){
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    while(true){
+        if(a & m){
+            p ^= b;
+            if((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// x^n modulo the polynomial.
+uint32_t xnmodp(uint64_t n){
+    uint32_t r = 1u << 31;
+    uint32_t sq = 1u << 30;
+    while(n){
+        if(n & 1)
+            r = multmodp(r, sq);
+        sq = multmodp(sq, sq);
+        n >>= 1;
+    }
+    return r;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t * p, size_t size){
+    while(size > 0 && (reinterpret_cast<uintptr_t>(p) & 7)){
+        crc = _mm_crc32_u8(crc, *p ++);
+        -- size;
+    }
+    uint64_t c = crc;
+    while(size >= 8){
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+        p += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(c);
+    while(size --)
+        crc = _mm_crc32_u8(crc, *p ++);
+    return crc;
+}
+
+// Bytes per stream of the interleaved loops, and the constants shifting the
+// register of a stream over the streams after it.
+const size_t CRC32C_LONG = 8192;
+const size_t CRC32C_SHORT = 256;
+uint32_t crc32c_long_shift[2];
+uint32_t crc32c_short_shift[2];
+
+void init_crc32c_shifts(){
+    // The product of the register and the constant is reduced by the crc32
+    // instruction, which multiplies it by x^32 on the way.
+    crc32c_long_shift[0] = xnmodp(CRC32C_LONG * 8 * 2 - 32);
+    crc32c_long_shift[1] = xnmodp(CRC32C_LONG * 8 - 32);
+    crc32c_short_shift[0] = xnmodp(CRC32C_SHORT * 8 * 2 - 32);
+    crc32c_short_shift[1] = xnmodp(CRC32C_SHORT * 8 - 32);
+}
+
+__attribute__((target("sse4.2,pclmul")))
+uint32_t crc32c_shift(uint32_t crc, uint32_t k){
+    __m128i prod = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc), _mm_cvtsi32_si128(k), 0);
+    // The product of two reflected values is one bit short.
+    uint64_t v = static_cast<uint64_t>(_mm_cvtsi128_si64(prod)) << 1;
+    return static_cast<uint32_t>(_mm_crc32_u64(0, v));
+}
+
+// Three streams of stride bytes run through the crc32 instruction at once,
+// hiding its latency, and are folded into one register.
+__attribute__((target("sse4.2,pclmul")))
+uint32_t crc32c_streams(uint32_t crc, const uint8_t ** pp, size_t * size, size_t stride, const uint32_t * shift){
+    const uint8_t * p = *pp;
+    while(*size >= stride * 3){
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+        const uint8_t * end = p + stride;
+        while(p < end){
+            uint64_t w0, w1, w2;
+            memcpy(&w0, p, 8);
+            memcpy(&w1, p + stride, 8);
+            memcpy(&w2, p + stride * 2, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+            p += 8;
+        }
+        crc = crc32c_shift(static_cast<uint32_t>(c0), shift[0]) ^ crc32c_shift(static_cast<uint32_t>(c1), shift[1]) ^ static_cast<uint32_t>(c2);
+        p += stride * 2;
+        *size -= stride * 3;
+    }
+    *pp = p;
+    return crc;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+uint32_t crc32c_pclmul(uint32_t crc, const uint8_t * p, size_t size){
+    crc = crc32c_streams(crc, &p, &size, CRC32C_LONG, crc32c_long_shift);
+    crc = crc32c_streams(crc, &p, &size, CRC32C_SHORT, crc32c_short_shift);
+    return crc32c_sse42(crc, p, size);
+}
+
+#endif
+
+typedef uint32_t (*Crc32cFunc)(uint32_t, const uint8_t *, size_t);
+
+class Crc32cImpl{
+    public:
+        Crc32cFunc f;
+        const char * name;
+
+        Crc32cImpl(){
+            init_crc32c_table();
+            f = &crc32c_software;
+            name = "software";
+#if defined(__x86_64__)
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("sse4.2")){
+                f = &crc32c_sse42;
+                name = "sse4.2";
+                if(__builtin_cpu_supports("pclmul")){
+                    init_crc32c_shifts();
+                    f = &crc32c_pclmul;
+                    name = "sse4.2+pclmul";
+                }
+            }
+#endif
+        }
+};
+
+const Crc32cImpl & crc32c_impl(){
+    static Crc32cImpl impl;
+    return impl;
+}
+
+}
+
+uint32_t extend_crc32c(uint32_t crc, const uint8_t * p, size_t size){
+    return crc32c_impl().f(crc, p, size);
+}
+
+const char * crc32c_implementation(){
+    return crc32c_impl().name;
+}
+
+void CRC32::process_bytes(const std::deque<uint8_t> & my_string){
+    uint8_t buf[DEQUE_CHUNK];
+    auto it = my_string.begin();
+    while(it != my_string.end()){
+        int n = 0;
+        while(n < DEQUE_CHUNK && it != my_string.end())
+            buf[n ++] = *it ++;
+        result.process_bytes(buf, n);
+    }
+}
+
 uint32_t GetCrc32(const std::string& my_string) {
     boost::crc_32_type result;
     result.process_bytes(my_string.data(), my_string.length());
@@ -10,9 +216,8 @@ uint32_t GetCrc32(const std::string& my_string) {
 }
 
 uint32_t GetCrc32(const std::deque<uint8_t> & my_string) {
-    boost::crc_32_type result;
-    for(uint8_t i: my_string)
-        result.process_byte(i);
+    CRC32 result;
+    result.process_bytes(my_string);
     return result.checksum();
 }
 
@@ -37,5 +242,13 @@ uint32_t GetCrc32(std::pair<const uint8_t*, int> p){
     return result.checksum();
 }
 
+uint32_t GetCrc32c(const uint8_t * my_string, int size){
+    return ~extend_crc32c(0xffffffff, my_string, size);
+}
+
+uint32_t GetCrc32c(std::pair<const uint8_t*, int> p){
+    return ~extend_crc32c(0xffffffff, p.first, p.second);
+}
+
+}
 }
-}
\ No newline at end of file
@@ -1,72 +1,108 @@
-#ifndef CHECKSUM_H
-#define CHECKSUM_H
-#include <boost/crc.hpp>
-#include <string>
-#include <stdint.h>
-#include "base/Endian.hpp"
-
-namespace tsdb{
-namespace base{
-
-class CRC32{
-    private:
-        boost::crc_32_type result;
-
-    public:
-        CRC32(){}
-
-        void process_bytes(const std::string& my_string){
-            result.process_bytes(my_string.data(), my_string.length());
-        }
-
-        void process_bytes(const std::vector<uint8_t> & my_string){
-            result.process_bytes(reinterpret_cast<const void *>(&my_string[0]), my_string.size());
-        }
-
-        void process_bytes(const std::deque<uint8_t> & my_string){
-            for(uint8_t i: my_string)
-                result.process_byte(i);
-        }
-
-        void process_bytes(const uint8_t * my_string, int size){
-            result.process_bytes(reinterpret_cast<const void *>(my_string), size);
-        }
-
-        void process_bytes(std::pair<const uint8_t*, int> p){
-            result.process_bytes(reinterpret_cast<const void *>(p.first), p.second);
-        }
-
-        void reset(){
-            result.reset();
-        }
-
-        uint32_t checksum(){
-            return result.checksum();
-        }
-};
-
-uint32_t GetCrc32(const std::string& my_string);
-
-// std::unique_ptr<unsigned char> GetCrc32_little_endian(const std::string & my_string){
-//     boost::crc_32_type result;
-//     result.process_bytes(my_string.data(), my_string.length());
-//     return little_endian<int32_t>(result.checksum());
-// }
-
-// std::string GetCrc32_little_endian(const std::string & my_string){
-//     boost::crc_32_type result;
-//     result.process_bytes(my_string.data(), my_string.length());
-//     return little_endian<int32_t>(result.checksum());
-// }
-
-uint32_t GetCrc32(const std::deque<uint8_t> & my_string);
-
-uint32_t GetCrc32(const std::vector<uint8_t> & my_string);
-
-uint32_t GetCrc32(const uint8_t * my_string, int size);
-
-uint32_t GetCrc32(std::pair<const uint8_t*, int> p);
-
-}}
-
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+#include <boost/crc.hpp>
+#include <deque>
+#include <string>
+#include <stdint.h>
+#include <vector>
+#include "base/Endian.hpp"
+
+namespace tsdb{
+namespace base{
+
+class CRC32{
+    private:
+        boost::crc_32_type result;
+
+    public:
+        CRC32(){}
+
+        void process_bytes(const std::string& my_string){
+            result.process_bytes(my_string.data(), my_string.length());
+        }
+
+        void process_bytes(const std::vector<uint8_t> & my_string){
+            result.process_bytes(reinterpret_cast<const void *>(&my_string[0]), my_string.size());
+        }
+
+        void process_bytes(const std::deque<uint8_t> & my_string);
+
+        void process_bytes(const uint8_t * my_string, int size){
+            result.process_bytes(reinterpret_cast<const void *>(my_string), size);
+        }
+
+        void process_bytes(std::pair<const uint8_t*, int> p){
+            result.process_bytes(reinterpret_cast<const void *>(p.first), p.second);
+        }
+
+        void reset(){
+            result.reset();
+        }
+
+        uint32_t checksum(){
+            return result.checksum();
+        }
+};
+
+// extend_crc32c continues the CRC-32C (Castagnoli) of the bytes before p,
+// crc being the register before the final inversion. The crc32 instruction of
+// SSE4.2 is used when the CPU has it, with three interleaved streams combined
+// by PCLMULQDQ on long buffers, and a slicing-by-8 table otherwise.
+uint32_t extend_crc32c(uint32_t crc, const uint8_t * p, size_t size);
+
+// Name of the CRC-32C implementation picked for this CPU.
+const char * crc32c_implementation();
+
+class CRC32C{
+    private:
+        uint32_t crc;
+
+    public:
+        CRC32C(): crc(0xffffffff){}
+
+        void process_bytes(const uint8_t * my_string, int size){
+            crc = extend_crc32c(crc, my_string, size);
+        }
+
+        void process_bytes(std::pair<const uint8_t*, int> p){
+            crc = extend_crc32c(crc, p.first, p.second);
+        }
+
+        void reset(){
+            crc = 0xffffffff;
+        }
+
+        uint32_t checksum(){
+            return ~crc;
+        }
+};
+
+uint32_t GetCrc32(const std::string& my_string);
+
+// std::unique_ptr<unsigned char> GetCrc32_little_endian(const std::string & my_string){
+//     boost::crc_32_type result;
+//     result.process_bytes(my_string.data(), my_string.length());
+//     return little_endian<int32_t>(result.checksum());
+// }
+
+// std::string GetCrc32_little_endian(const std::string & my_string){
+//     boost::crc_32_type result;
+//     result.process_bytes(my_string.data(), my_string.length());
+//     return little_endian<int32_t>(result.checksum());
+// }
+
+uint32_t GetCrc32(const std::deque<uint8_t> & my_string);
+
+uint32_t GetCrc32(const std::vector<uint8_t> & my_string);
+
+uint32_t GetCrc32(const uint8_t * my_string, int size);
+
+uint32_t GetCrc32(std::pair<const uint8_t*, int> p);
+
+uint32_t GetCrc32c(const uint8_t * my_string, int size);
+
+uint32_t GetCrc32c(std::pair<const uint8_t*, int> p);
+
+}}
+
 #endif
\ No newline at end of file
@@ -27,7 +27,8 @@ class Condition: boost::noncopyable{
             pthread_cond_wait(&pcond_, mutex_.getMutex());
         }
 
-        void waitForSeconds(double seconds){
+        // Return true on timeout.
+        bool waitForSeconds(double seconds){
             struct timespec abstime;
             // FIXME: use CLOCK_MONOTONIC or CLOCK_MONOTONIC_RAW to prevent time rewind.
             clock_gettime(CLOCK_REALTIME, &abstime);
@@ -39,7 +40,7 @@ class Condition: boost::noncopyable{
             abstime.tv_nsec = static_cast<long>((abstime.tv_nsec + nanoseconds) % kNanoSecondsPerSecond);
 
             // MutexLock::UnassignGuard ug(mutex_);
-            pthread_cond_timedwait(&pcond_, mutex_.getMutex(), &abstime);
+            return ETIMEDOUT == pthread_cond_timedwait(&pcond_, mutex_.getMutex(), &abstime);
         }
 
         void notify(){
@@ -83,6 +83,9 @@ class MinHeap{
         T front(){
             return samples.front();
         }
+        bool empty(){
+            return samples.empty();
+        }
 };
 
 template<typename T>
@@ -162,6 +165,9 @@ class MaxHeap{
         T front(){
             return samples.front();
         }
+        bool empty(){
+            return samples.empty();
+        }
 };
 
 }
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <unistd.h>
+
+#include "base/RateLimiter.hpp"
+#include "base/TimeStamp.hpp"
+
+namespace tsdb {
+namespace base {
+
+namespace {
+
+const int ADAPT_STEPS = 16;
+
+} // namespace
+
+RateLimiter::RateLimiter(int64_t rate, int64_t burst)
+    : max_rate(rate), rate_(rate), burst(burst > 0 ? burst : rate / 10 + 1),
+      tokens(this->burst),
+      last(TimeStamp::now().microSecondsSinceEpoch())
+{}
+
+void RateLimiter::refill(int64_t now)
+{
+    if (now <= last) return;
+    tokens = std::min(static_cast<double>(burst),
+                      tokens + static_cast<double>(now - last) * rate_ /
+                                   TimeStamp::kMicroSecondsPerSecond);
+    last = now;
+}
+
+void RateLimiter::request(int64_t bytes)
+{
+    if (bytes <= 0) return;
+    bytes_.add(bytes);
+    int64_t wait;
+    {
+        MutexLockGuard lock(mutex_);
+        refill(TimeStamp::now().microSecondsSinceEpoch());
+        tokens -= bytes;
+        if (tokens >= 0) return;
+        wait = static_cast<int64_t>(-tokens *
+                                    TimeStamp::kMicroSecondsPerSecond / rate_);
+    }
+    waited_us_.add(wait);
+    usleep(wait);
+}
+
+void RateLimiter::adapt(bool congested)
+{
+    MutexLockGuard lock(mutex_);
+    refill(TimeStamp::now().microSecondsSinceEpoch());
+    int64_t step = std::max(max_rate / ADAPT_STEPS, static_cast<int64_t>(1));
+    if (congested)
+        rate_ = std::max(rate_ / 2, step);
+    else
+        rate_ = std::min(rate_ + step, max_rate);
+}
+
+int64_t RateLimiter::rate()
+{
+    MutexLockGuard lock(mutex_);
+    return rate_;
+}
+
+} // namespace base
+} // namespace tsdb
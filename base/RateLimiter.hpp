@@ -0,0 +1,50 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <stdint.h>
+
+#include "base/Atomic.hpp"
+#include "base/Mutex.hpp"
+
+namespace tsdb {
+namespace base {
+
+// RateLimiter is a token bucket of bytes refilled at rate() bytes per second.
+// request() reserves the bytes and sleeps off the debt outside of the lock, so
+// a request larger than the burst still passes and the long-term rate holds.
+class RateLimiter {
+private:
+    MutexLock mutex_;
+    int64_t max_rate;
+    int64_t rate_;
+    int64_t burst;
+    double tokens;
+    int64_t last; // Microseconds of the last refill.
+
+    AtomicInt64 bytes_;
+    AtomicInt64 waited_us_;
+
+    void refill(int64_t now);
+
+public:
+    // rate > 0, burst defaults to 100ms of rate.
+    RateLimiter(int64_t rate, int64_t burst = 0);
+
+    // Block until bytes are allowed to be read or written.
+    void request(int64_t bytes);
+
+    // AIMD between max_rate / 16 and the rate given to the constructor: halve
+    // the rate when the protected workload is congested, otherwise grow it by
+    // one step.
+    void adapt(bool congested);
+
+    int64_t rate();
+
+    int64_t bytes() { return bytes_.get(); }
+    int64_t waited_us() { return waited_us_.get(); }
+};
+
+} // namespace base
+} // namespace tsdb
+
+#endif
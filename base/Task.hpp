@@ -0,0 +1,116 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tsdb{
+namespace base{
+
+// Task is a move-only void() callable. Callables of up to INLINE_SIZE bytes,
+// e.g. a boost::bind of a member function with a few arguments, are kept in
+// place, so queueing a task does not allocate unlike boost::function.
+class Task{
+    private:
+        static const size_t INLINE_SIZE = 64;
+        typedef std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+        struct Ops{
+            void (*call)(Storage * s);
+            void (*move)(Storage * from, Storage * to); // Destroys from.
+            void (*destroy)(Storage * s);
+        };
+
+        template <typename F>
+        struct InlineOps{
+            static F * get(Storage * s){ return reinterpret_cast<F *>(s); }
+            static void call(Storage * s){ (*get(s))(); }
+            static void move(Storage * from, Storage * to){
+                new (to) F(std::move(*get(from)));
+                get(from)->~F();
+            }
+            static void destroy(Storage * s){ get(s)->~F(); }
+            static const Ops ops;
+        };
+
+        template <typename F>
+        struct HeapOps{
+            static F *& get(Storage * s){ return *reinterpret_cast<F **>(s); }
+            static void call(Storage * s){ (*get(s))(); }
+            static void move(Storage * from, Storage * to){ new (to) F *(get(from)); }
+            static void destroy(Storage * s){ delete get(s); }
+            static const Ops ops;
+        };
+
+        template <typename F>
+        struct Fits: std::integral_constant<bool, sizeof(F) <= INLINE_SIZE && alignof(std::max_align_t) % alignof(F) == 0>{};
+
+        Storage storage;
+        const Ops * ops;
+
+        template <typename F, typename A>
+        void init(A && f, std::true_type){
+            new (&storage) F(std::forward<A>(f));
+            ops = &InlineOps<F>::ops;
+        }
+
+        template <typename F, typename A>
+        void init(A && f, std::false_type){
+            new (&storage) F *(new F(std::forward<A>(f)));
+            ops = &HeapOps<F>::ops;
+        }
+
+    public:
+        Task(): ops(NULL){}
+
+        template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+        Task(F && f): ops(NULL){
+            typedef typename std::decay<F>::type T;
+            init<T>(std::forward<F>(f), Fits<T>());
+        }
+
+        Task(Task && t): ops(t.ops){
+            if(ops)
+                ops->move(&t.storage, &storage);
+            t.ops = NULL;
+        }
+
+        Task & operator=(Task && t){
+            if(this != &t){
+                reset();
+                ops = t.ops;
+                if(ops)
+                    ops->move(&t.storage, &storage);
+                t.ops = NULL;
+            }
+            return *this;
+        }
+
+        Task(const Task &) = delete;
+        Task & operator=(const Task &) = delete;
+
+        void reset(){
+            if(ops){
+                ops->destroy(&storage);
+                ops = NULL;
+            }
+        }
+
+        explicit operator bool() const{ return ops != NULL; }
+
+        void operator()(){ ops->call(&storage); }
+
+        ~Task(){ reset(); }
+};
+
+template <typename F>
+const Task::Ops Task::InlineOps<F>::ops = {&Task::InlineOps<F>::call, &Task::InlineOps<F>::move, &Task::InlineOps<F>::destroy};
+
+template <typename F>
+const Task::Ops Task::HeapOps<F>::ops = {&Task::HeapOps<F>::call, &Task::HeapOps<F>::move, &Task::HeapOps<F>::destroy};
+
+}}
+
+#endif
@@ -1,5 +1,9 @@
 #include "Thread.hpp"
 
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 namespace tsdb{
 namespace base{
 
@@ -113,4 +117,8 @@ struct ThreadData{
         }
     }
 
+    bool set_current_thread_nice(int nice){
+        return setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), nice) == 0;
+    }
+
 }}
\ No newline at end of file
@@ -49,5 +49,9 @@ class Thread : boost::noncopyable
         static AtomicInt numCreated_;
 };
 
+// Set the nice value of the calling thread only, each Linux thread has its
+// own. Return false on failure, e.g. lowering the value without privilege.
+bool set_current_thread_nice(int nice);
+
 }}
 #endif
\ No newline at end of file
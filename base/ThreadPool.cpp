@@ -1,17 +1,32 @@
 #include "ThreadPool.hpp"
 #include <boost/bind.hpp>
 #include <exception>
+#include <unistd.h>
 // #include <iostream>
 
 namespace tsdb{
 namespace base{
 
+namespace{
+
+// The pool and the index of the worker running in the current thread.
+__thread ThreadPool * t_pool = NULL;
+__thread int t_worker = -1;
+
+}
+
+struct ThreadPool::Worker{
+    MutexLock mutex;
+    std::deque<Task> queues[NUM_TASK_PRIORITIES];
+    AtomicInt size; // Of all queues, checked before taking the lock.
+};
+
 ThreadPool::ThreadPool(const std::string& nameArg)
   : mutex_(),
     notEmpty_(mutex_),
     notFull_(mutex_),
     name_(nameArg),
-    maxQueueSize_(8),
+    maxQueueSize_(0),
     running_(false)
 {}
 
@@ -23,14 +38,24 @@ ThreadPool::~ThreadPool(){
     // LOG_DEBUG << "~ThreadPool() quits";
 }
 
+int ThreadPool::hardware_threads(){
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? static_cast<int>(n) : 1;
+}
+
 void ThreadPool::start(int numThreads){
     assert(threads_.empty());
+    if(numThreads < 0)
+        numThreads = hardware_threads();
     running_ = true;
+    workers_.reserve(numThreads);
+    for(int i = 0; i < numThreads; ++i)
+        workers_.emplace_back(new Worker());
     threads_.reserve(numThreads);
     for (int i = 0; i < numThreads; ++i){
         char id[32];
         snprintf(id, sizeof id, "%d", i+1);
-        threads_.push_back(new Thread(boost::bind(&ThreadPool::runInThread, this), name_+id));
+        threads_.push_back(new Thread(boost::bind(&ThreadPool::runInThread, this, i), name_+id));
         threads_[i].start();
     }
     if (numThreads == 0 && threadInitCallback_){
@@ -43,57 +68,111 @@ void ThreadPool::stop(){
         MutexLockGuard lock(mutex_);
         running_ = false;
         notEmpty_.notifyAll();
+        notFull_.notifyAll();
     }
     for(boost::ptr_vector<Thread>::iterator i = threads_.begin(); i != threads_.end(); ++i){
         (*i).join();
     }
 }
 
-void ThreadPool::run(const Task& f){
+void ThreadPool::run(Task task, int priority){
     // LOG_DEBUG << "add task";
-    if(running_ && maxQueueSize_ > 0){    
-        if(threads_.empty()){
-            f();
-        }
-        else{
+    if(!running_)
+        return;
+    if(threads_.empty()){
+        task();
+        return;
+    }
+
+    int index;
+    if(t_pool == this)
+        index = t_worker;
+    else{
+        if(maxQueueSize_ > 0){
             MutexLockGuard lock(mutex_);
-            while(queue_.size() >= maxQueueSize_){
+            while(pending_.get() >= static_cast<int>(maxQueueSize_) && running_){
                 notFull_.wait();
             }
-            queue_.push_back(f);
-            // std::cout << "push\n";
-            notEmpty_.notify();
+        }
+        index = next_worker_.getAndAdd(1) % workers_.size();
+    }
+
+    Worker & w = *workers_[index];
+    {
+        MutexLockGuard lock(w.mutex);
+        w.queues[priority].push_back(std::move(task));
+        w.size.increment();
+        pending_.increment();
+    }
+    // A worker going to sleep counts itself before checking pending_, so
+    // either it sees the task or the task sees it.
+    if(sleeping_.get() > 0){
+        MutexLockGuard lock(mutex_);
+        notEmpty_.notify();
+    }
+}
+
+// Take the first task of the highest priority, from the front of the own
+// queue or else from the back of another worker's.
+bool ThreadPool::pop(int index, Task * task){
+    int n = workers_.size();
+    for(int p = 0; p < NUM_TASK_PRIORITIES; ++p){
+        for(int k = 0; k < n; ++k){
+            Worker & w = *workers_[(index + k) % n];
+            if(w.size.get() == 0)
+                continue;
+            MutexLockGuard lock(w.mutex);
+            std::deque<Task> & q = w.queues[p];
+            if(q.empty())
+                continue;
+            if(k == 0){
+                *task = std::move(q.front());
+                q.pop_front();
+            }
+            else{
+                *task = std::move(q.back());
+                q.pop_back();
+            }
+            w.size.decrement();
+            pending_.decrement();
+            return true;
         }
     }
+    return false;
 }
 
-ThreadPool::Task ThreadPool::take(){
-    Task task;
-    if(running_ && maxQueueSize_ > 0){
+bool ThreadPool::take(int index, Task * task){
+    while(running_){
+        if(pending_.get() > 0 && pop(index, task)){
+            if(maxQueueSize_ > 0){
+                MutexLockGuard lock(mutex_);
+                notFull_.notify();
+            }
+            return true;
+        }
         MutexLockGuard lock(mutex_);
-        while(queue_.empty() && running_){ //一定要有running_条件，否则若调用stop会死循环
+        sleeping_.increment();
+        while(pending_.get() == 0 && running_){ //一定要有running_条件，否则若调用stop会死循环
             notEmpty_.wait();
         }
-        if(!queue_.empty()){
-            task = queue_.front();
-            queue_.pop_front();
-            // std::cout << "pop\n";
-            notFull_.notify();
-        }
+        sleeping_.decrement();
     }
-    return task;
+    return false;
 }
 
-void ThreadPool::runInThread(){
+void ThreadPool::runInThread(int index){
+    t_pool = this;
+    t_worker = index;
     try{
         if(threadInitCallback_){
             threadInitCallback_();
         }
+        Task task;
         while(running_){
-            Task task = take();
-            if(task){
+            if(take(index, &task)){
                 // LOG_DEBUG << "take task";
                 task();
+                task.reset();
             }
             // std::cout << queueSize() << std::endl;
         }
@@ -109,4 +188,4 @@ void ThreadPool::runInThread(){
     }
 }
 
-}}
\ No newline at end of file
+}}
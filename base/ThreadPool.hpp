@@ -1,64 +1,136 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
+#include "Atomic.hpp"
 #include "Mutex.hpp"
 #include "Condition.hpp"
+#include "CountDownLatch.hpp"
+#include "Task.hpp"
 #include "Thread.hpp"
+#include <algorithm>
+#include <atomic>
+#include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <deque>
+#include <memory>
+#include <vector>
 
 namespace tsdb{
 namespace base{
 
+// Queued tasks of a higher priority run first, wherever they are queued.
+enum TaskPriority{
+    TASK_PRIORITY_HIGH = 0,   // Latency sensitive, e.g. queries.
+    TASK_PRIORITY_NORMAL = 1,
+    TASK_PRIORITY_LOW = 2,    // Background work, e.g. checkpoints.
+    NUM_TASK_PRIORITIES = 3
+};
+
+// ThreadPool is a work-stealing scheduler. Each worker has its own queues and
+// runs them in submission order, a worker out of tasks steals the newest ones
+// of the others before going to sleep. Tasks submitted from a worker stay on
+// its queues, other submitters spread theirs over the workers.
 class ThreadPool : boost::noncopyable{
     public:
-        typedef boost::function<void ()> Task;
+        typedef boost::function<void ()> InitCallback;
 
         explicit ThreadPool(const std::string& nameArg = std::string("ThreadPool"));
         ~ThreadPool();
 
+        // Number of CPUs of the machine.
+        static int hardware_threads();
+
         // Must be called before start().
+        // Submitters outside the pool block while maxSize tasks are queued,
+        // 0 means unbounded. Tasks submitted by workers never block.
         void setMaxQueueSize(int maxSize) { maxQueueSize_ = maxSize; }
-        void setThreadInitCallback(const Task& cb){ threadInitCallback_ = cb; }
+        void setThreadInitCallback(const InitCallback& cb){ threadInitCallback_ = cb; }
 
-        void start(int numThreads);
+        // A negative numThreads starts one worker per CPU, 0 runs the tasks
+        // in the submitting thread.
+        void start(int numThreads = -1);
         void stop();
 
         const std::string& name() const{ return name_; }
 
+        int size() const{ return threads_.size(); }
+
         size_t queueSize() const{
-            MutexLockGuard lock(mutex_);
-            return queue_.size();
+            return pending_.get();
         }
 
-        // void getQueueSize(){
-        //     MutexLockGuard lock(mutex_);
-        //     qSize = queue_.size();
-        // }
-        // volatile size_t qSize;
         // Could block if maxQueueSize > 0
-        void run(const Task& f);
-        // #ifdef __GXX_EXPERIMENTAL_CXX0X__
-        //   void run(Task&& f);
-        // #endif
+        void run(Task task, int priority = TASK_PRIORITY_NORMAL);
+
+        // parallel_for calls f(i) for each i in [begin, end), grain indices
+        // per task, and returns when all calls returned. The caller runs its
+        // share too, so it may be called from a task of the same pool.
+        template <typename F>
+        void parallel_for(int begin, int end, const F& f, int grain = 1, int priority = TASK_PRIORITY_NORMAL);
 
     private:
-        // bool isFull() const;
-        void runInThread();
-        Task take();
+        struct Worker;
 
-        mutable MutexLock mutex_;
+        template <typename F>
+        class ParallelFor: boost::noncopyable{
+            public:
+                const F * f;
+                int begin;
+                int end;
+                int grain;
+                int chunks;
+                AtomicInt next;
+                CountDownLatch done;
+
+                ParallelFor(const F * f, int begin, int end, int grain): f(f), begin(begin), end(end), grain(grain), chunks((end - begin + grain - 1) / grain), done(chunks){}
+
+                // Run the chunks left. f is only touched after claiming a
+                // chunk, which the caller waits for.
+                static void work(const std::shared_ptr<ParallelFor> & s){
+                    int c;
+                    while((c = s->next.getAndAdd(1)) < s->chunks){
+                        int hi = std::min(s->begin + (c + 1) * s->grain, s->end);
+                        for(int i = s->begin + c * s->grain; i < hi; ++ i)
+                            (*(s->f))(i);
+                        s->done.countDown();
+                    }
+                }
+        };
+
+        void runInThread(int index);
+        bool take(int index, Task * task);
+        bool pop(int index, Task * task);
+
+        mutable MutexLock mutex_; // Of sleeping workers and blocked submitters.
         Condition notEmpty_;
         Condition notFull_;
         std::string name_;
-        Task threadInitCallback_;
+        InitCallback threadInitCallback_;
         boost::ptr_vector<Thread> threads_;
-        std::deque<Task> queue_;
+        std::vector<std::unique_ptr<Worker> > workers_;
+        mutable AtomicInt pending_; // Queued tasks.
+        AtomicInt sleeping_;
+        AtomicUInt64 next_worker_;
         size_t maxQueueSize_;
-        bool running_;
+        std::atomic<bool> running_; // Read by the workers and submitters without mutex_.
 };
 
+template <typename F>
+void ThreadPool::parallel_for(int begin, int end, const F& f, int grain, int priority){
+    if(begin >= end)
+        return;
+    if(grain < 1)
+        grain = 1;
+    std::shared_ptr<ParallelFor<F> > s(new ParallelFor<F>(&f, begin, end, grain));
+    int helpers = std::min(s->chunks - 1, size());
+    for(int i = 0; i < helpers; ++ i)
+        run(boost::bind(&ParallelFor<F>::work, s), priority);
+    ParallelFor<F>::work(s);
+    while(s->done.getCount() > 0)
+        s->done.wait();
+}
+
 }}
 
-#endif
\ No newline at end of file
+#endif
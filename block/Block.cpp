@@ -24,6 +24,19 @@ BlockChunkReader::chunk(tagtree::TSID tsid, uint64_t ref)
     return chunkr->chunk(tsid, ref);
 }
 
+std::pair<std::vector<std::shared_ptr<chunk::ChunkInterface>>, bool>
+BlockChunkReader::chunks(
+    const std::vector<std::pair<tagtree::TSID, uint64_t>>& refs)
+{
+    return chunkr->chunks(refs);
+}
+
+std::pair<std::shared_ptr<chunk::ChunkInterface>, bool>
+BlockChunkReader::raw_chunk(tagtree::TSID tsid, uint64_t ref)
+{
+    return chunkr->raw_chunk(tsid, ref);
+}
+
 bool BlockChunkReader::error() { return chunkr->error(); }
 
 uint64_t BlockChunkReader::size() { return chunkr->size(); }
@@ -93,7 +106,8 @@ void BlockTombstoneReader::add_interval(tagtree::TSID tsid,
 
 Block::Block(uint8_t type_) : type_(type_) {}
 
-Block::Block(const std::string& dir, uint8_t type_)
+Block::Block(const std::string& dir, uint8_t type_,
+             const std::shared_ptr<tsdbutil::BufferCache>& cache)
     : mutex_(), pending_readers(), closing(false), dir_(dir), type_(type_)
 {
     std::pair<BlockMeta, bool> meta_pair = read_block_meta(dir);
@@ -107,16 +121,28 @@ Block::Block(const std::string& dir, uint8_t type_)
     std::string chunks_dir = tsdbutil::filepath_join(dir, "chunks");
     std::string index_path = tsdbutil::filepath_join(dir, "index");
     if (type_ == static_cast<uint8_t>(OriginalBlock)) {
-        chunkr = std::shared_ptr<ChunkReaderInterface>(
-            new chunk::ChunkReader(chunks_dir));
+        if (cache) {
+            // Blocks fresh from the head are queried most.
+            int priority = meta_.compaction.level <= 1
+                               ? tsdbutil::BUFFER_PRIORITY_RECENT
+                               : tsdbutil::BUFFER_PRIORITY_OLD;
+            chunkr = std::shared_ptr<ChunkReaderInterface>(
+                new chunk::ChunkReader(chunks_dir, cache, priority));
+        } else
+            chunkr = std::shared_ptr<ChunkReaderInterface>(
+                new chunk::ChunkReader(chunks_dir));
         if (chunkr->error()) {
             // LOG_ERROR << "Error creating chunk reader";
             err_.set("error create chunk reader");
             return;
         }
 
-        indexr = std::shared_ptr<IndexReaderInterface>(
-            new index::IndexReader(index_path));
+        if (cache)
+            indexr = std::shared_ptr<IndexReaderInterface>(
+                new index::IndexReader(index_path, cache));
+        else
+            indexr = std::shared_ptr<IndexReaderInterface>(
+                new index::IndexReader(index_path));
         if (indexr->error()) {
             // LOG_ERROR << "Error creating index reader";
             err_.set("error create index reader");
@@ -326,7 +352,7 @@ Block::clean_tombstones(const std::string& dest, void* compactor)
     std::shared_ptr<BlockMeta> m(new BlockMeta(meta_));
     std::pair<ulid::ULID, error::Error> ulid_pair =
         ((compact::CompactorInterface*)compactor)
-            ->write(dest, b, MinTime(), MaxTime(), m);
+            ->rewrite(dest, b, m);
     if (ulid_pair.second) return {ulid::ULID(), ulid_pair.second};
     return ulid_pair;
 }
@@ -7,6 +7,7 @@
 #include "block/ChunkReaderInterface.hpp"
 #include "block/IndexReaderInterface.hpp"
 #include "tombstone/TombstoneReaderInterface.hpp"
+#include "tsdbutil/BufferCache.hpp"
 #include "tsdbutil/StringTuplesInterface.hpp"
 
 namespace tsdb {
@@ -28,6 +29,12 @@ public:
     std::pair<std::shared_ptr<chunk::ChunkInterface>, bool>
     chunk(tagtree::TSID tsid, uint64_t ref);
 
+    std::pair<std::vector<std::shared_ptr<chunk::ChunkInterface>>, bool>
+    chunks(const std::vector<std::pair<tagtree::TSID, uint64_t>>& refs);
+
+    std::pair<std::shared_ptr<chunk::ChunkInterface>, bool>
+    raw_chunk(tagtree::TSID tsid, uint64_t ref);
+
     bool error();
 
     uint64_t size();
@@ -108,8 +115,11 @@ private:
 
 public:
     Block(uint8_t type_ = static_cast<uint8_t>(OriginalBlock));
+    // The chunks and index are read through cache when it is not nullptr,
+    // otherwise they are mmapped.
     Block(const std::string& dir,
-          uint8_t type_ = static_cast<uint8_t>(OriginalBlock));
+          uint8_t type_ = static_cast<uint8_t>(OriginalBlock),
+          const std::shared_ptr<tsdbutil::BufferCache>& cache = nullptr);
     Block(bool closing, const std::string& dir_, const BlockMeta& meta_,
           const std::shared_ptr<ChunkReaderInterface>& chunkr,
           const std::shared_ptr<IndexReaderInterface>& indexr,
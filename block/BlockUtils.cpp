@@ -100,6 +100,12 @@ std::pair<BlockMeta, bool> read_block_meta(const std::string & dir){
             }
             meta.stats.num_bytes = d["stats"]["numBytes"].GetUint64();
         }
+        if(d["stats"].HasMember("numDeadBytes")){
+            if(!d["stats"]["numDeadBytes"].IsUint64()){
+                return {BlockMeta(), false};
+            }
+            meta.stats.num_dead_bytes = d["stats"]["numDeadBytes"].GetUint64();
+        }
     }
 
     if(d.HasMember("compaction")){
@@ -187,6 +193,8 @@ bool write_block_meta(const std::string & dir, const BlockMeta & meta){
     stats.AddMember("numChunks", meta.stats.num_chunks, d.GetAllocator());
     stats.AddMember("numTombstones", meta.stats.num_tombstones, d.GetAllocator());
     stats.AddMember("numBytes", meta.stats.num_bytes, d.GetAllocator());
+    if(meta.stats.num_dead_bytes > 0)
+        stats.AddMember("numDeadBytes", meta.stats.num_dead_bytes, d.GetAllocator());
     d.AddMember("stats", stats, d.GetAllocator());
 
     compaction.AddMember("level", meta.compaction.level, d.GetAllocator());
@@ -25,10 +25,13 @@ class BlockStats{
         uint64_t num_chunks;
         uint64_t num_tombstones;
         uint64_t num_bytes;
+        // Bytes of the chunk files no longer referenced by the index, left
+        // behind by LeveledCompactor::rewrite().
+        uint64_t num_dead_bytes;
 
-        BlockStats(): num_samples(0), num_series(0), num_chunks(0), num_tombstones(0), num_bytes(0){}
+        BlockStats(): num_samples(0), num_series(0), num_chunks(0), num_tombstones(0), num_bytes(0), num_dead_bytes(0){}
         bool operator==(const BlockStats & b) const{
-            return (b.num_samples == num_samples) && (b.num_series == num_series) && (b.num_chunks == num_chunks) && (b.num_tombstones == num_tombstones) && (b.num_bytes == num_bytes);
+            return (b.num_samples == num_samples) && (b.num_series == num_series) && (b.num_chunks == num_chunks) && (b.num_tombstones == num_tombstones) && (b.num_bytes == num_bytes) && (b.num_dead_bytes == num_dead_bytes);
         }
 };
 
@@ -2,6 +2,7 @@
 #define CHUNKREADERINTERFACE_H
 
 #include <stdint.h>
+#include <vector>
 
 #include "chunk/ChunkInterface.hpp"
 #include "tagtree/tsid.h"
@@ -14,6 +15,34 @@ class ChunkReaderInterface {
 public:
     virtual std::pair<std::shared_ptr<chunk::ChunkInterface>, bool>
     chunk(tagtree::TSID tsid, uint64_t ref) = 0;
+
+    // Multi-get, the chunks are returned in the order of refs. Readers backed
+    // by files read them in file order ahead of decoding. The second value is
+    // false if any chunk is missing, the missing chunks are nullptr.
+    virtual std::pair<std::vector<std::shared_ptr<chunk::ChunkInterface>>,
+                      bool>
+    chunks(const std::vector<std::pair<tagtree::TSID, uint64_t>>& refs)
+    {
+        std::vector<std::shared_ptr<chunk::ChunkInterface>> r;
+        r.reserve(refs.size());
+        bool succeed = true;
+        for (auto const& p : refs) {
+            std::pair<std::shared_ptr<chunk::ChunkInterface>, bool> c =
+                chunk(p.first, p.second);
+            succeed = succeed && c.second;
+            r.push_back(c.second ? c.first : nullptr);
+        }
+        return {r, succeed};
+    }
+
+    // Same as chunk(), but readers backed by stable file mappings return a
+    // chunk::RawChunk which can be copied to a chunk file without encoding.
+    virtual std::pair<std::shared_ptr<chunk::ChunkInterface>, bool>
+    raw_chunk(tagtree::TSID tsid, uint64_t ref)
+    {
+        return chunk(tsid, ref);
+    }
+
     virtual bool error() = 0;
     virtual uint64_t size() = 0;
     virtual ~ChunkReaderInterface() = default;
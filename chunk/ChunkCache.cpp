@@ -0,0 +1,146 @@
+#include <boost/functional/hash.hpp>
+
+#include "chunk/ChunkCache.hpp"
+
+namespace tsdb {
+namespace chunk {
+
+size_t ChunkCacheKeyHash::operator()(const ChunkCacheKey& k) const
+{
+    // ULID is a 128-bit integer, which std::hash does not cover.
+    size_t seed = 0;
+    boost::hash_combine(seed, static_cast<uint64_t>(k.ulid >> 64));
+    boost::hash_combine(seed, static_cast<uint64_t>(k.ulid));
+    boost::hash_combine(seed, k.ref);
+    return seed;
+}
+
+ChunkCache::ChunkCache(uint64_t capacity, int num_shards)
+{
+    if (num_shards < 1) num_shards = 1;
+    for (int i = 0; i < num_shards; i++)
+        shards_.emplace_back(new Shard(capacity / num_shards));
+}
+
+ChunkCache::Shard* ChunkCache::shard(const ChunkCacheKey& k)
+{
+    // Mix the hash again so that shards do not correlate with the buckets.
+    size_t h = ChunkCacheKeyHash()(k);
+    h ^= h >> 17;
+    h *= 0xed5ad4bbU;
+    return shards_[h % shards_.size()].get();
+}
+
+std::shared_ptr<ChunkInterface> ChunkCache::get(const ulid::ULID& ulid,
+                                                uint64_t ref)
+{
+    ChunkCacheKey k(ulid, ref);
+    Shard* s = shard(k);
+    base::MutexLockGuard lock(s->mutex_);
+    auto it = s->index.find(k);
+    if (it == s->index.end()) {
+        misses_.increment();
+        return nullptr;
+    }
+    hits_.increment();
+    s->slots[it->second].referenced = true;
+    return s->slots[it->second].chunk;
+}
+
+void ChunkCache::erase(Shard* s, int i)
+{
+    Slot& slot = s->slots[i];
+    s->index.erase(slot.key);
+    s->usage -= slot.charge;
+    slot.chunk.reset();
+    slot.charge = 0;
+    slot.referenced = false;
+    slot.used = false;
+    s->free_slots.push_back(i);
+}
+
+void ChunkCache::evict(Shard* s, uint64_t charge)
+{
+    while (s->usage + charge > s->capacity && !s->index.empty()) {
+        if (s->hand >= s->slots.size()) s->hand = 0;
+        Slot& slot = s->slots[s->hand];
+        if (slot.used) {
+            if (slot.referenced)
+                slot.referenced = false;
+            else {
+                erase(s, s->hand);
+                evictions_.increment();
+            }
+        }
+        ++s->hand;
+    }
+}
+
+void ChunkCache::insert(const ulid::ULID& ulid, uint64_t ref,
+                        const std::shared_ptr<ChunkInterface>& c)
+{
+    ChunkCacheKey k(ulid, ref);
+    uint64_t charge = c->size() + sizeof(Slot);
+    Shard* s = shard(k);
+    if (charge > s->capacity) return;
+
+    base::MutexLockGuard lock(s->mutex_);
+    // Another querier may have decoded the same chunk concurrently.
+    if (s->index.find(k) != s->index.end()) return;
+
+    evict(s, charge);
+
+    int i;
+    if (!s->free_slots.empty()) {
+        i = s->free_slots.back();
+        s->free_slots.pop_back();
+    }
+    else {
+        i = s->slots.size();
+        s->slots.emplace_back();
+    }
+    Slot& slot = s->slots[i];
+    slot.key = k;
+    slot.chunk = c;
+    slot.charge = charge;
+    slot.referenced = false;
+    slot.used = true;
+    s->index.emplace(k, i);
+    s->usage += charge;
+    inserts_.increment();
+}
+
+void ChunkCache::invalidate(const ulid::ULID& ulid)
+{
+    for (auto& s : shards_) {
+        base::MutexLockGuard lock(s->mutex_);
+        for (int i = 0; i < static_cast<int>(s->slots.size()); i++) {
+            if (s->slots[i].used &&
+                ulid::CompareULIDs(s->slots[i].key.ulid, ulid) == 0) {
+                erase(s.get(), i);
+                invalidations_.increment();
+            }
+        }
+    }
+}
+
+ChunkCacheStats ChunkCache::stats()
+{
+    ChunkCacheStats st;
+    st.hits = hits_.get();
+    st.misses = misses_.get();
+    st.inserts = inserts_.get();
+    st.evictions = evictions_.get();
+    st.invalidations = invalidations_.get();
+    st.bytes = 0;
+    st.entries = 0;
+    for (auto& s : shards_) {
+        base::MutexLockGuard lock(s->mutex_);
+        st.bytes += s->usage;
+        st.entries += s->index.size();
+    }
+    return st;
+}
+
+} // namespace chunk
+} // namespace tsdb
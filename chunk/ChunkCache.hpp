@@ -0,0 +1,106 @@
+#ifndef CHUNKCACHE_H
+#define CHUNKCACHE_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "base/Atomic.hpp"
+#include "base/Mutex.hpp"
+#include "chunk/ChunkInterface.hpp"
+#include "external/ulid.hpp"
+
+namespace tsdb {
+namespace chunk {
+
+// ChunkCacheKey identifies a chunk of a persistent block.
+struct ChunkCacheKey {
+    ulid::ULID ulid;
+    uint64_t ref;
+
+    ChunkCacheKey(const ulid::ULID& ulid, uint64_t ref) : ulid(ulid), ref(ref)
+    {}
+
+    bool operator==(const ChunkCacheKey& k) const
+    {
+        return ref == k.ref && ulid::CompareULIDs(ulid, k.ulid) == 0;
+    }
+};
+
+struct ChunkCacheKeyHash {
+    size_t operator()(const ChunkCacheKey& k) const;
+};
+
+struct ChunkCacheStats {
+    int64_t hits;
+    int64_t misses;
+    int64_t inserts;
+    int64_t evictions;
+    int64_t invalidations;
+    int64_t bytes;
+    int64_t entries;
+};
+
+// ChunkCache is a size-bounded cache of decoded chunks shared by all queriers
+// of a DB. Keys are spread over independently locked shards, each evicting
+// with the CLOCK algorithm.
+class ChunkCache {
+private:
+    struct Slot {
+        ChunkCacheKey key;
+        std::shared_ptr<ChunkInterface> chunk;
+        uint64_t charge;
+        bool referenced;
+        bool used;
+
+        Slot() : key(ulid::ULID(), 0), charge(0), referenced(false), used(false)
+        {}
+    };
+
+    struct Shard {
+        base::MutexLock mutex_;
+        std::vector<Slot> slots;
+        std::vector<int> free_slots;
+        std::unordered_map<ChunkCacheKey, int, ChunkCacheKeyHash> index;
+        size_t hand;
+        uint64_t usage;
+        uint64_t capacity;
+
+        Shard(uint64_t capacity) : hand(0), usage(0), capacity(capacity) {}
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    base::AtomicInt64 hits_;
+    base::AtomicInt64 misses_;
+    base::AtomicInt64 inserts_;
+    base::AtomicInt64 evictions_;
+    base::AtomicInt64 invalidations_;
+
+    Shard* shard(const ChunkCacheKey& k);
+
+    // Free slot i of s, s->mutex_ must be held.
+    void erase(Shard* s, int i);
+
+    // Evict until charge fits into s, s->mutex_ must be held.
+    void evict(Shard* s, uint64_t charge);
+
+public:
+    ChunkCache(uint64_t capacity, int num_shards = 16);
+
+    // Return nullptr when missing.
+    std::shared_ptr<ChunkInterface> get(const ulid::ULID& ulid, uint64_t ref);
+
+    // Chunks larger than the capacity of a shard are not cached.
+    void insert(const ulid::ULID& ulid, uint64_t ref,
+                const std::shared_ptr<ChunkInterface>& c);
+
+    // Drop all chunks of the given block.
+    void invalidate(const ulid::ULID& ulid);
+
+    ChunkCacheStats stats();
+};
+
+} // namespace chunk
+} // namespace tsdb
+
+#endif
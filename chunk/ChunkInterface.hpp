@@ -24,6 +24,8 @@ class ChunkInterface{
         virtual std::unique_ptr<ChunkIteratorInterface> iterator(int64_t start, uint64_t series_num){ return nullptr; }
         virtual int num_samples() = 0;
         virtual uint64_t size() = 0;
+        // The encoded entry in a chunk file of a chunk read unmodified, see RawChunk.
+        virtual std::pair<const uint8_t *, int> entry(){ return {NULL, 0}; }
         virtual ~ChunkInterface() = default;
 };
 
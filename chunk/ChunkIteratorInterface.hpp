@@ -10,7 +10,16 @@ namespace chunk{
 class ChunkIteratorInterface{
     public:
         virtual std::pair<int64_t, double> at() const = 0;
-        virtual bool seek(int64_t t) const{ return false; }
+        // Advance to the first sample at or after t. Must not be called while
+        // positioned at a sample at or after t. Iterators that can skip
+        // without decoding every sample override it.
+        virtual bool seek(int64_t t) const{
+            while(next()){
+                if(at().first >= t)
+                    return true;
+            }
+            return false;
+        }
         virtual bool next() const = 0;
         virtual bool error() const = 0;
         virtual ~ChunkIteratorInterface() = default;
@@ -1,9 +1,13 @@
+#include <algorithm>
+
 #include "chunk/ChunkReader.hpp"
 #include "base/Endian.hpp"
 #include "base/Logging.hpp"
 #include "chunk/ChunkUtils.hpp"
 #include "chunk/EmptyChunk.hpp"
+#include "chunk/RawChunk.hpp"
 #include "chunk/XORChunk.hpp"
+#include "tsdbutil/DirectSlice.hpp"
 #include "tsdbutil/MMapSlice.hpp"
 
 namespace tsdb {
@@ -26,15 +30,40 @@ ChunkReader::ChunkReader(const std::string& dir) : err_(false), size_(0)
     }
 }
 
+ChunkReader::ChunkReader(const std::string& dir,
+                         const std::shared_ptr<tsdbutil::BufferCache>& cache,
+                         int priority)
+    : err_(false), size_(0)
+{
+    std::deque<std::string> files = sequence_files(dir);
+    for (std::string& s : files) {
+        bs.push_back(std::shared_ptr<tsdbutil::ByteSlice>(
+            new tsdbutil::DirectSlice(s, cache, priority)));
+        if (!validate()) {
+            LOG_ERROR << "Invalid chunk: " << s;
+            bs.clear();
+            err_ = true;
+            return;
+        }
+        size_ += bs.back()->len();
+    }
+}
+
 // Validate the back of bs after each push_back
 bool ChunkReader::validate()
 {
     bool valid = true;
-    if (bs.back()->len() < 4)
+    if (bs.back()->len() < 8)
         valid = false;
     else if (static_cast<uint32_t>(base::get_uint32_big_endian(
                  bs.back()->range(0, 4).first)) != MAGIC_CHUNK)
         valid = false;
+    else {
+        int version = static_cast<int>(
+            base::get_uint32_big_endian(bs.back()->range(4, 8).first));
+        valid = version == CHUNK_FORMAT_V1 || version == CHUNK_FORMAT_V2;
+        versions.push_back(version);
+    }
     return valid;
 }
 
@@ -68,11 +97,77 @@ ChunkReader::chunk(tagtree::TSID, uint64_t ref)
 
     // TODO determine different encoding
     // A read mode XORChunk
+    if (!bs[seq]->stable())
+        return {std::shared_ptr<ChunkInterface>(
+                    new XORChunk(stream.first, static_cast<int>(l), true)),
+                true};
     return {std::shared_ptr<ChunkInterface>(
                 new XORChunk(stream.first, static_cast<int>(l))),
             true};
 }
 
+std::pair<std::vector<std::shared_ptr<ChunkInterface>>, bool>
+ChunkReader::chunks(const std::vector<std::pair<tagtree::TSID, uint64_t>>& refs)
+{
+    // The sequence number is in the high 32 bits, so refs sort by file and
+    // then offset.
+    std::vector<uint64_t> sorted;
+    sorted.reserve(refs.size());
+    for (auto const& p : refs)
+        sorted.push_back(p.second);
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t i = 0;
+    while (i < sorted.size()) {
+        int seq = static_cast<int>(sorted[i] >> 32);
+        int begin = static_cast<int>((sorted[i] << 32) >> 32);
+        int end = begin;
+        size_t j = i + 1;
+        while (j < sorted.size() && static_cast<int>(sorted[j] >> 32) == seq &&
+               static_cast<int>((sorted[j] << 32) >> 32) - end <=
+                   PREFETCH_MAX_GAP) {
+            end = static_cast<int>((sorted[j] << 32) >> 32);
+            ++j;
+        }
+        if (seq < static_cast<int>(bs.size())) bs[seq]->will_need(begin, end + PREFETCH_TAIL);
+        i = j;
+    }
+
+    std::vector<std::shared_ptr<ChunkInterface>> r;
+    r.reserve(refs.size());
+    bool succeed = true;
+    for (auto const& p : refs) {
+        std::pair<std::shared_ptr<ChunkInterface>, bool> c =
+            chunk(p.first, p.second);
+        succeed = succeed && c.second;
+        r.push_back(c.second ? c.first : nullptr);
+    }
+    return {r, succeed};
+}
+
+std::pair<std::shared_ptr<ChunkInterface>, bool>
+ChunkReader::raw_chunk(tagtree::TSID tsid, uint64_t ref)
+{
+    std::pair<std::shared_ptr<ChunkInterface>, bool> c = chunk(tsid, ref);
+    int seq = static_cast<int>(ref >> 32);
+    // Entries of older formats are rewritten with the current checksum.
+    if (!c.second || !bs[seq]->stable() || versions[seq] != CHUNK_FORMAT_V2)
+        return c;
+
+    // The data of a stable slice points into the mapping, the entry starts at
+    // its length and ends with the CRC32 after the data.
+    int offset = static_cast<int>((ref << 32) >> 32);
+    const uint8_t* entry = bs[seq]->range(offset, offset + 1).first;
+    int len = static_cast<int>(c.first->bytes() - entry) +
+              static_cast<int>(c.first->size()) + 4;
+    if (offset + len > bs[seq]->len()) {
+        LOG_ERROR << "Ref: " << ref << " chunk CRC32 exceeds the segment";
+        return {std::shared_ptr<ChunkInterface>(new EmptyChunk()), false};
+    }
+    return {std::shared_ptr<ChunkInterface>(new RawChunk(c.first, entry, len)),
+            true};
+}
+
 bool ChunkReader::error() { return err_; }
 
 uint64_t ChunkReader::size() { return size_; }
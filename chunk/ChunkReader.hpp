@@ -7,15 +7,24 @@
 
 #include "block/ChunkReaderInterface.hpp"
 #include "chunk/ChunkInterface.hpp"
+#include "tsdbutil/BufferCache.hpp"
 #include "tsdbutil/ByteSlice.hpp"
 
 namespace tsdb {
 namespace chunk {
 
+// Chunks closer than this are read ahead as one range.
+const int PREFETCH_MAX_GAP = 64 * 1024;
+
+// Read ahead after the last chunk of a range, whose length is unknown until
+// its header is read.
+const int PREFETCH_TAIL = 4096;
+
 // TODO(Alec), more chunk types.
 class ChunkReader : public block::ChunkReaderInterface {
 private:
     std::deque<std::shared_ptr<tsdbutil::ByteSlice>> bs;
+    std::deque<int> versions; // Format of each segment in bs.
 
     bool err_;
 
@@ -25,6 +34,11 @@ public:
     // Implicit construct from const char *
     ChunkReader(const std::string& dir);
 
+    // Read the segments through cache with DirectSlice instead of mmap.
+    ChunkReader(const std::string& dir,
+                const std::shared_ptr<tsdbutil::BufferCache>& cache,
+                int priority);
+
     // Validate the back of bs after each push_back
     bool validate();
 
@@ -32,6 +46,17 @@ public:
     std::pair<std::shared_ptr<ChunkInterface>, bool> chunk(tagtree::TSID,
                                                            uint64_t ref);
 
+    // Sorts the refs by (segment, offset), merges the ones closer than
+    // PREFETCH_MAX_GAP and hints each merged range to the page cache before
+    // decoding in the order of refs.
+    std::pair<std::vector<std::shared_ptr<ChunkInterface>>, bool>
+    chunks(const std::vector<std::pair<tagtree::TSID, uint64_t>>& refs);
+
+    // Returns a RawChunk when the segment is mmapped, see
+    // ByteSlice::stable().
+    std::pair<std::shared_ptr<ChunkInterface>, bool>
+    raw_chunk(tagtree::TSID tsid, uint64_t ref);
+
     bool error();
 
     uint64_t size();
@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <boost/range/iterator_range.hpp>
 #include <limits>
 
+#include "base/Endian.hpp"
 #include "chunk/ChunkUtils.hpp"
+#include "chunk/DeleteIterator.hpp"
 // #include "chunk/GroupDiskChunk1.hpp"
 // #include "chunk/GroupMemoryChunk1.hpp"
 #include "chunk/XORChunk.hpp"
@@ -14,8 +17,10 @@ namespace chunk {
 const uint32_t MAGIC_CHUNK = 0x51705259;
 const int DEFAULT_CHUNK_SIZE = 512 * 1024 * 1024;
 const int CHUNK_FORMAT_V1 = 1;
+const int CHUNK_FORMAT_V2 = 2;
 const uint8_t DEFAULT_MEDIAN_SEGMENT = 2;
 const uint8_t DEFAULT_TUPLE_SIZE = 8;
+const int DEFAULT_SAMPLES_PER_CHUNK = 120;
 
 bool is_number(const std::string& s)
 {
@@ -126,7 +131,7 @@ merge_overlapping_chunks(const std::vector<std::shared_ptr<ChunkMeta>>& chunks)
     std::vector<std::shared_ptr<ChunkMeta>> new_chunks;
     new_chunks.push_back(chunks[0]);
     int last = 0;
-    for (int i = 1; i < chunks.size(); i++) {
+    for (size_t i = 1; i < chunks.size(); i++) {
         // We need to check only the last chunk in newChks.
         // Reason: (1) newChks[last-1].MaxTime < newChks[last].MinTime (non
         // overlapping).
@@ -151,6 +156,268 @@ merge_overlapping_chunks(const std::vector<std::shared_ptr<ChunkMeta>>& chunks)
     return {new_chunks, error::Error()};
 }
 
+// vertical_merge_chunks streams the samples of every run of overlapping chunks
+// through a single k-way merge and re-encodes them into chunks of at most
+// samples_per_chunk samples. Chunks not overlapping any other chunk are
+// returned untouched. For equal timestamps the last appearing sample is
+// retained, same as merge_overlapping_chunks.
+// This assumes that `chunks` are sorted w.r.t. min_time.
+std::pair<std::vector<std::shared_ptr<ChunkMeta>>, error::Error>
+vertical_merge_chunks(const std::vector<std::shared_ptr<ChunkMeta>>& chunks,
+                      int samples_per_chunk)
+{
+    if (chunks.size() < 2) return {chunks, error::Error()};
+
+    std::vector<std::shared_ptr<ChunkMeta>> new_chunks;
+    std::vector<std::unique_ptr<ChunkIteratorInterface>> its;
+    std::vector<bool> ok;
+    size_t i = 0;
+    while (i < chunks.size()) {
+        // Find the run [i, j) of transitively overlapping chunks.
+        size_t j = i + 1;
+        int64_t max_time = chunks[i]->max_time;
+        while (j < chunks.size() && chunks[j]->min_time <= max_time) {
+            if (chunks[j]->max_time > max_time) max_time = chunks[j]->max_time;
+            ++j;
+        }
+        if (j == i + 1) {
+            new_chunks.push_back(chunks[i]);
+            ++i;
+            continue;
+        }
+
+        its.clear();
+        ok.clear();
+        for (size_t k = i; k < j; ++k) {
+            its.push_back(chunks[k]->chunk->iterator());
+            ok.push_back(its.back()->next());
+        }
+
+        std::shared_ptr<ChunkInterface> c;
+        std::unique_ptr<ChunkAppenderInterface> app;
+        int num = 0;
+        int64_t mint = 0, maxt = 0;
+        while (true) {
+            int m = -1;
+            for (size_t k = 0; k < its.size(); ++k) {
+                // "<=" so that the last appearing sample wins.
+                if (ok[k] &&
+                    (m == -1 || its[k]->at().first <= its[m]->at().first))
+                    m = k;
+            }
+            if (m == -1) break;
+            std::pair<int64_t, double> p = its[m]->at();
+            for (size_t k = 0; k < its.size(); ++k) {
+                if (ok[k] && its[k]->at().first == p.first)
+                    ok[k] = its[k]->next();
+            }
+
+            if (!app) {
+                c = std::shared_ptr<ChunkInterface>(new XORChunk());
+                try {
+                    app = c->appender();
+                } catch (const base::TSDBException& e) {
+                    return {std::vector<std::shared_ptr<ChunkMeta>>(),
+                            error::Error(e.what())};
+                }
+                mint = p.first;
+            }
+            app->append(p.first, p.second);
+            maxt = p.first;
+            if (++num == samples_per_chunk) {
+                new_chunks.emplace_back(new ChunkMeta(c, mint, maxt));
+                app.reset();
+                num = 0;
+            }
+        }
+        if (app) new_chunks.emplace_back(new ChunkMeta(c, mint, maxt));
+
+        for (size_t k = 0; k < its.size(); ++k) {
+            if (its[k]->error())
+                return {std::vector<std::shared_ptr<ChunkMeta>>(),
+                        error::Error("Error in chunk iterator " +
+                                     std::to_string(i + k))};
+        }
+        i = j;
+    }
+
+    return {new_chunks, error::Error()};
+}
+
+std::pair<std::vector<std::shared_ptr<ChunkMeta>>, error::Error>
+rechunk(const std::vector<std::shared_ptr<ChunkMeta>>& chunks, int max_samples,
+        int max_bytes)
+{
+    if (chunks.size() < 2) return {chunks, error::Error()};
+    // The number of samples of a XORChunk is stored in 16 bits.
+    max_samples = std::min(
+        max_samples, static_cast<int>(std::numeric_limits<uint16_t>::max()));
+
+    std::vector<std::shared_ptr<ChunkMeta>> new_chunks;
+    size_t i = 0;
+    while (i < chunks.size()) {
+        // Find the run [i, j) fitting in one chunk. The size of the merged
+        // chunk is estimated by the sizes of the chunks.
+        size_t j = i + 1;
+        int num = chunks[i]->chunk->num_samples();
+        uint64_t size = chunks[i]->chunk->size();
+        while (j < chunks.size() &&
+               num + chunks[j]->chunk->num_samples() <= max_samples &&
+               (max_bytes <= 0 ||
+                size + chunks[j]->chunk->size() <=
+                    static_cast<uint64_t>(max_bytes))) {
+            num += chunks[j]->chunk->num_samples();
+            size += chunks[j]->chunk->size();
+            ++j;
+        }
+        if (j == i + 1) {
+            new_chunks.push_back(chunks[i]);
+            ++i;
+            continue;
+        }
+
+        std::shared_ptr<ChunkInterface> c(new XORChunk());
+        std::unique_ptr<ChunkAppenderInterface> app;
+        try {
+            app = c->appender();
+        } catch (const base::TSDBException& e) {
+            return {std::vector<std::shared_ptr<ChunkMeta>>(),
+                    error::Error(e.what())};
+        }
+        for (size_t k = i; k < j; ++k) {
+            std::unique_ptr<ChunkIteratorInterface> it =
+                chunks[k]->chunk->iterator();
+            while (it->next()) {
+                std::pair<int64_t, double> p = it->at();
+                app->append(p.first, p.second);
+            }
+            if (it->error())
+                return {std::vector<std::shared_ptr<ChunkMeta>>(),
+                        error::Error("Error in chunk iterator " +
+                                     std::to_string(k))};
+        }
+        new_chunks.emplace_back(
+            new ChunkMeta(c, chunks[i]->min_time, chunks[j - 1]->max_time));
+        i = j;
+    }
+
+    return {new_chunks, error::Error()};
+}
+
+std::pair<std::vector<std::shared_ptr<ChunkMeta>>, error::Error>
+split_deleted(const std::shared_ptr<ChunkMeta>& c,
+              const tombstone::Intervals& intervals)
+{
+    std::vector<std::shared_ptr<ChunkMeta>> r;
+    if (c->chunk->encoding() != EncXOR) {
+        std::shared_ptr<ChunkInterface> nc(new XORChunk());
+        std::unique_ptr<ChunkAppenderInterface> app;
+        try {
+            app = nc->appender();
+        } catch (const base::TSDBException& e) {
+            return {r, error::Error(e.what())};
+        }
+        DeleteIterator it(c->chunk->iterator(), intervals.cbegin(),
+                          intervals.cend());
+        int64_t mint = 0, maxt = 0;
+        while (it.next()) {
+            std::pair<int64_t, double> p = it.at();
+            if (nc->num_samples() == 0) mint = p.first;
+            maxt = p.first;
+            app->append(p.first, p.second);
+        }
+        if (it.error()) return {r, error::Error("error iterate chunk")};
+        if (nc->num_samples() > 0)
+            r.emplace_back(new ChunkMeta(nc, mint, maxt));
+        return {r, error::Error()};
+    }
+
+    const uint8_t* src = c->chunk->bytes();
+    XORChunk view(src, c->chunk->size());
+    std::unique_ptr<XORIterator> it = view.xor_iterator();
+    auto itvl = intervals.cbegin();
+
+    // The run of surviving samples being built.
+    int begin = -1, num = 0;
+    int64_t mint = 0, maxt = 0;
+    // Runs after the first one re-encode their samples into out until one
+    // sets a new XOR window, the bits from copy_from on are copied.
+    std::shared_ptr<XORChunk> out;
+    std::unique_ptr<ChunkAppenderInterface> app;
+    int copy_from = -1, copied = 0;
+    int end_bit = 0;
+    auto close_run = [&]() {
+        if (begin < 0) return;
+        if (begin == 0 && num == view.num_samples())
+            r.push_back(c);
+        else if (begin == 0) {
+            // A prefix is valid as is once its sample count is updated.
+            std::vector<uint8_t> b(src, src + (end_bit + 7) / 8);
+            base::put_uint16_big_endian(b, num);
+            if (end_bit % 8 != 0) b.back() &= 0xff << (8 - end_bit % 8);
+            r.emplace_back(new ChunkMeta(
+                std::shared_ptr<ChunkInterface>(
+                    new XORChunk(b.data(), b.size(), true)),
+                mint, maxt));
+        } else {
+            app.reset();
+            if (copy_from >= 0)
+                out->append_bits(src, copy_from, end_bit, copied);
+            r.emplace_back(new ChunkMeta(out, mint, maxt));
+        }
+        begin = -1;
+        num = 0;
+        out.reset();
+        copy_from = -1;
+        copied = 0;
+    };
+
+    int i = 0;
+    int pos = it->bit_pos();
+    while (it->next()) {
+        int next_pos = it->bit_pos();
+        int64_t t = it->timestamp;
+        while (itvl != intervals.cend() && itvl->max_time < t)
+            ++itvl;
+        if (itvl != intervals.cend() && itvl->min_time <= t)
+            close_run();
+        else {
+            if (begin < 0) {
+                begin = i;
+                mint = t;
+                if (begin > 0) {
+                    out.reset(new XORChunk());
+                    try {
+                        app = out->appender();
+                    } catch (const base::TSDBException& e) {
+                        return {std::vector<std::shared_ptr<ChunkMeta>>(),
+                                error::Error(e.what())};
+                    }
+                }
+            }
+            if (begin > 0) {
+                if (copy_from >= 0)
+                    ++copied;
+                else if (i >= begin + 2 && it->new_window) {
+                    copy_from = pos;
+                    copied = 1;
+                } else
+                    app->append(t, it->value);
+            }
+            ++num;
+            maxt = t;
+            end_bit = next_pos;
+        }
+        pos = next_pos;
+        ++i;
+    }
+    if (it->error())
+        return {std::vector<std::shared_ptr<ChunkMeta>>(),
+                error::Error("error iterate chunk")};
+    close_run();
+    return {r, error::Error()};
+}
+
 // void next_helper_gacsi_(std::deque<querier::GroupAllChunkSeriesIterator> &
 // its){
 //     auto it = its.begin();
@@ -7,16 +7,19 @@
 #include "chunk/ChunkInterface.hpp"
 #include "chunk/ChunkMeta.hpp"
 #include "querier/ChunkSeriesMeta.hpp"
+#include "tombstone/Interval.hpp"
 
 namespace tsdb {
 namespace chunk {
 
 extern const uint32_t MAGIC_CHUNK;
 extern const int DEFAULT_CHUNK_SIZE;
-extern const int CHUNK_FORMAT_V1;
+extern const int CHUNK_FORMAT_V1; // CRC-32 of the chunk data.
+extern const int CHUNK_FORMAT_V2; // CRC-32C of the chunk data.
 extern const uint8_t
     DEFAULT_MEDIAN_SEGMENT; // NOTE(Alec): should be larger than one.
 extern const uint8_t DEFAULT_TUPLE_SIZE;
+extern const int DEFAULT_SAMPLES_PER_CHUNK;
 
 bool is_number(const std::string& s);
 
@@ -40,6 +43,35 @@ error::Error merge_group_chunks(
 // This assumes that `chunks` are sorted w.r.t. min_time.
 std::pair<std::vector<std::shared_ptr<ChunkMeta>>, error::Error>
 merge_overlapping_chunks(const std::vector<std::shared_ptr<ChunkMeta>>& chunks);
+
+// vertical_merge_chunks streams the samples of every run of overlapping chunks
+// through a single k-way merge and re-encodes them into chunks of at most
+// samples_per_chunk samples. Chunks not overlapping any other chunk are
+// returned untouched. For equal timestamps the last appearing sample is
+// retained, same as merge_overlapping_chunks.
+// This assumes that `chunks` are sorted w.r.t. min_time.
+std::pair<std::vector<std::shared_ptr<ChunkMeta>>, error::Error>
+vertical_merge_chunks(const std::vector<std::shared_ptr<ChunkMeta>>& chunks,
+                      int samples_per_chunk = DEFAULT_SAMPLES_PER_CHUNK);
+
+// rechunk merges runs of consecutive chunks into one chunk as long as the
+// merged chunk stays within max_samples samples and, if max_bytes > 0,
+// max_bytes bytes of data. Chunks that cannot be merged with a neighbour are
+// returned untouched. This assumes that `chunks` are sorted w.r.t. min_time
+// and do not overlap.
+std::pair<std::vector<std::shared_ptr<ChunkMeta>>, error::Error>
+rechunk(const std::vector<std::shared_ptr<ChunkMeta>>& chunks, int max_samples,
+        int max_bytes = 0);
+
+// split_deleted drops the samples of c within the sorted intervals and returns
+// each run of remaining samples as its own chunk. For XOR chunks only the
+// samples following a deleted range are re-encoded, up to the first one that
+// sets a new XOR window, the other bits are copied from c. c is returned as is
+// when none of its samples is deleted.
+std::pair<std::vector<std::shared_ptr<ChunkMeta>>, error::Error>
+split_deleted(const std::shared_ptr<ChunkMeta>& c,
+              const tombstone::Intervals& intervals);
+
 std::pair<std::shared_ptr<querier::GroupChunkSeriesMeta>, error::Error>
 merge_overlapping_group_chunks(
     const std::deque<std::deque<std::shared_ptr<chunk::ChunkMeta>>>& chunks);
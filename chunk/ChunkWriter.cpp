@@ -8,8 +8,10 @@ namespace tsdb {
 namespace chunk {
 
 // Implicit construct from const char *
-ChunkWriter::ChunkWriter(const std::string& dir)
-    : dir(dir), pos(0), chunk_size(DEFAULT_CHUNK_SIZE)
+ChunkWriter::ChunkWriter(const std::string& dir,
+                         const std::shared_ptr<base::RateLimiter>& limiter)
+    : dir(dir), pos(0), chunk_size(DEFAULT_CHUNK_SIZE), limiter(limiter),
+      run(NULL), run_len(0)
 {
     boost::filesystem::path block_dir = boost::filesystem::path(dir);
     if (!boost::filesystem::create_directories(block_dir)) {
@@ -30,6 +32,7 @@ FILE* ChunkWriter::tail()
 // finalize_tail writes all pending data to the current tail file and close it
 void ChunkWriter::finalize_tail()
 {
+    flush_run();
     if (!files.empty()) {
         fflush(files.back());
         fclose(files.back());
@@ -46,7 +49,7 @@ void ChunkWriter::cut()
     // Write header metadata for new file.
     uint8_t temp[8];
     base::put_uint32_big_endian(temp, MAGIC_CHUNK);
-    base::put_uint32_big_endian(temp + 4, CHUNK_FORMAT_V1);
+    base::put_uint32_big_endian(temp + 4, CHUNK_FORMAT_V2);
     fwrite(temp, 1, 8, f);
     files.push_back(f);
     seqs.push_back(p.first);
@@ -60,6 +63,14 @@ void ChunkWriter::write(const uint8_t* bytes, int size)
     pos += written;
 }
 
+void ChunkWriter::flush_run()
+{
+    if (run_len == 0) return;
+    fwrite(reinterpret_cast<const void*>(run), 1, run_len, files.back());
+    run = NULL;
+    run_len = 0;
+}
+
 void ChunkWriter::write_chunks(
     const std::vector<std::shared_ptr<ChunkMeta>>& chunks)
 {
@@ -68,6 +79,7 @@ void ChunkWriter::write_chunks(
         max_len += 5 + base::MAX_VARINT_LEN_32;
         max_len += static_cast<uint64_t>(ptr->chunk->size());
     }
+    if (limiter) limiter->request(max_len);
 
     if (files.empty() || pos > chunk_size ||
         (pos + max_len > chunk_size && max_len <= chunk_size))
@@ -78,6 +90,18 @@ void ChunkWriter::write_chunks(
     for (auto& chk : chunks) {
         chk->ref = sequence | static_cast<uint64_t>(pos);
 
+        std::pair<const uint8_t*, int> entry = chk->chunk->entry();
+        if (entry.first) {
+            // Copy the entry with its CRC32 as is, entries adjacent in the
+            // source file are written at once.
+            if (run_len > 0 && run + run_len != entry.first) flush_run();
+            if (run_len == 0) run = entry.first;
+            run_len += entry.second;
+            pos += entry.second;
+            continue;
+        }
+        flush_run();
+
         // Write len of chk->chunk->bytes()
         int encoded = base::encode_unsigned_varint(
             b, static_cast<uint64_t>(chk->chunk->size()));
@@ -90,11 +114,13 @@ void ChunkWriter::write_chunks(
         // Write data
         write(chk->chunk->bytes(), chk->chunk->size());
 
-        // Write crc32
+        // Write crc32c
         base::put_uint32_big_endian(
-            b, base::GetCrc32(chk->chunk->bytes(), chk->chunk->size()));
+            b, base::GetCrc32c(chk->chunk->bytes(), chk->chunk->size()));
         write(b, 4);
     }
+    // The entries only need to outlive the call.
+    flush_run();
 }
 
 uint64_t ChunkWriter::seq()
@@ -4,6 +4,7 @@
 #include <deque>
 #include <stdio.h>
 
+#include "base/RateLimiter.hpp"
 #include "block/ChunkWriterInterface.hpp"
 #include "chunk/ChunkMeta.hpp"
 
@@ -18,9 +19,20 @@ private:
     uint64_t pos;
     uint64_t chunk_size;
 
+    // Throttles the bytes written when not null.
+    std::shared_ptr<base::RateLimiter> limiter;
+
+    // Adjacent raw chunk entries of the current write_chunks() call not
+    // written yet, already counted in pos.
+    const uint8_t* run;
+    int run_len;
+
+    void flush_run();
+
 public:
     // Implicit construct from const char *
-    ChunkWriter(const std::string& dir);
+    ChunkWriter(const std::string& dir,
+                const std::shared_ptr<base::RateLimiter>& limiter = nullptr);
 
     FILE* tail();
 
@@ -32,6 +44,8 @@ public:
 
     void write(const uint8_t* bytes, int size);
 
+    // The entries of raw chunks, see ChunkInterface::entry(), are copied
+    // without encoding them again, the adjacent ones of chunks at once.
     void write_chunks(const std::vector<std::shared_ptr<ChunkMeta>>& chunks);
 
     uint64_t seq();
@@ -0,0 +1,68 @@
+#include <algorithm>
+
+#include "chunk/DecodedChunk.hpp"
+#include "chunk/EmptyAppender.hpp"
+
+namespace tsdb {
+namespace chunk {
+
+DecodedChunk::DecodedChunk(const std::shared_ptr<ChunkInterface>& c)
+{
+    std::vector<int64_t>* t = new std::vector<int64_t>();
+    std::vector<double>* v = new std::vector<double>();
+    t->reserve(c->num_samples());
+    v->reserve(c->num_samples());
+    std::unique_ptr<ChunkIteratorInterface> it = c->iterator();
+    while (it->next()) {
+        std::pair<int64_t, double> p = it->at();
+        t->push_back(p.first);
+        v->push_back(p.second);
+    }
+    ts.reset(t);
+    vs.reset(v);
+}
+
+std::unique_ptr<ChunkAppenderInterface> DecodedChunk::appender()
+{
+    return std::unique_ptr<ChunkAppenderInterface>(new EmptyAppender());
+}
+
+std::unique_ptr<ChunkIteratorInterface> DecodedChunk::iterator()
+{
+    return std::unique_ptr<ChunkIteratorInterface>(
+        new DecodedChunkIterator(ts, vs));
+}
+
+DecodedChunkIterator::DecodedChunkIterator(
+    const std::shared_ptr<const std::vector<int64_t>>& ts,
+    const std::shared_ptr<const std::vector<double>>& vs)
+    : ts(ts), vs(vs), i(-1)
+{}
+
+std::pair<int64_t, double> DecodedChunkIterator::at() const
+{
+    if (i < 0 || i >= static_cast<int>(ts->size())) return {0, 0};
+    return {(*ts)[i], (*vs)[i]};
+}
+
+bool DecodedChunkIterator::seek(int64_t t) const
+{
+    int from = i < 0 ? 0 : i;
+    if (from >= static_cast<int>(ts->size())) return false;
+    if ((*ts)[from] >= t) {
+        i = from;
+        return true;
+    }
+    i = std::lower_bound(ts->begin() + from, ts->end(), t) - ts->begin();
+    return i < static_cast<int>(ts->size());
+}
+
+bool DecodedChunkIterator::next() const
+{
+    if (i >= static_cast<int>(ts->size())) return false;
+    ++i;
+    return i < static_cast<int>(ts->size());
+}
+
+} // namespace chunk
+} // namespace tsdb
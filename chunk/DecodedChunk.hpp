@@ -0,0 +1,57 @@
+#ifndef DECODEDCHUNK_H
+#define DECODEDCHUNK_H
+
+#include "chunk/ChunkInterface.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+// DecodedChunk holds the samples of a chunk as two plain columns so that
+// repeated reads skip the bit-level decoding. It is read only, bytes() is
+// NULL and appender() returns an EmptyAppender.
+class DecodedChunk: public ChunkInterface{
+    private:
+        std::shared_ptr<const std::vector<int64_t>> ts;
+        std::shared_ptr<const std::vector<double>> vs;
+
+    public:
+        // Decodes all samples of c.
+        DecodedChunk(const std::shared_ptr<ChunkInterface> & c);
+
+        const uint8_t * bytes(){ return NULL; }
+
+        uint8_t encoding(){ return static_cast<uint8_t>(EncNone); }
+
+        std::unique_ptr<ChunkAppenderInterface> appender();
+
+        std::unique_ptr<ChunkIteratorInterface> iterator();
+
+        int num_samples(){ return ts->size(); }
+
+        // Size of the decoded columns in bytes.
+        uint64_t size(){ return ts->size() * (sizeof(int64_t) + sizeof(double)); }
+};
+
+class DecodedChunkIterator: public ChunkIteratorInterface{
+    private:
+        std::shared_ptr<const std::vector<int64_t>> ts;
+        std::shared_ptr<const std::vector<double>> vs;
+        mutable int i;
+
+    public:
+        DecodedChunkIterator(const std::shared_ptr<const std::vector<int64_t>> & ts,
+            const std::shared_ptr<const std::vector<double>> & vs);
+
+        std::pair<int64_t, double> at() const;
+
+        // Binary search over the timestamp column, never moves backwards.
+        bool seek(int64_t t) const;
+
+        bool next() const;
+
+        bool error() const{ return false; }
+};
+
+}}
+
+#endif
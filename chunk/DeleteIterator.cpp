@@ -14,23 +14,26 @@ std::pair<int64_t, double> DeleteIterator::at() const{
     return it->at();
 }
 
+bool DeleteIterator::deleted(int64_t t) const{
+    while(itvls_begin != itvls_end && t > itvls_begin->max_time)
+        ++ itvls_begin;
+    return itvls_begin != itvls_end && itvls_begin->in_bounds(t);
+}
+
+bool DeleteIterator::seek(int64_t t) const{
+    if(!it->seek(t))
+        return false;
+    if(!deleted(it->at().first))
+        return true;
+    return next();
+}
+
 bool DeleteIterator::next() const{
-    Outer:
-        while(it->next()){
-            std::pair<int, int> p = it->at();
-            while(itvls_begin != itvls_end){
-                if(itvls_begin->in_bounds(p.first))
-                    goto Outer;
-                
-                if(p.first > itvls_begin->max_time){
-                    ++ itvls_begin;
-                    continue;
-                }
-                return true;
-            }
+    while(it->next()){
+        if(!deleted(it->at().first))
             return true;
-        }
-        return false;
+    }
+    return false;
 }
 
 bool DeleteIterator::error() const{
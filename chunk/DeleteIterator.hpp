@@ -17,6 +17,9 @@ private:
     mutable tombstone::Intervals::const_iterator itvls_begin;
     tombstone::Intervals::const_iterator itvls_end;
 
+    // Intervals are sorted, so the ones before t are dropped on the way.
+    bool deleted(int64_t t) const;
+
 public:
     // NOTICE
     // currently pass a r-value reference
@@ -26,6 +29,8 @@ public:
 
     std::pair<int64_t, double> at() const;
 
+    bool seek(int64_t t) const;
+
     bool next() const;
 
     bool error() const;
@@ -0,0 +1,55 @@
+#ifndef RAWCHUNK_H
+#define RAWCHUNK_H
+
+#include "chunk/ChunkInterface.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+// RawChunk is a chunk read unmodified from a chunk file. It keeps the whole
+// encoded entry (length, encoding, data and CRC32) so that a ChunkWriter can
+// copy it as is instead of encoding it again.
+//
+// The entry points into the file mapping of the reader, so the
+// reader must outlive the RawChunk and any ChunkWriter it is written to.
+class RawChunk: public ChunkInterface{
+    private:
+        std::shared_ptr<ChunkInterface> chunk;
+        const uint8_t * entry_;
+        int entry_len;
+
+    public:
+        RawChunk(const std::shared_ptr<ChunkInterface> & chunk, const uint8_t * entry, int entry_len): chunk(chunk), entry_(entry), entry_len(entry_len){}
+
+        const uint8_t * bytes(){
+            return chunk->bytes();
+        }
+
+        uint8_t encoding(){
+            return chunk->encoding();
+        }
+
+        std::unique_ptr<ChunkAppenderInterface> appender(){
+            return chunk->appender();
+        }
+
+        std::unique_ptr<ChunkIteratorInterface> iterator(){
+            return chunk->iterator();
+        }
+
+        int num_samples(){
+            return chunk->num_samples();
+        }
+
+        uint64_t size(){
+            return chunk->size();
+        }
+
+        std::pair<const uint8_t *, int> entry(){
+            return {entry_, entry_len};
+        }
+};
+
+}}
+
+#endif
@@ -12,6 +12,10 @@ XORChunk::XORChunk(): bstream(2), read_mode(false){}
 
 XORChunk::XORChunk(const uint8_t * stream_ptr, uint64_t size): bstream(stream_ptr, size), read_mode(true), size_(size){}
 
+XORChunk::XORChunk(const uint8_t * stream_ptr, uint64_t size, bool copy):
+    owned(copy ? std::vector<uint8_t>(stream_ptr, stream_ptr + size) : std::vector<uint8_t>()),
+    bstream(copy ? owned.data() : stream_ptr, size), read_mode(true), size_(size){}
+
 const uint8_t * XORChunk::bytes(){
     if(read_mode)
         return bstream.stream_ptr;
@@ -55,6 +59,19 @@ std::unique_ptr<XORIterator> XORChunk::xor_iterator(){
     return std::unique_ptr<XORIterator>(new XORIterator(bstream, false));
 }
 
+void XORChunk::append_bits(const uint8_t * src, int begin, int end, int num){
+    for(; begin + 8 <= end; begin += 8){
+        int shift = begin % 8;
+        uint8_t b = src[begin / 8] << shift;
+        if(shift != 0)
+            b |= src[begin / 8 + 1] >> (8 - shift);
+        bstream.write_byte(b);
+    }
+    for(; begin < end; ++ begin)
+        bstream.write_bit(((src[begin / 8] << (begin % 8)) & 0x80) == 0x80);
+    base::put_uint16_big_endian(*bstream.bytes(), base::get_uint16_big_endian(*bstream.bytes()) + num);
+}
+
 int XORChunk::num_samples(){
     return base::get_uint16_big_endian(bytes());
 }
@@ -12,6 +12,8 @@ namespace chunk{
 
 class XORChunk: public ChunkInterface{
     private:
+        // Only set when the chunk owns its bytes, must precede bstream.
+        std::vector<uint8_t> owned;
         BitStream bstream;
         bool read_mode;
         uint64_t size_;
@@ -22,6 +24,10 @@ class XORChunk: public ChunkInterface{
 
         XORChunk(const uint8_t * stream_ptr, uint64_t size);
 
+        // Read mode over a copy of [stream_ptr, stream_ptr + size), for
+        // sources whose bytes do not outlive the call.
+        XORChunk(const uint8_t * stream_ptr, uint64_t size, bool copy);
+
         const uint8_t * bytes();
 
         uint8_t encoding();
@@ -34,6 +40,12 @@ class XORChunk: public ChunkInterface{
 
         int num_samples();
 
+        // Append the bits [begin, end) of the XOR chunk src, which encode num
+        // samples following the last sample of this chunk. The first of them
+        // must set a new XOR window, see XORIterator::new_window. Only for
+        // chunks being appended.
+        void append_bits(const uint8_t * src, int begin, int end, int num);
+
         uint64_t size();
 };
 
@@ -15,7 +15,8 @@ XORIterator::XORIterator(BitStream & bstream, bool safe_mode):
         leading_zero(0),
         trailing_zero(0),
         num_read(0),
-        err_(false)
+        err_(false),
+        new_window(false)
 {
     // This is to prevent pointer invalidation when vector resizes during appending new data.
     // For those XORChunk not created in read mode.
@@ -140,6 +141,7 @@ bool XORIterator::next() const{
 }
 
 bool XORIterator::read_value() const{
+    new_window = false;
     bool control_bit;
     try{
         control_bit = bstream.read_bit();   // First control bit
@@ -159,6 +161,7 @@ bool XORIterator::read_value() const{
         }
 
         if(control_bit != ZERO){
+            new_window = true;
             uint8_t bits;
             try{
                 bits = static_cast<uint8_t>(bstream.read_bits(5));
@@ -19,6 +19,9 @@ class XORIterator: public ChunkIteratorInterface{
         mutable uint16_t num_total;
         mutable uint16_t num_read;
         mutable bool err_;
+        // Whether the value of the last sample read set a new XOR window, so
+        // that the following bits decode the same whatever the samples before.
+        mutable bool new_window;
         bool safe_mode;
 
     public:
@@ -32,6 +35,9 @@ class XORIterator: public ChunkIteratorInterface{
         bool read_value() const;
 
         bool error() const;
+
+        // Offset in bits from the beginning of the chunk of the next sample.
+        int bit_pos() const{ return bstream.index * 8 + 8 - bstream.head_count; }
 };
 
 }}
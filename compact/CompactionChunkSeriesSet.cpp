@@ -8,8 +8,9 @@ CompactionChunkSeriesSet::CompactionChunkSeriesSet(
     const std::shared_ptr<block::IndexReaderInterface>& ir,
     const std::shared_ptr<block::ChunkReaderInterface>& cr,
     const std::shared_ptr<tombstone::TombstoneReaderInterface>& tr,
-    std::unique_ptr<index::PostingsInterface>&& p)
-    : p(std::move(p)), ir(ir), cr(cr), tr(tr),
+    std::unique_ptr<index::PostingsInterface>&& p,
+    const std::shared_ptr<base::RateLimiter>& limiter)
+    : p(std::move(p)), ir(ir), cr(cr), tr(tr), limiter(limiter),
       csm(new querier::ChunkSeriesMeta()), err_()
 {}
 
@@ -44,16 +45,19 @@ bool CompactionChunkSeriesSet::next() const
     }
 
     // Read real chunk for each chunk meta.
+    int64_t read = 0;
     for (int i = 0; i < csm->chunks.size(); i++) {
         bool succeed;
         std::tie(csm->chunks[i]->chunk, succeed) =
-            cr->chunk(csm->tsid, csm->chunks[i]->ref);
+            cr->raw_chunk(csm->tsid, csm->chunks[i]->ref);
         if (!succeed) {
             err_.wrap("Chunk " + std::to_string(csm->chunks[i]->ref) +
                       "not found");
             return false;
         }
+        read += csm->chunks[i]->chunk->size();
     }
+    if (limiter) limiter->request(read);
 
     return true;
 }
@@ -1,6 +1,7 @@
 #ifndef COMPACTIONCHUNKSERIESSET_H
 #define COMPACTIONCHUNKSERIESSET_H
 
+#include "base/RateLimiter.hpp"
 #include "block/ChunkReaderInterface.hpp"
 #include "block/IndexReaderInterface.hpp"
 #include "index/PostingsInterface.hpp"
@@ -18,7 +19,9 @@ class CompactionChunkSeriesSet: public querier::ChunkSeriesSetInterface{
         std::shared_ptr<block::IndexReaderInterface> ir;
         std::shared_ptr<block::ChunkReaderInterface> cr;
         std::shared_ptr<tombstone::TombstoneReaderInterface> tr;
-        
+        // Throttles the chunk bytes read when not null.
+        std::shared_ptr<base::RateLimiter> limiter;
+
         mutable std::shared_ptr<querier::ChunkSeriesMeta> csm;
         mutable error::Error err_;
 
@@ -26,7 +29,8 @@ class CompactionChunkSeriesSet: public querier::ChunkSeriesSetInterface{
         CompactionChunkSeriesSet(const std::shared_ptr<block::IndexReaderInterface> & ir,
                 const std::shared_ptr<block::ChunkReaderInterface> & cr,
                 const std::shared_ptr<tombstone::TombstoneReaderInterface> & tr,
-                std::unique_ptr<index::PostingsInterface> && p);
+                std::unique_ptr<index::PostingsInterface> && p,
+                const std::shared_ptr<base::RateLimiter> & limiter=nullptr);
 
         bool next() const;
 
@@ -21,6 +21,13 @@ class CompactorInterface{
         // No Block is written when resulting Block has 0 samples, and returns empty ulid.ULID{}.
         virtual std::pair<ulid::ULID, error::Error> write(const std::string & dest, const std::shared_ptr<block::BlockInterface> & b, int64_t min_time, int64_t max_time, const std::shared_ptr<block::BlockMeta> & parent)=0;
 
+        // Rewrite persists b without its deleted samples into a new Block of dest,
+        // parent is the meta of b. Returns empty ulid.ULID{} like write() when
+        // nothing is left.
+        virtual std::pair<ulid::ULID, error::Error> rewrite(const std::string & dest, const std::shared_ptr<block::BlockInterface> & b, const std::shared_ptr<block::BlockMeta> & parent){
+            return write(dest, b, b->MinTime(), b->MaxTime(), parent);
+        }
+
         // Compact runs compaction against the provided directories. Must
         // only be called concurrently with results of Plan().
         // Can optionally pass a list of already open blocks,
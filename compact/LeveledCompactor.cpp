@@ -1,18 +1,20 @@
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+
 #include "compact/LeveledCompactor.hpp"
 #include "base/Logging.hpp"
 #include "base/TimeStamp.hpp"
 #include "block/Block.hpp"      // Block, Blocks
-#include "chunk/ChunkUtils.hpp" // merge_overlapping_chunks.
+#include "chunk/ChunkUtils.hpp" // vertical_merge_chunks.
 #include "chunk/ChunkWriter.hpp"
-#include "chunk/DeleteIterator.hpp"
 #include "chunk/XORChunk.hpp"
 #include "compact/CompactionChunkSeriesSet.hpp"
 #include "compact/MergedChunkSeriesSet.hpp"
 #include "db/DBUtils.hpp"
 #include "index/IndexWriter.hpp"
-#include "index/MemPostings.hpp"
 #include "querier/ChunkSeriesSetInterface.hpp"
 #include "tombstone/TombstoneUtils.hpp"
+#include "tsdbutil/tsdbutils.hpp"
 
 #include <limits>
 #include <unordered_map>
@@ -23,26 +25,54 @@ namespace compact {
 
 LeveledCompactor::LeveledCompactor(
     const std::deque<int64_t>& ranges,
-    const std::shared_ptr<base::Channel<char>>& cancel)
-    : ranges(ranges), cancel(cancel)
+    const std::shared_ptr<base::Channel<char>>& cancel, int concurrency,
+    const std::shared_ptr<base::RateLimiter>& limiter, int nice)
+    : ranges(ranges), cancel(cancel), concurrency(concurrency),
+      limiter(limiter), nice(nice)
 {
+    init_pool();
     if (ranges.empty()) err_.set("at least one range must be provided");
 }
 LeveledCompactor::LeveledCompactor(
     const std::vector<int64_t>& ranges,
-    const std::shared_ptr<base::Channel<char>>& cancel)
-    : ranges(ranges.begin(), ranges.end()), cancel(cancel)
+    const std::shared_ptr<base::Channel<char>>& cancel, int concurrency,
+    const std::shared_ptr<base::RateLimiter>& limiter, int nice)
+    : ranges(ranges.begin(), ranges.end()), cancel(cancel),
+      concurrency(concurrency), limiter(limiter), nice(nice)
 {
+    init_pool();
     if (this->ranges.empty()) err_.set("at least one range must be provided");
 }
 LeveledCompactor::LeveledCompactor(
     const std::initializer_list<int64_t>& ranges,
-    const std::shared_ptr<base::Channel<char>>& cancel)
-    : ranges(ranges.begin(), ranges.end()), cancel(cancel)
+    const std::shared_ptr<base::Channel<char>>& cancel, int concurrency,
+    const std::shared_ptr<base::RateLimiter>& limiter, int nice)
+    : ranges(ranges.begin(), ranges.end()), cancel(cancel),
+      concurrency(concurrency), limiter(limiter), nice(nice)
 {
+    init_pool();
     if (this->ranges.empty()) err_.set("at least one range must be provided");
 }
 
+void LeveledCompactor::set_chunk_targets(const std::vector<int>& samples,
+                                         const std::vector<int>& bytes)
+{
+    chunk_samples = samples;
+    chunk_bytes = bytes;
+}
+
+void LeveledCompactor::init_pool()
+{
+    if (concurrency <= 1) return;
+    pool = std::shared_ptr<base::ThreadPool>(
+        new base::ThreadPool("Compaction ThreadPool"));
+    if (nice != 0)
+        pool->setThreadInitCallback(
+            boost::bind(&base::set_current_thread_nice, nice));
+    // The compacting thread populates a partition as well.
+    pool->start(concurrency - 1);
+}
+
 std::pair<std::deque<std::string>, error::Error>
 LeveledCompactor::plan_helper(const std::shared_ptr<block::DirMetas>& dms)
 {
@@ -251,6 +281,9 @@ LeveledCompactor::compact(const std::string& dest,
                 }
             }
         }
+        // Blocks not open in the DB are mapped rather than read through its
+        // BufferCache on purpose, a single pass over them would only evict
+        // the blocks queries are using.
         if (!b) {
             b = std::shared_ptr<block::BlockInterface>(new block::Block(d));
             if (b->error())
@@ -371,29 +404,84 @@ error::Error LeveledCompactor::populate_blocks(
     const std::shared_ptr<block::ChunkWriterInterface>& chunkw)
 {
     // LOG_DEBUG << bm->min_time << " " << bm->max_time;
-    if (blocks->empty()) {
-        return error::Error("cannot populate block from no readers");
-    }
-
-    std::shared_ptr<querier::ChunkSeriesSetInterface> set;
+    std::vector<BlockReaders> readers;
     bool overlapping = false;
-    int err;
+    error::Error err = open_readers(blocks, *bm, &readers, &overlapping);
+    if (err) return err;
 
     // Create ChunkSeriesSets.
     std::shared_ptr<querier::ChunkSeriesSets> sets(
         new querier::ChunkSeriesSets());
+    for (size_t i = 0; i < readers.size(); i++) {
+        std::pair<std::unique_ptr<index::PostingsInterface>, bool>
+            all_postings_pair = readers[i].ir->get_all_postings();
+        if (!all_postings_pair.second)
+            return error::Error("Error get postings of ALL_POSTINGS_KEYS " +
+                                ulid::Marshal(blocks->at(i)->meta().ulid_));
+
+        // Append block to ChunkSeriesSets.
+        sets->push_back(std::shared_ptr<querier::ChunkSeriesSetInterface>(
+            new CompactionChunkSeriesSet(
+                readers[i].ir, readers[i].cr, readers[i].tr,
+                std::move(all_postings_pair.first), limiter)));
+    }
+
+    // Create MergedChunkSeriesSet.
+    MergedChunkSeriesSet mcss(sets);
+
+    int ret;
+    // STEP 1 in index writer.
+    while (mcss.next()) {
+        // Check if receiving cancel signal.
+        if (!cancel->empty()) return error::Error("cancel");
+
+        std::shared_ptr<querier::ChunkSeriesMeta> csm = mcss.at();
+        if ((err = rewrite_chunks(csm, *bm, overlapping))) return err;
+        // Skip the series with all deleted chunks.
+        if (csm->chunks.empty()) continue;
+
+        // write_chunks will update ref in ChunkMeta.
+        chunkw->write_chunks(csm->chunks);
+
+        // STEP 2 in index writer.
+        // Monotonically increasing ID.
+        if ((ret = indexw->add_series(csm->tsid, csm->chunks)) !=
+            index::SUCCEED)
+            return error::wrap(error::Error(index::error_string(ret)),
+                               "add_series");
+
+        bm->stats.num_chunks += csm->chunks.size();
+        ++bm->stats.num_series;
+        for (auto const& chk : csm->chunks)
+            bm->stats.num_samples += chk->chunk->num_samples();
+    }
+    if (mcss.error())
+        return error::wrap(mcss.error_detail(), "iterate MergedChunkSeriesSet");
+
+    return error::Error();
+}
+
+error::Error
+LeveledCompactor::open_readers(const std::shared_ptr<block::Blocks>& blocks,
+                               const block::BlockMeta& bm,
+                               std::vector<BlockReaders>* readers,
+                               bool* overlapping)
+{
+    if (blocks->empty()) {
+        return error::Error("cannot populate block from no readers");
+    }
 
     int64_t max_time = blocks->front()->MaxTime();
     for (int i = 0; i < blocks->size(); i++) {
         // Check if receiving cancel signal.
         if (!cancel->empty()) return error::Error("cancel");
 
-        if (!overlapping) {
+        if (!*overlapping) {
             if (i > 0 && blocks->at(i)->MinTime() < max_time) {
-                overlapping = true;
+                *overlapping = true;
                 LOG_WARN << "found overlapping blocks during "
                             "populate_blocks(), ulid: "
-                         << ulid::Marshal(bm->ulid_);
+                         << ulid::Marshal(bm.ulid_);
             }
             if (blocks->at(i)->MaxTime() > max_time)
                 max_time = blocks->at(i)->MaxTime();
@@ -417,112 +505,299 @@ error::Error LeveledCompactor::populate_blocks(
             return error::Error("Error open tombstone reader for block " +
                                 ulid::Marshal(blocks->at(i)->meta().ulid_));
 
-        std::pair<std::unique_ptr<index::PostingsInterface>, bool>
-            all_postings_pair = index_pair.first->get_all_postings();
-        if (!all_postings_pair.second)
-            return error::Error("Error get postings of ALL_POSTINGS_KEYS " +
-                                ulid::Marshal(blocks->at(i)->meta().ulid_));
-
-        // Append block to ChunkSeriesSets.
-        sets->push_back(std::shared_ptr<querier::ChunkSeriesSetInterface>(
-            new CompactionChunkSeriesSet(index_pair.first, chunks_pair.first,
-                                         tombstones_pair.first,
-                                         std::move(all_postings_pair.first))));
+        readers->push_back(BlockReaders{index_pair.first, chunks_pair.first,
+                                        tombstones_pair.first});
     }
+    return error::Error();
+}
 
-    // Create MergedChunkSeriesSet.
-    MergedChunkSeriesSet mcss(sets);
+error::Error LeveledCompactor::rewrite_chunks(
+    const std::shared_ptr<querier::ChunkSeriesMeta>& csm,
+    const block::BlockMeta& bm, bool overlapping)
+{
+    if (overlapping) {
+        // If blocks are overlapping, it is possible to have unsorted
+        // chunks. Keep the block order for equal min_time so that the
+        // newer block wins in vertical_merge_chunks().
+        std::stable_sort(csm->chunks.begin(), csm->chunks.end(),
+                         [](const std::shared_ptr<chunk::ChunkMeta>& lhs,
+                            const std::shared_ptr<chunk::ChunkMeta>& rhs) {
+                             return lhs->min_time < rhs->min_time;
+                         });
+    }
+    if (csm->chunks.empty()) return error::Error();
+
+    for (size_t i = 0; i < csm->chunks.size(); ++i) {
+        if (csm->chunks[i]->min_time < bm.min_time ||
+            csm->chunks[i]->max_time > bm.max_time)
+            return error::Error(
+                "found chunk with minTime: " +
+                std::to_string(csm->chunks[i]->min_time) +
+                " maxTime: " + std::to_string(csm->chunks[i]->max_time) +
+                " outside of compacted minTime: " +
+                std::to_string(bm.min_time) +
+                " maxTime: " + std::to_string(bm.max_time));
+    }
 
-    index::MemPostings postings;
+    // Split the chunks at the deleted ranges.
+    if (!csm->intervals.empty()) {
+        std::vector<std::shared_ptr<chunk::ChunkMeta>> chunks;
+        for (auto const& c : csm->chunks) {
+            if (!c->overlap_closed(csm->intervals.front().min_time,
+                                   csm->intervals.back().max_time)) {
+                chunks.push_back(c);
+                continue;
+            }
+            auto split = chunk::split_deleted(c, csm->intervals);
+            if (split.second)
+                return error::wrap(split.second, "split deleted chunk");
+            chunks.insert(chunks.end(), split.first.begin(),
+                          split.first.end());
+        }
+        csm->chunks.swap(chunks);
+        if (csm->chunks.empty()) return error::Error();
+    }
 
-    // STEP 1 in index writer.
-    while (mcss.next()) {
-        // Check if receiving cancel signal.
-        if (!cancel->empty()) return error::Error("cancel");
+    if (overlapping) {
+        auto merged_chunks = chunk::vertical_merge_chunks(csm->chunks);
+        if (merged_chunks.second)
+            return error::wrap(merged_chunks.second,
+                               "merge overlapping chunks");
+        csm->chunks = merged_chunks.first;
+    }
 
-        std::shared_ptr<querier::ChunkSeriesMeta> csm = mcss.at();
-        if (overlapping) {
-            // If blocks are overlapping, it is possible to have unsorted
-            // chunks.
-            std::sort(csm->chunks.begin(), csm->chunks.end(),
-                      [](const std::shared_ptr<chunk::ChunkMeta>& lhs,
-                         const std::shared_ptr<chunk::ChunkMeta>& rhs) {
-                          return lhs->min_time < rhs->min_time;
-                      });
+    if (!chunk_samples.empty()) {
+        int l = std::max(bm.compaction.level, 1) - 1;
+        int max_samples = chunk_samples[std::min(
+            l, static_cast<int>(chunk_samples.size()) - 1)];
+        int max_bytes = 0;
+        if (!chunk_bytes.empty())
+            max_bytes = chunk_bytes[std::min(
+                l, static_cast<int>(chunk_bytes.size()) - 1)];
+        if (max_samples > 0) {
+            auto merged_chunks =
+                chunk::rechunk(csm->chunks, max_samples, max_bytes);
+            if (merged_chunks.second)
+                return error::wrap(merged_chunks.second, "rechunk");
+            csm->chunks = merged_chunks.first;
         }
-        // Skip the series with all deleted chunks.
-        // LOG_DEBUG << csm->chunks.size();
-        if (csm->chunks.empty()) continue;
+    }
+    return error::Error();
+}
 
-        for (int i = 0; i < csm->chunks.size(); ++i) {
-            // LOG_DEBUG << csm->chunks[i]->min_time << " " <<
-            // csm->chunks[i]->max_time;
-            if (csm->chunks[i]->min_time < bm->min_time ||
-                csm->chunks[i]->max_time > bm->max_time)
-                return error::Error(
-                    "found chunk with minTime: " +
-                    std::to_string(csm->chunks[i]->min_time) +
-                    " maxTime: " + std::to_string(csm->chunks[i]->max_time) +
-                    " outside of compacted minTime: " +
-                    std::to_string(bm->min_time) +
-                    " maxTime: " + std::to_string(bm->max_time));
-            // Re-encode the chunk to not have deleted values.
-            if (!csm->intervals.empty()) {
-                if (!csm->chunks[i]->overlap_closed(
-                        csm->intervals.front().min_time,
-                        csm->intervals.back().max_time))
-                    continue;
+std::vector<tagtree::TSID> LeveledCompactor::partition_bounds(
+    const std::shared_ptr<block::Blocks>& blocks,
+    const std::vector<BlockReaders>& readers)
+{
+    std::vector<tagtree::TSID> bounds;
+    int largest = 0;
+    for (int i = 1; i < blocks->size(); i++) {
+        if (blocks->at(i)->meta().stats.num_series >
+            blocks->at(largest)->meta().stats.num_series)
+            largest = i;
+    }
+    uint64_t num_series = blocks->at(largest)->meta().stats.num_series;
+    uint64_t n = std::min(static_cast<uint64_t>(concurrency),
+                          num_series / COMPACTION_MIN_PARTITION_SERIES);
+    if (n <= 1) return bounds;
+
+    std::pair<std::unique_ptr<index::PostingsInterface>, bool> p =
+        readers[largest].ir->get_all_postings();
+    if (!p.second) return bounds;
+    uint64_t i = 0;
+    while (p.first->next() && bounds.size() + 1 < n) {
+        if (i++ == num_series * (bounds.size() + 1) / n)
+            bounds.push_back(p.first->at());
+    }
+    return bounds;
+}
 
-                // TODO(alec), different types of chunk.
-                std::shared_ptr<chunk::ChunkInterface> new_chunk =
-                    std::shared_ptr<chunk::XORChunk>(new chunk::XORChunk());
-                std::unique_ptr<chunk::ChunkAppenderInterface> app;
-                try {
-                    app = new_chunk->appender();
-                } catch (const base::TSDBException& e) {
-                    return error::Error(e.what());
-                }
+namespace {
+
+// The postings within [lo, hi).
+class RangePostings : public index::PostingsInterface {
+private:
+    std::unique_ptr<index::PostingsInterface> p;
+    bool has_lo;
+    bool has_hi;
+    tagtree::TSID lo;
+    tagtree::TSID hi;
+    bool started;
+
+public:
+    RangePostings(std::unique_ptr<index::PostingsInterface>&& p, bool has_lo,
+                  tagtree::TSID lo, bool has_hi, tagtree::TSID hi)
+        : p(std::move(p)), has_lo(has_lo), has_hi(has_hi), lo(lo), hi(hi),
+          started(false)
+    {}
+
+    bool next()
+    {
+        bool ok;
+        if (!started && has_lo)
+            ok = p->seek(lo);
+        else
+            ok = p->next();
+        started = true;
+        return ok && (!has_hi || p->at() < hi);
+    }
 
-                chunk::DeleteIterator it(
-                    std::move(csm->chunks[i]->chunk->iterator()),
-                    csm->intervals.cbegin(), csm->intervals.cend());
-                while (it.next()) {
-                    std::pair<int64_t, double> p = it.at();
-                    app->append(p.first, p.second);
-                }
-                csm->chunks[i]->chunk = new_chunk;
-            }
+    bool seek(tagtree::TSID v)
+    {
+        started = true;
+        if (has_lo && v < lo) v = lo;
+        return p->seek(v) && (!has_hi || p->at() < hi);
+    }
+
+    tagtree::TSID at() const { return p->at(); }
+};
+
+} // namespace
+
+void LeveledCompactor::populate_partition(
+    const std::vector<BlockReaders>* readers, const block::BlockMeta* bm,
+    bool overlapping, Partition* part)
+{
+    std::shared_ptr<querier::ChunkSeriesSets> sets(
+        new querier::ChunkSeriesSets());
+    for (auto const& r : *readers) {
+        std::pair<std::unique_ptr<index::PostingsInterface>, bool>
+            all_postings_pair = r.ir->get_all_postings();
+        if (!all_postings_pair.second) {
+            part->err = error::Error("Error get postings of "
+                                     "ALL_POSTINGS_KEYS");
+            break;
         }
+        std::unique_ptr<index::PostingsInterface> p(
+            new RangePostings(std::move(all_postings_pair.first),
+                              part->has_lo, part->lo, part->has_hi,
+                              part->hi));
+        sets->push_back(std::shared_ptr<querier::ChunkSeriesSetInterface>(
+            new CompactionChunkSeriesSet(r.ir, r.cr, r.tr, std::move(p),
+                                         limiter)));
+    }
 
-        if (overlapping) {
-            auto merged_chunks = chunk::merge_overlapping_chunks(csm->chunks);
-            if (merged_chunks.second)
-                return error::wrap(merged_chunks.second,
-                                   "merge overlapping chunks");
-            csm->chunks = merged_chunks.first;
+    chunk::ChunkWriter chunkw(part->dir, limiter);
+    MergedChunkSeriesSet mcss(sets);
+    while (!part->err && mcss.next()) {
+        if (!cancel->empty()) {
+            part->err = error::Error("cancel");
+            break;
         }
 
-        // write_chunks will update ref in ChunkMeta.
-        chunkw->write_chunks(csm->chunks);
+        std::shared_ptr<querier::ChunkSeriesMeta> csm = mcss.at();
+        if ((part->err = rewrite_chunks(csm, *bm, overlapping))) break;
+        if (csm->chunks.empty()) continue;
 
-        // STEP 2 in index writer.
-        // Monotonically increasing ID.
-        if ((err = indexw->add_series(csm->tsid, csm->chunks)) !=
-            index::SUCCEED)
-            return error::wrap(error::Error(index::error_string(err)),
-                               "add_series");
+        chunkw.write_chunks(csm->chunks);
 
-        bm->stats.num_chunks += csm->chunks.size();
-        ++bm->stats.num_series;
-        for (auto const& chk : csm->chunks)
-            bm->stats.num_samples += chk->chunk->num_samples();
+        std::vector<std::shared_ptr<chunk::ChunkMeta>> metas;
+        metas.reserve(csm->chunks.size());
+        for (auto const& chk : csm->chunks) {
+            part->stats.num_samples += chk->chunk->num_samples();
+            metas.emplace_back(new chunk::ChunkMeta(
+                chk->ref, chk->min_time, chk->max_time));
+        }
+        part->stats.num_chunks += metas.size();
+        ++part->stats.num_series;
+        part->series.emplace_back(csm->tsid, std::move(metas));
+    }
+    if (!part->err && mcss.error())
+        part->err = error::wrap(mcss.error_detail(),
+                                "iterate MergedChunkSeriesSet");
+}
 
-        // Add postings to MemPostings.
-        postings.add(csm->tsid);
+error::Error LeveledCompactor::populate_partitions(
+    const std::shared_ptr<block::Blocks>& blocks, block::BlockMeta* bm,
+    const std::shared_ptr<block::IndexWriterInterface>& indexw,
+    const std::shared_ptr<block::ChunkWriterInterface>& chunkw,
+    const std::string& dir)
+{
+    std::vector<BlockReaders> readers;
+    bool overlapping = false;
+    error::Error err = open_readers(blocks, *bm, &readers, &overlapping);
+    if (err) return err;
+
+    std::vector<tagtree::TSID> bounds = partition_bounds(blocks, readers);
+    // Too few series to split, e.g. persisting the head.
+    if (bounds.empty()) return populate_blocks(blocks, bm, indexw, chunkw);
+    std::vector<Partition> parts(bounds.size() + 1);
+    for (size_t i = 0; i < parts.size(); i++) {
+        if (i > 0) {
+            parts[i].has_lo = true;
+            parts[i].lo = bounds[i - 1];
+        }
+        if (i < bounds.size()) {
+            parts[i].has_hi = true;
+            parts[i].hi = bounds[i];
+        }
+        parts[i].dir = dir + "/chunks." + std::to_string(i);
     }
-    if (mcss.error())
-        return error::wrap(mcss.error_detail(), "iterate MergedChunkSeriesSet");
 
+    boost::filesystem::path chunks_dir = boost::filesystem::path(dir) / "chunks";
+    boost::filesystem::create_directories(chunks_dir);
+
+    // The partitions are flushed in TSID order as soon as all the partitions
+    // before them are done, so only the metas of the partitions finished
+    // ahead of a slower one are held in memory.
+    base::MutexLock flush_mutex;
+    size_t flushed = 0;
+    uint64_t offset = 0;
+    pool->parallel_for(0, static_cast<int>(parts.size()), [&](int i) {
+        populate_partition(&readers, bm, overlapping, &parts[i]);
+
+        base::MutexLockGuard lock(flush_mutex);
+        parts[i].done = true;
+        while (flushed < parts.size() && parts[flushed].done) {
+            if (!err)
+                err = flush_partition(&parts[flushed], bm, indexw,
+                                      chunks_dir.string(), &offset);
+            ++flushed;
+        }
+    });
+    return err;
+}
+
+error::Error LeveledCompactor::flush_partition(
+    Partition* part, block::BlockMeta* bm,
+    const std::shared_ptr<block::IndexWriterInterface>& indexw,
+    const std::string& chunks_dir, uint64_t* offset)
+{
+    if (part->err) return part->err;
+
+    // Move the chunk files of the partition after the ones of the previous
+    // partitions.
+    std::deque<std::string> files = chunk::sequence_files(part->dir);
+    char name[7];
+    for (size_t i = 0; i < files.size(); i++) {
+        sprintf(name, "%06d", static_cast<int>(*offset + i));
+        try {
+            boost::filesystem::rename(files[i],
+                                      boost::filesystem::path(chunks_dir) /
+                                          name);
+        } catch (const boost::filesystem::filesystem_error& e) {
+            return error::Error(e.what());
+        }
+    }
+    boost::filesystem::remove_all(part->dir);
+
+    int ret;
+    for (auto& s : part->series) {
+        for (auto& chk : s.second)
+            chk->ref += *offset << 32;
+        if ((ret = indexw->add_series(s.first, s.second)) != index::SUCCEED)
+            return error::wrap(error::Error(index::error_string(ret)),
+                               "add_series");
+    }
+    *offset += files.size();
+
+    bm->stats.num_samples += part->stats.num_samples;
+    bm->stats.num_series += part->stats.num_series;
+    bm->stats.num_chunks += part->stats.num_chunks;
+    // Release the metas as soon as they are in the index.
+    std::vector<
+        std::pair<tagtree::TSID, std::vector<std::shared_ptr<chunk::ChunkMeta>>>>()
+        .swap(part->series);
     return error::Error();
 }
 
@@ -551,13 +826,19 @@ LeveledCompactor::write_helper(const std::string& dest, block::BlockMeta* bm,
             // of all blocks.
             std::shared_ptr<block::ChunkWriterInterface> chunkw =
                 std::shared_ptr<chunk::ChunkWriter>(
-                    new chunk::ChunkWriter(tmp.string() + "/chunks"));
+                    new chunk::ChunkWriter(tmp.string() + "/chunks",
+                                           limiter));
 
             std::shared_ptr<block::IndexWriterInterface> indexw =
                 std::shared_ptr<index::IndexWriter>(
-                    new index::IndexWriter(tmp.string() + "/index"));
-
-            err = populate_blocks(blocks, bm, indexw, chunkw);
+                    new index::IndexWriter(tmp.string() + "/index",
+                                           limiter));
+
+            if (pool)
+                err = populate_partitions(blocks, bm, indexw, chunkw,
+                                          tmp.string());
+            else
+                err = populate_blocks(blocks, bm, indexw, chunkw);
         }
         if (err) {
             boost::filesystem::remove_all(tmp);
@@ -634,5 +915,214 @@ LeveledCompactor::write(const std::string& dest,
     return {ulid, error::Error()};
 }
 
+error::Error
+LeveledCompactor::rewrite_helper(const std::string& dest, block::BlockMeta* bm,
+                                 const std::shared_ptr<block::BlockInterface>& b)
+{
+    std::pair<std::shared_ptr<block::IndexReaderInterface>, bool> ir =
+        b->index();
+    std::pair<std::shared_ptr<block::ChunkReaderInterface>, bool> cr =
+        b->chunks();
+    std::pair<std::shared_ptr<tombstone::TombstoneReaderInterface>, bool> tr =
+        b->tombstones();
+    if (!ir.second || !cr.second || !tr.second)
+        return error::Error("Error open readers for block " +
+                            ulid::Marshal(b->meta().ulid_));
+    std::pair<std::unique_ptr<index::PostingsInterface>, bool> p =
+        ir.first->get_all_postings();
+    if (!p.second)
+        return error::Error("Error get postings of ALL_POSTINGS_KEYS " +
+                            ulid::Marshal(b->meta().ulid_));
+
+    boost::filesystem::path dir =
+        boost::filesystem::path(dest) /
+        boost::filesystem::path(ulid::Marshal(bm->ulid_));
+    boost::filesystem::path tmp(dir.string() + ".tmp");
+    boost::filesystem::remove_all(tmp);
+    boost::filesystem::path chunks_dir = tmp / "chunks";
+    boost::filesystem::create_directories(chunks_dir);
+
+    // The chunk files keep their sequence numbers, so do the refs into them,
+    // and the rewritten chunks go to the files numbered after them.
+    for (auto const& f : chunk::sequence_files(b->dir() + "/chunks")) {
+        boost::filesystem::path to =
+            chunks_dir / boost::filesystem::path(f).filename();
+        if (!tsdbutil::clone_file(f, to.string())) {
+            boost::filesystem::remove_all(tmp);
+            return error::Error("cannot clone chunk file " + f);
+        }
+    }
+
+    // Samples of the chunks replaced and of their replacements.
+    uint64_t removed = 0, added = 0;
+    // Bytes of the replaced chunks left in the cloned files.
+    uint64_t dead = 0;
+    error::Error err;
+    {
+        std::shared_ptr<block::ChunkWriterInterface> chunkw =
+            std::shared_ptr<chunk::ChunkWriter>(
+                new chunk::ChunkWriter(chunks_dir.string(), limiter));
+        std::shared_ptr<block::IndexWriterInterface> indexw =
+            std::shared_ptr<index::IndexWriter>(
+                new index::IndexWriter(tmp.string() + "/index", limiter));
+
+        std::vector<std::shared_ptr<chunk::ChunkMeta>> chunks;
+        std::vector<std::shared_ptr<chunk::ChunkMeta>> kept;
+        std::vector<std::shared_ptr<chunk::ChunkMeta>> rewritten;
+        int ret;
+        while (!err && p.first->next()) {
+            // Check if receiving cancel signal.
+            if (!cancel->empty()) {
+                err = error::Error("cancel");
+                break;
+            }
+
+            tagtree::TSID tsid = p.first->at();
+            chunks.clear();
+            if (!ir.first->series(tsid, chunks)) {
+                err = error::Error("Error get series " + std::to_string(tsid));
+                break;
+            }
+            const tombstone::Intervals* intervals = nullptr;
+            try {
+                intervals = &tr.first->get(tsid);
+            } catch (const std::out_of_range& e) {
+            }
+
+            kept.clear();
+            rewritten.clear();
+            for (auto const& c : chunks) {
+                if (!intervals || intervals->empty() ||
+                    !c->overlap_closed(intervals->front().min_time,
+                                       intervals->back().max_time)) {
+                    kept.push_back(c);
+                    continue;
+                }
+                bool succeed;
+                std::tie(c->chunk, succeed) = cr.first->raw_chunk(tsid, c->ref);
+                if (!succeed) {
+                    err = error::Error("Chunk " + std::to_string(c->ref) +
+                                       " not found");
+                    break;
+                }
+                if (limiter) limiter->request(c->chunk->size());
+
+                auto split = chunk::split_deleted(c, *intervals);
+                if (split.second) {
+                    err = error::wrap(split.second, "split deleted chunk");
+                    break;
+                }
+                if (split.first.size() == 1 && split.first[0] == c) {
+                    kept.push_back(c);
+                    continue;
+                }
+                removed += c->chunk->num_samples();
+                std::pair<const uint8_t*, int> entry = c->chunk->entry();
+                dead += entry.first ? entry.second : c->chunk->size();
+                for (auto const& nc : split.first) {
+                    added += nc->chunk->num_samples();
+                    rewritten.push_back(nc);
+                    kept.push_back(nc);
+                }
+            }
+            if (err) break;
+            if (kept.empty()) continue;
+
+            // write_chunks will update ref in ChunkMeta.
+            if (!rewritten.empty()) chunkw->write_chunks(rewritten);
+            if ((ret = indexw->add_series(tsid, kept)) != index::SUCCEED) {
+                err = error::wrap(error::Error(index::error_string(ret)),
+                                  "add_series");
+                break;
+            }
+            bm->stats.num_chunks += kept.size();
+            ++bm->stats.num_series;
+        }
+    }
+    if (err) {
+        boost::filesystem::remove_all(tmp);
+        return err;
+    }
+
+    bm->stats.num_samples = bm->stats.num_samples > removed
+                                ? bm->stats.num_samples - removed + added
+                                : added;
+    bm->stats.num_dead_bytes += dead;
+    if (bm->stats.num_series == 0) {
+        boost::filesystem::remove_all(tmp);
+        bm->stats.num_samples = 0;
+        return error::Error();
+    }
+
+    if (!block::write_block_meta(tmp.string(), *bm)) {
+        boost::filesystem::remove_all(tmp);
+        return error::Error("rewrite_helper: write_block_meta");
+    }
+    tombstone::write_tombstones(tmp.string(), nullptr);
+    try {
+        boost::filesystem::rename(tmp, dir);
+    } catch (const boost::filesystem::filesystem_error& e) {
+        boost::filesystem::remove_all(tmp);
+        return error::Error(e.what());
+    }
+    return error::Error();
+}
+
+std::pair<ulid::ULID, error::Error>
+LeveledCompactor::rewrite(const std::string& dest,
+                          const std::shared_ptr<block::BlockInterface>& b,
+                          const std::shared_ptr<block::BlockMeta>& parent)
+{
+    std::pair<std::shared_ptr<tombstone::TombstoneReaderInterface>, bool> tr =
+        b->tombstones();
+    uint64_t deleted_series = 0;
+    if (tr.second)
+        tr.first->iter([&deleted_series](tagtree::TSID tsid,
+                                         const tombstone::Intervals& ivs) {
+            ++deleted_series;
+        });
+    uint64_t chunk_bytes = 0;
+    if (!b->dir().empty()) {
+        boost::system::error_code ec;
+        for (auto const& f : chunk::sequence_files(b->dir() + "/chunks")) {
+            uint64_t size = boost::filesystem::file_size(f, ec);
+            if (!ec) chunk_bytes += size;
+        }
+    }
+    if (!tr.second || b->dir().empty() ||
+        deleted_series > parent->stats.num_series *
+                             REWRITE_MAX_DELETED_SERIES_RATIO ||
+        parent->stats.num_dead_bytes >
+            chunk_bytes * (1 - REWRITE_MIN_LIVE_BYTES_RATIO))
+        return write(dest, b, b->MinTime(), b->MaxTime(), parent);
+
+    base::TimeStamp start = base::TimeStamp::now();
+    ulid::ULID ulid = ulid::CreateNowRand();
+
+    // Same data, same place in the compaction plan.
+    block::BlockMeta bm(*parent);
+    bm.ulid_ = ulid;
+    bm.stats = block::BlockStats();
+    bm.stats.num_samples = parent->stats.num_samples;
+    bm.stats.num_dead_bytes = parent->stats.num_dead_bytes;
+    bm.compaction.parents.clear();
+    bm.compaction.parents.emplace_back(parent->ulid_, parent->min_time,
+                                       parent->max_time);
+
+    error::Error err = rewrite_helper(dest, &bm, b);
+    if (err) return {ulid, error::wrap(err, "rewrite_helper")};
+
+    if (bm.stats.num_samples == 0) return {ulid::ULID(), error::Error()};
+
+    LOG_INFO << "msg=\"rewrite block\" "
+             << "mint=" << bm.min_time << " maxt=" << bm.max_time
+             << " deleted_series=" << deleted_series
+             << " dead_bytes=" << bm.stats.num_dead_bytes << " ulid=\""
+             << ulid::Marshal(bm.ulid_) << "\" duration="
+             << base::timeDifference(base::TimeStamp::now(), start);
+
+    return {ulid, error::Error()};
+}
+
 } // namespace compact
 } // namespace tsdb
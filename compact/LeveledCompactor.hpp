@@ -4,26 +4,111 @@
 #include <vector>
 
 #include "base/Channel.hpp"
+#include "base/RateLimiter.hpp"
+#include "base/ThreadPool.hpp"
+#include "base/WaitGroup.hpp"
 #include "block/BlockUtils.hpp"
+#include "block/ChunkReaderInterface.hpp"
 #include "block/ChunkWriterInterface.hpp"
+#include "block/IndexReaderInterface.hpp"
 #include "block/IndexWriterInterface.hpp"
 #include "compact/CompactorInterface.hpp"
+#include "querier/ChunkSeriesMeta.hpp"
+#include "tombstone/TombstoneReaderInterface.hpp"
 
 namespace tsdb{
 namespace compact{
 
+// rewrite() falls back to write() when more than this ratio of the series of
+// the block have tombstones.
+const double REWRITE_MAX_DELETED_SERIES_RATIO = 0.5;
+
+// rewrite() falls back to write() when less than this ratio of the chunk
+// bytes of the block are still referenced by its index, see
+// BlockStats::num_dead_bytes.
+const double REWRITE_MIN_LIVE_BYTES_RATIO = 0.5;
+
+// A partition needs at least this many series of the largest input block to
+// be worth its own worker.
+const int COMPACTION_MIN_PARTITION_SERIES = 4096;
+
 class LeveledCompactor: public CompactorInterface{
-    private:
+    protected:
         std::deque<int64_t> ranges;
+
+    private:
+        // Readers of an input block, shared by all the partitions.
+        struct BlockReaders{
+            std::shared_ptr<block::IndexReaderInterface> ir;
+            std::shared_ptr<block::ChunkReaderInterface> cr;
+            std::shared_ptr<tombstone::TombstoneReaderInterface> tr;
+        };
+
+        // The series in the TSID range [lo, hi) of the output block, populated
+        // by one worker into the chunk files under dir.
+        struct Partition{
+            bool has_lo;
+            bool has_hi;
+            tagtree::TSID lo;
+            tagtree::TSID hi;
+            std::string dir;
+            // Chunk metas without the chunk data, the refs are relative to the
+            // files of dir.
+            std::vector<std::pair<tagtree::TSID, std::vector<std::shared_ptr<chunk::ChunkMeta>>>> series;
+            block::BlockStats stats;
+            error::Error err;
+            // Set once the worker is finished, guarded by the flush mutex of
+            // populate_partitions().
+            bool done;
+
+            Partition(): has_lo(false), has_hi(false), done(false){}
+        };
+
         std::shared_ptr<base::Channel<char>> cancel;
         error::Error err_;
 
+        // Number of workers of populate_partitions(), pool is only created when > 1.
+        int concurrency;
+        std::shared_ptr<base::ThreadPool> pool;
+
+        // Throttles the chunk bytes read and all the bytes written when not null.
+        std::shared_ptr<base::RateLimiter> limiter;
+        // Nice value of the workers of pool, 0 keeps the default.
+        int nice;
+
+        // Targets of chunk::rechunk() indexed by the compaction level of the
+        // output block minus one, the last one applies to the higher levels.
+        std::vector<int> chunk_samples;
+        std::vector<int> chunk_bytes;
+
+        void init_pool();
+
+        error::Error open_readers(const std::shared_ptr<block::Blocks> & blocks, const block::BlockMeta & bm, std::vector<BlockReaders> * readers, bool * overlapping);
+
+        // Drop the deleted samples of csm and merge its overlapping chunks.
+        error::Error rewrite_chunks(const std::shared_ptr<querier::ChunkSeriesMeta> & csm, const block::BlockMeta & bm, bool overlapping);
+
+        // Split the TSIDs of the largest input block into at most concurrency
+        // ranges of similar size.
+        std::vector<tagtree::TSID> partition_bounds(const std::shared_ptr<block::Blocks> & blocks, const std::vector<BlockReaders> & readers);
+
+        void populate_partition(const std::vector<BlockReaders> * readers, const block::BlockMeta * bm, bool overlapping, Partition * part);
+
+        // Move the chunk files of a finished partition into chunks_dir after
+        // the offset files already there, add its series to indexw and its
+        // stats to bm.
+        error::Error flush_partition(Partition * part, block::BlockMeta * bm, const std::shared_ptr<block::IndexWriterInterface> & indexw, const std::string & chunks_dir, uint64_t * offset);
+
+        // Clone the chunk files of b and write the index of the new block, see
+        // rewrite().
+        error::Error rewrite_helper(const std::string & dest, block::BlockMeta * bm, const std::shared_ptr<block::BlockInterface> & b);
+
     public:
         std::deque<std::string> overlapping_dirs(const std::shared_ptr<block::DirMetas> & dms);
 
         // selectDirs returns the dir metas that should be compacted into a single new block.
         // If only a single block range is configured, the result is always nil.
-        std::shared_ptr<block::DirMetas> select_dirs(const std::shared_ptr<block::DirMetas> & dms);
+        virtual std::shared_ptr<block::DirMetas> select_dirs(const std::shared_ptr<block::DirMetas> & dms);
 
         // splitByRange splits the directories by the time range. The range sequence starts at 0.
         //
@@ -56,24 +141,55 @@ class LeveledCompactor: public CompactorInterface{
         // -- 2.1. Sort csm->chunks by time of 'overlapping' detected before.
         // -- 2.2. For each csm->chunks
         // ------- 2.2.1. Rewrite chunk.
-        // -- 2.3. Merge overlapping csm->chunks.
+        // -- 2.3. Merge overlapping csm->chunks by streaming their samples (vertical_merge_chunks).
         // -- 2.4. chunkw->write_chunks(csm->chunks) and add_series.
         // 3. write_label_index and write_postings.
         //
         // TODO(Alec), add metrics tracking the number of populated blocks.
         error::Error populate_blocks(const std::shared_ptr<block::Blocks> & blocks, block::BlockMeta * bm, const std::shared_ptr<block::IndexWriterInterface> & indexw, const std::shared_ptr<block::ChunkWriterInterface> & chunkw);
 
+        // populate_partitions does the same as populate_blocks() with the TSID
+        // space split into ranges populated in parallel. Each worker streams its
+        // series into its own chunk files under dir. A finished partition is
+        // renumbered into dir/chunks and added to the index once all the
+        // partitions before it are, so the index is written in TSID order and
+        // the block stays readable by the existing readers. Falls back to
+        // populate_blocks() with chunkw when there are too few series to split.
+        //
+        // The chunk metas of a partition, about 100 bytes per output chunk, are
+        // kept in memory until it is flushed, while the chunk data of a worker
+        // is bounded by the buffer of its chunk files.
+        error::Error populate_partitions(const std::shared_ptr<block::Blocks> & blocks, block::BlockMeta * bm, const std::shared_ptr<block::IndexWriterInterface> & indexw, const std::shared_ptr<block::ChunkWriterInterface> & chunkw, const std::string & dir);
+
         std::pair<std::deque<std::string>, error::Error> plan_helper(const std::shared_ptr<block::DirMetas> & dms);
 
-        LeveledCompactor()=default;
-        LeveledCompactor(const std::deque<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel);
-        LeveledCompactor(const std::vector<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel);
-        LeveledCompactor(const std::initializer_list<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel);
+        LeveledCompactor(): concurrency(1), nice(0){}
+        LeveledCompactor(const std::deque<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel, int concurrency=1, const std::shared_ptr<base::RateLimiter> & limiter=nullptr, int nice=0);
+        LeveledCompactor(const std::vector<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel, int concurrency=1, const std::shared_ptr<base::RateLimiter> & limiter=nullptr, int nice=0);
+        LeveledCompactor(const std::initializer_list<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel, int concurrency=1, const std::shared_ptr<base::RateLimiter> & limiter=nullptr, int nice=0);
 
         std::pair<std::deque<std::string>, error::Error> plan(const std::string & dir);
 
+        // Merge consecutive chunks of a series written at compaction level l
+        // into chunks of up to samples[l - 1] samples and bytes[l - 1] bytes,
+        // a level without a sample target > 0 keeps its chunks.
+        void set_chunk_targets(const std::vector<int> & samples, const std::vector<int> & bytes);
+
         std::pair<ulid::ULID, error::Error> write(const std::string & dest, const std::shared_ptr<block::BlockInterface> & b, int64_t min_time, int64_t max_time, const std::shared_ptr<block::BlockMeta> & parent);
 
+        // The chunk files of b are cloned into the new block, see
+        // tsdbutil::clone_file(), and only the chunks overlapping a tombstone
+        // are rewritten into new chunk files after them. The index is written
+        // again with the refs of the untouched chunks kept as is, so the cost
+        // follows the deleted data rather than the size of b. Falls back to
+        // write() when most series of b have tombstones.
+        //
+        // The replaced chunks are left in the cloned files until the new block
+        // is compacted and counted in its num_dead_bytes. Falls back to write()
+        // as well once they outweigh the live chunks of b, so repeated deletes
+        // do not grow the chunk files without bound.
+        std::pair<ulid::ULID, error::Error> rewrite(const std::string & dest, const std::shared_ptr<block::BlockInterface> & b, const std::shared_ptr<block::BlockMeta> & parent);
+
         // Compact creates a new block in the compactor's directory from the blocks in the
         // provided directories.
         std::pair<ulid::ULID, error::Error> compact(const std::string & dest, const std::deque<std::string> & dirs, const std::shared_ptr<block::Blocks> & open);
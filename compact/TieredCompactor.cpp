@@ -0,0 +1,65 @@
+#include <algorithm>
+
+#include "compact/TieredCompactor.hpp"
+
+namespace tsdb {
+namespace compact {
+
+TieredCompactor::TieredCompactor(
+    const std::vector<int64_t>& ranges,
+    const std::shared_ptr<base::Channel<char>>& cancel, int min_blocks,
+    double size_ratio, int concurrency,
+    const std::shared_ptr<base::RateLimiter>& limiter, int nice)
+    : LeveledCompactor(ranges, cancel, concurrency, limiter, nice),
+      min_blocks(std::max(min_blocks, 2)), size_ratio(std::max(size_ratio, 1.0))
+{}
+
+double TieredCompactor::block_size(const block::BlockMeta& meta)
+{
+    if (meta.stats.num_bytes > 0)
+        return static_cast<double>(meta.stats.num_bytes);
+    return static_cast<double>(meta.max_time - meta.min_time);
+}
+
+std::shared_ptr<block::DirMetas>
+TieredCompactor::select_dirs(const std::shared_ptr<block::DirMetas>& dms)
+{
+    if (ranges.size() < 2 || dms->empty())
+        return std::shared_ptr<block::DirMetas>();
+
+    std::deque<std::shared_ptr<block::DirMetas>> parts =
+        split_by_range(dms, ranges.back());
+    for (auto const& part : parts) {
+        // Grow a run of adjacent blocks while all of them stay within
+        // size_ratio of the smallest one, restarting at the block that breaks
+        // it.
+        int begin = 0;
+        double lo = 0, hi = 0;
+        for (int i = 0; i < part->size(); i++) {
+            const block::BlockMeta& meta = *part->at(i).meta;
+            if (meta.compaction.failed) {
+                begin = i + 1;
+                continue;
+            }
+            double size = block_size(meta);
+            if (i == begin ||
+                std::max(hi, size) > size_ratio * std::min(lo, size)) {
+                begin = i;
+                lo = hi = size;
+            } else {
+                lo = std::min(lo, size);
+                hi = std::max(hi, size);
+            }
+            if (i - begin + 1 == min_blocks) {
+                std::shared_ptr<block::DirMetas> r(new block::DirMetas());
+                for (int j = begin; j <= i; j++)
+                    r->push_back(part->at(j));
+                return r;
+            }
+        }
+    }
+    return std::shared_ptr<block::DirMetas>();
+}
+
+} // namespace compact
+} // namespace tsdb
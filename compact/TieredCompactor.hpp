@@ -0,0 +1,36 @@
+#ifndef TIEREDCOMPACTOR_H
+#define TIEREDCOMPACTOR_H
+
+#include "compact/LeveledCompactor.hpp"
+
+namespace tsdb{
+namespace compact{
+
+// TieredCompactor plans size-tiered compactions: adjacent blocks are only
+// merged once min_blocks of them have similar sizes, so a sample is rewritten
+// about log(min_blocks) of (window / ranges[0]) times instead of once per
+// range of LeveledCompactor. Blocks never span an aligned window of the
+// largest range, which keeps retention deleting whole blocks.
+//
+// A window can end up with up to min_blocks - 1 blocks per tier, so
+// queries over old data open more blocks than with leveled compaction.
+class TieredCompactor: public LeveledCompactor{
+    private:
+        int min_blocks;
+        // Blocks of a tier are within this ratio of the smallest one.
+        double size_ratio;
+
+        // Size of a block used to find its tier, the span for empty stats.
+        static double block_size(const block::BlockMeta & meta);
+
+    public:
+        TieredCompactor(const std::vector<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel, int min_blocks=4, double size_ratio=2, int concurrency=1, const std::shared_ptr<base::RateLimiter> & limiter=nullptr, int nice=0);
+
+        // Return the oldest run of at least min_blocks adjacent blocks of
+        // similar sizes inside a window of the largest range.
+        std::shared_ptr<block::DirMetas> select_dirs(const std::shared_ptr<block::DirMetas> & dms);
+};
+
+}}
+
+#endif
@@ -7,6 +7,7 @@
 #include "base/WaitGroup.hpp"
 #include "block/Block.hpp"
 #include "compact/LeveledCompactor.hpp"
+#include "compact/TieredCompactor.hpp"
 #include "db/DB.hpp"
 #include "db/DBAppender.hpp"
 #include "db/DBUtils.hpp"
@@ -20,10 +21,11 @@ namespace tsdb {
 namespace db {
 
 DB::DB(const std::string& dir_, const Options& options)
-    : dir_(dir_), opts(options), compactc(new base::Channel<char>()),
-      donec(new base::Channel<char>()), stopc(new base::Channel<char>()),
+    : dir_(dir_), opts(options), stopc(new base::Channel<char>()),
       compact_cancel(new base::Channel<char>()), auto_compact(true),
-      pool_(new base::ThreadPool("DB ThreadPool"))
+      pool_(new base::ThreadPool("DB ThreadPool")),
+      compact_pool_(new base::ThreadPool("DB CompactPool")),
+      last_adapt_us_(0), commit_latency_us_(0)
 {
     boost::filesystem::create_directories(dir_);
 
@@ -35,15 +37,54 @@ DB::DB(const std::string& dir_, const Options& options)
         }
     }
 
-    compactor = std::unique_ptr<compact::CompactorInterface>(
-        new compact::LeveledCompactor(opts.block_ranges, compact_cancel));
+    if (opts.compaction_bytes_per_sec > 0)
+        compaction_limiter_ = std::shared_ptr<base::RateLimiter>(
+            new base::RateLimiter(opts.compaction_bytes_per_sec));
+    compact::LeveledCompactor* leveled;
+    if (opts.compaction_strategy == COMPACTION_TIERED)
+        leveled = new compact::TieredCompactor(
+            opts.block_ranges, compact_cancel, opts.compaction_tier_blocks,
+            opts.compaction_tier_size_ratio, opts.compaction_concurrency,
+            compaction_limiter_, opts.compaction_nice);
+    else
+        leveled = new compact::LeveledCompactor(
+            opts.block_ranges, compact_cancel, opts.compaction_concurrency,
+            compaction_limiter_, opts.compaction_nice);
+    leveled->set_chunk_targets(opts.compaction_chunk_samples,
+                               opts.compaction_chunk_bytes);
+    compactor = std::unique_ptr<compact::CompactorInterface>(leveled);
     if (compactor->error()) {
         err_.set(error::wrap(compactor->error(), "create LeveledCompactor"));
         return;
     }
 
-    // TODO(Alec), thread number optimization.
-    pool_->start(8);
+    // One worker per CPU.
+    pool_->start();
+
+    // The scheduler loop, kept off pool_ so that compactions never wait
+    // behind or hold up WAL and deletion tasks. One thread is enough since
+    // the scheduler runs its jobs one at a time on it, the partitions of a
+    // compaction run on the pool of the compactor.
+    if (opts.compaction_nice != 0)
+        compact_pool_->setThreadInitCallback(
+            boost::bind(&base::set_current_thread_nice, opts.compaction_nice));
+    compact_pool_->start(1);
+
+    if (opts.query_concurrency > 0) {
+        query_pool_ = std::shared_ptr<base::ThreadPool>(
+            new base::ThreadPool("DB QueryPool"));
+        query_pool_->start(opts.query_concurrency);
+    }
+
+    if (opts.chunk_cache_bytes > 0)
+        chunk_cache_ = std::shared_ptr<chunk::ChunkCache>(new chunk::ChunkCache(
+            opts.chunk_cache_bytes, opts.chunk_cache_shards));
+    if (opts.block_cache_bytes > 0)
+        block_cache_ = std::shared_ptr<tsdbutil::BufferCache>(
+            new tsdbutil::BufferCache(opts.block_cache_bytes));
+    if (opts.result_cache_bytes > 0)
+        result_cache_ = std::shared_ptr<querier::ResultCache>(
+            new querier::ResultCache(opts.result_cache_bytes));
 
     std::unique_ptr<wal::WAL> wal;
     // Wal is enabled.
@@ -59,10 +100,13 @@ DB::DB(const std::string& dir_, const Options& options)
             err_.set(error::wrap(wal->error(), "create WAL"));
             return;
         }
+        wal->set_compression(opts.wal_compression == WAL_COMPRESSION_ZLIB);
+        wal->set_sync(opts.wal_sync);
     }
 
     head_ = std::shared_ptr<head::Head>(
-        new head::Head(opts.block_ranges[0], std::move(wal), pool_));
+        new head::Head(opts.block_ranges[0], std::move(wal), pool_,
+                       opts.wal_compression != WAL_COMPRESSION_NONE));
     if (head_->error()) {
         err_.set(error::wrap(head_->error(), "create Head"));
         return;
@@ -81,8 +125,35 @@ DB::DB(const std::string& dir_, const Options& options)
     err = head_->init(min_valid_time);
     if (err) err_.set(error::wrap(err, "error head::init"));
 
-    pool_->run(boost::bind(&DB::run, this));
-    // run();
+    scheduler_.set_job(JOB_PERSIST_HEAD,
+                       boost::bind(&DB::run_job, this, JOB_PERSIST_HEAD), 60);
+    scheduler_.set_job(JOB_COMPACT_BLOCKS,
+                       boost::bind(&DB::run_job, this, JOB_COMPACT_BLOCKS), 60);
+    scheduler_.set_job(JOB_CLEAN_TOMBSTONES,
+                       boost::bind(&DB::run_job, this, JOB_CLEAN_TOMBSTONES));
+    if (opts.retention_duration > 0 || opts.max_bytes > 0)
+        scheduler_.set_job(JOB_RETENTION,
+                           boost::bind(&DB::run_job, this, JOB_RETENTION), 60);
+    // Persist what the WAL replayed into the head without waiting an interval.
+    scheduler_.submit(JOB_PERSIST_HEAD);
+    scheduler_.start(compact_pool_.get());
+}
+
+void DB::observe_commit_latency(int64_t usec)
+{
+    int64_t now = base::TimeStamp::now().microSecondsSinceEpoch();
+    bool congested;
+    {
+        base::MutexLockGuard lock(commit_latency_mutex_);
+        commit_latency_us_ = commit_latency_us_ == 0
+                                 ? usec
+                                 : (commit_latency_us_ * 7 + usec) / 8;
+        if (now - last_adapt_us_ < COMPACTION_ADAPT_INTERVAL_US) return;
+        last_adapt_us_ = now;
+        congested =
+            commit_latency_us_ > opts.compaction_target_commit_latency_us;
+    }
+    compaction_limiter_->adapt(congested);
 }
 
 std::unique_ptr<db::AppenderInterface> DB::appender()
@@ -93,6 +164,18 @@ std::unique_ptr<db::AppenderInterface> DB::appender()
 
 std::pair<std::unique_ptr<querier::QuerierInterface>, error::Error>
 DB::querier(int64_t mint, int64_t maxt)
+{
+    if (!result_cache_) return uncached_querier(mint, maxt);
+    return {std::unique_ptr<querier::QuerierInterface>(
+                new querier::CachedQuerier(
+                    result_cache_, mint, maxt,
+                    std::bind(&DB::uncached_querier, this,
+                              std::placeholders::_1, std::placeholders::_2))),
+            error::Error()};
+}
+
+std::pair<std::unique_ptr<querier::QuerierInterface>, error::Error>
+DB::uncached_querier(int64_t mint, int64_t maxt)
 {
     std::vector<std::shared_ptr<block::BlockInterface>>
         bs; // block::BlockInterface for constructing querier::BlockQuerier.
@@ -105,14 +188,17 @@ DB::querier(int64_t mint, int64_t maxt)
             bms.push_back(b->meta());
         }
     }
+    // Chunks of the head are still being appended, never cache them.
+    int num_persistent = bs.size();
     if (maxt >= head_->MinTime())
         bs.push_back(std::shared_ptr<block::BlockInterface>(
             new head::RangeHead(head_, mint, maxt)));
 
     std::vector<std::shared_ptr<querier::QuerierInterface>> queriers;
-    for (auto const& b : bs) {
-        std::shared_ptr<querier::QuerierInterface> q(
-            new querier::BlockQuerier(b, mint, maxt));
+    for (int i = 0; i < static_cast<int>(bs.size()); i++) {
+        const std::shared_ptr<block::BlockInterface>& b = bs[i];
+        std::shared_ptr<querier::QuerierInterface> q(new querier::BlockQuerier(
+            b, mint, maxt, i < num_persistent ? chunk_cache_ : nullptr));
         if (!q->error()) {
             queriers.push_back(q);
             continue;
@@ -125,14 +211,16 @@ DB::querier(int64_t mint, int64_t maxt)
                 error::wrap(q->error(), "open querier for block " + b->dir())};
     }
 
-    if (!overlapping_blocks(bms).empty()) {
-        // TODO(Alec), add vertical querier.
-        return {nullptr,
-                error::Error("cannot get querier on overlapping blocks")};
-    }
+    // Overlapping blocks are merged sample by sample.
+    bool vertical = !overlapping_blocks(bms).empty();
 
+    if (query_pool_)
+        return {std::unique_ptr<querier::QuerierInterface>(
+                    new querier::Querier(queriers, query_pool_,
+                                         opts.query_prefetch_series, vertical)),
+                error::Error()};
     return {std::unique_ptr<querier::QuerierInterface>(
-                new querier::Querier(queriers)),
+                new querier::Querier(queriers, vertical)),
             error::Error()};
 }
 
@@ -171,7 +259,8 @@ DB::open_blocks(std::deque<std::shared_ptr<block::BlockInterface>>& blocks)
         std::shared_ptr<block::BlockInterface> b =
             get_block(meta_pair.first.ulid_);
         if (b == nullptr) {
-            b = std::shared_ptr<block::BlockInterface>(new block::Block(dir));
+            b = std::shared_ptr<block::BlockInterface>(new block::Block(
+                dir, static_cast<uint8_t>(block::OriginalBlock), block_cache_));
             if (b->error()) {
                 corrupted[meta_pair.first.ulid_] = b->error();
                 continue;
@@ -272,7 +361,13 @@ void DB::delete_blocks(
         if (p.second) {
             // This is a blocking function.
             p.second->close();
+            // Results over the block, e.g. dropped by retention or replaced by
+            // a compaction without its deleted samples, are recomputed.
+            if (result_cache_)
+                result_cache_->truncate(p.second->meta().min_time,
+                                        p.second->meta().max_time - 1);
         }
+        if (chunk_cache_) chunk_cache_->invalidate(p.first);
         boost::filesystem::remove_all(
             tsdbutil::filepath_join(dir_, ulid::Marshal(p.first)));
     }
@@ -394,10 +489,16 @@ error::Error DB::reload()
 // only deleted on reload based on the new block's parent information. See
 // DB.reload documentation for further information.
 error::Error DB::compact()
+{
+    // Pending head blocks have the highest priority.
+    error::Error err = persist_head();
+    if (err) return err;
+    return compact_blocks();
+}
+
+error::Error DB::persist_head()
 {
     base::MutexLockGuard lock(cmutex_);
-    // Check whether we have pending head blocks that are ready to be persisted.
-    // They have the highest priority.
     while (true) {
         // Return when receiving stop signal.
         if (!stopc->empty()) return error::Error();
@@ -450,8 +551,12 @@ error::Error DB::compact()
                 return error::wrap(err, "head truncate failed (in compact)");
         }
     }
+    return error::Error();
+}
 
-    // Check for compactions of multiple blocks.
+error::Error DB::compact_blocks()
+{
+    base::MutexLockGuard lock(cmutex_);
     while (true) {
         std::pair<std::deque<std::string>, error::Error> plan =
             compactor->plan(dir_);
@@ -489,59 +594,29 @@ error::Error DB::compact()
     return error::Error();
 }
 
-void backoff_timing(std::shared_ptr<base::Channel<char>> chan, int sleep_secs)
-{
-    chan->wait_for_seconds(sleep_secs);
-    chan->send(0);
-}
-
-void DB::run()
+error::Error DB::run_job(int type)
 {
-    int backoff = 0;
-    std::shared_ptr<base::Channel<char>> backoff_chan(
-        new base::Channel<char>());
-    while (true) {
-        int select = -1;
-        pool_->run(boost::bind(&backoff_timing, backoff_chan, backoff));
-        while ((select = base::channel_select<char>({stopc, backoff_chan})) ==
-               -1) {
-        }
-        if (select == 0) {
-            backoff_chan->notify();
-            break;
-        } else
-            backoff_chan->flush();
-
-        select = -1;
-        pool_->run(boost::bind(&backoff_timing, compactc, 60));
-        while ((select = base::channel_select<char>({stopc, compactc})) == -1) {
-        }
-        if (select == 0) {
-            compactc->notify();
-            break;
-        } else {
-            base::MutexLockGuard lock(auto_compact_mutex_);
-
-            // NOTE(Alec), the main thread can already created a compact signal
-            // before backoff_timing() ends, so need to call notify() here to
-            // wake up asleep backoff_timing thread.
-            compactc->notify();
-            if (auto_compact) {
-                error::Error err = compact();
-                if (err) {
-                    LOG_ERROR << "msg=\"compaction failed\" err="
-                              << err.error();
-                    backoff = exponential(
-                        backoff, 1, 60); // backoff time between 1s and 1m.
-                    if (!compact_cancel->empty()) break;
-                } else
-                    backoff = 0;
-            }
-            compactc->flush();
-        }
+    base::MutexLockGuard lock(auto_compact_mutex_);
+    if (!auto_compact) return error::Error();
+    switch (type) {
+    case JOB_PERSIST_HEAD: {
+        error::Error err = persist_head();
+        // New blocks may be compactable.
+        if (!err) scheduler_.submit(JOB_COMPACT_BLOCKS);
+        return err;
+    }
+    case JOB_COMPACT_BLOCKS:
+        return compact_blocks();
+    case JOB_CLEAN_TOMBSTONES:
+        return clean_tombstones();
+    case JOB_RETENTION: {
+        // Blocks out of the retention window are deleted by reload().
+        base::MutexLockGuard lock1(cmutex_);
+        return reload();
+    }
+    default:
+        return error::Error("unknown job " + job_name(type));
     }
-    donec->send(0);
-    // LOG_DEBUG << "DB::run quit";
 }
 
 void DB::close()
@@ -549,8 +624,24 @@ void DB::close()
     stopc->send(0);
     compact_cancel->send(0);
 
-    // Wait until DB::run() exits.
-    while (donec->empty()) {
+    // Wait until the running job returns.
+    scheduler_.stop();
+
+    if (chunk_cache_) {
+        chunk::ChunkCacheStats st = chunk_cache_->stats();
+        LOG_INFO << "msg=\"chunk cache\" hits=" << st.hits
+                 << " misses=" << st.misses << " evictions=" << st.evictions
+                 << " invalidations=" << st.invalidations
+                 << " bytes=" << st.bytes << " entries=" << st.entries;
+    }
+    if (block_cache_) {
+        tsdbutil::BufferCacheStats st = block_cache_->stats();
+        for (int i = 0; i < tsdbutil::NUM_BUFFER_PRIORITIES; i++)
+            LOG_INFO << "msg=\"block cache\" priority=" << i
+                     << " hits=" << st.hits[i] << " misses=" << st.misses[i]
+                     << " evictions=" << st.evictions[i]
+                     << " bytes=" << st.bytes[i];
+        LOG_INFO << "msg=\"block cache\" read_bytes=" << st.read_bytes;
     }
 
     base::RWLockGuard lock(mutex_, 1);
@@ -585,10 +676,12 @@ DB::del(int64_t mint, int64_t maxt,
     error::MultiError multi_err;
 
     // On disk blocks.
+    bool on_disk = false;
     for (auto& b : blocks_) {
         // LOG_DEBUG << ulid::Marshal(b->meta().ulid_) << " mint:" <<
         // b->meta().min_time << " maxt:" << b->meta().max_time;
         if (b->overlap_closed(mint, maxt)) {
+            on_disk = true;
             wg.add(1);
             pool_->run(boost::bind(&del_helper, b, mint, maxt, &matchers, &wg,
                                    &multi_err));
@@ -604,6 +697,12 @@ DB::del(int64_t mint, int64_t maxt,
                                &multi_err));
     }
     wg.wait();
+    // Deleted samples may be cached, recompute the range from now on.
+    if (result_cache_) result_cache_->truncate(mint, maxt);
+    // The head drops deleted samples when it is truncated, blocks have to be
+    // rewritten. The delay lets a burst of deletes share one rewrite.
+    if (on_disk)
+        scheduler_.submit(JOB_CLEAN_TOMBSTONES, CLEAN_TOMBSTONES_DELAY_SECONDS);
     return error::Error(multi_err.error());
 }
 
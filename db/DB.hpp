@@ -8,14 +8,19 @@
 #include "base/FLock.hpp"
 #include "base/Logging.hpp"
 #include "base/Mutex.hpp"
+#include "base/RateLimiter.hpp"
 #include "base/ThreadPool.hpp"
 #include "block/BlockInterface.hpp"
+#include "chunk/ChunkCache.hpp"
 #include "compact/CompactorInterface.hpp"
 #include "db/AppenderInterface.hpp"
 #include "db/DBUtils.hpp"
+#include "db/Scheduler.hpp"
 #include "external/ulid.hpp"
 #include "head/Head.hpp"
 #include "querier/QuerierInterface.hpp"
+#include "querier/ResultCache.hpp"
+#include "tsdbutil/BufferCache.hpp"
 
 namespace tsdb {
 namespace db {
@@ -34,8 +39,6 @@ private:
 
     std::shared_ptr<head::Head> head_;
 
-    std::shared_ptr<base::Channel<char>> compactc;
-    std::shared_ptr<base::Channel<char>> donec;
     std::shared_ptr<base::Channel<char>> stopc;
     std::shared_ptr<base::Channel<char>> compact_cancel;
 
@@ -48,8 +51,29 @@ private:
     bool auto_compact;
 
     std::shared_ptr<base::ThreadPool> pool_;
+    // Runs the loop of scheduler_, so compactions run on its thread.
+    std::shared_ptr<base::ThreadPool> compact_pool_;
+    Scheduler scheduler_;
+    // Only created when opts.query_concurrency > 0.
+    std::shared_ptr<base::ThreadPool> query_pool_;
+    // Only created when opts.chunk_cache_bytes > 0.
+    std::shared_ptr<chunk::ChunkCache> chunk_cache_;
+    // Only created when opts.result_cache_bytes > 0.
+    std::shared_ptr<querier::ResultCache> result_cache_;
+    // Only created when opts.block_cache_bytes > 0.
+    std::shared_ptr<tsdbutil::BufferCache> block_cache_;
+    // Only created when opts.compaction_bytes_per_sec > 0.
+    std::shared_ptr<base::RateLimiter> compaction_limiter_;
+
+    // Moving average of the commit latencies reported by the appenders.
+    base::MutexLock commit_latency_mutex_;
+    int64_t last_adapt_us_;
+    int64_t commit_latency_us_;
     error::Error err_;
 
+    // Run a job of scheduler_, see JobType.
+    error::Error run_job(int type);
+
 public:
     DB(const std::string& dir_, const Options& options = DefaultOptions);
 
@@ -57,6 +81,37 @@ public:
 
     std::shared_ptr<head::Head> head() { return head_; }
 
+    // Return nullptr when the chunk cache is disabled.
+    std::shared_ptr<chunk::ChunkCache> chunk_cache() { return chunk_cache_; }
+
+    // Return nullptr when blocks are mmapped.
+    std::shared_ptr<tsdbutil::BufferCache> block_cache()
+    {
+        return block_cache_;
+    }
+
+    // Return nullptr when the result cache is disabled.
+    std::shared_ptr<querier::ResultCache> result_cache()
+    {
+        return result_cache_;
+    }
+
+    // Return nullptr when compactions are not throttled.
+    std::shared_ptr<base::RateLimiter> compaction_limiter()
+    {
+        return compaction_limiter_;
+    }
+
+    // Report the latency of a commit, the compaction rate backs off while
+    // commits are slower than opts.compaction_target_commit_latency_us.
+    void observe_commit_latency(int64_t usec);
+
+    bool observes_commit_latency() const
+    {
+        return compaction_limiter_ &&
+               opts.compaction_target_commit_latency_us > 0;
+    }
+
     error::Error error() { return err_; }
 
     std::deque<std::shared_ptr<block::BlockInterface>> blocks();
@@ -104,7 +159,12 @@ public:
     // information. See DB.reload documentation for further information.
     error::Error compact();
 
-    void run();
+    // Persist the head ranges that are ready, the first half of compact().
+    error::Error persist_head();
+
+    // Compact the blocks planned by the compactor, the second half of
+    // compact().
+    error::Error compact_blocks();
 
     void close();
 
@@ -121,13 +181,21 @@ public:
         LOG_INFO << "msg=\"auto compaction enabled\"";
     }
 
-    std::shared_ptr<base::Channel<char>> compact_channel() { return compactc; }
+    // Submit JOB_PERSIST_HEAD to trigger a compaction.
+    Scheduler* scheduler() { return &scheduler_; }
 
     std::unique_ptr<db::AppenderInterface> appender();
 
+    // Served through the result cache when it is enabled.
     std::pair<std::unique_ptr<querier::QuerierInterface>, error::Error>
     querier(int64_t mint, int64_t maxt);
 
+    // Querier over the blocks and the head, bypassing the result cache.
+    std::pair<std::unique_ptr<querier::QuerierInterface>, error::Error>
+    uncached_querier(int64_t mint, int64_t maxt);
+
+    // del adds tombstones to the blocks and the head, the blocks are
+    // rewritten by JOB_CLEAN_TOMBSTONES CLEAN_TOMBSTONES_DELAY_SECONDS later.
     error::Error
     del(int64_t mint, int64_t maxt,
         const std::deque<std::shared_ptr<label::MatcherInterface>>& matchers);
@@ -1,6 +1,10 @@
 #ifndef DBAPPENDER_H
 #define DBAPPENDER_H
 
+#include <limits>
+#include <vector>
+
+#include "base/TimeStamp.hpp"
 #include "db/AppenderInterface.hpp"
 #include "db/DB.hpp"
 
@@ -14,24 +18,52 @@ private:
     std::unique_ptr<db::AppenderInterface> app;
     db::DB* db;
 
+    // Lowest timestamp added since the last commit or rollback, and all
+    // added samples when the DB has a result cache.
+    int64_t min_time;
+    std::vector<std::pair<tagtree::TSID, int64_t>> samples;
+    bool cached;
+
+    // Report commit latencies for the compaction back-pressure.
+    bool observe;
+
 public:
     DBAppender(std::unique_ptr<db::AppenderInterface>&& app, db::DB* db)
-        : app(std::move(app)), db(db)
+        : app(std::move(app)), db(db),
+          min_time(std::numeric_limits<int64_t>::max()),
+          cached(db->result_cache() != nullptr),
+          observe(db->observes_commit_latency())
     {}
 
     error::Error add(tagtree::TSID tsid, int64_t t, double v)
     {
+        if (t < min_time) min_time = t;
+        if (cached) samples.emplace_back(tsid, t);
         return app->add(tsid, t, v);
     }
 
     error::Error commit()
     {
+        base::TimeStamp start;
+        if (observe) start = base::TimeStamp::now();
         error::Error err = app->commit();
+        if (observe)
+            db->observe_commit_latency(
+                base::TimeStamp::now().microSecondsSinceEpoch() -
+                start.microSecondsSinceEpoch());
+        // Samples inside the range of cached results make the results of
+        // their series stale. They are visible to queriers now, so the
+        // truncated range gets recomputed.
+        std::shared_ptr<querier::ResultCache> cache = db->result_cache();
+        if (cache && min_time <= cache->max_end()) cache->truncate(samples);
+        min_time = std::numeric_limits<int64_t>::max();
+        samples.clear();
+
         // We could just run this check every few minutes practically. But for
         // benchmarks and high frequency use cases this is the safer way.
         if (db->head()->MaxTime() - db->head()->MinTime() >
             db->head()->chunk_range / 2 * 3) {
-            db->compact_channel()->send(0);
+            db->scheduler()->submit(JOB_PERSIST_HEAD);
             // LOG_DEBUG << db->head()->MinTime() << " " <<
             // db->head()->MaxTime() << " " << (db->head()->MaxTime() -
             // db->head()->MinTime() > db->head()->chunk_range / 2 * 3);
@@ -40,7 +72,12 @@ public:
         return err;
     }
 
-    error::Error rollback() { return app->rollback(); }
+    error::Error rollback()
+    {
+        min_time = std::numeric_limits<int64_t>::max();
+        samples.clear();
+        return app->rollback();
+    }
 
     ~DBAppender()
     {
@@ -22,6 +22,21 @@ int64_t range_for_timestamp(int64_t t, int64_t width);
 
 std::vector<int64_t> exponential_block_ranges(int64_t min_size, int step, int step_size);
 
+// Planning of the compactions of persisted blocks.
+enum CompactionStrategy{
+    COMPACTION_LEVELED = 0, // compact::LeveledCompactor.
+    COMPACTION_TIERED = 1   // compact::TieredCompactor.
+};
+
+// Encoding of the samples logged to the WAL. The WAL is read back whatever
+// the encoding it was written with.
+enum WALCompression{
+    WAL_COMPRESSION_NONE = 0,    // tsdbutil::RECORD_SAMPLES.
+    WAL_COMPRESSION_SAMPLES = 1, // tsdbutil::RECORD_COMPRESSED_SAMPLES.
+    WAL_COMPRESSION_ZLIB = 2     // Compressed samples, and all the records
+                                 // deflated by wal::WAL::set_compression().
+};
+
 class Options{
     public:
         // Segments (wal files) max size.
@@ -30,6 +45,12 @@ class Options{
         // wal_segment_size < 0, wal is disabled.
         int wal_segment_size;
 
+        // See WALCompression.
+        int wal_compression;
+
+        // Wait for each appender commit to reach the disk.
+        bool wal_sync;
+
         // Duration of persisted data to keep.
         uint64_t retention_duration;
 
@@ -50,18 +71,95 @@ class Options{
         // This in-turn enables vertical compaction and vertical query merge.
         bool allow_overlapping_blocks;
 
-        Options(): wal_segment_size(0), retention_duration(0), max_bytes(0), no_lock_file(false), allow_overlapping_blocks(false){}
+        // Number of threads used to resolve and decode blocks of a query in
+        // parallel. 0 evaluates queries lazily on the calling thread.
+        int query_concurrency;
+
+        // Decoded series buffered ahead of the consumer for each block when
+        // query_concurrency > 0.
+        int query_prefetch_series;
+
+        // Capacity in bytes of the decoded chunk cache shared by the queriers
+        // of persistent blocks. 0 disables the cache.
+        uint64_t chunk_cache_bytes;
+
+        // Number of independently locked shards of the chunk cache.
+        int chunk_cache_shards;
+
+        // Memory budget in bytes of the range query result cache, see
+        // querier::ResultCache. 0 disables the cache.
+        uint64_t result_cache_bytes;
+
+        // When > 0, the chunks and indexes of the blocks are read with
+        // O_DIRECT into a buffer cache of this many bytes instead of being
+        // mmapped, see tsdbutil::DirectSlice.
+        uint64_t block_cache_bytes;
+
+        // Number of threads populating disjoint TSID ranges of a compacted
+        // block in parallel. <= 1 compacts on the calling thread.
+        int compaction_concurrency;
+
+        // Bytes per second of chunks read and of chunks and index written by
+        // compactions. 0 does not throttle compactions.
+        uint64_t compaction_bytes_per_sec;
+
+        // When > 0 and compactions are throttled, their rate is lowered while
+        // the average commit latency of the appenders exceeds this many
+        // microseconds, and raised back to compaction_bytes_per_sec otherwise.
+        int64_t compaction_target_commit_latency_us;
+
+        // Nice value of the compaction threads, 0 keeps the default.
+        int compaction_nice;
+
+        // Compactions merge consecutive chunks of a series into chunks of up
+        // to compaction_chunk_samples[l - 1] samples and, if > 0,
+        // compaction_chunk_bytes[l - 1] bytes for an output block of
+        // compaction level l. The last element applies to the higher levels,
+        // empty or 0 keeps the chunks cut by the head.
+        std::vector<int> compaction_chunk_samples;
+        std::vector<int> compaction_chunk_bytes;
+
+        // See CompactionStrategy.
+        int compaction_strategy;
+
+        // With COMPACTION_TIERED, adjacent blocks are merged once this many
+        // of them are within compaction_tier_size_ratio of the smallest one.
+        int compaction_tier_blocks;
+        double compaction_tier_size_ratio;
+
+        Options(): wal_segment_size(0), wal_compression(WAL_COMPRESSION_NONE), wal_sync(false), retention_duration(0), max_bytes(0), no_lock_file(false), allow_overlapping_blocks(false), query_concurrency(0), query_prefetch_series(64), chunk_cache_bytes(0), chunk_cache_shards(16), result_cache_bytes(0), block_cache_bytes(0), compaction_concurrency(1), compaction_bytes_per_sec(0), compaction_target_commit_latency_us(0), compaction_nice(0), compaction_strategy(COMPACTION_LEVELED), compaction_tier_blocks(4), compaction_tier_size_ratio(2){}
         Options(int wal_segment_size, uint64_t retention_duration, int64_t max_bytes, const std::vector<int64_t> & block_ranges, bool no_lock_file, bool allow_overlapping_blocks):
             wal_segment_size(wal_segment_size),
+            wal_compression(WAL_COMPRESSION_NONE),
+            wal_sync(false),
             retention_duration(retention_duration),
             max_bytes(max_bytes),
             block_ranges(block_ranges),
             no_lock_file(no_lock_file),
-            allow_overlapping_blocks(allow_overlapping_blocks){}
+            allow_overlapping_blocks(allow_overlapping_blocks),
+            query_concurrency(0),
+            query_prefetch_series(64),
+            chunk_cache_bytes(0),
+            chunk_cache_shards(16),
+            result_cache_bytes(0),
+            block_cache_bytes(0),
+            compaction_concurrency(1),
+            compaction_bytes_per_sec(0),
+            compaction_target_commit_latency_us(0),
+            compaction_nice(0),
+            compaction_strategy(COMPACTION_LEVELED),
+            compaction_tier_blocks(4),
+            compaction_tier_size_ratio(2){}
 };
 
 extern const Options DefaultOptions;
 
+// Minimum interval between two adjustments of the compaction rate.
+const int64_t COMPACTION_ADAPT_INTERVAL_US = 100 * 1000;
+
+// Delay of the block rewrite after a delete, see DB::del().
+const double CLEAN_TOMBSTONES_DELAY_SECONDS = 60;
+
 class TimeRange{
     public:
         int64_t min_time;
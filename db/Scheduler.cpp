@@ -0,0 +1,156 @@
+#include <boost/bind.hpp>
+#include <limits>
+
+#include "base/Logging.hpp"
+#include "base/TimeStamp.hpp"
+#include "db/DBUtils.hpp"
+#include "db/Scheduler.hpp"
+
+namespace tsdb {
+namespace db {
+
+std::string job_name(int type)
+{
+    switch (type) {
+    case JOB_PERSIST_HEAD:
+        return "persist_head";
+    case JOB_COMPACT_BLOCKS:
+        return "compact_blocks";
+    case JOB_CLEAN_TOMBSTONES:
+        return "clean_tombstones";
+    case JOB_RETENTION:
+        return "retention";
+    default:
+        return "unknown";
+    }
+}
+
+Scheduler::Scheduler()
+    : stopped_cond_(mutex_), wakeup(new base::Channel<char>()), started(false),
+      stopping(false), stopped(false)
+{
+    for (int i = 0; i < NUM_JOB_TYPES; i++) {
+        intervals[i] = 0;
+        backoffs[i] = 0;
+        status_[i].type = i;
+    }
+}
+
+void Scheduler::set_job(int type, const Job& job, double interval_seconds)
+{
+    base::MutexLockGuard lock(mutex_);
+    jobs[type] = job;
+    intervals[type] = interval_seconds;
+    if (interval_seconds > 0) queue(type, interval_seconds);
+}
+
+void Scheduler::start(base::ThreadPool* pool)
+{
+    {
+        base::MutexLockGuard lock(mutex_);
+        started = true;
+    }
+    pool->run(boost::bind(&Scheduler::run, this));
+}
+
+void Scheduler::queue(int type, double delay_seconds)
+{
+    int64_t due = base::TimeStamp::now().microSecondsSinceEpoch() +
+                  static_cast<int64_t>(delay_seconds *
+                                       base::TimeStamp::kMicroSecondsPerSecond);
+    if (!status_[type].queued || due < status_[type].due_us) {
+        status_[type].queued = true;
+        status_[type].due_us = due;
+    }
+}
+
+void Scheduler::submit(int type, double delay_seconds)
+{
+    {
+        base::MutexLockGuard lock(mutex_);
+        if (stopping || !jobs[type]) return;
+        queue(type, delay_seconds);
+    }
+    wakeup->send(0);
+}
+
+void Scheduler::run()
+{
+    char c;
+    while (true) {
+        int type = -1;
+        double wait = -1;
+        {
+            base::MutexLockGuard lock(mutex_);
+            if (stopping) break;
+            int64_t now = base::TimeStamp::now().microSecondsSinceEpoch();
+            int64_t next = std::numeric_limits<int64_t>::max();
+            for (int i = 0; i < NUM_JOB_TYPES; i++) {
+                if (!status_[i].queued) continue;
+                if (status_[i].due_us <= now) {
+                    type = i;
+                    break;
+                }
+                if (status_[i].due_us < next) next = status_[i].due_us;
+            }
+            if (type >= 0) {
+                status_[type].queued = false;
+                status_[type].running = true;
+                status_[type].started_us = now;
+            } else if (next != std::numeric_limits<int64_t>::max())
+                wait = static_cast<double>(next - now) /
+                       base::TimeStamp::kMicroSecondsPerSecond;
+        }
+        if (type < 0) {
+            wakeup->recv_wait(wait, &c);
+            continue;
+        }
+
+        error::Error err = jobs[type]();
+
+        base::MutexLockGuard lock(mutex_);
+        JobStatus& st = status_[type];
+        st.running = false;
+        ++st.runs;
+        st.last_duration_us =
+            base::TimeStamp::now().microSecondsSinceEpoch() - st.started_us;
+        if (err) {
+            ++st.failures;
+            st.last_error = err.error();
+            backoffs[type] = exponential(backoffs[type], 1, 60);
+            LOG_ERROR << "msg=\"" << job_name(type) << " failed\" err="
+                      << err.error() << " retry_secs=" << backoffs[type];
+            queue(type, backoffs[type]);
+        } else {
+            st.last_error.clear();
+            backoffs[type] = 0;
+            if (intervals[type] > 0) queue(type, intervals[type]);
+        }
+    }
+
+    base::MutexLockGuard lock(mutex_);
+    stopped = true;
+    stopped_cond_.notifyAll();
+}
+
+void Scheduler::stop()
+{
+    {
+        base::MutexLockGuard lock(mutex_);
+        stopping = true;
+    }
+    wakeup->send(0);
+
+    base::MutexLockGuard lock(mutex_);
+    while (started && !stopped)
+        stopped_cond_.wait();
+}
+
+std::vector<JobStatus> Scheduler::status()
+{
+    base::MutexLockGuard lock(mutex_);
+    return std::vector<JobStatus>(status_, status_ + NUM_JOB_TYPES);
+}
+
+} // namespace db
+} // namespace tsdb
@@ -0,0 +1,95 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <boost/function.hpp>
+#include <string>
+#include <vector>
+
+#include "base/Channel.hpp"
+#include "base/Condition.hpp"
+#include "base/Error.hpp"
+#include "base/Mutex.hpp"
+#include "base/ThreadPool.hpp"
+
+namespace tsdb {
+namespace db {
+
+// Background jobs of a DB, a smaller type runs first when several are due.
+enum JobType {
+    JOB_PERSIST_HEAD = 0,
+    JOB_COMPACT_BLOCKS = 1,
+    JOB_CLEAN_TOMBSTONES = 2,
+    JOB_RETENTION = 3,
+    NUM_JOB_TYPES = 4
+};
+
+std::string job_name(int type);
+
+struct JobStatus {
+    int type;
+    bool queued;
+    int64_t due_us; // When queued.
+    bool running;
+    int64_t started_us; // When running.
+    int64_t runs;
+    int64_t failures;
+    int64_t last_duration_us;
+    std::string last_error;
+
+    JobStatus()
+        : type(0), queued(false), due_us(0), running(false), started_us(0),
+          runs(0), failures(0), last_duration_us(0)
+    {}
+};
+
+// Scheduler runs the background jobs of a DB one at a time on a single
+// thread. Its loop sleeps on a wakeup channel until a job is submitted or the
+// next delayed job is due, so an idle DB uses no CPU.
+//
+// A job submitted while queued keeps the earlier due time. A failed job is
+// retried after a backoff between 1s and 1m, and a job with an interval is
+// queued again that long after each run.
+class Scheduler {
+public:
+    typedef boost::function<error::Error()> Job;
+
+private:
+    base::MutexLock mutex_;
+    base::Condition stopped_cond_;
+    std::shared_ptr<base::Channel<char>> wakeup;
+
+    Job jobs[NUM_JOB_TYPES];
+    double intervals[NUM_JOB_TYPES]; // Seconds, 0 runs only when submitted.
+    int backoffs[NUM_JOB_TYPES];     // Seconds.
+    JobStatus status_[NUM_JOB_TYPES];
+
+    bool started;
+    bool stopping;
+    bool stopped;
+
+    void queue(int type, double delay_seconds);
+
+    void run();
+
+public:
+    Scheduler();
+
+    // Must be called before start().
+    void set_job(int type, const Job& job, double interval_seconds = 0);
+
+    // Run the loop on a thread of pool.
+    void start(base::ThreadPool* pool);
+
+    void submit(int type, double delay_seconds = 0);
+
+    // Return after the running job finishes, the queued jobs are dropped.
+    void stop();
+
+    // The state of each job type, see JobType.
+    std::vector<JobStatus> status();
+};
+
+} // namespace db
+} // namespace tsdb
+
+#endif
@@ -8,7 +8,6 @@
 #include "head/HeadChunkReader.hpp"
 #include "head/HeadIndexReader.hpp"
 #include "head/InitAppender.hpp"
-#include "querier/ChunkSeriesIterator.hpp"
 #include "querier/QuerierUtils.hpp"
 #include "tombstone/MemTombstones.hpp"
 #include "tsdbutil/RecordDecoder.hpp"
@@ -19,8 +18,10 @@ namespace tsdb {
 namespace head {
 
 Head::Head(int64_t chunk_range, std::unique_ptr<wal::WAL>&& wal,
-           const std::shared_ptr<base::ThreadPool>& pool_)
-    : chunk_range(chunk_range), wal(std::move(wal)), pool_(pool_)
+           const std::shared_ptr<base::ThreadPool>& pool_,
+           bool compress_samples)
+    : chunk_range(chunk_range), wal(std::move(wal)),
+      compress_samples(compress_samples), pool_(pool_)
 {
     if (chunk_range < 1) {
         err_.set("invalid chunk range " + std::to_string(chunk_range));
@@ -31,6 +32,11 @@ Head::Head(int64_t chunk_range, std::unique_ptr<wal::WAL>&& wal,
     series = std::unique_ptr<StripeSeries>(new StripeSeries());
     posting_list =
         std::unique_ptr<index::MemPostings>(new index::MemPostings());
+    if (this->wal) {
+        checkpoint_pool_ = std::unique_ptr<base::ThreadPool>(
+            new base::ThreadPool("Head CheckpointPool"));
+        checkpoint_pool_->start(1);
+    }
 }
 
 // init loads data from the write ahead log and prepares the head for writes.
@@ -102,8 +108,7 @@ void Head::update_min_max_time(int64_t mint, int64_t maxt)
 // The samples before valid_time will be appended.
 // The samples will be destructed automatically after this function finishes.
 void Head::process_wal_samples(const std::vector<tsdbutil::RefSample>& samples,
-                               base::AtomicUInt64* unknown_refs,
-                               base::WaitGroup* wg)
+                               base::AtomicUInt64* unknown_refs)
 {
     // Mitigate lock contention in StripeSeries::get_by_id().
     std::unordered_map<tagtree::TSID, std::shared_ptr<MemSeries>> series_map;
@@ -129,7 +134,6 @@ void Head::process_wal_samples(const std::vector<tsdbutil::RefSample>& samples,
         if (s.t < mint) mint = s.t;
     }
     update_min_max_time(mint, maxt);
-    wg->done();
 }
 
 // NOTICE(Alec), when loading RefSeries, RecordDecoder will sort the lset of
@@ -140,12 +144,6 @@ wal::CorruptionError Head::load_wal(wal::SegmentReader* reader)
     // for error reporting.
     base::AtomicUInt64 unknown_refs;
 
-    // Count total tasks sent to pool_.
-    base::WaitGroup wg;
-
-    // Store all Stone for chunk_rewrite.
-    tombstone::MemTombstones all_stones;
-
     // Partition samples by ref % partition_num.
     int partition_num = 8;
 
@@ -157,7 +155,7 @@ wal::CorruptionError Head::load_wal(wal::SegmentReader* reader)
     shards.resize(partition_num);
 
     while (reader->next()) {
-        std::pair<uint8_t*, int> rec_pair = reader->record();
+        std::pair<const uint8_t*, int> rec_pair = reader->record();
 
         if (rec_pair.second < 1)
             return wal::CorruptionError(reader->segment(), reader->offset(),
@@ -179,7 +177,8 @@ wal::CorruptionError Head::load_wal(wal::SegmentReader* reader)
                 get_or_create(s.tsid);
             }
             // LOG_DEBUG << "RECORD_SERIES finished";
-        } else if (type == tsdbutil::RECORD_SAMPLES) {
+        } else if (type == tsdbutil::RECORD_SAMPLES ||
+                   type == tsdbutil::RECORD_COMPRESSED_SAMPLES) {
             // LOG_DEBUG << "RECORD_SAMPLES start";
             rsamples.clear();
             error::Error err = tsdbutil::RecordDecoder::samples(
@@ -195,13 +194,12 @@ wal::CorruptionError Head::load_wal(wal::SegmentReader* reader)
                 shards[std::hash<tagtree::TSID>()(s.tsid) % partition_num]
                     .push_back(s);
 
-            for (int i = 0; i < partition_num; ++i) {
-                if (!shards[i].empty()) {
-                    wg.add(1);
-                    pool_->run(boost::bind(&Head::process_wal_samples, this,
-                                           shards[i], &unknown_refs, &wg));
-                }
-            }
+            // The shards are applied in place, the reader thread takes its
+            // share.
+            pool_->parallel_for(0, partition_num, [&](int i) {
+                if (!shards[i].empty())
+                    process_wal_samples(shards[i], &unknown_refs);
+            });
             // LOG_DEBUG << "RECORD_SAMPLES finished";
         } else if (type == tsdbutil::RECORD_TOMBSTONES) {
             // LOG_DEBUG << "RECORD_TOMBSTONES start";
@@ -218,31 +216,18 @@ wal::CorruptionError Head::load_wal(wal::SegmentReader* reader)
                     // LOG_DEBUG << s.ref << " " << itvl.min_time << " " <<
                     // itvl.max_time;
                     if (itvl.max_time < valid_time.get()) continue;
-                    all_stones.add_interval(s.tsid, itvl);
+                    stones.add_interval(s.tsid, itvl);
                 }
             }
+            stones_changed();
 
         } else
             return wal::CorruptionError(
                 reader->segment(), reader->offset(),
                 error::Error("invalid record type " + std::to_string(type)));
-
-        // Wait till all task finished.
-        wg.wait();
     }
     if (reader->error()) return reader->cerror();
 
-    error::Error err = all_stones.iter(
-        static_cast<std::function<error::Error(tagtree::TSID,
-                                               const tombstone::Intervals&)>>(
-            [this](tagtree::TSID tsid, const tombstone::Intervals& itv) {
-                return this->chunk_rewrite(tsid, itv);
-            }));
-
-    if (err)
-        return wal::CorruptionError(
-            -1, 0, error::Error("deleting samples from tombstones"));
-
     if (unknown_refs.get() > 0)
         LOG_WARN << "msg=\"unknown series references count="
                  << unknown_refs.get();
@@ -293,13 +278,30 @@ Head::chunks() const
             true};
 }
 
-// tombstones returns a TombstoneReader over the block's deleted data.
+// tombstones returns a TombstoneReader over a snapshot of stones, shared by
+// all readers until the next change.
 std::pair<std::shared_ptr<tombstone::TombstoneReaderInterface>, bool>
 Head::tombstones() const
 {
-    return {std::shared_ptr<tombstone::TombstoneReaderInterface>(
-                new tombstone::MemTombstones()),
-            true};
+    // Held while copying, so a change cannot be lost between the copy and
+    // publishing it.
+    base::MutexLockGuard lock(snapshot_mutex_);
+    if (!stones_snapshot_) {
+        std::shared_ptr<tombstone::MemTombstones> r(
+            new tombstone::MemTombstones());
+        stones.iter(static_cast<tombstone::TombstoneReaderInterface::IterFunc>(
+            [&r](tagtree::TSID tsid, const tombstone::Intervals& itvls) {
+                r->interval_groups[tsid] = itvls;
+            }));
+        stones_snapshot_ = r;
+    }
+    return {stones_snapshot_, true};
+}
+
+void Head::stones_changed()
+{
+    base::MutexLockGuard lock(snapshot_mutex_);
+    stones_snapshot_.reset();
 }
 
 // init_time initializes a head with the first timestamp. This only needs to be
@@ -338,56 +340,31 @@ Head::get_or_create(tagtree::TSID tsid)
     return {s2.first, true};
 }
 
-// chunkRewrite re-writes the chunks which overlaps with deleted ranges
-// and removes the samples in the deleted ranges.
-// Chunks is deleted if no samples are left at the end.
-error::Error Head::chunk_rewrite(tagtree::TSID tsid,
-                                 const tombstone::Intervals& dranges)
+void Head::truncate_tombstones(int64_t mint)
 {
-    if (dranges.empty()) {
-        return error::Error();
-    }
-
-    std::shared_ptr<MemSeries> ms = series->get_by_id(tsid);
-    if (!ms) {
-        return error::Error();
-    }
-
-    base::MutexLockGuard lock(ms->mutex_);
-    if (ms->chunks.empty()) {
-        return error::Error();
-    }
-
-    std::vector<std::shared_ptr<MemChunk>> chks;
-    for (auto chk : ms->chunks) {
-        chks.push_back(chk);
-    }
-
-    if (chks.empty()) return error::Error();
-    querier::ChunkSeriesIterator it(chks, dranges, chks.front()->min_time,
-                                    chks.back()->max_time);
-    // if(ref == 0){
-    //     for(auto & iv: dranges)
-    //         LOG_DEBUG  << iv.min_time << ", " << iv.max_time;
-    // }
-    ms->reset();
-    while (it.next()) {
-        std::pair<int64_t, double> p = it.at();
-        std::pair<bool, bool> ap = ms->append(p.first, p.second);
-        if (!ap.first) {
-            // TODO(Alec), make it clear.
-            LOG_WARN << "msg=\"failed to add sample during delete\"";
+    {
+        base::RWLockGuard lock(stones.mutex_, true);
+        auto it = stones.interval_groups.begin();
+        while (it != stones.interval_groups.end()) {
+            tombstone::Intervals& itvls = it->second;
+            itvls.erase(std::remove_if(itvls.begin(), itvls.end(),
+                                       [mint](const tombstone::Interval& itvl) {
+                                           return itvl.max_time < mint;
+                                       }),
+                        itvls.end());
+            if (itvls.empty())
+                it = stones.interval_groups.erase(it);
+            else
+                ++it;
         }
     }
-
-    return error::Error();
+    stones_changed();
 }
 
 // del all samples in the range of [mint, maxt] for series that satisfy the
-// given label matchers.
-//
-// Head::chunk_rewrite()
-// WAL::log()
+// given label matchers. The ranges are recorded in stones and logged to the
+// WAL, the chunks are left untouched. The ranges end at the newest sample of
+// each series, so samples appended afterwards are never masked.
 error::Error Head::del(int64_t mint, int64_t maxt,
                        const std::unordered_set<tagtree::TSID>& tsids)
 {
@@ -400,15 +377,16 @@ error::Error Head::del(int64_t mint, int64_t maxt,
     std::shared_ptr<block::IndexReaderInterface> ir(
         new HeadIndexReader(this, tp.first, tp.second));
 
-    std::vector<tsdbutil::Stone> stones;
-    bool dirty = false;
+    std::vector<tsdbutil::Stone> wal_stones;
     // LOG_DEBUG << "tp1: " << tp.first << " " << tp.second;
     for (auto&& p : tsids) {
         // LOG_DEBUG << "next() " << tp.first << " " << tp.second;
         std::shared_ptr<MemSeries> s = series->get_by_id(p);
-        if (!s)
+        if (!s) {
+            stones_changed();
             return error::Error("error StripeSeries::get_by_id " +
                                 std::to_string(p));
+        }
 
         int64_t t0 = s->min_time();
         int64_t t1 = s->max_time();
@@ -419,27 +397,24 @@ error::Error Head::del(int64_t mint, int64_t maxt,
         tp = tsdbutil::clamp_interval(mint, maxt, t0, t1);
         if (tp.first > tp.second) continue;
         if (wal)
-            stones.emplace_back(p,
-                                tombstone::Intervals({{tp.first, tp.second}}));
+            wal_stones.emplace_back(
+                p, tombstone::Intervals({{tp.first, tp.second}}));
         // LOG_DEBUG << "tp: " << tp.first << " " << tp.second;
-        error::Error err = chunk_rewrite(p, {{tp.first, tp.second}});
-        if (err) return error::Error("error delete samples");
-        dirty = true;
+        stones.add_interval(p, tombstone::Interval(tp.first, tp.second));
     }
+    stones_changed();
     if (wal) {
-        // Although we don't store the stones in the head
-        // we need to write them to the WAL to mark these as deleted
-        // after a restart while loading the WAL.
+        // Log the stones to mark these as deleted after a restart while
+        // loading the WAL.
         // for(auto & s: stones){
         //     for(auto &i: s.itvls)
         //         LOG_DEBUG << s.ref << " " << i.min_time << " " << i.max_time;
         // }
         std::vector<uint8_t> rec;
-        tsdbutil::RecordEncoder::tombstones(stones, rec);
+        tsdbutil::RecordEncoder::tombstones(wal_stones, rec);
         error::Error err = wal->log(rec);
         if (err) return error::wrap(err, "error wal::log");
     }
-    if (dirty) gc();
     return error::Error();
 }
 
@@ -481,6 +456,7 @@ error::Error Head::truncate(int64_t mint)
 
     auto t0 = std::chrono::high_resolution_clock::now();
     gc();
+    truncate_tombstones(mint);
     LOG_INFO << "msg=\"head GC completed\" MinTime=" << MinTime()
              << " duration="
              << std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -489,27 +465,49 @@ error::Error Head::truncate(int64_t mint)
              << "ms";
 
     if (!wal) return error::Error();
-    t0 = std::chrono::high_resolution_clock::now();
+    if (!checkpointing_.cas(0, 1)) {
+        LOG_INFO << "msg=\"WAL checkpoint still running, skipped\"";
+        return error::Error();
+    }
+    checkpoint_pool_->run(boost::bind(&Head::checkpoint_wal, this, mint));
+    return error::Error();
+}
+
+void Head::checkpoint_wal(int64_t mint)
+{
+    auto t0 = std::chrono::high_resolution_clock::now();
     std::pair<std::pair<int, int>, error::Error> segs =
         wal->segments(wal->dir());
-    if (segs.second) return error::wrap(segs.second, "get segment range");
+    if (segs.second) {
+        LOG_ERROR << "msg=\"get segment range\" err=" << segs.second.error();
+        checkpointing_.getAndSet(0);
+        return;
+    }
     --segs.first.second; // Never consider last segment for checkpoint.
-    if (segs.first.second < 0) return error::Error();
     // The lower third of segments should contain mostly obsolete samples.
     // If we have less than three segments, it's not worth checkpointing yet.
     segs.first.second =
         segs.first.first + (segs.first.second - segs.first.first) / 3;
-    if (segs.first.second <= segs.first.first) return error::Error();
+    if (segs.first.second <= segs.first.first) {
+        checkpointing_.getAndSet(0);
+        return;
+    }
+
+    // The series still in the head, looked up without the stripe locks by the
+    // checkpoint tasks. Series created later cannot be referenced by the
+    // segments checkpointed.
+    std::vector<tagtree::TSID> live = series->ids();
     std::pair<wal::CheckpointStats, error::Error> ckp = wal::checkpoint(
         wal.get(), segs.first.first, segs.first.second,
-        [this](tagtree::TSID tsid) -> bool {
-            if (this->series->get_by_id(tsid))
-                return true;
-            else
-                return false;
+        [&live](tagtree::TSID tsid) -> bool {
+            return std::binary_search(live.begin(), live.end(), tsid);
         },
         mint);
-    if (ckp.second) return error::wrap(ckp.second, "create checkpoint");
+    if (ckp.second) {
+        LOG_ERROR << "msg=\"create checkpoint\" err=" << ckp.second.error();
+        checkpointing_.getAndSet(0);
+        return;
+    }
     error::Error err = wal->truncate(segs.first.second + 1);
     if (err) {
         // If truncating fails, we'll just try again at the next checkpoint.
@@ -530,7 +528,7 @@ error::Error Head::truncate(int64_t mint)
                     std::chrono::high_resolution_clock::now() - t0)
                     .count()
              << "ms";
-    return error::Error();
+    checkpointing_.getAndSet(0);
 }
 
 } // namespace head
@@ -14,6 +14,7 @@
 #include "db/AppenderInterface.hpp"
 #include "head/StripeSeries.hpp"
 #include "index/MemPostings.hpp"
+#include "tombstone/MemTombstones.hpp"
 #include "tsdbutil/tsdbutils.hpp"
 #include "wal/WAL.hpp"
 
@@ -26,6 +27,8 @@ class Head : public block::BlockInterface {
 public:
     int64_t chunk_range;
     std::unique_ptr<wal::WAL> wal;
+    // Log the samples as tsdbutil::RECORD_COMPRESSED_SAMPLES.
+    bool compress_samples;
 
     base::AtomicInt64 min_time;
     base::AtomicInt64 max_time;
@@ -43,12 +46,25 @@ public:
 
     std::unique_ptr<index::MemPostings> posting_list;
 
+    // Deleted ranges of the series. Readers mask them and they are dropped
+    // from the chunks when the head is persisted.
+    tombstone::MemTombstones stones;
+    // Copy of stones shared by the readers, built on the first read after
+    // stones changed and never modified afterwards.
+    mutable base::MutexLock snapshot_mutex_;
+    mutable std::shared_ptr<tombstone::MemTombstones> stones_snapshot_;
+
     std::shared_ptr<base::ThreadPool> pool_;
 
+    // Runs the WAL checkpoints off the caller of truncate(), one at a time.
+    std::unique_ptr<base::ThreadPool> checkpoint_pool_;
+    base::AtomicInt checkpointing_;
+
     error::Error err_;
 
     Head(int64_t chunk_range, std::unique_ptr<wal::WAL>&& wal,
-         const std::shared_ptr<base::ThreadPool>& pool_);
+         const std::shared_ptr<base::ThreadPool>& pool_,
+         bool compress_samples = false);
 
     // The samples before valid_time will be appended.
     //
@@ -62,8 +78,7 @@ public:
     // The samples will be destructed automatically after this function
     // finishes.
     void process_wal_samples(const std::vector<tsdbutil::RefSample>& samples,
-                             base::AtomicUInt64* unknown_refs,
-                             base::WaitGroup* wg);
+                             base::AtomicUInt64* unknown_refs);
 
     wal::CorruptionError load_wal(wal::SegmentReader* reader);
 
@@ -78,7 +93,8 @@ public:
     std::pair<std::shared_ptr<block::ChunkReaderInterface>, bool>
     chunks() const;
 
-    // tombstones returns a TombstoneReader over the block's deleted data.
+    // tombstones returns a TombstoneReader over a snapshot of stones, shared
+    // by all readers until the next change.
     std::pair<std::shared_ptr<tombstone::TombstoneReaderInterface>, bool>
     tombstones() const;
 
@@ -112,22 +128,27 @@ public:
     std::pair<std::shared_ptr<MemSeries>, bool>
     get_or_create(tagtree::TSID tsid);
 
-    // chunkRewrite re-writes the chunks which overlaps with deleted ranges
-    // and removes the samples in the deleted ranges.
-    // Chunks is deleted if no samples are left at the end.
-    error::Error chunk_rewrite(tagtree::TSID tsid,
-                               const tombstone::Intervals& dranges);
+    // Drop the deleted ranges entirely before mint.
+    void truncate_tombstones(int64_t mint);
+
+    // Drop the snapshot of stones, must be called after changing them.
+    void stones_changed();
 
     // del all samples in the range of [mint, maxt] for series that satisfy the
-    // given label matchers.
-    //
-    // Head::chunk_rewrite()
-    // WAL::log()
+    // given label matchers. The ranges are recorded in stones and logged to
+    // the WAL, the chunks are left untouched. The ranges end at the newest
+    // sample of each series, so samples appended afterwards are never masked.
     error::Error del(int64_t mint, int64_t maxt,
                      const std::unordered_set<tagtree::TSID>& tsids);
 
     void gc();
 
+    // checkpoint_wal checkpoints the lower third of the WAL segments against
+    // a snapshot of the live series and drops them. Errors are only logged.
+    void checkpoint_wal(int64_t mint);
+
+    // truncate drops the data before mint. The WAL checkpoint is left to the
+    // background, and skipped when the previous one is still running.
     error::Error truncate(int64_t mint);
 
     // void close() const{
@@ -140,6 +161,8 @@ public:
     ~Head()
     {
         // LOG_DEBUG << "~Head";
+        // Wait for the running checkpoint before the WAL goes away.
+        if (checkpoint_pool_) checkpoint_pool_->stop();
     }
 };
 
@@ -115,7 +115,10 @@ public:
         }
         if (!samples.empty()) {
             rec.clear();
-            tsdbutil::RecordEncoder::samples(samples, rec);
+            if (head->compress_samples)
+                tsdbutil::RecordEncoder::compressed_samples(samples, rec);
+            else
+                tsdbutil::RecordEncoder::samples(samples, rec);
             // LOG_DEBUG << "after RecordEncoder::samples()";
             error::Error err = head->wal->log(rec);
             // LOG_DEBUG << "after wal->log()";
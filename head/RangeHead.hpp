@@ -5,7 +5,6 @@
 #include "head/Head.hpp"
 #include "head/HeadChunkReader.hpp"
 #include "head/HeadIndexReader.hpp"
-#include "tombstone/MemTombstones.hpp"
 
 namespace tsdb{
 namespace head{
@@ -31,7 +30,7 @@ class RangeHead: public block::BlockInterface{
 
         // tombstones returns a TombstoneReader over the block's deleted data.
         std::pair<std::shared_ptr<tombstone::TombstoneReaderInterface>, bool> tombstones() const{
-            return {std::shared_ptr<tombstone::TombstoneReaderInterface>(new tombstone::MemTombstones()), true};
+            return head->tombstones();
         }
 
         int64_t MaxTime(){
@@ -2,6 +2,7 @@
 #include "base/Logging.hpp"
 #include "head/HeadUtils.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 namespace tsdb {
@@ -76,6 +77,18 @@ std::shared_ptr<MemSeries> StripeSeries::get_by_id(tagtree::TSID tsid)
     return r->second;
 }
 
+std::vector<tagtree::TSID> StripeSeries::ids()
+{
+    std::vector<tagtree::TSID> r;
+    for (int i = 0; i < STRIPE_SIZE; ++i) {
+        base::PadRWLockGuard lock_i(locks[i], 0);
+        for (auto const& p : series[i])
+            r.push_back(p.first);
+    }
+    std::sort(r.begin(), r.end());
+    return r;
+}
+
 // Return <MemSeries, if the series being set>.
 std::pair<std::shared_ptr<MemSeries>, bool>
 StripeSeries::get_or_set(tagtree::TSID tsid,
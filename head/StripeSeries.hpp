@@ -30,6 +30,10 @@ public:
 
     std::shared_ptr<MemSeries> get_by_id(tagtree::TSID tsid);
 
+    // ids returns the sorted TSIDs of all series, taking each stripe lock
+    // once.
+    std::vector<tagtree::TSID> ids();
+
     // Return <MemSeries, if the series being set>.
     std::pair<std::shared_ptr<MemSeries>, bool>
     get_or_set(tagtree::TSID tsid, const std::shared_ptr<MemSeries>& s);
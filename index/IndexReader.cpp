@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cassert>
 #include <cstring>
 // #include <iostream>
 
@@ -7,12 +9,14 @@
 #include "index/PostingSet.hpp"
 #include "label/Label.hpp"
 #include "tsdbutil/DecBuf.hpp"
+#include "tsdbutil/DirectSlice.hpp"
 #include "tsdbutil/MMapSlice.hpp"
 
 namespace tsdb {
 namespace index {
 
-IndexReader::IndexReader(std::shared_ptr<tsdbutil::ByteSlice> b) : err_(false)
+IndexReader::IndexReader(std::shared_ptr<tsdbutil::ByteSlice> b)
+    : err_(false), version_(0)
 {
     if (!validate(b)) {
         LOG_ERROR << "Fail to create IndexReader, invalid ByteSlice";
@@ -23,7 +27,7 @@ IndexReader::IndexReader(std::shared_ptr<tsdbutil::ByteSlice> b) : err_(false)
     init();
 }
 
-IndexReader::IndexReader(const std::string& filename) : err_(false)
+IndexReader::IndexReader(const std::string& filename) : err_(false), version_(0)
 {
     std::shared_ptr<tsdbutil::ByteSlice> temp =
         std::shared_ptr<tsdbutil::ByteSlice>(new tsdbutil::MMapSlice(filename));
@@ -37,9 +41,25 @@ IndexReader::IndexReader(const std::string& filename) : err_(false)
     get_all_postings();
 }
 
+IndexReader::IndexReader(const std::string& filename,
+                         const std::shared_ptr<tsdbutil::BufferCache>& cache)
+    : err_(false), version_(0)
+{
+    std::shared_ptr<tsdbutil::ByteSlice> temp(new tsdbutil::DirectSlice(
+        filename, cache, tsdbutil::BUFFER_PRIORITY_INDEX));
+    if (!validate(temp)) {
+        LOG_ERROR << "Fail to create IndexReader, invalid ByteSlice";
+        err_ = true;
+        return;
+    }
+    this->b = temp;
+    init();
+}
+
 void IndexReader::init()
 {
-    std::pair<TOC, bool> toc_pair = toc_from_ByteSlice(b.get());
+    std::pair<TOC, bool> toc_pair =
+        toc_from_ByteSlice(b.get(), version_ == INDEX_VERSION_V3);
     if (!toc_pair.second) {
         LOG_ERROR << "Fail to create IndexReader, error reading TOC";
         b.reset();
@@ -60,12 +80,13 @@ void IndexReader::init()
 std::pair<std::unique_ptr<PostingsInterface>, bool>
 IndexReader::get_all_postings()
 {
-    std::unordered_set<tagtree::TSID> all;
+    std::vector<tagtree::TSID> all;
+    all.reserve(offset_table.size());
     for (auto&& p : offset_table) {
-        all.insert(p.first);
+        all.push_back(p.first);
     }
 
-    return {std::make_unique<PostingSet>(all), true};
+    return {std::make_unique<PostingSet>(std::move(all)), true};
 }
 
 bool IndexReader::validate(const std::shared_ptr<tsdbutil::ByteSlice>& b)
@@ -78,7 +99,8 @@ bool IndexReader::validate(const std::shared_ptr<tsdbutil::ByteSlice>& b)
         LOG_ERROR << "Not beginning with MAGIC_INDEX";
         return false;
     }
-    if (*((b->range(4, 5)).first) != INDEX_VERSION_V1) {
+    version_ = *((b->range(4, 5)).first);
+    if (version_ != INDEX_VERSION_V1 && version_ != INDEX_VERSION_V3) {
         LOG_ERROR << "Invalid Index Version";
         return false;
     }
@@ -108,18 +130,28 @@ bool IndexReader::read_offset_table(uint64_t offset)
     std::pair<const uint8_t*, int> table_begin = b->range(offset, offset + 4);
     if (table_begin.second != 4) return false;
     uint32_t len = base::get_uint32_big_endian(table_begin.first);
+    // Slices other than mmap only expose the requested range.
+    table_begin = b->range(offset, offset + 4 + len);
+    if (table_begin.second != 4 + len) return false;
     uint32_t num_entries = base::get_uint32_big_endian(table_begin.first + 4);
     tsdbutil::DecBuf dec_buf(table_begin.first + 8, len - 4);
+    uint64_t gen = b->generation();
 
-    // Read label name to offset of label value
+    offset_table.clear();
+    offset_table.reserve(num_entries);
+    bool sorted = true;
     for (int i = 0; i < num_entries; i++) {
         tagtree::TSID tsid = dec_buf.get_tsid();
-        offset_table[tsid] = dec_buf.get_unsigned_variant();
+        if (!offset_table.empty() && tsid < offset_table.back().first)
+            sorted = false;
+        offset_table.emplace_back(tsid, dec_buf.get_unsigned_variant());
     }
-    if (dec_buf.err != tsdbutil::NO_ERR)
-        return false;
-    else
-        return true;
+    if (dec_buf.err != tsdbutil::NO_ERR) return false;
+    assert(b->generation() == gen);
+
+    // Blocks written before the table was emitted in TSID order.
+    if (!sorted) std::sort(offset_table.begin(), offset_table.end());
+    return true;
 }
 
 // ┌─────────────────────────────────────────────────────────────────────────┐
@@ -153,8 +185,12 @@ bool IndexReader::series(
 {
     if (!b) return false;
 
-    auto it = offset_table.find(tsid);
-    if (it == offset_table.end()) return false;
+    auto it = std::lower_bound(
+        offset_table.begin(), offset_table.end(), tsid,
+        [](const std::pair<tagtree::TSID, uint64_t>& lhs, tagtree::TSID rhs) {
+            return lhs.first < rhs;
+        });
+    if (it == offset_table.end() || it->first != tsid) return false;
     auto ref = it->second;
     ref *= 16;
 
@@ -162,7 +198,10 @@ bool IndexReader::series(
     int decoded;
     uint64_t len =
         base::decode_unsigned_varint(start, decoded, base::MAX_VARINT_LEN_64);
+    start = (b->range(ref, ref + decoded + len)).first;
+    if (!start) return false;
     tsdbutil::DecBuf dec_buf(start + decoded, len);
+    uint64_t gen = b->generation();
     // Decode the Chunks
     uint64_t num_chunks = dec_buf.get_unsigned_variant();
     if (num_chunks == 0) return true;
@@ -194,6 +233,7 @@ bool IndexReader::series(
             new chunk::ChunkMeta(static_cast<uint64_t>(last_ref), last_t,
                                  static_cast<int64_t>(delta_t) + last_t)));
     }
+    assert(b->generation() == gen);
     return true;
 }
 
@@ -5,9 +5,12 @@
 #include "block/IndexReaderInterface.hpp"
 #include "index/IndexUtils.hpp"
 #include "index/TOC.hpp"
+#include "tsdbutil/BufferCache.hpp"
 #include "tsdbutil/ByteSlice.hpp"
 #include "tsdbutil/SerializedStringTuples.hpp"
 
+#include <vector>
+
 namespace tsdb {
 namespace index {
 
@@ -17,12 +20,18 @@ private:
 
     bool err_;
 
-    // offset table
-    std::unordered_map<tagtree::TSID, uint64_t> offset_table;
+    uint8_t version_;
+
+    // offset table, sorted by TSID so that lookups of a sorted TSID list walk
+    // the series section forwards.
+    std::vector<std::pair<tagtree::TSID, uint64_t>> offset_table;
 
 public:
     IndexReader(std::shared_ptr<tsdbutil::ByteSlice> b);
     IndexReader(const std::string& filename);
+    // Read the file through cache with DirectSlice instead of mmap.
+    IndexReader(const std::string& filename,
+                const std::shared_ptr<tsdbutil::BufferCache>& cache);
 
     void init();
 
@@ -10,6 +10,7 @@ const int HEADER_LEN = 5;
 const std::string LABEL_NAME_SEPARATOR = "\xff";
 const uint8_t INDEX_VERSION_V1 = 1;
 const uint8_t INDEX_VERSION_V2 = 2;
+const uint8_t INDEX_VERSION_V3 = 3;
 
 const int SUCCEED = 0;
 const int INVALID_STAGE = -1;
@@ -14,6 +14,7 @@ extern const int HEADER_LEN;
 extern const std::string LABEL_NAME_SEPARATOR;
 extern const uint8_t INDEX_VERSION_V1;          // Original index.
 extern const uint8_t INDEX_VERSION_V2;          // Group version index.
+extern const uint8_t INDEX_VERSION_V3;          // V1 with CRC-32C checksums.
 
 extern const int SUCCEED;
 extern const int INVALID_STAGE;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <stdio.h>
 #include <unordered_map>
@@ -13,9 +14,10 @@ namespace tsdb {
 namespace index {
 
 // All the dirs inside filename should be existed.
-IndexWriter::IndexWriter(const std::string& filename)
+IndexWriter::IndexWriter(const std::string& filename,
+                         const std::shared_ptr<base::RateLimiter>& limiter)
     : pos(0), stage(IDX_STAGE_NONE), buf1(1 << 22), buf2(1 << 22),
-      uint32_cache(1 << 15)
+      uint32_cache(1 << 15), limiter(limiter)
 {
     boost::filesystem::path p(filename);
     if (boost::filesystem::exists(p)) boost::filesystem::remove_all(p);
@@ -32,12 +34,18 @@ void IndexWriter::write_meta()
 {
     buf1.reset();
     buf1.put_BE_uint32(MAGIC_INDEX);
-    buf1.put_byte(INDEX_VERSION_V1);
+    buf1.put_byte(INDEX_VERSION_V3);
     write({buf1.get()});
 }
 
 void IndexWriter::write(std::initializer_list<std::pair<const uint8_t*, int>> l)
 {
+    if (limiter) {
+        int64_t n = 0;
+        for (auto& p : l)
+            n += p.second;
+        limiter->request(n);
+    }
     for (auto& p : l) {
         fwrite(p.first, 1, p.second, f);
         pos += static_cast<uint64_t>(p.second);
@@ -150,7 +158,7 @@ int IndexWriter::add_series(
     // LOG_INFO << "stage2";
     buf1.reset();
     buf1.put_unsigned_variant(buf2.len());          // Len in the beginning
-    buf2.put_BE_uint32(base::GetCrc32(buf2.get())); // Crc32 in the end
+    buf2.put_BE_uint32(base::GetCrc32c(buf2.get())); // Crc32c in the end
     write({buf1.get(), buf2.get()});
 
     return 0;
@@ -175,19 +183,26 @@ int IndexWriter::add_series(
 // │  CRC32 <4b>                              │
 // └──────────────────────────────────────────┘
 // Need to record the starting offset in the TOC first
+//
+// Entries are emitted in TSID order so that readers can binary search the
+// table and a sorted query walks the series section front to back.
 void IndexWriter::write_offset_table()
 {
+    std::vector<std::pair<tagtree::TSID, uint64_t>> sorted(series.begin(),
+                                                           series.end());
+    std::sort(sorted.begin(), sorted.end());
+
     buf2.reset();
-    buf2.put_BE_uint32(series.size());
+    buf2.put_BE_uint32(sorted.size());
 
-    for (auto&& s : series) {
+    for (auto&& s : sorted) {
         buf2.put_tsid(s.first);
         buf2.put_unsigned_variant(s.second);
     }
 
     buf1.reset();
     buf1.put_BE_uint32(buf2.len());
-    buf2.put_BE_uint32(base::GetCrc32(buf2.get())); // Crc32 in the end
+    buf2.put_BE_uint32(base::GetCrc32c(buf2.get())); // Crc32c in the end
 
     write({buf1.get(), buf2.get()});
 }
@@ -204,7 +219,7 @@ void IndexWriter::write_TOC()
     buf1.reset();
     buf1.put_BE_uint64(toc.series);
     buf1.put_BE_uint64(toc.label_indices_table);
-    buf1.put_BE_uint32(base::GetCrc32(buf1.get())); // Crc32 in the end
+    buf1.put_BE_uint32(base::GetCrc32c(buf1.get())); // Crc32c in the end
 
     write({buf1.get()});
 }
@@ -5,6 +5,7 @@
 #include <initializer_list>
 #include <unordered_map>
 
+#include "base/RateLimiter.hpp"
 #include "block/IndexWriterInterface.hpp"
 #include "index/IndexUtils.hpp"
 #include "index/TOC.hpp"
@@ -32,9 +33,13 @@ private:
 
     int version;
 
+    // Throttles the bytes written when not null.
+    std::shared_ptr<base::RateLimiter> limiter;
+
 public:
     // All the dirs inside filename should be existed.
-    IndexWriter(const std::string& filename);
+    IndexWriter(const std::string& filename,
+                const std::shared_ptr<base::RateLimiter>& limiter = nullptr);
 
     void write_meta();
 
@@ -8,6 +8,14 @@ namespace index {
 // deque/vector into it
 PostingSet::PostingSet(const std::unordered_set<tagtree::TSID>& set)
     : elements(set.begin(), set.end()), index(-1)
+{
+    std::sort(elements.begin(), elements.end());
+    begin = elements.cbegin();
+    size = elements.size();
+}
+
+PostingSet::PostingSet(std::vector<tagtree::TSID>&& sorted)
+    : elements(std::move(sorted)), index(-1)
 {
     begin = elements.cbegin();
     size = elements.size();
@@ -21,12 +29,16 @@ bool PostingSet::next()
 
 bool PostingSet::seek(tagtree::TSID v)
 {
-    auto it = std::find(begin, begin + size, v);
-    if (it == elements.end()) {
-        return false;
+    // Never move backwards.
+    size_t from = index == static_cast<size_t>(-1) ? 0 : index;
+    if (from >= size) return false;
+    if (*(begin + from) >= v) {
+        index = from;
+        return true;
     }
+    auto it = std::lower_bound(begin + from, begin + size, v);
     index = it - begin;
-    return true;
+    return index < size;
 }
 
 tagtree::TSID PostingSet::at() const { return *(begin + index); }
@@ -8,6 +8,8 @@
 namespace tsdb {
 namespace index {
 
+// PostingSet keeps its elements sorted by TSID so that it honours the
+// PostingsInterface contract and can be merge-joined against a sorted index.
 class PostingSet : public PostingsInterface {
 private:
     std::vector<tagtree::TSID> elements;
@@ -19,8 +21,12 @@ private:
 public:
     PostingSet(const std::unordered_set<tagtree::TSID>& set);
 
+    // elements are expected to be sorted already.
+    PostingSet(std::vector<tagtree::TSID>&& sorted);
+
     bool next();
 
+    // seek advances to the first element >= v.
     bool seek(tagtree::TSID v);
 
     tagtree::TSID at() const;
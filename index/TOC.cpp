@@ -9,8 +9,9 @@ namespace index {
 const int INDEX_TOC_LEN = 2 * 8 + 4;       // 6 fields + crc32
 const int INDEX_GROUP_TOC_LEN = 8 * 8 + 4; // 8 fields + crc32
 
-// return false if error
-std::pair<TOC, bool> toc_from_ByteSlice(const tsdbutil::ByteSlice* bs)
+// return false if error, castagnoli selects CRC-32C over CRC-32.
+std::pair<TOC, bool> toc_from_ByteSlice(const tsdbutil::ByteSlice* bs,
+                                        bool castagnoli)
 {
     if (bs->len() < INDEX_TOC_LEN)
         return std::make_pair<TOC, bool>(TOC(), false);
@@ -18,7 +19,8 @@ std::pair<TOC, bool> toc_from_ByteSlice(const tsdbutil::ByteSlice* bs)
         bs->range(bs->len() - INDEX_TOC_LEN, bs->len());
 
     uint32_t crc1 = base::get_uint32_big_endian(b.first + b.second - 4);
-    uint32_t crc2 = base::GetCrc32(b.first, b.second - 4);
+    uint32_t crc2 = castagnoli ? base::GetCrc32c(b.first, b.second - 4)
+                               : base::GetCrc32(b.first, b.second - 4);
 
     if (crc1 != crc2) return std::make_pair<TOC, bool>(TOC(), false);
 
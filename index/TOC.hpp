@@ -30,8 +30,9 @@ public:
     uint64_t group_postings_table;
 };
 
-// return false if error
-std::pair<TOC, bool> toc_from_ByteSlice(const tsdbutil::ByteSlice* bs);
+// return false if error, castagnoli selects CRC-32C over CRC-32.
+std::pair<TOC, bool> toc_from_ByteSlice(const tsdbutil::ByteSlice* bs,
+                                        bool castagnoli = false);
 std::pair<GroupTOC, bool>
 group_toc_from_ByteSlice(const tsdbutil::ByteSlice* bs);
 
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "base/Heap.hpp"
+#include "chunk/DeleteIterator.hpp"
+#include "querier/Aggregator.hpp"
+
+namespace tsdb {
+namespace querier {
+
+Aggregator::Aggregator(const AggregateRequest& req, AggregateResult* result)
+    : req(req), result(result), num_steps(req.num_steps()), sorted(true)
+{
+    result->start = req.start;
+    result->step = req.step;
+    result->columns.assign(req.num_groups, std::vector<double>(num_steps, 0));
+    counts.assign(req.num_groups, std::vector<int>(num_steps, 0));
+}
+
+void Aggregator::append(int64_t t, double v)
+{
+    if (t <= req.start - req.window() || t > req.end) return;
+    if (!ts.empty() && t < ts.back()) sorted = false;
+    ts.push_back(t);
+    vs.push_back(v);
+}
+
+error::Error Aggregator::append(const std::shared_ptr<ChunkSeriesMeta>& csm)
+{
+    // The intersection of the evaluation range and the series' range.
+    int64_t mint = std::max(req.start - req.window() + 1, csm->min_time);
+    int64_t maxt = std::min(req.end, csm->max_time);
+    for (auto const& c : csm->chunks) {
+        if (c->max_time < mint || c->min_time > maxt) continue;
+        std::unique_ptr<chunk::ChunkIteratorInterface> it = c->chunk->iterator();
+        if (!csm->intervals.empty())
+            it.reset(new chunk::DeleteIterator(std::move(it),
+                                               csm->intervals.cbegin(),
+                                               csm->intervals.cend()));
+        while (it->next()) {
+            std::pair<int64_t, double> p = it->at();
+            if (p.first > maxt) break;
+            if (p.first >= mint) append(p.first, p.second);
+        }
+        if (it->error())
+            return error::Error("error iterate chunk of series " +
+                                std::to_string(csm->tsid));
+    }
+    return error::Error();
+}
+
+void Aggregator::flush(tagtree::TSID tsid)
+{
+    auto g = req.groups.find(tsid);
+    if (g == req.groups.end() || ts.empty()) {
+        ts.clear();
+        vs.clear();
+        sorted = true;
+        return;
+    }
+
+    if (!sorted) {
+        // Overlapping blocks, the last appended sample wins on equal
+        // timestamps.
+        std::vector<int> idx(ts.size());
+        for (size_t i = 0; i < idx.size(); i++)
+            idx[i] = i;
+        std::stable_sort(idx.begin(), idx.end(),
+                         [this](int lhs, int rhs) { return ts[lhs] < ts[rhs]; });
+        std::vector<int64_t> ts2;
+        std::vector<double> vs2;
+        for (int i : idx) {
+            if (!ts2.empty() && ts2.back() == ts[i])
+                vs2.back() = vs[i];
+            else {
+                ts2.push_back(ts[i]);
+                vs2.push_back(vs[i]);
+            }
+        }
+        ts.swap(ts2);
+        vs.swap(vs2);
+    }
+
+    std::vector<double>& col = result->columns[g->second];
+    std::vector<int>& cnt = counts[g->second];
+    size_t i = 0, j = 0;
+    int64_t t = req.start;
+    for (int k = 0; k < num_steps; k++, t += req.step) {
+        while (j < ts.size() && ts[j] <= t)
+            ++j;
+        double v;
+        if (req.range > 0) {
+            // The samples [i, j) are in (t - range, t].
+            while (i < j && ts[i] <= t - req.range)
+                ++i;
+            if (!range_function(req.range_func, ts.data() + i, vs.data() + i,
+                                j - i, t, req.range, &v))
+                continue;
+        } else {
+            if (j == 0 || t - ts[j - 1] >= req.lookback) continue;
+            v = vs[j - 1];
+        }
+        switch (req.op) {
+            case AGG_SUM:
+            case AGG_AVG:
+                col[k] += v;
+                break;
+            case AGG_MIN:
+                if (cnt[k] == 0 || v < col[k]) col[k] = v;
+                break;
+            case AGG_MAX:
+                if (cnt[k] == 0 || v > col[k]) col[k] = v;
+                break;
+            case AGG_COUNT:
+                col[k] += 1;
+                break;
+        }
+        ++cnt[k];
+    }
+
+    ts.clear();
+    vs.clear();
+    sorted = true;
+}
+
+void Aggregator::finish()
+{
+    for (int g = 0; g < req.num_groups; g++) {
+        for (int k = 0; k < num_steps; k++) {
+            if (counts[g][k] == 0)
+                result->columns[g][k] = std::numeric_limits<double>::quiet_NaN();
+            else if (req.op == AGG_AVG)
+                result->columns[g][k] /= counts[g][k];
+        }
+    }
+}
+
+error::Error aggregate_series_set(const std::shared_ptr<SeriesSetInterface>& ss,
+                                  const AggregateRequest& req,
+                                  AggregateResult* result)
+{
+    Aggregator agg(req, result);
+    if (ss) {
+        while (ss->next()) {
+            std::shared_ptr<SeriesInterface> s = ss->at();
+            std::unique_ptr<SeriesIteratorInterface> it = s->iterator();
+            if (it->seek(req.start - req.window() + 1)) {
+                do {
+                    std::pair<int64_t, double> p = it->at();
+                    if (p.first > req.end) break;
+                    agg.append(p.first, p.second);
+                } while (it->next());
+            }
+            if (it->error())
+                return error::Error("error iterate series " +
+                                    std::to_string(s->tsid()));
+            agg.flush(s->tsid());
+        }
+    }
+    agg.finish();
+    return error::Error();
+}
+
+// Same k-way merge by TSID as MergedSeriesSet, over ChunkSeriesMeta.
+error::Error aggregate_chunk_series_sets(
+    const std::shared_ptr<ChunkSeriesSets>& css, const AggregateRequest& req,
+    AggregateResult* result)
+{
+    Aggregator agg(req, result);
+    base::MinHeap<std::pair<tagtree::TSID, int>> heap(css->size());
+    for (int i = 0; i < css->size(); i++) {
+        if (css->at(i)->next()) heap.push({css->at(i)->at()->tsid, i});
+    }
+
+    std::vector<int> id;
+    while (!heap.empty()) {
+        std::pair<tagtree::TSID, int> top = heap.pop();
+        id.clear();
+        id.push_back(top.second);
+        while (!heap.empty() && heap.front().first == top.first)
+            id.push_back(heap.pop().second);
+
+        // Sets are sorted by time, so are the chunks appended.
+        for (int i : id) {
+            error::Error err = agg.append(css->at(i)->at());
+            if (err) return err;
+        }
+        agg.flush(top.first);
+
+        for (int i : id) {
+            if (css->at(i)->next())
+                heap.push({css->at(i)->at()->tsid, i});
+            else if (css->at(i)->error())
+                return error::Error("error iterate chunk series set");
+        }
+    }
+    agg.finish();
+    return error::Error();
+}
+
+} // namespace querier
+} // namespace tsdb
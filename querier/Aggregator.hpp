@@ -0,0 +1,106 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "base/Error.hpp"
+#include "querier/QuerierUtils.hpp"
+#include "querier/RangeFunctionIterator.hpp"
+
+namespace tsdb {
+namespace querier {
+
+enum AggregateOp { AGG_SUM, AGG_AVG, AGG_MIN, AGG_MAX, AGG_COUNT };
+
+// AggregateRequest describes a cross-series aggregation evaluated at every
+// step in [start, end], e.g. sum by (group) at a step.
+//
+// At each step t a series contributes its latest sample in (t - lookback, t],
+// the same selection as an instant vector selector. When range > 0 it
+// contributes range_func over its samples in (t - range, t] instead, e.g.
+// sum(rate(x[5m])).
+class AggregateRequest {
+public:
+    // TSID -> group index in [0, num_groups).
+    std::unordered_map<tagtree::TSID, int> groups;
+    int num_groups;
+    int64_t start;
+    int64_t end;
+    int64_t step;
+    int64_t lookback;
+    AggregateOp op;
+    RangeFunction range_func;
+    int64_t range;
+
+    AggregateRequest()
+        : num_groups(0), start(0), end(0), step(1), lookback(5 * 60 * 1000),
+          op(AGG_SUM), range_func(RANGE_RATE), range(0)
+    {}
+
+    // The samples read by the step at t are in (t - window(), t].
+    int64_t window() const { return range > 0 ? range : lookback; }
+
+    int num_steps() const
+    {
+        if (step <= 0 || end < start) return 0;
+        return static_cast<int>((end - start) / step) + 1;
+    }
+};
+
+// One column per group, aligned to start + i * step. Steps without any
+// contributing series are NaN.
+class AggregateResult {
+public:
+    int64_t start;
+    int64_t step;
+    std::vector<std::vector<double>> columns;
+
+    AggregateResult() : start(0), step(0) {}
+};
+
+// Aggregator folds series into the result columns. The samples of one series
+// are buffered with append() and evaluated at every step by flush().
+class Aggregator {
+private:
+    const AggregateRequest& req;
+    AggregateResult* result;
+    int num_steps;
+    std::vector<std::vector<int>> counts;
+
+    // Decoded samples of the current series.
+    std::vector<int64_t> ts;
+    std::vector<double> vs;
+    bool sorted;
+
+public:
+    Aggregator(const AggregateRequest& req, AggregateResult* result);
+
+    void append(int64_t t, double v);
+
+    // Append the samples of csm inside both the evaluation range and
+    // [csm->min_time, csm->max_time].
+    error::Error append(const std::shared_ptr<ChunkSeriesMeta>& csm);
+
+    // Evaluate the buffered series at every step and clear the buffer.
+    void flush(tagtree::TSID tsid);
+
+    // Finalize avg and mark empty steps. Must be called once at the end.
+    void finish();
+};
+
+// Evaluate req over series resolved by select(), one series at a time.
+error::Error aggregate_series_set(const std::shared_ptr<SeriesSetInterface>& ss,
+                                  const AggregateRequest& req,
+                                  AggregateResult* result);
+
+// Evaluate req directly over the decoded chunks of every set. The sets must
+// be sorted by time and iterate their series in TSID order.
+error::Error aggregate_chunk_series_sets(
+    const std::shared_ptr<ChunkSeriesSets>& css, const AggregateRequest& req,
+    AggregateResult* result);
+
+} // namespace querier
+} // namespace tsdb
+
+#endif
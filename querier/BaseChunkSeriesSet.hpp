@@ -19,6 +19,9 @@ namespace querier {
 // The chunk pointer in ChunkMeta is not set.
 // NOTE(Alec), BaseChunkSeriesSet fine-grained filters the chunks using
 // tombstone.
+// The requested TSIDs are visited in ascending order. Blocks lay
+// out series entries and chunks in TSID order, so the lookups merge-join
+// against the index and both files are read front to back.
 class BaseChunkSeriesSet : public ChunkSeriesSetInterface {
 private:
     std::unique_ptr<index::PostingsInterface> p;
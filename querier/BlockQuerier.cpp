@@ -10,9 +10,11 @@ namespace tsdb {
 namespace querier {
 
 BlockQuerier::BlockQuerier(const std::shared_ptr<block::BlockInterface>& block,
-                           int64_t min_time, int64_t max_time)
-    : min_time(min_time), max_time(max_time)
+                           int64_t min_time, int64_t max_time,
+                           const std::shared_ptr<chunk::ChunkCache>& cache)
+    : min_time(min_time), max_time(max_time), cache(cache)
 {
+    if (cache) ulid = block->meta().ulid_;
     bool succeed_;
     std::tie(indexr, succeed_) = block->index();
     if (!succeed_) {
@@ -36,6 +38,15 @@ BlockQuerier::BlockQuerier(const std::shared_ptr<block::BlockInterface>& block,
 
 std::shared_ptr<SeriesSetInterface>
 BlockQuerier::select(const std::unordered_set<tagtree::TSID>& l) const
+{
+    std::shared_ptr<ChunkSeriesSetInterface> populated = chunk_select(l);
+    if (!populated) return nullptr;
+    return std::shared_ptr<SeriesSetInterface>(
+        new BlockSeriesSet(populated, min_time, max_time));
+}
+
+std::shared_ptr<ChunkSeriesSetInterface>
+BlockQuerier::chunk_select(const std::unordered_set<tagtree::TSID>& l) const
 {
     std::shared_ptr<ChunkSeriesSetInterface> base(
         new BaseChunkSeriesSet(indexr, tombstones, l));
@@ -44,10 +55,21 @@ BlockQuerier::select(const std::unordered_set<tagtree::TSID>& l) const
         LOG_ERROR << "Error get BaseChunkSeriesSet";
         return nullptr;
     }
-    return std::shared_ptr<SeriesSetInterface>(new BlockSeriesSet(
-        std::shared_ptr<ChunkSeriesSetInterface>(
-            new PopulatedChunkSeriesSet(base, chunkr, min_time, max_time)),
-        min_time, max_time));
+    return std::shared_ptr<ChunkSeriesSetInterface>(
+        new PopulatedChunkSeriesSet(base, chunkr, min_time, max_time, cache,
+                                    ulid));
+}
+
+error::Error BlockQuerier::aggregate(const AggregateRequest& req,
+                                     AggregateResult* result) const
+{
+    std::unordered_set<tagtree::TSID> l;
+    for (auto const& g : req.groups)
+        l.insert(g.first);
+    std::shared_ptr<ChunkSeriesSets> css(new ChunkSeriesSets());
+    std::shared_ptr<ChunkSeriesSetInterface> populated = chunk_select(l);
+    if (populated) css->push_back(populated);
+    return aggregate_chunk_series_sets(css, req, result);
 }
 
 } // namespace querier
@@ -4,6 +4,7 @@
 #include "block/BlockInterface.hpp"
 #include "block/ChunkReaderInterface.hpp"
 #include "block/IndexReaderInterface.hpp"
+#include "chunk/ChunkCache.hpp"
 #include "querier/QuerierInterface.hpp"
 #include "tombstone/TombstoneReaderInterface.hpp"
 
@@ -17,15 +18,26 @@ private:
     std::shared_ptr<tombstone::TombstoneReaderInterface> tombstones;
     int64_t min_time;
     int64_t max_time;
+    std::shared_ptr<chunk::ChunkCache> cache;
+    ulid::ULID ulid;
     mutable error::Error err_;
 
 public:
+    // Decoded chunks are shared through cache when it is not nullptr. It must
+    // only be passed for persistent blocks, whose chunks are immutable.
     BlockQuerier(const std::shared_ptr<block::BlockInterface>& block,
-                 int64_t min_time, int64_t max_time);
+                 int64_t min_time, int64_t max_time,
+                 const std::shared_ptr<chunk::ChunkCache>& cache = nullptr);
 
     std::shared_ptr<SeriesSetInterface>
     select(const std::unordered_set<tagtree::TSID>& l) const;
 
+    std::shared_ptr<ChunkSeriesSetInterface>
+    chunk_select(const std::unordered_set<tagtree::TSID>& l) const;
+
+    error::Error aggregate(const AggregateRequest& req,
+                           AggregateResult* result) const;
+
     std::deque<std::string> label_values(const std::string& s) const;
 
     std::deque<std::string> label_names() const;
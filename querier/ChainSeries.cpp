@@ -20,5 +20,10 @@ std::unique_ptr<SeriesIteratorInterface> ChainSeries::iterator()
         new ChainSeriesIterator(series));
 }
 
+bool ChainSeries::time_range(int64_t* min_time, int64_t* max_time)
+{
+    return series->time_range(min_time, max_time);
+}
+
 } // namespace querier
 } // namespace tsdb
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "querier/ChainSeriesIterator.hpp"
 
 namespace tsdb{
@@ -6,20 +8,39 @@ namespace querier{
 // chainedSeriesIterator implements a series iterater over a list
 // of time-sorted, non-overlapping iterators.
 ChainSeriesIterator::ChainSeriesIterator(const std::shared_ptr<Series> & series): series(series), i(0){
+    max_times.reserve(series->size());
+    for(int j = 0; j < series->size(); j ++){
+        int64_t mint, maxt;
+        if(!series->at(j)->time_range(&mint, &maxt)){
+            max_times.clear();
+            break;
+        }
+        max_times.push_back(maxt);
+    }
+}
+
+void ChainSeriesIterator::reset_series() const{
     cur.reset();
-    if(!series->empty())
-        cur = series->at(0)->iterator();
+    if(i < series->size())
+        cur = series->at(i)->iterator();
 }
 
 bool ChainSeriesIterator::seek(int64_t t) const{
-    for(int j = i; j < series->size(); j ++){
-        std::unique_ptr<SeriesIteratorInterface> temp = series->at(i)->iterator();
-        if(!temp->seek(t))
-            continue;
-        cur.reset();
-        cur = std::move(temp);
+    int j = i;
+    if(!max_times.empty())
+        j = std::lower_bound(max_times.begin() + i, max_times.end(), t) - max_times.begin();
+    if(j != i || !cur){
         i = j;
-        return true;
+        reset_series();
+    }
+    // Only moves on when the rest of series i is deleted or it has no range.
+    while(cur){
+        if(cur->seek(t))
+            return true;
+        if(cur->error())
+            return false;
+        ++ i;
+        reset_series();
     }
     return false;
 }
@@ -30,21 +51,22 @@ std::pair<int64_t, double> ChainSeriesIterator::at() const{
 
 bool ChainSeriesIterator::next() const{
     if(!cur)
-        return false;
-    if(cur->next())
-        return true;
-    if(cur->error())
-        return false;
-    if(i == series->size() - 1)
-        return false;
-    ++ i;
-    cur.reset();
-    cur = series->at(i)->iterator();
-    return next();
+        reset_series();
+    while(cur){
+        if(cur->next())
+            return true;
+        if(cur->error())
+            return false;
+        ++ i;
+        reset_series();
+    }
+    return false;
 }
 
 bool ChainSeriesIterator::error() const{
+    if(!cur)
+        return false;
     return cur->error();
 }
 
-}}
\ No newline at end of file
+}}
@@ -2,6 +2,7 @@
 #define CHAINSERIESITERATOR_H
 
 #include <utility>
+#include <vector>
 
 #include "querier/QuerierUtils.hpp"
 #include "querier/SeriesIteratorInterface.hpp"
@@ -11,12 +12,23 @@ namespace querier{
 
 // chainedSeriesIterator implements a series iterater over a list
 // of time-sorted, non-overlapping iterators.
+//
+// The iterators of the series are created lazily, seek() binary
+// searches the time ranges of the series and never creates the iterators of
+// the skipped ones.
 class ChainSeriesIterator: public SeriesIteratorInterface{
     private:
         std::shared_ptr<Series> series;
         mutable int i;
         mutable std::unique_ptr<SeriesIteratorInterface> cur;
 
+        // max_times[j] is the upper bound of series j, empty if any series
+        // cannot tell its time range.
+        std::vector<int64_t> max_times;
+
+        // Replace cur with the iterator of series i.
+        void reset_series() const;
+
     public:
         ChainSeriesIterator(const std::shared_ptr<Series> & series);
 
@@ -31,4 +43,4 @@ class ChainSeriesIterator: public SeriesIteratorInterface{
 
 }}
 
-#endif
\ No newline at end of file
+#endif
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "querier/ChunkSeries.hpp"
 #include "querier/ChunkSeriesIterator.hpp"
 #include "querier/ChunkSeriesMeta.hpp"
@@ -20,5 +22,13 @@ std::unique_ptr<SeriesIteratorInterface> ChunkSeries::iterator()
         new ChunkSeriesIterator(cm->chunks, cm->intervals, min_time, max_time));
 }
 
+bool ChunkSeries::time_range(int64_t* min_time, int64_t* max_time)
+{
+    if (cm->chunks.empty()) return false;
+    *min_time = std::max(this->min_time, cm->chunks.front()->min_time);
+    *max_time = std::min(this->max_time, cm->chunks.back()->max_time);
+    return true;
+}
+
 } // namespace querier
 } // namespace tsdb
@@ -21,6 +21,7 @@ public:
 
     tagtree::TSID tsid();
     std::unique_ptr<SeriesIteratorInterface> iterator();
+    bool time_range(int64_t* min_time, int64_t* max_time);
 };
 
 } // namespace querier
@@ -1,6 +1,7 @@
 #include "querier/ChunkSeriesIterator.hpp"
 #include "chunk/DeleteIterator.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 namespace tsdb {
@@ -16,7 +17,7 @@ ChunkSeriesIterator::ChunkSeriesIterator(
     const std::vector<std::shared_ptr<chunk::ChunkMeta>>& chunks,
     const tombstone::Intervals& intervals, int64_t min_time, int64_t max_time)
     : chunks(chunks), i(0), min_time(min_time), max_time(max_time),
-      intervals(intervals), err_(false)
+      intervals(intervals), err_(false), valid(false), done(false)
 {
     // std::cerr << "chunks size: " << this->chunks.size() << " " <<
     // this->chunks.empty() << std::endl;
@@ -24,8 +25,13 @@ ChunkSeriesIterator::ChunkSeriesIterator(
         err_ = true;
         return;
     }
+    reset_chunk();
+}
+
+void ChunkSeriesIterator::reset_chunk() const
+{
     std::unique_ptr<chunk::ChunkIteratorInterface> temp =
-        chunks.front()->chunk->iterator();
+        chunks[i]->chunk->iterator();
     if (!intervals.empty())
         cur.reset(new chunk::DeleteIterator(std::move(temp), intervals.cbegin(),
                                             intervals.cend()));
@@ -33,47 +39,62 @@ ChunkSeriesIterator::ChunkSeriesIterator(
         cur.reset();
         cur = std::move(temp);
     }
+    valid = false;
 }
 
-// This method is not available in ChunkIterator
 bool ChunkSeriesIterator::seek(int64_t t) const
 {
-    if (err_) return false;
-    if (t > max_time) return false;
+    if (err_ || done) return false;
+    if (t > max_time) {
+        valid = false;
+        done = true;
+        return false;
+    }
 
     // Seek to the first valid value after t.
     if (t < min_time) t = min_time;
 
-    int last = i;
-
-    while (t > chunks[i]->max_time) {
-        if (i == chunks.size() - 1) return false;
-        ++i;
+    // Never move backwards.
+    if (valid && cur->at().first >= t) return true;
+
+    // Chunks are sorted and non-overlapping, find the first one that can hold
+    // t without touching the chunks in between.
+    auto it = std::lower_bound(
+        chunks.begin() + i, chunks.end(), t,
+        [](const std::shared_ptr<chunk::ChunkMeta>& c, int64_t t) {
+            return c->max_time < t;
+        });
+    if (it == chunks.end()) {
+        valid = false;
+        done = true;
+        return false;
     }
-
-    if (last != i) {
-        std::unique_ptr<chunk::ChunkIteratorInterface> temp =
-            chunks[i]->chunk->iterator();
-        if (intervals.size() > 0)
-            cur.reset(new chunk::DeleteIterator(
-                std::move(temp), intervals.cbegin(), intervals.cend()));
-        else {
-            cur.reset();
-            cur = std::move(temp);
-        }
+    if (it - chunks.begin() != i) {
+        i = it - chunks.begin();
+        reset_chunk();
     }
 
-    while (cur->next()) {
-        if (cur->at().first >= t) return true;
+    while (true) {
+        valid = cur->seek(t);
+        if (valid) return cur->at().first <= max_time;
+        if (cur->error()) {
+            err_ = true;
+            return false;
+        }
+        // The rest of the chunk is deleted.
+        if (i == chunks.size() - 1) return false;
+        ++i;
+        reset_chunk();
     }
-    return false;
 }
 
 std::pair<int64_t, double> ChunkSeriesIterator::at() const { return cur->at(); }
 
 bool ChunkSeriesIterator::next() const
 {
-    if (cur->next()) {
+    if (err_ || done) return false;
+    valid = cur->next();
+    if (valid) {
         std::pair<int64_t, double> p = cur->at();
 
         // Compare with min_time
@@ -97,15 +118,7 @@ bool ChunkSeriesIterator::next() const
     if (i == chunks.size() - 1) return false;
 
     ++i;
-    std::unique_ptr<chunk::ChunkIteratorInterface> temp =
-        chunks[i]->chunk->iterator();
-    if (intervals.size() > 0)
-        cur.reset(new chunk::DeleteIterator(std::move(temp), intervals.cbegin(),
-                                            intervals.cend()));
-    else {
-        cur.reset();
-        cur = std::move(temp);
-    }
+    reset_chunk();
 
     return next();
 }
@@ -22,6 +22,13 @@ private:
     int64_t max_time;
     const tombstone::Intervals& intervals;
     mutable bool err_;
+    // cur is positioned at a sample.
+    mutable bool valid;
+    // A seek() found nothing, the iterator is exhausted.
+    mutable bool done;
+
+    // Replace cur with an iterator over chunks[i].
+    void reset_chunk() const;
 
 public:
     ChunkSeriesIterator(
@@ -29,7 +36,7 @@ public:
         const tombstone::Intervals& intervals, int64_t min_time,
         int64_t max_time);
 
-    // This method is not available in ChunkIterator
+    // Binary searches the chunks by max_time and seeks inside the chunk.
     bool seek(int64_t t) const;
 
     std::pair<int64_t, double> at() const;
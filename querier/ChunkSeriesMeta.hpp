@@ -2,6 +2,7 @@
 #define CHUNKSERIESMETA_H
 
 #include <algorithm>
+#include <limits>
 
 #include "chunk/ChunkMeta.hpp"
 #include "tagtree/tsid.h"
@@ -17,6 +18,11 @@ public:
     std::vector<std::shared_ptr<chunk::ChunkMeta>> chunks;
     tombstone::Intervals intervals;
 
+    // Samples outside [min_time, max_time] are not part of the series, e.g.
+    // the chunks of a querier overlapping its time range.
+    int64_t min_time = std::numeric_limits<int64_t>::min();
+    int64_t max_time = std::numeric_limits<int64_t>::max();
+
     ChunkSeriesMeta() = default;
 
     void clear()
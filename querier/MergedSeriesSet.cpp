@@ -1,35 +1,46 @@
 #include "querier/MergedSeriesSet.hpp"
 #include "base/Logging.hpp"
 #include "querier/ChainSeries.hpp"
+#include "querier/VerticalSeries.hpp"
 
 namespace tsdb {
 namespace querier {
 
 // View it as a collections of blocks sorted by time.
-MergedSeriesSet::MergedSeriesSet(const std::shared_ptr<SeriesSets>& ss)
-    : ss(ss), series(new Series()), err_(false)
+MergedSeriesSet::MergedSeriesSet(const std::shared_ptr<SeriesSets>& ss,
+                                 bool vertical)
+    : ss(ss), heap(ss->size()), series(new Series()), err_(false),
+      vertical(vertical)
 {
     // To move one step for each SeriesInterface.
-    ss->next();
-    if (ss->empty()) err_ = true;
+    for (int i = 0; i < ss->size(); i++)
+        advance(i);
+    if (heap.empty()) err_ = true;
+}
+
+void MergedSeriesSet::advance(int i) const
+{
+    if (ss->at(i)->next()) heap.push({ss->at(i)->at()->tsid(), i});
 }
 
 bool MergedSeriesSet::next_helper() const
 {
-    ss->next(id);
+    for (int i : id)
+        advance(i);
 
     series->clear();
     id.clear();
 
-    if (ss->empty()) {
+    if (heap.empty()) {
         err_ = true;
         return false;
     }
 
-    id.push_back(0);
-    for (int i = 1; i < ss->size(); i++) {
-        id.push_back(i);
-    }
+    // Ties are broken by the set index, so id stays sorted by time.
+    std::pair<tagtree::TSID, int> top = heap.pop();
+    id.push_back(top.second);
+    while (!heap.empty() && heap.front().first == top.first)
+        id.push_back(heap.pop().second);
     for (int i : id)
         series->push_back(ss->at(i)->at());
     return true;
@@ -47,6 +58,8 @@ std::shared_ptr<SeriesInterface> MergedSeriesSet::at()
         return nullptr;
     else if (id.size() == 1)
         return (*series)[0];
+    else if (vertical)
+        return std::shared_ptr<SeriesInterface>(new VerticalSeries(series));
     else {
         // LOG_INFO << "Create ChainSeries(same lset in several
         // SeriesSetInterface), num of SeriesInterface: " << series->size();
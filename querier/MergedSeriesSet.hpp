@@ -3,6 +3,7 @@
 
 #include <deque>
 
+#include "base/Heap.hpp"
 #include "querier/QuerierUtils.hpp"
 #include "querier/SeriesInterface.hpp"
 #include "querier/SeriesSetInterface.hpp"
@@ -11,18 +12,29 @@ namespace tsdb{
 namespace querier{
 
 // View it as a collections of blocks sorted by time.
+//
+// Every SeriesSetInterface must iterate its series in TSID order. The sets are
+// k-way merged by TSID with a min heap of <TSID, set index>, so series with
+// equal TSIDs are chained in the order of the sets (i.e. by time).
+//
+// When vertical is set the sets may overlap in time, and series with equal
+// TSIDs are merged sample by sample through VerticalSeries instead.
 class MergedSeriesSet: public SeriesSetInterface{
     private:
         mutable std::shared_ptr<SeriesSets> ss;
-        // std::shared_ptr<SeriesInterface> cur;
+        mutable base::MinHeap<std::pair<tagtree::TSID, int>> heap;
 
         // For SeriesInterface s that have same labels.
         mutable std::shared_ptr<Series> series;
         mutable std::deque<int> id;
         mutable bool err_;
+        bool vertical;
+
+        // Advance the sets of the current group and push them back to heap.
+        void advance(int i) const;
 
     public:
-        MergedSeriesSet(const std::shared_ptr<SeriesSets> & ss);
+        MergedSeriesSet(const std::shared_ptr<SeriesSets> & ss, bool vertical=false);
 
         bool next_helper() const;
 
@@ -35,4 +47,4 @@ class MergedSeriesSet: public SeriesSetInterface{
 
 }}
 
-#endif
\ No newline at end of file
+#endif
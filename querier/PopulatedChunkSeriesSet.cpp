@@ -1,5 +1,8 @@
+#include <algorithm>
+
 #include "querier/PopulatedChunkSeriesSet.hpp"
 #include "base/Logging.hpp"
+#include "chunk/DecodedChunk.hpp"
 
 namespace tsdb {
 namespace querier {
@@ -15,7 +18,17 @@ PopulatedChunkSeriesSet::PopulatedChunkSeriesSet(
     const std::shared_ptr<block::ChunkReaderInterface>& chunkr,
     int64_t min_time, int64_t max_time)
     : set(set), chunkr(chunkr), min_time(min_time), max_time(max_time),
-      cm(new ChunkSeriesMeta())
+      cm(new ChunkSeriesMeta()), err_(false), missing_(false)
+{}
+
+PopulatedChunkSeriesSet::PopulatedChunkSeriesSet(
+    const std::shared_ptr<ChunkSeriesSetInterface>& set,
+    const std::shared_ptr<block::ChunkReaderInterface>& chunkr,
+    int64_t min_time, int64_t max_time,
+    const std::shared_ptr<chunk::ChunkCache>& cache, const ulid::ULID& ulid)
+    : set(set), chunkr(chunkr), min_time(min_time), max_time(max_time),
+      cache(cache), ulid(ulid), cm(new ChunkSeriesMeta()), err_(false),
+      missing_(false)
 {}
 
 // next() always called before at().
@@ -26,47 +39,81 @@ const std::shared_ptr<ChunkSeriesMeta>& PopulatedChunkSeriesSet::at() const
 
 bool PopulatedChunkSeriesSet::next() const
 {
-    while (set->next()) {
-        cm = set->at();
+    if (batch.empty() && !fill()) return false;
+    cm = batch.front();
+    batch.pop_front();
+    return true;
+}
 
-        while (!cm->chunks.empty()) {
-            if (cm->chunks[0]->max_time >= min_time) break;
-            cm->chunks.erase(cm->chunks.begin());
-        }
+bool PopulatedChunkSeriesSet::fill() const
+{
+    if (err_) return false;
+    if (missing_) {
+        err_ = true;
+        return false;
+    }
 
-        // This is to delete in place while iterating.
-        for (int i = 0, rlen = cm->chunks.size(); i < rlen; i++) {
-            int j = i - (rlen - cm->chunks.size());
+    // Refs of the chunks to read, where to put them and the index of their
+    // series in batch.
+    std::vector<std::pair<tagtree::TSID, uint64_t>> refs;
+    std::vector<std::shared_ptr<chunk::ChunkMeta>> targets;
+    std::vector<int> owners;
+    while (batch.size() < POPULATE_BATCH_SERIES && set->next()) {
+        // The underlying set reuses its ChunkSeriesMeta.
+        std::shared_ptr<ChunkSeriesMeta> c(new ChunkSeriesMeta(*set->at()));
 
-            // Break out at the first chunk that has no overlap with mint, maxt.
-            if (cm->chunks[j]->min_time > max_time) {
-                int chunk_size = cm->chunks.size();
-                for (int k = j; k < chunk_size; k++)
-                    cm->chunks.pop_back();
-                break;
-            }
+        // Chunks are sorted by min_time, keep the ones overlapping
+        // [min_time, max_time].
+        size_t b = 0;
+        while (b < c->chunks.size() && c->chunks[b]->max_time < min_time)
+            ++b;
+        size_t e = b;
+        while (e < c->chunks.size() && c->chunks[e]->min_time <= max_time)
+            ++e;
+        c->chunks.erase(c->chunks.begin() + e, c->chunks.end());
+        c->chunks.erase(c->chunks.begin(), c->chunks.begin() + b);
+        if (c->chunks.empty()) continue;
+        c->min_time = std::max(c->min_time, min_time);
+        c->max_time = std::min(c->max_time, max_time);
 
-            std::tie(cm->chunks[j]->chunk, err_) =
-                chunkr->chunk(cm->tsid, cm->chunks[j]->ref);
-            err_ = !err_;
-            if (err_) {
-                // This means that the chunk has be garbage collected. Remove it
-                // from the list. Only used in Head --> in-momery ErrNotFound
-                // chunks[j]->chunk.reset();
-                cm->chunks.clear();
-                return false;
+        for (auto const& m : c->chunks) {
+            if (cache) {
+                m->chunk = cache->get(ulid, m->ref);
+                if (m->chunk) continue;
             }
+            refs.emplace_back(c->tsid, m->ref);
+            targets.push_back(m);
+            owners.push_back(batch.size());
         }
+        batch.push_back(c);
+    }
+    if (set->error()) err_ = true;
 
-        if (cm->chunks.empty()) {
-            continue;
+    if (!refs.empty()) {
+        std::pair<std::vector<std::shared_ptr<chunk::ChunkInterface>>, bool> r =
+            chunkr->chunks(refs);
+        size_t n = targets.size();
+        if (!r.second) {
+            // This means that the chunk has be garbage collected. Only used in
+            // Head --> in-momery ErrNotFound
+            n = 0;
+            while (n < targets.size() && r.first[n])
+                ++n;
+            // Keep the series before the one of the first missing chunk, the
+            // error is reported when reaching it.
+            batch.erase(batch.begin() + owners[n], batch.end());
+            missing_ = true;
+        }
+        for (size_t i = 0; i < n && static_cast<size_t>(owners[i]) < batch.size(); i++) {
+            if (cache) {
+                targets[i]->chunk = std::shared_ptr<chunk::ChunkInterface>(
+                    new chunk::DecodedChunk(r.first[i]));
+                cache->insert(ulid, targets[i]->ref, targets[i]->chunk);
+            } else
+                targets[i]->chunk = r.first[i];
         }
-
-        return true;
     }
-
-    if (set->error()) err_ = true;
-    return false;
+    return !batch.empty();
 }
 
 bool PopulatedChunkSeriesSet::error() const { return err_; }
@@ -1,13 +1,19 @@
 #ifndef POPULATEDCHUNKSERIESSET_H
 #define POPULATEDCHUNKSERIESSET_H
 
+#include <deque>
+
 #include "block/ChunkReaderInterface.hpp"
+#include "chunk/ChunkCache.hpp"
 #include "querier/ChunkSeriesMeta.hpp"
 #include "querier/ChunkSeriesSetInterface.hpp"
 
 namespace tsdb{
 namespace querier{
 
+// Number of series whose chunks are fetched with one ChunkReaderInterface::chunks().
+const int POPULATE_BATCH_SERIES = 64;
+
 // Similar to BaseChunkSeriesSet, but it has two extra fields: 1.min_time 2.max_time,
 // which are used for filtering the chunks not in time range.
 // NOTE(Alec), PopulatedChunkSeriesSet coarse-grained filters the chunks using min_time and max_time.
@@ -19,8 +25,18 @@ class PopulatedChunkSeriesSet: public ChunkSeriesSetInterface{
         int64_t min_time;
         int64_t max_time;
 
+        // Optional, shared by all queriers of a DB.
+        std::shared_ptr<chunk::ChunkCache> cache;
+        ulid::ULID ulid;
+
         mutable std::shared_ptr<ChunkSeriesMeta> cm;
+        mutable std::deque<std::shared_ptr<ChunkSeriesMeta>> batch;
         mutable bool err_;
+        // A chunk of the series after batch is missing.
+        mutable bool missing_;
+
+        // Load the chunks of the next POPULATE_BATCH_SERIES series into batch.
+        bool fill() const;
 
     public:
         PopulatedChunkSeriesSet(const std::shared_ptr<ChunkSeriesSetInterface> & set, 
@@ -28,6 +44,15 @@ class PopulatedChunkSeriesSet: public ChunkSeriesSetInterface{
             int64_t min_time,
             int64_t max_time);
 
+        // Decoded chunks are looked up in and added to cache under the ulid
+        // of the block chunkr belongs to.
+        PopulatedChunkSeriesSet(const std::shared_ptr<ChunkSeriesSetInterface> & set, 
+            const std::shared_ptr<block::ChunkReaderInterface> & chunkr,
+            int64_t min_time,
+            int64_t max_time,
+            const std::shared_ptr<chunk::ChunkCache> & cache,
+            const ulid::ULID & ulid);
+
         // next() always called before at().
         const std::shared_ptr<ChunkSeriesMeta> & at() const;
 
@@ -0,0 +1,171 @@
+#include <boost/bind.hpp>
+
+#include "base/Logging.hpp"
+#include "querier/PrefetchSeriesSet.hpp"
+
+namespace tsdb {
+namespace querier {
+
+PrefetchedSeries::PrefetchedSeries(
+    tagtree::TSID tsid,
+    const std::shared_ptr<std::vector<std::pair<int64_t, double>>>& samples)
+    : tsid_(tsid), samples(samples)
+{}
+
+std::unique_ptr<SeriesIteratorInterface> PrefetchedSeries::iterator()
+{
+    return std::unique_ptr<SeriesIteratorInterface>(
+        new PrefetchedSeriesIterator(samples));
+}
+
+bool PrefetchedSeries::time_range(int64_t* min_time, int64_t* max_time)
+{
+    if (samples->empty()) return false;
+    *min_time = samples->front().first;
+    *max_time = samples->back().first;
+    return true;
+}
+
+PrefetchedSeriesIterator::PrefetchedSeriesIterator(
+    const std::shared_ptr<std::vector<std::pair<int64_t, double>>>& samples)
+    : samples(samples), i(-1)
+{}
+
+bool PrefetchedSeriesIterator::seek(int64_t t) const
+{
+    int from = i < 0 ? 0 : i;
+    if (from >= static_cast<int>(samples->size())) return false;
+    auto it = std::lower_bound(
+        samples->begin() + from, samples->end(), t,
+        [](const std::pair<int64_t, double>& lhs, int64_t rhs) {
+            return lhs.first < rhs;
+        });
+    i = it - samples->begin();
+    return i < static_cast<int>(samples->size());
+}
+
+std::pair<int64_t, double> PrefetchedSeriesIterator::at() const
+{
+    return (*samples)[i];
+}
+
+bool PrefetchedSeriesIterator::next() const
+{
+    if (i >= static_cast<int>(samples->size())) return false;
+    ++i;
+    return i < static_cast<int>(samples->size());
+}
+
+PrefetchState::PrefetchState(
+    const std::shared_ptr<QuerierInterface>& q,
+    const std::shared_ptr<const std::unordered_set<tagtree::TSID>>& l,
+    const std::shared_ptr<base::ThreadPool>& pool, int capacity)
+    : q(q), l(l), pool(pool), capacity(capacity < 2 ? 2 : capacity),
+      mutex_(), cond_(mutex_), inflight(false), done(false)
+{}
+
+PrefetchSeriesSet::PrefetchSeriesSet(
+    const std::shared_ptr<QuerierInterface>& q,
+    const std::shared_ptr<const std::unordered_set<tagtree::TSID>>& l,
+    const std::shared_ptr<base::ThreadPool>& pool, int capacity)
+    : state(new PrefetchState(q, l, pool, capacity))
+{
+    // Start resolving the series right away so that all blocks are looked up
+    // concurrently.
+    state->inflight = true;
+    schedule(state);
+}
+
+void PrefetchSeriesSet::schedule(const std::shared_ptr<PrefetchState>& state)
+{
+    state->pool->run(boost::bind(&PrefetchSeriesSet::fill, state),
+                     base::TASK_PRIORITY_HIGH);
+}
+
+void PrefetchSeriesSet::fill(const std::shared_ptr<PrefetchState>& state)
+{
+    if (!state->ss) {
+        state->ss = state->q->select(*(state->l));
+        if (!state->ss) {
+            base::MutexLockGuard lock(state->mutex_);
+            state->done = true;
+            state->inflight = false;
+            state->cond_.notifyAll();
+            return;
+        }
+    }
+
+    while (true) {
+        {
+            base::MutexLockGuard lock(state->mutex_);
+            if (static_cast<int>(state->buffer.size()) >= state->capacity) {
+                state->inflight = false;
+                return;
+            }
+        }
+
+        if (!state->ss->next()) {
+            base::MutexLockGuard lock(state->mutex_);
+            state->done = true;
+            state->inflight = false;
+            if (state->ss->error_detail())
+                state->err_.set(state->ss->error_detail());
+            state->cond_.notifyAll();
+            return;
+        }
+
+        // Decode now, the chunks behind at() are only valid until the next
+        // call of next().
+        std::shared_ptr<SeriesInterface> s = state->ss->at();
+        std::shared_ptr<std::vector<std::pair<int64_t, double>>> samples(
+            new std::vector<std::pair<int64_t, double>>());
+        std::unique_ptr<SeriesIteratorInterface> it = s->iterator();
+        while (it->next())
+            samples->push_back(it->at());
+
+        base::MutexLockGuard lock(state->mutex_);
+        state->buffer.emplace_back(new PrefetchedSeries(s->tsid(), samples));
+        state->cond_.notifyAll();
+    }
+}
+
+bool PrefetchSeriesSet::next() const
+{
+    bool kick = false;
+    {
+        base::MutexLockGuard lock(state->mutex_);
+        while (state->buffer.empty() && !state->done)
+            state->cond_.wait();
+        if (state->buffer.empty()) {
+            cur.reset();
+            return false;
+        }
+        cur = state->buffer.front();
+        state->buffer.pop_front();
+
+        if (!state->inflight && !state->done &&
+            static_cast<int>(state->buffer.size()) <= state->capacity / 2) {
+            state->inflight = true;
+            kick = true;
+        }
+    }
+    if (kick) schedule(state);
+    return true;
+}
+
+std::shared_ptr<SeriesInterface> PrefetchSeriesSet::at() { return cur; }
+
+bool PrefetchSeriesSet::error() const
+{
+    base::MutexLockGuard lock(state->mutex_);
+    return static_cast<bool>(state->err_);
+}
+
+error::Error PrefetchSeriesSet::error_detail() const
+{
+    base::MutexLockGuard lock(state->mutex_);
+    return state->err_;
+}
+
+} // namespace querier
+} // namespace tsdb
@@ -0,0 +1,110 @@
+#ifndef PREFETCHSERIESSET_H
+#define PREFETCHSERIESSET_H
+
+#include <deque>
+#include <unordered_set>
+#include <vector>
+
+#include "base/Condition.hpp"
+#include "base/Mutex.hpp"
+#include "base/ThreadPool.hpp"
+#include "querier/QuerierInterface.hpp"
+#include "querier/SeriesInterface.hpp"
+#include "querier/SeriesSetInterface.hpp"
+
+namespace tsdb {
+namespace querier {
+
+// PrefetchedSeries holds the decoded samples of one series.
+class PrefetchedSeries : public SeriesInterface {
+private:
+    tagtree::TSID tsid_;
+    std::shared_ptr<std::vector<std::pair<int64_t, double>>> samples;
+
+public:
+    PrefetchedSeries(
+        tagtree::TSID tsid,
+        const std::shared_ptr<std::vector<std::pair<int64_t, double>>>&
+            samples);
+
+    tagtree::TSID tsid() { return tsid_; }
+
+    std::unique_ptr<SeriesIteratorInterface> iterator();
+
+    bool time_range(int64_t* min_time, int64_t* max_time);
+};
+
+class PrefetchedSeriesIterator : public SeriesIteratorInterface {
+private:
+    std::shared_ptr<std::vector<std::pair<int64_t, double>>> samples;
+    mutable int i;
+
+public:
+    PrefetchedSeriesIterator(
+        const std::shared_ptr<std::vector<std::pair<int64_t, double>>>&
+            samples);
+
+    bool seek(int64_t t) const;
+    std::pair<int64_t, double> at() const;
+    bool next() const;
+    bool error() const { return false; }
+};
+
+// Shared between a PrefetchSeriesSet and the fill task running on the pool,
+// so that the task can outlive the set.
+class PrefetchState {
+public:
+    std::shared_ptr<QuerierInterface> q;
+    std::shared_ptr<const std::unordered_set<tagtree::TSID>> l;
+    std::shared_ptr<base::ThreadPool> pool;
+    std::shared_ptr<SeriesSetInterface> ss; // Only touched by the fill task.
+    int capacity;
+
+    base::MutexLock mutex_;
+    base::Condition cond_;
+    std::deque<std::shared_ptr<SeriesInterface>> buffer;
+    bool inflight;
+    bool done;
+    error::Error err_;
+
+    PrefetchState(const std::shared_ptr<QuerierInterface>& q,
+                  const std::shared_ptr<const std::unordered_set<tagtree::TSID>>& l,
+                  const std::shared_ptr<base::ThreadPool>& pool, int capacity);
+};
+
+// PrefetchSeriesSet resolves and decodes the series of one querier on a
+// thread pool, keeping at most capacity decoded series buffered ahead of the
+// consumer.
+//
+// The fill task never blocks on the consumer. It returns once the
+// buffer is full and is rescheduled by next() when the buffer drains below
+// half, so a pool smaller than the number of blocks cannot deadlock.
+class PrefetchSeriesSet : public SeriesSetInterface {
+private:
+    std::shared_ptr<PrefetchState> state;
+    mutable std::shared_ptr<SeriesInterface> cur;
+
+    static void fill(const std::shared_ptr<PrefetchState>& state);
+
+    // Must be called without holding state->mutex_.
+    static void schedule(const std::shared_ptr<PrefetchState>& state);
+
+public:
+    PrefetchSeriesSet(
+        const std::shared_ptr<QuerierInterface>& q,
+        const std::shared_ptr<const std::unordered_set<tagtree::TSID>>& l,
+        const std::shared_ptr<base::ThreadPool>& pool, int capacity);
+
+    bool next() const;
+
+    std::shared_ptr<SeriesInterface> at();
+
+    bool error() const;
+
+    error::Error error_detail() const;
+};
+
+} // namespace querier
+} // namespace tsdb
+
+#endif
@@ -3,6 +3,7 @@
 #include "base/Logging.hpp"
 #include "querier/EmptySeriesSet.hpp"
 #include "querier/MergedSeriesSet.hpp"
+#include "querier/PrefetchSeriesSet.hpp"
 #include "querier/Querier.hpp"
 
 namespace tsdb {
@@ -10,16 +11,34 @@ namespace querier {
 
 Querier::Querier(
     const std::initializer_list<std::shared_ptr<QuerierInterface>>& list)
-    : queriers(list.begin(), list.end())
+    : queriers(list.begin(), list.end()), prefetch_series(0), vertical_(false)
 {}
-Querier::Querier(const std::vector<std::shared_ptr<QuerierInterface>>& queriers)
-    : queriers(queriers)
+Querier::Querier(const std::vector<std::shared_ptr<QuerierInterface>>& queriers,
+                 bool vertical)
+    : queriers(queriers), prefetch_series(0), vertical_(vertical)
+{}
+Querier::Querier(const std::vector<std::shared_ptr<QuerierInterface>>& queriers,
+                 const std::shared_ptr<base::ThreadPool>& pool,
+                 int prefetch_series, bool vertical)
+    : queriers(queriers), pool_(pool), prefetch_series(prefetch_series),
+      vertical_(vertical)
 {}
 
 std::shared_ptr<SeriesSetInterface>
 Querier::select(const std::unordered_set<tagtree::TSID>& l) const
 {
     std::shared_ptr<SeriesSets> ss(new SeriesSets());
+    if (pool_ && queriers.size() > 1) {
+        // The queriers keep their (time) order inside SeriesSets, so every
+        // series is still chained in time order by MergedSeriesSet.
+        std::shared_ptr<const std::unordered_set<tagtree::TSID>> lp(
+            new std::unordered_set<tagtree::TSID>(l));
+        for (auto const& querier : queriers)
+            ss->push_back(std::shared_ptr<SeriesSetInterface>(
+                new PrefetchSeriesSet(querier, lp, pool_, prefetch_series)));
+        return std::shared_ptr<SeriesSetInterface>(
+            new MergedSeriesSet(ss, vertical_));
+    }
     for (auto const& querier : queriers) {
         auto i = querier->select(l);
         if (i) ss->push_back(i);
@@ -27,11 +46,32 @@ Querier::select(const std::unordered_set<tagtree::TSID>& l) const
     if (!ss->empty()) {
         // LOG_INFO << "Create MergedSeriesSet, num of SeriesSetInterface: " <<
         // ss->size();
-        return std::shared_ptr<SeriesSetInterface>(new MergedSeriesSet(ss));
+        return std::shared_ptr<SeriesSetInterface>(
+            new MergedSeriesSet(ss, vertical_));
     } else
         return nullptr;
 }
 
+error::Error Querier::aggregate(const AggregateRequest& req,
+                                AggregateResult* result) const
+{
+    std::unordered_set<tagtree::TSID> l;
+    for (auto const& g : req.groups)
+        l.insert(g.first);
+
+    std::shared_ptr<ChunkSeriesSets> css(new ChunkSeriesSets());
+    for (auto const& querier : queriers) {
+        auto i = querier->chunk_select(l);
+        if (!i) {
+            css.reset();
+            break;
+        }
+        css->push_back(i);
+    }
+    if (css) return aggregate_chunk_series_sets(css, req, result);
+    return aggregate_series_set(select(l), req, result);
+}
+
 error::Error Querier::error() const
 {
     std::string err;
@@ -3,6 +3,7 @@
 
 #include <unordered_set>
 
+#include "base/ThreadPool.hpp"
 #include "querier/QuerierInterface.hpp"
 
 namespace tsdb {
@@ -12,15 +13,32 @@ class Querier : public QuerierInterface {
 private:
     std::vector<std::shared_ptr<QuerierInterface>> queriers;
 
+    // When set, every sub-querier is resolved and decoded on the pool with at
+    // most prefetch_series series buffered ahead of the consumer.
+    std::shared_ptr<base::ThreadPool> pool_;
+    int prefetch_series = 0;
+
+    // The sub-queriers may overlap in time, see MergedSeriesSet.
+    bool vertical_ = false;
+
 public:
     Querier() = default;
     Querier(
         const std::initializer_list<std::shared_ptr<QuerierInterface>>& list);
-    Querier(const std::vector<std::shared_ptr<QuerierInterface>>& queriers);
+    Querier(const std::vector<std::shared_ptr<QuerierInterface>>& queriers,
+            bool vertical = false);
+    Querier(const std::vector<std::shared_ptr<QuerierInterface>>& queriers,
+            const std::shared_ptr<base::ThreadPool>& pool, int prefetch_series,
+            bool vertical = false);
 
     std::shared_ptr<SeriesSetInterface>
     select(const std::unordered_set<tagtree::TSID>& l) const;
 
+    // Evaluated block by block over decoded chunks when every sub-querier
+    // exposes them, otherwise over the series from select().
+    error::Error aggregate(const AggregateRequest& req,
+                           AggregateResult* result) const;
+
     error::Error error() const;
 };
 
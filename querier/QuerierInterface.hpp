@@ -8,6 +8,8 @@
 #include "tagtree/tsid.h"
 #include "label/Label.hpp"
 #include "label/MatcherInterface.hpp"
+#include "querier/Aggregator.hpp"
+#include "querier/ChunkSeriesSetInterface.hpp"
 #include "querier/SeriesSetInterface.hpp"
 
 namespace tsdb {
@@ -19,6 +21,24 @@ public:
     virtual std::shared_ptr<SeriesSetInterface>
     select(const std::unordered_set<tagtree::TSID>& l) const = 0;
 
+    // Return the populated chunks of the matching series in TSID order, or
+    // nullptr if the querier cannot expose chunks.
+    virtual std::shared_ptr<ChunkSeriesSetInterface>
+    chunk_select(const std::unordered_set<tagtree::TSID>& l) const
+    {
+        return nullptr;
+    }
+
+    // Evaluate a cross-series aggregation, see AggregateRequest.
+    virtual error::Error aggregate(const AggregateRequest& req,
+                                   AggregateResult* result) const
+    {
+        std::unordered_set<tagtree::TSID> l;
+        for (auto const& g : req.groups)
+            l.insert(g.first);
+        return aggregate_series_set(select(l), req, result);
+    }
+
     virtual error::Error error() const = 0;
     virtual ~QuerierInterface() = default;
 };
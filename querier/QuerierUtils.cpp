@@ -34,6 +34,18 @@ int Series::size() { return series.size(); }
 
 bool Series::empty() { return series.empty(); }
 
+bool Series::time_range(int64_t* min_time, int64_t* max_time)
+{
+    if (series.empty()) return false;
+    for (int i = 0; i < series.size(); i++) {
+        int64_t mint, maxt;
+        if (!series[i]->time_range(&mint, &maxt)) return false;
+        if (i == 0 || mint < *min_time) *min_time = mint;
+        if (i == 0 || maxt > *max_time) *max_time = maxt;
+    }
+    return true;
+}
+
 SeriesSets::SeriesSets(
     const std::deque<std::shared_ptr<SeriesSetInterface>>& ss)
     : ss(ss)
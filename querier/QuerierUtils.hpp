@@ -28,6 +28,9 @@ public:
     std::shared_ptr<SeriesInterface>& at(int i);
     int size();
     bool empty();
+
+    // Union of the time ranges of all series, false if any is unknown.
+    bool time_range(int64_t* min_time, int64_t* max_time);
 };
 
 class SeriesSets {
@@ -0,0 +1,162 @@
+#include <algorithm>
+
+#include "querier/RangeFunctionIterator.hpp"
+
+namespace tsdb {
+namespace querier {
+
+namespace {
+
+bool extrapolated_rate(bool is_rate, const int64_t* ts, const double* vs,
+                       size_t n, int64_t t, int64_t range, double* v)
+{
+    if (n < 2) return false;
+
+    double result = vs[n - 1] - vs[0];
+    double prev = vs[0];
+    for (size_t i = 0; i < n; i++) {
+        // Counter reset.
+        if (vs[i] < prev) result += prev;
+        prev = vs[i];
+    }
+
+    double range_start = static_cast<double>(t - range) / 1000;
+    double range_end = static_cast<double>(t) / 1000;
+    double first_t = static_cast<double>(ts[0]) / 1000;
+    double last_t = static_cast<double>(ts[n - 1]) / 1000;
+    double duration_to_start = first_t - range_start;
+    double duration_to_end = range_end - last_t;
+    double sampled_interval = last_t - first_t;
+    double average_duration_between_samples =
+        sampled_interval / static_cast<double>(n - 1);
+
+    // If the first/last samples are close to the boundaries of the range,
+    // extrapolate the result. Otherwise extrapolate by half an interval.
+    double extrapolation_threshold = average_duration_between_samples * 1.1;
+    if (duration_to_start >= extrapolation_threshold)
+        duration_to_start = average_duration_between_samples / 2;
+    // Counters cannot be negative, do not extrapolate below zero.
+    if (result > 0 && vs[0] >= 0) {
+        double duration_to_zero = sampled_interval * (vs[0] / result);
+        if (duration_to_zero < duration_to_start)
+            duration_to_start = duration_to_zero;
+    }
+    if (duration_to_end >= extrapolation_threshold)
+        duration_to_end = average_duration_between_samples / 2;
+
+    result *= (sampled_interval + duration_to_start + duration_to_end) /
+              sampled_interval;
+    if (is_rate) result /= static_cast<double>(range) / 1000;
+    *v = result;
+    return true;
+}
+
+} // namespace
+
+bool range_function(RangeFunction func, const int64_t* ts, const double* vs,
+                    size_t n, int64_t t, int64_t range, double* v)
+{
+    if (n == 0) return false;
+    switch (func) {
+        case RANGE_RATE:
+            return extrapolated_rate(true, ts, vs, n, t, range, v);
+        case RANGE_INCREASE:
+            return extrapolated_rate(false, ts, vs, n, t, range, v);
+        case RANGE_MIN_OVER_TIME:
+            *v = *std::min_element(vs, vs + n);
+            return true;
+        case RANGE_MAX_OVER_TIME:
+            *v = *std::max_element(vs, vs + n);
+            return true;
+        case RANGE_AVG_OVER_TIME:
+        case RANGE_SUM_OVER_TIME:
+            *v = 0;
+            for (size_t i = 0; i < n; i++)
+                *v += vs[i];
+            if (func == RANGE_AVG_OVER_TIME) *v /= n;
+            return true;
+        case RANGE_COUNT_OVER_TIME:
+            *v = n;
+            return true;
+    }
+    return false;
+}
+
+RangeFunctionIterator::RangeFunctionIterator(
+    std::unique_ptr<SeriesIteratorInterface>&& it, RangeFunction func,
+    int64_t range, int64_t start, int64_t end, int64_t step)
+    : it(std::move(it)), func(func), range(range), start(start), end(end),
+      step(step > 0 ? step : 1), t(start), lo(0), pending(false),
+      exhausted(false), valid(false)
+{}
+
+void RangeFunctionIterator::fill() const
+{
+    int64_t lower = t - range;
+    while (lo < wts.size() && wts[lo] <= lower)
+        ++lo;
+    // Drop the samples left behind once they are the larger part.
+    if (lo > 0 && lo * 2 >= wts.size()) {
+        wts.erase(wts.begin(), wts.begin() + lo);
+        wvs.erase(wvs.begin(), wvs.begin() + lo);
+        lo = 0;
+    }
+
+    if (!pending && !exhausted) {
+        pending = it->seek(lower + 1);
+        exhausted = !pending;
+    }
+    while (pending) {
+        std::pair<int64_t, double> p = it->at();
+        if (p.first > t) break;
+        if (p.first <= lower) {
+            // Skip the gap between two windows.
+            pending = it->seek(lower + 1);
+            if (pending && it->at().first <= lower) pending = it->next();
+        } else {
+            wts.push_back(p.first);
+            wvs.push_back(p.second);
+            pending = it->next();
+        }
+        exhausted = !pending;
+    }
+}
+
+bool RangeFunctionIterator::seek(int64_t t) const
+{
+    if (valid && cur.first >= t) return true;
+    if (t > this->t) {
+        // Align to the first step >= t.
+        int64_t n = (t - start + step - 1) / step;
+        this->t = start + n * step;
+    }
+    return next();
+}
+
+std::pair<int64_t, double> RangeFunctionIterator::at() const { return cur; }
+
+bool RangeFunctionIterator::next() const
+{
+    while (t <= end) {
+        fill();
+        double v;
+        bool ok = range_function(func, wts.data() + lo, wvs.data() + lo,
+                                 wts.size() - lo, t, range, &v);
+        int64_t ts = t;
+        t += step;
+        if (ok) {
+            cur = {ts, v};
+            valid = true;
+            return true;
+        }
+        if (exhausted && empty()) break;
+    }
+    t = end + step;
+    valid = false;
+    return false;
+}
+
+bool RangeFunctionIterator::error() const { return it->error(); }
+
+} // namespace querier
+} // namespace tsdb
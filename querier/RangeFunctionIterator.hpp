@@ -0,0 +1,112 @@
+#ifndef RANGEFUNCTIONITERATOR_H
+#define RANGEFUNCTIONITERATOR_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "querier/SeriesInterface.hpp"
+#include "querier/SeriesIteratorInterface.hpp"
+
+namespace tsdb {
+namespace querier {
+
+enum RangeFunction {
+    RANGE_RATE,
+    RANGE_INCREASE,
+    RANGE_MIN_OVER_TIME,
+    RANGE_MAX_OVER_TIME,
+    RANGE_AVG_OVER_TIME,
+    RANGE_SUM_OVER_TIME,
+    RANGE_COUNT_OVER_TIME
+};
+
+// range_function evaluates func at t over the n samples of ts and vs, which
+// must be the samples of the window (t - range, t] in time order. Return false
+// when the window does not hold enough samples, e.g. less than two for rate.
+//
+// rate and increase are counter-reset aware and extrapolated to the window
+// boundaries the same way as Prometheus' extrapolatedRate.
+bool range_function(RangeFunction func, const int64_t* ts, const double* vs,
+                    size_t n, int64_t t, int64_t range, double* v);
+
+// RangeFunctionIterator evaluates a range function over the window
+// (t - range, t] at every step t in [start, end] and yields one point per
+// step. Steps whose window does not hold enough samples are skipped. It is
+// meant for series only exposed as iterators, aggregations evaluate range
+// functions over the decoded samples of each series, see
+// AggregateRequest::range.
+//
+// When the step is larger than the range the underlying iterator
+// is seeked to the next window, so the samples between windows are never
+// decoded into the window buffer.
+class RangeFunctionIterator : public SeriesIteratorInterface {
+private:
+    std::unique_ptr<SeriesIteratorInterface> it;
+    RangeFunction func;
+    int64_t range;
+    int64_t start;
+    int64_t end;
+    int64_t step;
+
+    mutable int64_t t; // Timestamp of the next step to evaluate.
+    // The window is [lo, size) of wts and wvs.
+    mutable std::vector<int64_t> wts;
+    mutable std::vector<double> wvs;
+    mutable size_t lo;
+    // Whether it is positioned at a sample not yet moved into window.
+    mutable bool pending;
+    mutable bool exhausted;
+    mutable bool valid;
+    mutable std::pair<int64_t, double> cur;
+
+    // Fill window with the samples of (t - range, t].
+    void fill() const;
+
+    bool empty() const { return lo == wts.size(); }
+
+public:
+    RangeFunctionIterator(std::unique_ptr<SeriesIteratorInterface>&& it,
+                          RangeFunction func, int64_t range, int64_t start,
+                          int64_t end, int64_t step);
+
+    bool seek(int64_t t) const;
+
+    std::pair<int64_t, double> at() const;
+
+    bool next() const;
+
+    bool error() const;
+};
+
+class RangeFunctionSeries : public SeriesInterface {
+private:
+    std::shared_ptr<SeriesInterface> series;
+    RangeFunction func;
+    int64_t range;
+    int64_t start;
+    int64_t end;
+    int64_t step;
+
+public:
+    RangeFunctionSeries(const std::shared_ptr<SeriesInterface>& series,
+                        RangeFunction func, int64_t range, int64_t start,
+                        int64_t end, int64_t step)
+        : series(series), func(func), range(range), start(start), end(end),
+          step(step)
+    {}
+
+    tagtree::TSID tsid() { return series->tsid(); }
+
+    std::unique_ptr<SeriesIteratorInterface> iterator()
+    {
+        return std::unique_ptr<SeriesIteratorInterface>(
+            new RangeFunctionIterator(series->iterator(), func, range, start,
+                                      end, step));
+    }
+};
+
+} // namespace querier
+} // namespace tsdb
+
+#endif
@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <limits>
+
+#include "querier/PrefetchSeriesSet.hpp"
+#include "querier/ResultCache.hpp"
+
+namespace tsdb {
+namespace querier {
+
+namespace {
+
+// Copy the samples of c within [mint, maxt], shares c when nothing is cut.
+SampleColumn window(const SampleColumn& c, int64_t mint, int64_t maxt)
+{
+    auto cmp = [](const std::pair<int64_t, double>& s, int64_t t) {
+        return s.first < t;
+    };
+    auto first = std::lower_bound(c->begin(), c->end(), mint, cmp);
+    auto last = std::lower_bound(first, c->end(), maxt, cmp);
+    if (last != c->end() && last->first == maxt) ++last;
+    if (first == c->begin() && last == c->end()) return c;
+    return SampleColumn(
+        new std::vector<std::pair<int64_t, double>>(first, last));
+}
+
+} // namespace
+
+uint64_t ResultCacheEntry::charge() const
+{
+    uint64_t r = sizeof(ResultCacheEntry) +
+                 tsids.size() * sizeof(tagtree::TSID) +
+                 series.size() * (sizeof(series[0]) + 32);
+    for (auto const& s : series)
+        r += s.second->size() * sizeof(std::pair<int64_t, double>);
+    return r;
+}
+
+ResultSeriesSet::ResultSeriesSet(
+    const std::shared_ptr<const ResultCacheEntry>& e)
+    : e(e), i(-1)
+{}
+
+bool ResultSeriesSet::next() const
+{
+    if (i >= static_cast<int>(e->series.size())) return false;
+    ++i;
+    return i < static_cast<int>(e->series.size());
+}
+
+std::shared_ptr<SeriesInterface> ResultSeriesSet::at()
+{
+    if (i < 0 || i >= static_cast<int>(e->series.size())) return nullptr;
+    return std::shared_ptr<SeriesInterface>(
+        new PrefetchedSeries(e->series[i].first, e->series[i].second));
+}
+
+ResultCache::ResultCache(uint64_t capacity)
+    : capacity(capacity), usage(0), epoch_(0), floor_epoch_(0)
+{
+    max_end_.getAndSet(std::numeric_limits<int64_t>::min());
+}
+
+uint64_t ResultCache::hash(const std::vector<tagtree::TSID>& tsids)
+{
+    return boost::hash_range(tsids.begin(), tsids.end());
+}
+
+std::shared_ptr<const ResultCacheEntry>
+ResultCache::get(const std::vector<tagtree::TSID>& tsids)
+{
+    base::MutexLockGuard lock(mutex_);
+    auto it = index.find(hash(tsids));
+    if (it == index.end() || (*it->second)->tsids != tsids) return nullptr;
+    lru.splice(lru.begin(), lru, it->second);
+    return *it->second;
+}
+
+uint64_t ResultCache::begin(int64_t end)
+{
+    base::MutexLockGuard lock(mutex_);
+    // Commits from now on inside the range reach truncate().
+    if (end > max_end_.get()) max_end_.getAndSet(end);
+    return epoch_;
+}
+
+void ResultCache::erase(Index::iterator it)
+{
+    uint64_t h = it->first;
+    for (tagtree::TSID tsid : (*it->second)->tsids) {
+        auto t = by_tsid.find(tsid);
+        if (t == by_tsid.end()) continue;
+        t->second.erase(h);
+        if (t->second.empty()) by_tsid.erase(t);
+    }
+    usage -= (*it->second)->charge();
+    lru.erase(it->second);
+    index.erase(it);
+}
+
+ResultCache::Index::iterator ResultCache::cut(Index::iterator it, int64_t mint)
+{
+    std::shared_ptr<const ResultCacheEntry> e = *it->second;
+    if (mint <= e->start) {
+        erase(it++);
+        return it;
+    }
+    if (mint > e->end) return ++it;
+
+    std::shared_ptr<ResultCacheEntry> r(new ResultCacheEntry());
+    r->tsids = e->tsids;
+    r->start = e->start;
+    r->end = mint - 1;
+    for (auto const& s : e->series) {
+        SampleColumn c = window(s.second, r->start, r->end);
+        if (!c->empty()) r->series.emplace_back(s.first, c);
+    }
+    usage -= e->charge();
+    usage += r->charge();
+    *it->second = r;
+    return ++it;
+}
+
+void ResultCache::put(const std::shared_ptr<const ResultCacheEntry>& e,
+                      uint64_t epoch)
+{
+    uint64_t charge = e->charge();
+    base::MutexLockGuard lock(mutex_);
+    if (epoch < floor_epoch_) return;
+    if (epoch != epoch_) {
+        for (tagtree::TSID tsid : e->tsids) {
+            auto t = truncated_.find(tsid);
+            if (t != truncated_.end() && t->second.epoch > epoch &&
+                t->second.mint <= e->end)
+                return;
+        }
+    }
+
+    uint64_t h = hash(e->tsids);
+    auto it = index.find(h);
+    if (it != index.end()) erase(it);
+    if (charge > capacity) return;
+
+    lru.push_front(e);
+    index[h] = lru.begin();
+    for (tagtree::TSID tsid : e->tsids)
+        by_tsid[tsid].insert(h);
+    usage += charge;
+    while (usage > capacity) {
+        erase(index.find(hash(lru.back()->tsids)));
+        evictions_.increment();
+    }
+    if (e->end > max_end_.get()) max_end_.getAndSet(e->end);
+}
+
+void ResultCache::truncate(int64_t mint, int64_t maxt)
+{
+    base::MutexLockGuard lock(mutex_);
+    // Queries evaluated before this call must not be cached, even if they do
+    // not overlap any current entry.
+    floor_epoch_ = ++epoch_;
+    truncated_.clear();
+
+    int64_t max_end = std::numeric_limits<int64_t>::min();
+    auto it = index.begin();
+    while (it != index.end()) {
+        std::shared_ptr<const ResultCacheEntry> e = *it->second;
+        if (e->start > maxt || e->end < mint) {
+            max_end = std::max(max_end, e->end);
+            ++it;
+            continue;
+        }
+        if (mint > e->start) max_end = std::max(max_end, mint - 1);
+        it = cut(it, mint);
+    }
+    max_end_.getAndSet(max_end);
+}
+
+void ResultCache::truncate(
+    const std::vector<std::pair<tagtree::TSID, int64_t>>& samples)
+{
+    base::MutexLockGuard lock(mutex_);
+    ++epoch_;
+    // Bound the memory of the TSIDs remembered for the running queries.
+    if (truncated_.size() > RESULT_CACHE_MAX_TRUNCATED) {
+        floor_epoch_ = epoch_;
+        truncated_.clear();
+    }
+
+    int64_t max_end = max_end_.get();
+    std::unordered_map<uint64_t, int64_t> cuts;
+    for (auto const& s : samples) {
+        if (s.second > max_end) continue;
+        auto r = truncated_.emplace(s.first, Truncation{epoch_, s.second});
+        if (!r.second) {
+            r.first->second.epoch = epoch_;
+            r.first->second.mint = std::min(r.first->second.mint, s.second);
+        }
+        auto t = by_tsid.find(s.first);
+        if (t == by_tsid.end()) continue;
+        for (uint64_t h : t->second) {
+            auto c = cuts.emplace(h, s.second);
+            if (!c.second) c.first->second = std::min(c.first->second, s.second);
+        }
+    }
+    for (auto const& c : cuts) {
+        auto it = index.find(c.first);
+        if (it != index.end()) cut(it, c.second);
+    }
+}
+
+void ResultCache::record(bool hit, bool partial)
+{
+    if (hit)
+        hits_.increment();
+    else if (partial)
+        partial_hits_.increment();
+    else
+        misses_.increment();
+}
+
+ResultCacheStats ResultCache::stats()
+{
+    ResultCacheStats st;
+    st.hits = hits_.get();
+    st.partial_hits = partial_hits_.get();
+    st.misses = misses_.get();
+    st.evictions = evictions_.get();
+    base::MutexLockGuard lock(mutex_);
+    st.bytes = usage;
+    st.entries = index.size();
+    return st;
+}
+
+CachedQuerier::CachedQuerier(const std::shared_ptr<ResultCache>& cache,
+                             int64_t min_time, int64_t max_time,
+                             const Factory& factory)
+    : cache(cache), min_time(min_time), max_time(max_time), factory(factory)
+{}
+
+error::Error CachedQuerier::evaluate(
+    const std::unordered_set<tagtree::TSID>& l, int64_t mint, int64_t maxt,
+    std::vector<std::pair<tagtree::TSID, SampleColumn>>* series) const
+{
+    std::pair<std::unique_ptr<QuerierInterface>, error::Error> p =
+        factory(mint, maxt);
+    if (p.second) return p.second;
+
+    std::shared_ptr<SeriesSetInterface> ss = p.first->select(l);
+    if (!ss) return error::Error();
+    while (ss->next()) {
+        std::shared_ptr<SeriesInterface> s = ss->at();
+        SampleColumn c(new std::vector<std::pair<int64_t, double>>());
+        std::unique_ptr<SeriesIteratorInterface> it = s->iterator();
+        while (it->next()) {
+            std::pair<int64_t, double> sample = it->at();
+            if (sample.first < mint) continue;
+            if (sample.first > maxt) break;
+            c->push_back(sample);
+        }
+        if (!c->empty()) series->emplace_back(s->tsid(), c);
+    }
+    // error() also reports an exhausted MergedSeriesSet.
+    if (ss->error_detail())
+        return error::wrap(ss->error_detail(), "evaluate series set");
+    std::sort(series->begin(), series->end(),
+              [](const std::pair<tagtree::TSID, SampleColumn>& lhs,
+                 const std::pair<tagtree::TSID, SampleColumn>& rhs) {
+                  return lhs.first < rhs.first;
+              });
+    return error::Error();
+}
+
+QuerierInterface* CachedQuerier::uncached() const
+{
+    if (uncached_) return uncached_.get();
+    std::pair<std::unique_ptr<QuerierInterface>, error::Error> p =
+        factory(min_time, max_time);
+    if (p.second) {
+        err_.set(error::wrap(p.second, "create uncached querier"));
+        return nullptr;
+    }
+    uncached_ = std::move(p.first);
+    return uncached_.get();
+}
+
+std::shared_ptr<ChunkSeriesSetInterface>
+CachedQuerier::chunk_select(const std::unordered_set<tagtree::TSID>& l) const
+{
+    QuerierInterface* q = uncached();
+    if (!q) return nullptr;
+    return q->chunk_select(l);
+}
+
+error::Error CachedQuerier::aggregate(const AggregateRequest& req,
+                                      AggregateResult* result) const
+{
+    QuerierInterface* q = uncached();
+    if (!q) return err_;
+    return q->aggregate(req, result);
+}
+
+std::shared_ptr<SeriesSetInterface>
+CachedQuerier::select(const std::unordered_set<tagtree::TSID>& l) const
+{
+    std::shared_ptr<ResultCacheEntry> r(new ResultCacheEntry());
+    r->tsids.assign(l.begin(), l.end());
+    std::sort(r->tsids.begin(), r->tsids.end());
+    r->start = min_time;
+    r->end = max_time;
+
+    // Read the epoch first so that a truncation after it invalidates r.
+    uint64_t epoch = cache->begin(max_time);
+    std::shared_ptr<const ResultCacheEntry> e = cache->get(r->tsids);
+    // The entry must cover the beginning of the query without gap.
+    if (e && (e->start > min_time || e->end < min_time - 1)) e.reset();
+
+    if (e && e->end >= max_time) {
+        cache->record(true, false);
+        for (auto const& s : e->series) {
+            SampleColumn c = window(s.second, min_time, max_time);
+            if (!c->empty()) r->series.emplace_back(s.first, c);
+        }
+        if (r->series.empty()) return nullptr;
+        return std::shared_ptr<SeriesSetInterface>(new ResultSeriesSet(r));
+    }
+
+    std::vector<std::pair<tagtree::TSID, SampleColumn>> tail;
+    error::Error err = evaluate(l, e ? e->end + 1 : min_time, max_time, &tail);
+    if (err) {
+        err_.set(error::wrap(err, "evaluate uncached range"));
+        return nullptr;
+    }
+    cache->record(false, e != nullptr);
+
+    // Splice the cached prefix and the tail by TSID.
+    size_t i = 0, j = 0;
+    size_t n = e ? e->series.size() : 0;
+    while (i < n || j < tail.size()) {
+        if (j == tail.size() ||
+            (i < n && e->series[i].first < tail[j].first)) {
+            SampleColumn c = window(e->series[i].second, min_time, max_time);
+            if (!c->empty()) r->series.emplace_back(e->series[i].first, c);
+            ++i;
+        } else if (i == n || tail[j].first < e->series[i].first) {
+            r->series.push_back(tail[j]);
+            ++j;
+        } else {
+            SampleColumn c = window(e->series[i].second, min_time, max_time);
+            SampleColumn merged(new std::vector<std::pair<int64_t, double>>());
+            merged->reserve(c->size() + tail[j].second->size());
+            merged->insert(merged->end(), c->begin(), c->end());
+            merged->insert(merged->end(), tail[j].second->begin(),
+                           tail[j].second->end());
+            r->series.emplace_back(tail[j].first, merged);
+            ++i;
+            ++j;
+        }
+    }
+    cache->put(r, epoch);
+
+    if (r->series.empty()) return nullptr;
+    return std::shared_ptr<SeriesSetInterface>(new ResultSeriesSet(r));
+}
+
+} // namespace querier
+} // namespace tsdb
@@ -0,0 +1,182 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "base/Atomic.hpp"
+#include "base/Mutex.hpp"
+#include "querier/QuerierInterface.hpp"
+
+namespace tsdb {
+namespace querier {
+
+typedef std::shared_ptr<std::vector<std::pair<int64_t, double>>> SampleColumn;
+
+// Number of truncated TSIDs remembered for the running queries, beyond which
+// all of them are dropped on put().
+const size_t RESULT_CACHE_MAX_TRUNCATED = 1 << 20;
+
+// ResultCacheEntry holds the samples of a TSID set within [start, end].
+// Entries are never modified once put into the cache.
+class ResultCacheEntry {
+public:
+    std::vector<tagtree::TSID> tsids; // Sorted, the key.
+    int64_t start;
+    int64_t end;
+    // Sorted by TSID, series without samples are left out.
+    std::vector<std::pair<tagtree::TSID, SampleColumn>> series;
+
+    uint64_t charge() const;
+};
+
+// ResultSeriesSet iterates the series of a ResultCacheEntry.
+class ResultSeriesSet : public SeriesSetInterface {
+private:
+    std::shared_ptr<const ResultCacheEntry> e;
+    mutable int i;
+
+public:
+    ResultSeriesSet(const std::shared_ptr<const ResultCacheEntry>& e);
+
+    bool next() const;
+
+    std::shared_ptr<SeriesInterface> at();
+
+    bool error() const { return false; }
+};
+
+struct ResultCacheStats {
+    int64_t hits;         // Served completely from the cache.
+    int64_t partial_hits; // Only the tail was computed.
+    int64_t misses;
+    int64_t evictions;
+    int64_t bytes;
+    int64_t entries;
+};
+
+// ResultCache keeps the latest result of repeated range queries over the same
+// TSID set, so that a refreshed query only computes the range not covered yet.
+//
+// Writers call truncate() after the data is visible to queriers. A put()
+// racing with a truncate() of one of its TSIDs, or with a range truncate(),
+// is detected by the epoch and dropped.
+class ResultCache {
+private:
+    typedef std::list<std::shared_ptr<const ResultCacheEntry>> LRUList;
+    typedef std::unordered_map<uint64_t, LRUList::iterator> Index;
+
+    // Epoch and lowest timestamp of the latest truncation of a TSID.
+    struct Truncation {
+        uint64_t epoch;
+        int64_t mint;
+    };
+
+    uint64_t capacity;
+    uint64_t usage;
+
+    base::MutexLock mutex_;
+    LRUList lru; // Most recently used at the front.
+    Index index;
+    // TSID -> hashes of the entries containing it.
+    std::unordered_map<tagtree::TSID, std::unordered_set<uint64_t>> by_tsid;
+    uint64_t epoch_;
+    // Puts older than this epoch are dropped, moved forward by range
+    // truncations and when truncated_ is reset.
+    uint64_t floor_epoch_;
+    std::unordered_map<tagtree::TSID, Truncation> truncated_;
+
+    base::AtomicInt64 max_end_;
+    base::AtomicInt64 hits_;
+    base::AtomicInt64 partial_hits_;
+    base::AtomicInt64 misses_;
+    base::AtomicInt64 evictions_;
+
+    // mutex_ must be held.
+    void erase(Index::iterator it);
+
+    // Cut the entry back to before mint, mutex_ must be held.
+    // Return the iterator following it.
+    Index::iterator cut(Index::iterator it, int64_t mint);
+
+public:
+    ResultCache(uint64_t capacity);
+
+    static uint64_t hash(const std::vector<tagtree::TSID>& tsids);
+
+    // Return nullptr when missing.
+    std::shared_ptr<const ResultCacheEntry>
+    get(const std::vector<tagtree::TSID>& tsids);
+
+    // Called before evaluating a query ending at end, returns the epoch to
+    // pass to put().
+    uint64_t begin(int64_t end);
+
+    // Drop e if one of its TSIDs was truncated within it after epoch.
+    void put(const std::shared_ptr<const ResultCacheEntry>& e, uint64_t epoch);
+
+    // Cut every entry overlapping [mint, maxt] back to before mint.
+    void truncate(int64_t mint, int64_t maxt);
+
+    // Cut every entry containing one of the TSIDs back to before the earliest
+    // of their committed timestamps.
+    void truncate(const std::vector<std::pair<tagtree::TSID, int64_t>>& samples);
+
+    // Upper bound of the end of all entries and running queries, cheap to
+    // read on the append path.
+    int64_t max_end() { return max_end_.get(); }
+
+    void record(bool hit, bool partial);
+
+    ResultCacheStats stats();
+};
+
+// CachedQuerier answers select() from a ResultCache, evaluating only the range
+// after the cached entry with a querier created by the factory.
+class CachedQuerier : public QuerierInterface {
+public:
+    typedef std::function<std::pair<std::unique_ptr<QuerierInterface>,
+                                    error::Error>(int64_t, int64_t)>
+        Factory;
+
+private:
+    std::shared_ptr<ResultCache> cache;
+    int64_t min_time;
+    int64_t max_time;
+    Factory factory;
+    // Created on first use by aggregate() and chunk_select().
+    mutable std::unique_ptr<QuerierInterface> uncached_;
+    mutable error::Error err_;
+
+    QuerierInterface* uncached() const;
+
+    // Decode [mint, maxt] of l into series sorted by TSID.
+    error::Error
+    evaluate(const std::unordered_set<tagtree::TSID>& l, int64_t mint,
+             int64_t maxt,
+             std::vector<std::pair<tagtree::TSID, SampleColumn>>* series) const;
+
+public:
+    CachedQuerier(const std::shared_ptr<ResultCache>& cache, int64_t min_time,
+                  int64_t max_time, const Factory& factory);
+
+    std::shared_ptr<SeriesSetInterface>
+    select(const std::unordered_set<tagtree::TSID>& l) const;
+
+    // Not cached, served by the underlying querier.
+    std::shared_ptr<ChunkSeriesSetInterface>
+    chunk_select(const std::unordered_set<tagtree::TSID>& l) const;
+
+    error::Error aggregate(const AggregateRequest& req,
+                           AggregateResult* result) const;
+
+    error::Error error() const { return err_; }
+};
+
+} // namespace querier
+} // namespace tsdb
+
+#endif
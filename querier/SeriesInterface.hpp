@@ -13,6 +13,13 @@ public:
     virtual tagtree::TSID tsid() = 0;
     virtual std::unique_ptr<SeriesIteratorInterface> iterator() = 0;
 
+    // Bounds of the samples the iterator can return, used to seek without
+    // materializing iterators. Return false when unknown.
+    virtual bool time_range(int64_t* min_time, int64_t* max_time)
+    {
+        return false;
+    }
+
     virtual ~SeriesInterface() = default;
 };
 
@@ -0,0 +1,25 @@
+#include "querier/VerticalSeries.hpp"
+#include "querier/VerticalSeriesIterator.hpp"
+
+namespace tsdb {
+namespace querier {
+
+VerticalSeries::VerticalSeries(const std::shared_ptr<Series>& series)
+    : series(series)
+{}
+
+tagtree::TSID VerticalSeries::tsid() { return series->at(0)->tsid(); }
+
+std::unique_ptr<SeriesIteratorInterface> VerticalSeries::iterator()
+{
+    return std::unique_ptr<SeriesIteratorInterface>(
+        new VerticalSeriesIterator(series));
+}
+
+bool VerticalSeries::time_range(int64_t* min_time, int64_t* max_time)
+{
+    return series->time_range(min_time, max_time);
+}
+
+} // namespace querier
+} // namespace tsdb
@@ -0,0 +1,32 @@
+#ifndef VERTICALSERIES_H
+#define VERTICALSERIES_H
+
+#include "querier/QuerierUtils.hpp"
+#include "querier/SeriesInterface.hpp"
+#include "querier/SeriesIteratorInterface.hpp"
+
+namespace tsdb {
+namespace querier {
+
+// VerticalSeries implements a series for a list of series that may overlap in
+// time, e.g. the same series from overlapping blocks.
+// They all must have the same TSID.
+//
+// NOTICE
+// Never pass a temporary variable to it
+class VerticalSeries : public SeriesInterface {
+private:
+    std::shared_ptr<Series> series;
+
+public:
+    VerticalSeries(const std::shared_ptr<Series>& series);
+
+    tagtree::TSID tsid();
+    std::unique_ptr<SeriesIteratorInterface> iterator();
+    bool time_range(int64_t* min_time, int64_t* max_time);
+};
+
+} // namespace querier
+} // namespace tsdb
+
+#endif
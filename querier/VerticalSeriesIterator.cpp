@@ -0,0 +1,70 @@
+#include <algorithm>
+
+#include "querier/VerticalSeriesIterator.hpp"
+
+namespace tsdb {
+namespace querier {
+
+VerticalSeriesIterator::VerticalSeriesIterator(
+    const std::shared_ptr<Series>& series)
+    : started(false)
+{
+    its.reserve(series->size());
+    for (int i = 0; i < series->size(); i++)
+        its.push_back(series->at(i)->iterator());
+    ok.resize(its.size(), false);
+}
+
+bool VerticalSeriesIterator::pick() const
+{
+    int m = -1;
+    for (size_t i = 0; i < its.size(); i++) {
+        // "<=" so that the last series wins on equal timestamps.
+        if (ok[i] && (m == -1 || its[i]->at().first <= cur.first)) {
+            m = i;
+            cur = its[i]->at();
+        }
+    }
+    return m != -1;
+}
+
+bool VerticalSeriesIterator::seek(int64_t t) const
+{
+    if (started && cur.first >= t)
+        return std::find(ok.begin(), ok.end(), true) != ok.end();
+    for (size_t i = 0; i < its.size(); i++) {
+        if (!started || ok[i]) ok[i] = its[i]->seek(t);
+    }
+    started = true;
+    return pick();
+}
+
+std::pair<int64_t, double> VerticalSeriesIterator::at() const { return cur; }
+
+bool VerticalSeriesIterator::next() const
+{
+    if (!started) {
+        for (size_t i = 0; i < its.size(); i++)
+            ok[i] = its[i]->next();
+        started = true;
+    } else {
+        // Advance every iterator sitting on the returned timestamp, which
+        // drops the duplicates.
+        for (size_t i = 0; i < its.size(); i++) {
+            if (ok[i] && its[i]->at().first == cur.first)
+                ok[i] = its[i]->next();
+        }
+    }
+    return pick();
+}
+
+bool VerticalSeriesIterator::error() const
+{
+    for (auto const& it : its) {
+        if (it->error()) return true;
+    }
+    return false;
+}
+
+} // namespace querier
+} // namespace tsdb
@@ -0,0 +1,42 @@
+#ifndef VERTICALSERIESITERATOR_H
+#define VERTICALSERIESITERATOR_H
+
+#include <utility>
+#include <vector>
+
+#include "querier/QuerierUtils.hpp"
+#include "querier/SeriesIteratorInterface.hpp"
+
+namespace tsdb {
+namespace querier {
+
+// VerticalSeriesIterator merges the samples of possibly overlapping iterators
+// by timestamp. When several iterators have a sample at the same timestamp,
+// the one from the last series is returned and the others are skipped.
+class VerticalSeriesIterator : public SeriesIteratorInterface {
+private:
+    std::vector<std::unique_ptr<SeriesIteratorInterface>> its;
+    // Whether its[i] is positioned at a valid sample.
+    mutable std::vector<bool> ok;
+    mutable bool started;
+    mutable std::pair<int64_t, double> cur;
+
+    // Select the smallest timestamp among the valid iterators into cur.
+    bool pick() const;
+
+public:
+    VerticalSeriesIterator(const std::shared_ptr<Series>& series);
+
+    bool seek(int64_t t) const;
+
+    std::pair<int64_t, double> at() const;
+
+    bool next() const;
+
+    bool error() const;
+};
+
+} // namespace querier
+} // namespace tsdb
+
+#endif
@@ -1,5 +1,6 @@
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <stdlib.h>
@@ -9,12 +10,19 @@
 #include "base/Atomic.hpp"
 #include "base/TimeStamp.hpp"
 #include "base/WaitGroup.hpp"
+#include "block/Block.hpp"
+#include "chunk/ChunkCache.hpp"
+#include "chunk/ChunkWriter.hpp"
+#include "chunk/XORChunk.hpp"
+#include "compact/LeveledCompactor.hpp"
+#include "compact/TieredCompactor.hpp"
 #include "db/DB.hpp"
 #include "external/rapidjson/document.h"
 #include "external/rapidjson/writer.h"
 #include "external/rapidjson/stringbuffer.h"
 #include "external/rapidjson/rapidjson.h"
 #include "head/RangeHead.hpp"
+#include "index/IndexWriter.hpp"
 #include "label/EqualMatcher.hpp"
 #include "querier/BlockQuerier.hpp"
 #include "querier/Querier.hpp"
@@ -158,4 +166,239 @@ void db_bench(){
         TEST_COUT << "> complete stage=query duration=" << base::timeDifference(base::TimeStamp::now(), start) << endl;
         TEST_COUT << "  > total samples=" << total << endl;
     }
-}
\ No newline at end of file
+}
+
+// Evict every file under dir from the page cache so that the next read hits
+// the disk.
+void drop_page_cache(const std::string & dir){
+    for(boost::filesystem::recursive_directory_iterator it(dir), end; it != end; ++ it){
+        if(!boost::filesystem::is_regular_file(it->path()))
+            continue;
+        int fd = open(it->path().string().c_str(), O_RDONLY);
+        if(fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Write one block of num_series series in TSID order, like compaction does.
+// Sample timestamps are shifted by offset.
+std::string create_tsid_block(const std::string & dir, int num_series, int64_t num_samples, int64_t offset = 0){
+    ulid::ULID ulid = ulid::CreateNowRand();
+    std::string block_dir = tsdbutil::filepath_join(dir, ulid::Marshal(ulid));
+    boost::filesystem::create_directories(tsdbutil::filepath_join(block_dir, "chunks"));
+
+    block::BlockMeta bm(ulid, offset, (num_samples - 1) * time_delta + offset);
+    {
+        chunk::ChunkWriter cw(tsdbutil::filepath_join(block_dir, "chunks"));
+        index::IndexWriter iw(tsdbutil::filepath_join(block_dir, "index"));
+        for(int i = 0; i < num_series; ++ i){
+            vector<shared_ptr<chunk::ChunkMeta>> metas;
+            for(int64_t j = 0; j < num_samples; j += 120){
+                shared_ptr<chunk::ChunkInterface> c(new chunk::XORChunk());
+                auto app = c->appender();
+                int64_t end = std::min(j + 120, num_samples);
+                for(int64_t k = j; k < end; ++ k)
+                    app->append(k * time_delta + offset, k * 1000);
+                metas.emplace_back(new chunk::ChunkMeta(c, j * time_delta + offset, (end - 1) * time_delta + offset));
+            }
+            cw.write_chunks(metas);
+            EXPECT_EQ(iw.add_series(i, metas), 0);
+            bm.stats.num_chunks += metas.size();
+            bm.stats.num_samples += num_samples;
+        }
+    }
+    bm.stats.num_series = num_series;
+    EXPECT_TRUE(block::write_block_meta(block_dir, bm));
+    return block_dir;
+}
+
+// Query a random subset of series from a block with a cold page cache.
+void block_cold_query_bench(){
+    boost::filesystem::remove_all("db_test");
+    int num_series = 100000;
+    int64_t num_samples = 720;
+    std::string block_dir = create_tsid_block("db_test/bench_cold_query", num_series, num_samples);
+
+    for(int selectivity: {100, 10, 1}){
+        unordered_set<tagtree::TSID> tsids;
+        for(int i = 0; i < num_series; ++ i){
+            if(rand() % 100 < selectivity)
+                tsids.insert(i);
+        }
+
+        drop_page_cache(block_dir);
+        auto start = base::TimeStamp::now();
+        shared_ptr<block::BlockInterface> b(new block::Block(block_dir));
+        ASSERT_FALSE(b->error());
+        querier::BlockQuerier q(b, 0, num_samples * time_delta);
+        auto ss = q.select(tsids);
+        ASSERT_TRUE(ss);
+        int64_t total = 0;
+        while(ss->next()){
+            auto it = ss->at()->iterator();
+            while(it->next())
+                ++ total;
+        }
+        TEST_COUT << "> complete stage=cold query selectivity=" << selectivity << "% series=" << tsids.size()
+            << " duration=" << base::timeDifference(base::TimeStamp::now(), start) << endl;
+        TEST_COUT << "  > total samples=" << total << endl;
+    }
+}
+
+// Repeat the same query over one block to compare decoding from mmap with
+// reading decoded chunks back from a shared ChunkCache.
+void chunk_cache_bench(){
+    boost::filesystem::remove_all("db_test");
+    int num_series = 100000;
+    int64_t num_samples = 720;
+    std::string block_dir = create_tsid_block("db_test/bench_chunk_cache", num_series, num_samples);
+    shared_ptr<block::BlockInterface> b(new block::Block(block_dir));
+    ASSERT_FALSE(b->error());
+
+    unordered_set<tagtree::TSID> tsids;
+    for(int i = 0; i < num_series; ++ i){
+        if(rand() % 100 < 10)
+            tsids.insert(i);
+    }
+
+    shared_ptr<chunk::ChunkCache> cache(new chunk::ChunkCache(1024 * 1024 * 1024));
+    for(auto c: {shared_ptr<chunk::ChunkCache>(), cache}){
+        for(int round = 0; round < 3; ++ round){
+            auto start = base::TimeStamp::now();
+            querier::BlockQuerier q(b, 0, num_samples * time_delta, c);
+            auto ss = q.select(tsids);
+            ASSERT_TRUE(ss);
+            int64_t total = 0;
+            while(ss->next()){
+                auto it = ss->at()->iterator();
+                while(it->next())
+                    ++ total;
+            }
+            TEST_COUT << "> complete stage=query cache=" << (c ? "on" : "off") << " round=" << round
+                << " duration=" << base::timeDifference(base::TimeStamp::now(), start) << endl;
+            TEST_COUT << "  > total samples=" << total << endl;
+        }
+    }
+    chunk::ChunkCacheStats st = cache->stats();
+    TEST_COUT << "> cache hits=" << st.hits << " misses=" << st.misses << " evictions=" << st.evictions
+        << " bytes=" << st.bytes << endl;
+}
+
+// Query and compact num_blocks fully overlapping blocks. Every other block
+// shares its timestamps with block 0, so half of the samples are duplicates.
+void vertical_bench(){
+    boost::filesystem::remove_all("db_test");
+    std::string dir = "db_test/bench_vertical";
+    int num_series = 10000;
+    int64_t num_samples = 720;
+    for(int num_blocks: {2, 4, 8}){
+        boost::filesystem::remove_all(dir);
+        std::deque<std::string> dirs;
+        for(int i = 0; i < num_blocks; ++ i)
+            dirs.push_back(create_tsid_block(dir, num_series, num_samples, (i % 2) * time_delta / 2));
+
+        unordered_set<tagtree::TSID> tsids;
+        for(int i = 0; i < num_series; ++ i)
+            tsids.insert(i);
+        {
+            auto start = base::TimeStamp::now();
+            std::vector<std::shared_ptr<querier::QuerierInterface>> queriers;
+            for(auto & d: dirs){
+                shared_ptr<block::BlockInterface> b(new block::Block(d));
+                ASSERT_FALSE(b->error());
+                queriers.emplace_back(new querier::BlockQuerier(b, 0, num_samples * time_delta));
+            }
+            querier::Querier q(queriers, true);
+            auto ss = q.select(tsids);
+            ASSERT_TRUE(ss);
+            int64_t total = 0;
+            while(ss->next()){
+                auto it = ss->at()->iterator();
+                while(it->next())
+                    ++ total;
+            }
+            TEST_COUT << "> complete stage=vertical query blocks=" << num_blocks
+                << " duration=" << base::timeDifference(base::TimeStamp::now(), start) << endl;
+            TEST_COUT << "  > total samples=" << total << endl;
+        }
+        {
+            auto start = base::TimeStamp::now();
+            compact::LeveledCompactor compactor({2 * 3600 * 1000}, shared_ptr<base::Channel<char>>(new base::Channel<char>()));
+            auto r = compactor.compact(dir, dirs, nullptr);
+            ASSERT_FALSE(r.second);
+            TEST_COUT << "> complete stage=vertical compaction blocks=" << num_blocks
+                << " duration=" << base::timeDifference(base::TimeStamp::now(), start) << endl;
+        }
+    }
+}
+
+// Simulate 90 days of 2h head blocks with a 30 days retention through the
+// planner of a compactor, without writing blocks. Every persisted head block
+// and every compaction output counts as written bytes.
+void simulate_compactions(const std::string & name, compact::LeveledCompactor * compactor){
+    int64_t block_range = 2 * 3600 * 1000;
+    int64_t retention = 30 * 24 * 3600 * 1000LL;
+    int64_t head_bytes = 64 * 1024 * 1024;
+    std::deque<block::DirMeta> metas;
+    int64_t ingested = 0, written = 0, max_blocks = 0;
+    int next_dir = 0;
+    for(int64_t t = 0; t < 90 * 24 * 3600 * 1000LL; t += block_range){
+        std::shared_ptr<block::BlockMeta> head(new block::BlockMeta(ulid::ULID(), t, t + block_range));
+        // +-20% of variation between head blocks.
+        head->stats.num_bytes = head_bytes * (80 + rand() % 41) / 100;
+        head->stats.num_series = 1;
+        head->compaction.level = 1;
+        metas.emplace_back(std::to_string(next_dir ++), head);
+        ingested += head->stats.num_bytes;
+        written += head->stats.num_bytes;
+
+        while(true){
+            auto plan = compactor->plan_helper(std::shared_ptr<block::DirMetas>(new block::DirMetas(metas)));
+            ASSERT_FALSE(plan.second);
+            if(plan.first.empty())
+                break;
+            std::unordered_set<std::string> dirs(plan.first.begin(), plan.first.end());
+            std::shared_ptr<block::BlockMeta> out(new block::BlockMeta());
+            std::deque<block::DirMeta> kept;
+            for(auto & m: metas){
+                if(dirs.find(m.dir) == dirs.end()){
+                    kept.push_back(m);
+                    continue;
+                }
+                out->min_time = std::min(out->min_time, m.meta->min_time);
+                out->max_time = std::max(out->max_time, m.meta->max_time);
+                out->stats.num_bytes += m.meta->stats.num_bytes;
+                out->compaction.level = std::max(out->compaction.level, m.meta->compaction.level + 1);
+            }
+            out->stats.num_series = 1;
+            written += out->stats.num_bytes;
+            kept.emplace_back(std::to_string(next_dir ++), out);
+            std::sort(kept.begin(), kept.end(), [](const block::DirMeta & lhs, const block::DirMeta & rhs){
+                return lhs.meta->min_time < rhs.meta->min_time;
+            });
+            metas.swap(kept);
+        }
+
+        while(!metas.empty() && metas.front().meta->max_time <= t + block_range - retention)
+            metas.pop_front();
+        max_blocks = std::max(max_blocks, static_cast<int64_t>(metas.size()));
+    }
+    TEST_COUT << "> compaction=" << name << " write amplification=" << static_cast<double>(written) / ingested
+        << " blocks=" << metas.size() << " max blocks=" << max_blocks << endl;
+}
+
+// Bytes written per byte ingested by leveled and tiered compactions over the
+// default block ranges.
+void compaction_write_amp_bench(){
+    std::vector<int64_t> ranges = db::DefaultOptions.block_ranges;
+    shared_ptr<base::Channel<char>> cancel(new base::Channel<char>());
+    compact::LeveledCompactor leveled(ranges, cancel);
+    simulate_compactions("leveled", &leveled);
+    for(int min_blocks: {4, 8}){
+        compact::TieredCompactor tiered(ranges, cancel, min_blocks);
+        simulate_compactions("tiered min_blocks=" + std::to_string(min_blocks), &tiered);
+    }
+}
@@ -1,30 +1,57 @@
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 #include <google/profiler.h>
 
 #include "base/Atomic.hpp"
+#include "base/Checksum.hpp"
+#include "base/RateLimiter.hpp"
 #include "base/TimeStamp.hpp"
 #include "base/WaitGroup.hpp"
+#include "block/Block.hpp"
+#include "chunk/ChunkCache.hpp"
+#include "chunk/ChunkUtils.hpp"
 #include "chunk/ChunkWriter.hpp"
 #include "chunk/XORChunk.hpp"
+#include "compact/LeveledCompactor.hpp"
+#include "compact/TieredCompactor.hpp"
 #include "db/DB.hpp"
 #include "external/rapidjson/document.h"
 #include "external/rapidjson/writer.h"
 #include "external/rapidjson/stringbuffer.h"
 #include "external/rapidjson/rapidjson.h"
 #include "head/RangeHead.hpp"
+#include "index/IndexReader.hpp"
+#include "index/IndexUtils.hpp"
 #include "index/IndexWriter.hpp"
 #include "label/EqualMatcher.hpp"
+#include "querier/BaseChunkSeriesSet.hpp"
 #include "querier/BlockQuerier.hpp"
+#include "querier/ChainSeriesIterator.hpp"
+#include "querier/ChunkSeriesIterator.hpp"
+#include "querier/MergedSeriesSet.hpp"
+#include "querier/PopulatedChunkSeriesSet.hpp"
+#include "querier/PrefetchSeriesSet.hpp"
 #include "querier/Querier.hpp"
 #include "querier/QuerierUtils.hpp"
+#include "querier/RangeFunctionIterator.hpp"
+#include "querier/ResultCache.hpp"
 #include "test/TestUtils.hpp"
 #include "tombstone/MemTombstones.hpp"
 #include "tombstone/TombstoneUtils.hpp"
+#include "tsdbutil/DecBuf.hpp"
+#include "tsdbutil/DirectSlice.hpp"
+#include "tsdbutil/RecordDecoder.hpp"
+#include "tsdbutil/RecordEncoder.hpp"
+#include "tsdbutil/tsdbutils.hpp"
 #include "wal/WAL.hpp"
+#include "wal/checkpoint.hpp"
 
 using namespace std;
 using namespace tsdb;
@@ -217,4 +244,2170 @@ TEST(DBTest, All){
             }
         }
     }
-}
\ No newline at end of file
+}
+
+double test_value(tagtree::TSID tsid, int64_t t){
+    return static_cast<double>((t / 1000) * (tsid + 1) % 977) + 0.5 * tsid;
+}
+
+// Writes the series [0, num_series) with a test_value() sample every step in
+// [mint, maxt) as a new block under dir.
+shared_ptr<block::Block> write_test_block(const string & dir, int64_t mint, int64_t maxt, int num_series, int64_t step = 15000){
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+    pool->start(1);
+    shared_ptr<head::Head> h(new head::Head(maxt - mint, nullptr, pool));
+    EXPECT_FALSE(h->init(mint));
+    for(int64_t t = mint; t < maxt; t += step){
+        auto app = h->appender();
+        for(int i = 0; i < num_series; ++ i)
+            EXPECT_FALSE(app->add(i, t, test_value(i, t)));
+        EXPECT_FALSE(app->commit());
+    }
+    compact::LeveledCompactor c({maxt - mint}, shared_ptr<base::Channel<char>>(new base::Channel<char>()));
+    auto r = c.write(dir, shared_ptr<block::BlockInterface>(new head::RangeHead(h, mint, maxt - 1)), mint, maxt, nullptr);
+    EXPECT_FALSE(r.second);
+    pool->stop();
+    return shared_ptr<block::Block>(new block::Block(tsdbutil::filepath_join(dir, ulid::Marshal(r.first))));
+}
+
+// Collects the samples of every series of ss.
+map<tagtree::TSID, vector<pair<int64_t, double>>> collect(const shared_ptr<querier::SeriesSetInterface> & ss){
+    map<tagtree::TSID, vector<pair<int64_t, double>>> m;
+    if(!ss)
+        return m;
+    while(ss->next()){
+        auto & v = m[ss->at()->tsid()];
+        auto it = ss->at()->iterator();
+        while(it->next())
+            v.push_back(it->at());
+    }
+    return m;
+}
+
+// A series set over series held in memory.
+class TestSeriesSet: public querier::SeriesSetInterface{
+    public:
+        vector<shared_ptr<querier::SeriesInterface>> series;
+        mutable int i;
+
+        TestSeriesSet(): i(-1){}
+
+        // Adds tsid with the samples (t, tsid + offset) for t in [mint, maxt).
+        void add(tagtree::TSID tsid, int64_t mint, int64_t maxt, int64_t step = 1, double offset = 0){
+            shared_ptr<vector<pair<int64_t, double>>> samples(new vector<pair<int64_t, double>>());
+            for(int64_t t = mint; t < maxt; t += step)
+                samples->emplace_back(t, tsid + offset);
+            series.emplace_back(new querier::PrefetchedSeries(tsid, samples));
+        }
+
+        bool next() const{ return ++ i < static_cast<int>(series.size()); }
+        shared_ptr<querier::SeriesInterface> at(){ return series[i]; }
+        bool error() const{ return false; }
+};
+
+// Builds a chunk with the samples (t, v) for t in [mint, maxt).
+shared_ptr<chunk::ChunkMeta> test_chunk(int64_t mint, int64_t maxt, int64_t step, double v){
+    shared_ptr<chunk::ChunkInterface> c(new chunk::XORChunk());
+    auto app = c->appender();
+    int64_t last = mint;
+    for(int64_t t = mint; t < maxt; t += step){
+        app->append(t, v);
+        last = t;
+    }
+    return shared_ptr<chunk::ChunkMeta>(new chunk::ChunkMeta(c, mint, last));
+}
+
+TEST(DBTest, IndexOffsetTableSorted){
+    boost::filesystem::remove_all("db_test/index");
+    boost::filesystem::create_directories("db_test/index");
+    std::string filename = "db_test/index/index";
+
+    // Add the series in descending TSID order.
+    vector<tagtree::TSID> tsids;
+    for(int i = 0; i < 1000; ++ i)
+        tsids.push_back((i * 7919) % 1000 + 1);
+    sort(tsids.rbegin(), tsids.rend());
+    {
+        index::IndexWriter iw(filename);
+        for(tagtree::TSID tsid: tsids){
+            vector<shared_ptr<chunk::ChunkMeta>> chunks;
+            chunks.emplace_back(new chunk::ChunkMeta(tsid * 16, tsid * 1000, tsid * 1000 + 999));
+            ASSERT_EQ(iw.add_series(tsid, chunks), 0);
+        }
+    }
+
+    index::IndexReader ir(filename);
+    ASSERT_FALSE(ir.error());
+
+    // All postings come out in ascending order.
+    auto p = ir.get_all_postings();
+    ASSERT_TRUE(p.second);
+    vector<tagtree::TSID> all;
+    while(p.first->next())
+        all.push_back(p.first->at());
+    vector<tagtree::TSID> expected(tsids.rbegin(), tsids.rend());
+    ASSERT_EQ(all, expected);
+
+    // Every series is found through the sorted table.
+    for(tagtree::TSID tsid: tsids){
+        vector<shared_ptr<chunk::ChunkMeta>> chunks;
+        ASSERT_TRUE(ir.series(tsid, chunks));
+        ASSERT_EQ(chunks.size(), 1);
+        ASSERT_EQ(chunks[0]->ref, tsid * 16);
+        ASSERT_EQ(chunks[0]->min_time, tsid * 1000);
+        ASSERT_EQ(chunks[0]->max_time, tsid * 1000 + 999);
+    }
+    vector<shared_ptr<chunk::ChunkMeta>> chunks;
+    ASSERT_FALSE(ir.series(0, chunks));
+    ASSERT_FALSE(ir.series(1001, chunks));
+
+    // Seeking the postings lands on the next present TSID.
+    p = ir.get_all_postings();
+    ASSERT_TRUE(p.first->seek(500));
+    ASSERT_EQ(p.first->at(), 500);
+    ASSERT_FALSE(p.first->seek(1001));
+}
+
+TEST(DBTest, PrefetchQuerier){
+    boost::filesystem::remove_all("db_test/prefetch");
+    int64_t range = 3600 * 1000;
+    int num_series = 50;
+    // A block waits for the readers of its queriers when destroyed.
+    vector<shared_ptr<block::Block>> blocks;
+    vector<shared_ptr<querier::QuerierInterface>> queriers;
+    for(int i = 0; i < 3; ++ i){
+        blocks.push_back(write_test_block("db_test/prefetch", i * range, (i + 1) * range, num_series));
+        queriers.emplace_back(new querier::BlockQuerier(blocks.back(), 0, 3 * range));
+    }
+    unordered_set<tagtree::TSID> l;
+    for(int i = 0; i < num_series; i += 2)
+        l.insert(i);
+
+    querier::Querier plain(queriers);
+    auto expected = collect(plain.select(l));
+    ASSERT_EQ(expected.size(), l.size());
+    for(auto & p: expected){
+        ASSERT_EQ(p.second.size(), 3 * range / 15000);
+        for(auto & s: p.second)
+            ASSERT_EQ(s.second, test_value(p.first, s.first));
+    }
+
+    // Fewer workers than blocks and a buffer smaller than the result.
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+    pool->start(2);
+    querier::Querier prefetch(queriers, pool, 4);
+    ASSERT_EQ(collect(prefetch.select(l)), expected);
+    ASSERT_FALSE(prefetch.error());
+    pool->stop();
+
+    querier::Querier empty;
+    ASSERT_FALSE(empty.select(l));
+}
+
+TEST(DBTest, MergedSeriesSetOrder){
+    // Set k covers [10k, 10k + 10), the sets are in time order.
+    vector<vector<tagtree::TSID>> tsids({{1, 3, 5, 7}, {2, 3, 6, 7, 9}, {}, {0, 7, 9}});
+    shared_ptr<querier::SeriesSets> ss(new querier::SeriesSets());
+    map<tagtree::TSID, vector<pair<int64_t, double>>> expected;
+    for(int k = 0; k < tsids.size(); ++ k){
+        TestSeriesSet * s = new TestSeriesSet();
+        for(tagtree::TSID tsid: tsids[k]){
+            s->add(tsid, 10 * k, 10 * k + 10);
+            for(int64_t t = 10 * k; t < 10 * k + 10; ++ t)
+                expected[tsid].emplace_back(t, tsid);
+        }
+        ss->push_back(shared_ptr<querier::SeriesSetInterface>(s));
+    }
+
+    querier::MergedSeriesSet m(ss);
+    vector<tagtree::TSID> order;
+    map<tagtree::TSID, vector<pair<int64_t, double>>> got;
+    while(m.next()){
+        order.push_back(m.at()->tsid());
+        auto it = m.at()->iterator();
+        while(it->next())
+            got[m.at()->tsid()].push_back(it->at());
+    }
+    ASSERT_EQ(order, vector<tagtree::TSID>({0, 1, 2, 3, 5, 6, 7, 9}));
+    ASSERT_EQ(got, expected);
+    ASSERT_FALSE(m.next());
+}
+
+TEST(DBTest, VerticalMerge){
+    // Later series win on equal timestamps.
+    map<int64_t, double> expected;
+    shared_ptr<querier::SeriesSets> ss(new querier::SeriesSets());
+    for(int k = 0; k < 3; ++ k){
+        TestSeriesSet * s = new TestSeriesSet();
+        s->add(1, 20 * k, 20 * k + 50, k + 1, k);
+        for(int64_t t = 20 * k; t < 20 * k + 50; t += k + 1)
+            expected[t] = 1 + k;
+        ss->push_back(shared_ptr<querier::SeriesSetInterface>(s));
+    }
+    querier::MergedSeriesSet m(ss, true);
+    ASSERT_TRUE(m.next());
+    vector<pair<int64_t, double>> got;
+    auto it = m.at()->iterator();
+    while(it->next())
+        got.push_back(it->at());
+    vector<pair<int64_t, double>> want(expected.begin(), expected.end());
+    ASSERT_EQ(got, want);
+
+    // Seeking into the overlap.
+    it = m.at()->iterator();
+    ASSERT_TRUE(it->seek(45));
+    ASSERT_EQ(it->at().first, expected.lower_bound(45)->first);
+    ASSERT_EQ(it->at().second, expected.lower_bound(45)->second);
+    ASSERT_FALSE(it->seek(1000));
+    ASSERT_FALSE(m.next());
+
+    // The chunks of the overlapping run are re-encoded, the last one is
+    // passed through.
+    vector<shared_ptr<chunk::ChunkMeta>> chunks({
+        test_chunk(0, 100, 1, 0), test_chunk(50, 150, 2, 1), test_chunk(60, 70, 1, 2), test_chunk(200, 250, 1, 3)});
+    expected.clear();
+    for(auto & c: chunks){
+        auto cit = c->chunk->iterator();
+        while(cit->next())
+            expected[cit->at().first] = cit->at().second;
+    }
+    auto r = chunk::vertical_merge_chunks(chunks, 30);
+    ASSERT_FALSE(r.second);
+    ASSERT_EQ(r.first.back(), chunks.back());
+    got.clear();
+    for(auto & c: r.first){
+        if(c != chunks.back())
+            ASSERT_LE(c->chunk->num_samples(), 30);
+        if(!got.empty())
+            ASSERT_GT(c->min_time, got.back().first);
+        auto cit = c->chunk->iterator();
+        while(cit->next())
+            got.push_back(cit->at());
+        ASSERT_EQ(c->max_time, got.back().first);
+    }
+    want.assign(expected.begin(), expected.end());
+    ASSERT_EQ(got, want);
+}
+
+TEST(DBTest, AggregatePushdown){
+    boost::filesystem::remove_all("db_test/aggregate");
+    int64_t range = 3600 * 1000;
+    int num_series = 20;
+    vector<shared_ptr<block::Block>> blocks;
+    for(int i = 0; i < 3; ++ i)
+        blocks.push_back(write_test_block("db_test/aggregate", i * range, (i + 1) * range, num_series));
+    ASSERT_FALSE(blocks[1]->del(range + 600 * 1000, range + 1200 * 1000, 3));
+
+    // The time ranges of the queriers cut into the blocks.
+    vector<shared_ptr<querier::QuerierInterface>> queriers;
+    queriers.emplace_back(new querier::BlockQuerier(blocks[0], range / 4, range - 1));
+    queriers.emplace_back(new querier::BlockQuerier(blocks[1], range, 2 * range - range / 3));
+    queriers.emplace_back(new querier::BlockQuerier(blocks[2], 2 * range + range / 2, 3 * range));
+    querier::Querier q(queriers);
+
+    querier::AggregateRequest req;
+    unordered_set<tagtree::TSID> l;
+    for(int i = 0; i < num_series; ++ i){
+        req.groups[i] = i % 3;
+        l.insert(i);
+    }
+    req.num_groups = 3;
+    req.start = 10 * 1000;
+    req.end = 3 * range - 10 * 1000;
+    req.step = 60 * 1000;
+    auto series = collect(q.select(l));
+    ASSERT_EQ(series.size(), num_series);
+
+    for(querier::AggregateOp op: {querier::AGG_SUM, querier::AGG_AVG, querier::AGG_MIN, querier::AGG_MAX, querier::AGG_COUNT}){
+        req.op = op;
+        querier::AggregateResult got;
+        ASSERT_FALSE(q.aggregate(req, &got));
+        ASSERT_EQ(got.columns.size(), req.num_groups);
+
+        // The latest sample in (t - lookback, t] of every series.
+        vector<vector<double>> want(req.num_groups, vector<double>(req.num_steps(), 0));
+        vector<vector<int>> counts(req.num_groups, vector<int>(req.num_steps(), 0));
+        for(auto & p: series){
+            int g = req.groups[p.first];
+            for(int k = 0; k < req.num_steps(); ++ k){
+                int64_t t = req.start + k * req.step;
+                auto it = upper_bound(p.second.begin(), p.second.end(), make_pair(t, numeric_limits<double>::max()));
+                if(it == p.second.begin() || t - (it - 1)->first >= req.lookback)
+                    continue;
+                double v = (it - 1)->second;
+                if(op == querier::AGG_COUNT)
+                    want[g][k] += 1;
+                else if(op == querier::AGG_MIN)
+                    want[g][k] = counts[g][k] == 0 ? v : min(want[g][k], v);
+                else if(op == querier::AGG_MAX)
+                    want[g][k] = counts[g][k] == 0 ? v : max(want[g][k], v);
+                else
+                    want[g][k] += v;
+                ++ counts[g][k];
+            }
+        }
+        int empty = 0;
+        for(int g = 0; g < req.num_groups; ++ g){
+            ASSERT_EQ(got.columns[g].size(), req.num_steps());
+            for(int k = 0; k < req.num_steps(); ++ k){
+                if(counts[g][k] == 0){
+                    ASSERT_TRUE(std::isnan(got.columns[g][k]));
+                    ++ empty;
+                    continue;
+                }
+                if(op == querier::AGG_AVG)
+                    want[g][k] /= counts[g][k];
+                ASSERT_DOUBLE_EQ(got.columns[g][k], want[g][k]);
+            }
+        }
+        // The gaps between the queriers are empty.
+        ASSERT_GT(empty, 0);
+    }
+}
+
+TEST(DBTest, ChunkCache){
+    // The ULIDs only differ in their upper 64 bits.
+    ulid::ULID u1 = static_cast<ulid::ULID>(1) << 64;
+    ulid::ULID u2 = static_cast<ulid::ULID>(2) << 64;
+    vector<shared_ptr<chunk::ChunkInterface>> chunks;
+    for(int i = 0; i < 5; ++ i)
+        chunks.push_back(test_chunk(0, 100, 1, i)->chunk);
+
+    // Find the charge of one chunk.
+    int64_t charge;
+    {
+        chunk::ChunkCache c(1 << 20, 1);
+        c.insert(u1, 0, chunks[0]);
+        charge = c.stats().bytes;
+        ASSERT_GT(charge, chunks[0]->size());
+    }
+
+    // Room for three chunks.
+    chunk::ChunkCache c(3 * charge + charge / 2, 1);
+    for(int i = 0; i < 3; ++ i)
+        c.insert(u1, i, chunks[i]);
+    ASSERT_EQ(c.get(u1, 0), chunks[0]);
+    ASSERT_EQ(c.get(u2, 0), nullptr);
+
+    // The clock hand spares the referenced chunk 0 and evicts chunk 1.
+    c.insert(u2, 0, chunks[3]);
+    ASSERT_EQ(c.get(u1, 1), nullptr);
+    ASSERT_EQ(c.get(u1, 0), chunks[0]);
+    ASSERT_EQ(c.get(u1, 2), chunks[2]);
+    ASSERT_EQ(c.get(u2, 0), chunks[3]);
+    chunk::ChunkCacheStats st = c.stats();
+    ASSERT_EQ(st.inserts, 4);
+    ASSERT_EQ(st.evictions, 1);
+    ASSERT_EQ(st.hits, 4);
+    ASSERT_EQ(st.misses, 2);
+    ASSERT_EQ(st.entries, 3);
+    ASSERT_EQ(st.bytes, 3 * charge);
+
+    // Inserting a cached key again is a no-op.
+    c.insert(u1, 0, chunks[4]);
+    ASSERT_EQ(c.get(u1, 0), chunks[0]);
+
+    // Invalidation only drops the chunks of the given block.
+    c.invalidate(u1);
+    ASSERT_EQ(c.get(u1, 0), nullptr);
+    ASSERT_EQ(c.get(u1, 2), nullptr);
+    ASSERT_EQ(c.get(u2, 0), chunks[3]);
+    st = c.stats();
+    ASSERT_EQ(st.invalidations, 2);
+    ASSERT_EQ(st.entries, 1);
+    ASSERT_EQ(st.bytes, charge);
+
+    // Chunks larger than a shard are not cached.
+    chunk::ChunkCache small(charge / 2, 1);
+    small.insert(u1, 0, chunks[0]);
+    ASSERT_EQ(small.get(u1, 0), nullptr);
+    ASSERT_EQ(small.stats().inserts, 0);
+}
+
+// An entry of tsids with a sample every 10 in [start, end].
+shared_ptr<querier::ResultCacheEntry> test_entry(const vector<tagtree::TSID> & tsids, int64_t start, int64_t end){
+    shared_ptr<querier::ResultCacheEntry> e(new querier::ResultCacheEntry());
+    e->tsids = tsids;
+    e->start = start;
+    e->end = end;
+    for(tagtree::TSID tsid: tsids){
+        querier::SampleColumn c(new vector<pair<int64_t, double>>());
+        for(int64_t t = start; t <= end; t += 10)
+            c->emplace_back(t, tsid);
+        e->series.emplace_back(tsid, c);
+    }
+    return e;
+}
+
+TEST(DBTest, ResultCache){
+    querier::ResultCache c(1 << 20);
+    vector<tagtree::TSID> a({1, 2}), b({3, 4});
+    uint64_t epoch = c.begin(100);
+    ASSERT_EQ(c.max_end(), 100);
+    c.put(test_entry(a, 0, 100), epoch);
+    c.put(test_entry(b, 0, 100), epoch);
+
+    // Only the entries of the committed series are cut.
+    c.truncate(vector<pair<tagtree::TSID, int64_t>>({{3, 55}, {3, 50}, {9, 0}}));
+    ASSERT_EQ(c.get(a)->end, 100);
+    auto e = c.get(b);
+    ASSERT_EQ(e->end, 49);
+    ASSERT_EQ(e->series.size(), 2);
+    ASSERT_EQ(e->series[0].second->back().first, 40);
+    // Samples after the cached range do not change it.
+    c.truncate(vector<pair<tagtree::TSID, int64_t>>({{1, 150}}));
+    ASSERT_EQ(c.get(a)->end, 100);
+
+    // A put racing with a commit of one of its series is dropped.
+    epoch = c.begin(100);
+    c.truncate(vector<pair<tagtree::TSID, int64_t>>({{1, 60}}));
+    ASSERT_EQ(c.get(a)->end, 59);
+    c.put(test_entry(a, 0, 100), epoch);
+    ASSERT_EQ(c.get(a)->end, 59);
+    // But not one racing with a commit of other series.
+    c.put(test_entry(b, 0, 100), epoch);
+    ASSERT_EQ(c.get(b)->end, 100);
+
+    // Commits after a query began reach the cache even without an entry.
+    vector<tagtree::TSID> d({5});
+    epoch = c.begin(300);
+    c.truncate(vector<pair<tagtree::TSID, int64_t>>({{5, 250}}));
+    c.put(test_entry(d, 0, 300), epoch);
+    ASSERT_EQ(c.get(d), nullptr);
+
+    // A range truncation cuts all overlapping entries and drops running puts.
+    epoch = c.begin(100);
+    c.truncate(40, 80);
+    ASSERT_EQ(c.get(a)->end, 39);
+    ASSERT_EQ(c.get(b)->end, 39);
+    c.put(test_entry(d, 0, 100), epoch);
+    ASSERT_EQ(c.get(d), nullptr);
+    c.truncate(0, 10);
+    ASSERT_EQ(c.get(a), nullptr);
+    ASSERT_EQ(c.stats().entries, 0);
+    ASSERT_EQ(c.stats().bytes, 0);
+}
+
+TEST(DBTest, CachedQuerier){
+    boost::filesystem::remove_all("db_test/cached");
+    int64_t range = 3600 * 1000;
+    int num_series = 10;
+    vector<shared_ptr<block::Block>> blocks;
+    for(int i = 0; i < 2; ++ i)
+        blocks.push_back(write_test_block("db_test/cached", i * range, (i + 1) * range, num_series));
+    querier::CachedQuerier::Factory factory = [&blocks](int64_t mint, int64_t maxt){
+        vector<shared_ptr<querier::QuerierInterface>> queriers;
+        for(auto & b: blocks)
+            queriers.emplace_back(new querier::BlockQuerier(b, mint, maxt));
+        return make_pair(unique_ptr<querier::QuerierInterface>(new querier::Querier(queriers)), error::Error());
+    };
+    shared_ptr<querier::ResultCache> cache(new querier::ResultCache(1 << 24));
+    querier::Querier direct(vector<shared_ptr<querier::QuerierInterface>>({
+        shared_ptr<querier::QuerierInterface>(new querier::BlockQuerier(blocks[0], range / 2, 2 * range - 1)),
+        shared_ptr<querier::QuerierInterface>(new querier::BlockQuerier(blocks[1], range / 2, 2 * range - 1))}));
+
+    unordered_set<tagtree::TSID> l({1, 4, 7});
+    querier::AggregateRequest req;
+    for(tagtree::TSID tsid: l)
+        req.groups[tsid] = 0;
+    req.num_groups = 1;
+    req.start = range / 2;
+    req.end = 2 * range - 1;
+    req.step = 60 * 1000;
+    querier::AggregateResult want;
+    ASSERT_FALSE(direct.aggregate(req, &want));
+    auto series = collect(direct.select(l));
+
+    // Twice, the second select() is served from the cache.
+    for(int i = 0; i < 2; ++ i){
+        querier::CachedQuerier q(cache, range / 2, 2 * range - 1, factory);
+        ASSERT_EQ(collect(q.select(l)), series);
+        querier::AggregateResult got;
+        ASSERT_FALSE(q.aggregate(req, &got));
+        ASSERT_EQ(got.columns, want.columns);
+        ASSERT_FALSE(q.error());
+    }
+    ASSERT_EQ(cache->stats().hits, 1);
+    ASSERT_EQ(cache->stats().misses, 1);
+
+    // The chunks come from the underlying querier.
+    querier::CachedQuerier q(cache, 0, range - 1, [&blocks](int64_t mint, int64_t maxt){
+        return make_pair(unique_ptr<querier::QuerierInterface>(new querier::BlockQuerier(blocks[0], mint, maxt)), error::Error());
+    });
+    auto css = q.chunk_select(l);
+    ASSERT_TRUE(css != nullptr);
+    vector<tagtree::TSID> tsids;
+    while(css->next())
+        tsids.push_back(css->at()->tsid);
+    ASSERT_EQ(tsids, vector<tagtree::TSID>({1, 4, 7}));
+}
+
+TEST(DBTest, ChunkSeriesIteratorSeek){
+    vector<shared_ptr<chunk::ChunkMeta>> chunks({test_chunk(0, 100, 1, 0), test_chunk(100, 200, 2, 1), test_chunk(300, 400, 1, 2)});
+    tombstone::Intervals intervals({{150, 199}, {300, 310}});
+
+    querier::ChunkSeriesIterator it(chunks, intervals, 10, 350);
+    ASSERT_TRUE(it.seek(5));
+    ASSERT_EQ(it.at().first, 10);
+    ASSERT_TRUE(it.seek(99));
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.at(), make_pair(static_cast<int64_t>(100), 1.0));
+    // Into the deleted tail of the second chunk.
+    ASSERT_TRUE(it.seek(150));
+    ASSERT_EQ(it.at(), make_pair(static_cast<int64_t>(311), 2.0));
+    // Never moves backwards.
+    ASSERT_TRUE(it.seek(200));
+    ASSERT_EQ(it.at().first, 311);
+    ASSERT_TRUE(it.seek(350));
+    ASSERT_EQ(it.at().first, 350);
+    ASSERT_FALSE(it.next());
+    ASSERT_FALSE(it.error());
+
+    // Failed seeks exhaust the iterator.
+    querier::ChunkSeriesIterator past_max(chunks, intervals, 10, 350);
+    ASSERT_TRUE(past_max.next());
+    ASSERT_FALSE(past_max.seek(351));
+    ASSERT_FALSE(past_max.next());
+    querier::ChunkSeriesIterator past_end(chunks, intervals, 0, 1000);
+    ASSERT_TRUE(past_end.next());
+    ASSERT_FALSE(past_end.seek(400));
+    ASSERT_FALSE(past_end.next());
+    ASSERT_FALSE(past_end.seek(0));
+    ASSERT_FALSE(past_end.error());
+}
+
+TEST(DBTest, ChainSeriesIteratorSeek){
+    TestSeriesSet s;
+    s.add(1, 0, 100);
+    s.add(1, 100, 200, 2);
+    s.add(1, 300, 400);
+    shared_ptr<querier::Series> series(new querier::Series());
+    for(auto & p: s.series)
+        series->push_back(p);
+
+    querier::ChainSeriesIterator it(series);
+    ASSERT_TRUE(it.seek(99));
+    ASSERT_EQ(it.at().first, 99);
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(it.at().first, 100);
+    ASSERT_TRUE(it.seek(199));
+    ASSERT_EQ(it.at().first, 300);
+    ASSERT_TRUE(it.seek(250));
+    ASSERT_EQ(it.at().first, 300);
+    ASSERT_TRUE(it.seek(399));
+    ASSERT_FALSE(it.next());
+    ASSERT_FALSE(it.seek(0));
+
+    querier::ChainSeriesIterator past_end(series);
+    ASSERT_TRUE(past_end.seek(150));
+    ASSERT_FALSE(past_end.seek(400));
+    ASSERT_FALSE(past_end.next());
+    ASSERT_FALSE(past_end.error());
+
+    int n = 0;
+    querier::ChainSeriesIterator all(series);
+    while(all.next())
+        ++ n;
+    ASSERT_EQ(n, 250);
+}
+
+// Garbage collects the head before mint once the series gc_after is read.
+class GCChunkSeriesSet: public querier::ChunkSeriesSetInterface{
+    public:
+        shared_ptr<querier::ChunkSeriesSetInterface> set;
+        shared_ptr<head::Head> h;
+        tagtree::TSID gc_after;
+        int64_t mint;
+
+        GCChunkSeriesSet(const shared_ptr<querier::ChunkSeriesSetInterface> & set, const shared_ptr<head::Head> & h, tagtree::TSID gc_after, int64_t mint): set(set), h(h), gc_after(gc_after), mint(mint){}
+
+        bool next() const{
+            if(!set->next())
+                return false;
+            if(set->at()->tsid == gc_after)
+                h->truncate(mint);
+            return true;
+        }
+        const shared_ptr<querier::ChunkSeriesMeta> & at() const{ return set->at(); }
+        bool error() const{ return set->error(); }
+};
+
+TEST(DBTest, PopulatedChunkSeriesSetHeadGC){
+    int64_t range = 3600 * 1000;
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+    pool->start(1);
+    shared_ptr<head::Head> h(new head::Head(range, nullptr, pool));
+    ASSERT_FALSE(h->init(0));
+    // Series [0, 5) only have recent samples, [5, 10) also old ones.
+    for(int64_t t = 0; t < 3 * range; t += 15000){
+        auto app = h->appender();
+        for(int i = 0; i < 10; ++ i){
+            if(i >= 5 || t >= 2 * range)
+                ASSERT_FALSE(app->add(i, t, test_value(i, t)));
+        }
+        ASSERT_FALSE(app->commit());
+    }
+
+    unordered_set<tagtree::TSID> l;
+    for(int i = 0; i < 10; ++ i)
+        l.insert(i);
+    shared_ptr<querier::ChunkSeriesSetInterface> base(new querier::BaseChunkSeriesSet(h->index().first, h->tombstones().first, l));
+    // The old chunks are dropped after their refs are read, before the chunks
+    // are.
+    shared_ptr<querier::ChunkSeriesSetInterface> gc(new GCChunkSeriesSet(base, h, 9, 2 * range));
+    querier::PopulatedChunkSeriesSet p(gc, h->chunks().first, 0, 3 * range);
+    vector<tagtree::TSID> tsids;
+    while(p.next()){
+        tsids.push_back(p.at()->tsid);
+        for(auto & c: p.at()->chunks)
+            ASSERT_TRUE(c->chunk != nullptr);
+    }
+    ASSERT_EQ(tsids, vector<tagtree::TSID>({0, 1, 2, 3, 4}));
+    ASSERT_TRUE(p.error());
+
+    // Fresh queries only see the remaining chunks.
+    base.reset(new querier::BaseChunkSeriesSet(h->index().first, h->tombstones().first, l));
+    querier::PopulatedChunkSeriesSet p2(base, h->chunks().first, 0, 3 * range);
+    int n = 0;
+    while(p2.next())
+        ++ n;
+    ASSERT_EQ(n, 10);
+    ASSERT_FALSE(p2.error());
+    pool->stop();
+}
+
+TEST(DBTest, DirectSliceRange){
+    boost::filesystem::remove_all("db_test_direct");
+    boost::filesystem::create_directories("db_test_direct");
+    int size = 2 * tsdbutil::BUFFER_BLOCK_SIZE + 100;
+    vector<char> data(size);
+    for(int i = 0; i < size; ++ i)
+        data[i] = static_cast<char>(i * 7);
+    {
+        std::ofstream out("db_test_direct/file", std::ios::binary);
+        out.write(data.data(), size);
+    }
+
+    shared_ptr<tsdbutil::BufferCache> cache(new tsdbutil::BufferCache(1 << 20));
+    tsdbutil::DirectSlice s("db_test_direct/file", cache, 0);
+    ASSERT_EQ(s.len(), size);
+    ASSERT_FALSE(s.stable());
+
+    // Within a block, across two blocks and up to the end of the file.
+    vector<pair<int, int>> ranges({{10, 20}, {tsdbutil::BUFFER_BLOCK_SIZE - 5, tsdbutil::BUFFER_BLOCK_SIZE + 5}, {0, size}, {size - 50, size + 50}});
+    for(auto & r: ranges){
+        uint64_t gen = s.generation();
+        std::pair<const uint8_t *, int> p = s.range(r.first, r.second);
+        ASSERT_EQ(s.generation(), gen + 1);
+        int end = std::min(r.second, size);
+        ASSERT_EQ(p.second, end - r.first);
+        ASSERT_EQ(memcmp(p.first, data.data() + r.first, p.second), 0);
+    }
+    ASSERT_TRUE(s.range(5, 5).first == nullptr);
+    boost::filesystem::remove_all("db_test_direct");
+}
+
+TEST(DBTest, DeleteSchedulesCleanTombstones){
+    boost::filesystem::remove_all("db_test_del");
+    int64_t range = 3600 * 1000;
+    write_test_block("db_test_del", 0, range, 4);
+    {
+        db::DB db("db_test_del");
+        ASSERT_FALSE(db.error());
+        std::deque<shared_ptr<label::MatcherInterface>> matchers({shared_ptr<label::MatcherInterface>(new label::EqualMatcher("a", "1"))});
+
+        // Only the head overlaps, it drops the samples itself.
+        ASSERT_FALSE(db.del(10 * range, 11 * range, matchers));
+        ASSERT_FALSE(db.scheduler()->status()[db::JOB_CLEAN_TOMBSTONES].queued);
+
+        int64_t now = base::TimeStamp::now().microSecondsSinceEpoch();
+        ASSERT_FALSE(db.del(0, range / 2, matchers));
+        db::JobStatus st = db.scheduler()->status()[db::JOB_CLEAN_TOMBSTONES];
+        ASSERT_TRUE(st.queued);
+        ASSERT_GE(st.due_us, now + static_cast<int64_t>(db::CLEAN_TOMBSTONES_DELAY_SECONDS * base::TimeStamp::kMicroSecondsPerSecond));
+    }
+    boost::filesystem::remove_all("db_test_del");
+}
+
+block::DirMeta test_dir_meta(const string & dir, int64_t mint, int64_t maxt, uint64_t bytes, bool failed = false){
+    shared_ptr<block::BlockMeta> meta(new block::BlockMeta(ulid::ULID(), mint, maxt));
+    meta->stats.num_bytes = bytes;
+    meta->compaction.failed = failed;
+    return block::DirMeta(dir, meta);
+}
+
+// The dirs of the selected blocks, empty when there are none.
+vector<string> selected_dirs(const shared_ptr<block::DirMetas> & dms){
+    vector<string> r;
+    if(dms){
+        for(int i = 0; i < dms->size(); ++ i)
+            r.push_back(dms->at(i).dir);
+    }
+    return r;
+}
+
+TEST(DBTest, TieredSelectDirs){
+    shared_ptr<base::Channel<char>> cancel(new base::Channel<char>());
+    compact::TieredCompactor c({10, 80}, cancel, 3, 2);
+    vector<string> expected;
+
+    // Not enough blocks of a tier yet.
+    shared_ptr<block::DirMetas> dms(new block::DirMetas({test_dir_meta("a", 0, 10, 100), test_dir_meta("b", 10, 20, 150)}));
+    ASSERT_TRUE(selected_dirs(c.select_dirs(dms)).empty());
+
+    // The oldest run of min_blocks similar blocks.
+    dms.reset(new block::DirMetas({test_dir_meta("a", 0, 10, 100), test_dir_meta("b", 10, 20, 150), test_dir_meta("c", 20, 30, 200), test_dir_meta("d", 30, 40, 100)}));
+    expected = {"a", "b", "c"};
+    ASSERT_EQ(selected_dirs(c.select_dirs(dms)), expected);
+
+    // A block out of size_ratio restarts the run, at itself.
+    dms.reset(new block::DirMetas({test_dir_meta("a", 0, 10, 100), test_dir_meta("b", 10, 20, 1000), test_dir_meta("c", 20, 30, 100), test_dir_meta("d", 30, 40, 120), test_dir_meta("e", 40, 50, 150)}));
+    expected = {"c", "d", "e"};
+    ASSERT_EQ(selected_dirs(c.select_dirs(dms)), expected);
+    dms.reset(new block::DirMetas({test_dir_meta("a", 0, 10, 100), test_dir_meta("b", 10, 20, 1000), test_dir_meta("c", 20, 30, 900), test_dir_meta("d", 30, 40, 600)}));
+    expected = {"b", "c", "d"};
+    ASSERT_EQ(selected_dirs(c.select_dirs(dms)), expected);
+
+    // Failed blocks are skipped and break the run.
+    dms.reset(new block::DirMetas({test_dir_meta("a", 0, 10, 100), test_dir_meta("b", 10, 20, 100, true), test_dir_meta("c", 20, 30, 100), test_dir_meta("d", 30, 40, 100)}));
+    ASSERT_TRUE(selected_dirs(c.select_dirs(dms)).empty());
+    dms->push_back(test_dir_meta("e", 40, 50, 100));
+    expected = {"c", "d", "e"};
+    ASSERT_EQ(selected_dirs(c.select_dirs(dms)), expected);
+
+    // Runs do not cross a window of the largest range.
+    dms.reset(new block::DirMetas({test_dir_meta("a", 60, 70, 100), test_dir_meta("b", 70, 80, 100), test_dir_meta("c", 80, 90, 100), test_dir_meta("d", 90, 100, 100)}));
+    ASSERT_TRUE(selected_dirs(c.select_dirs(dms)).empty());
+
+    // Without stats the span is the size.
+    dms.reset(new block::DirMetas({test_dir_meta("a", 0, 40, 0), test_dir_meta("b", 40, 50, 0), test_dir_meta("c", 50, 60, 0), test_dir_meta("d", 60, 70, 0)}));
+    expected = {"b", "c", "d"};
+    ASSERT_EQ(selected_dirs(c.select_dirs(dms)), expected);
+
+    // A single range has nothing to merge into.
+    compact::TieredCompactor single({10}, cancel, 3, 2);
+    dms.reset(new block::DirMetas({test_dir_meta("a", 0, 10, 100), test_dir_meta("b", 10, 20, 100), test_dir_meta("c", 20, 30, 100)}));
+    ASSERT_TRUE(selected_dirs(single.select_dirs(dms)).empty());
+}
+
+// n samples with irregular timestamps, the odd ones setting ever lower bits of
+// the value so that both new and reused XOR windows are encoded.
+shared_ptr<chunk::ChunkMeta> xor_test_chunk(int n){
+    shared_ptr<chunk::ChunkInterface> c(new chunk::XORChunk());
+    auto app = c->appender();
+    for(int i = 0; i < n; ++ i)
+        app->append(i * 1000 + (i % 3) * 7, i % 2 ? 100 + std::ldexp(1.0, -(i / 4)) : 100 + (i % 4) * 0.25);
+    return shared_ptr<chunk::ChunkMeta>(new chunk::ChunkMeta(c, 0, (n - 1) * 1000 + ((n - 1) % 3) * 7));
+}
+
+vector<pair<int64_t, double>> chunk_samples(const shared_ptr<chunk::ChunkInterface> & c){
+    vector<pair<int64_t, double>> r;
+    auto it = c->iterator();
+    while(it->next())
+        r.push_back(it->at());
+    EXPECT_FALSE(it->error());
+    return r;
+}
+
+shared_ptr<chunk::ChunkInterface> encode_samples(const vector<pair<int64_t, double>> & samples){
+    shared_ptr<chunk::ChunkInterface> c(new chunk::XORChunk());
+    auto app = c->appender();
+    for(auto & p: samples)
+        app->append(p.first, p.second);
+    return c;
+}
+
+TEST(DBTest, XORAppendBits){
+    auto c = xor_test_chunk(120);
+    auto all = chunk_samples(c->chunk);
+    chunk::XORChunk view(c->chunk->bytes(), c->chunk->size());
+    auto it = view.xor_iterator();
+
+    // Bit offsets of each sample and of the end.
+    vector<int> pos({it->bit_pos()});
+    vector<bool> new_window;
+    while(it->next()){
+        pos.push_back(it->bit_pos());
+        new_window.push_back(it->new_window);
+    }
+    ASSERT_EQ(pos.front(), 16);
+    ASSERT_EQ(new_window.size(), all.size());
+    for(int i = 1; i < pos.size(); ++ i)
+        ASSERT_GT(pos[i], pos[i - 1]);
+    ASSERT_LE(pos.back(), c->chunk->size() * 8);
+    ASSERT_GT(pos.back(), (c->chunk->size() - 1) * 8);
+
+    // A suffix starting at a new window decodes the same after any two
+    // samples re-encoded before it.
+    int windows = 0, reused = 0;
+    for(int k = 2; k < all.size(); ++ k){
+        if(!new_window[k]){
+            ++ reused;
+            continue;
+        }
+        ++ windows;
+        for(int j = 0; j <= k - 2; j += k - 2 > 0 ? k - 2 : 1){
+            shared_ptr<chunk::XORChunk> out(new chunk::XORChunk());
+            {
+                auto app = out->appender();
+                for(int i = j; i < k; ++ i)
+                    app->append(all[i].first, all[i].second);
+            }
+            out->append_bits(c->chunk->bytes(), pos[k], pos.back(), all.size() - k);
+            ASSERT_EQ(out->num_samples(), all.size() - j);
+            vector<pair<int64_t, double>> expected(all.begin() + j, all.end());
+            ASSERT_EQ(chunk_samples(out), expected);
+        }
+    }
+    ASSERT_GT(windows, 5);
+    ASSERT_GT(reused, 5);
+}
+
+// The runs of samples outside of itvls.
+vector<vector<pair<int64_t, double>>> surviving_runs(const vector<pair<int64_t, double>> & samples, const tombstone::Intervals & itvls){
+    vector<vector<pair<int64_t, double>>> r;
+    bool open = false;
+    for(auto & p: samples){
+        bool deleted = false;
+        for(auto & itvl: itvls)
+            deleted = deleted || (itvl.min_time <= p.first && p.first <= itvl.max_time);
+        if(deleted)
+            open = false;
+        else{
+            if(!open)
+                r.emplace_back();
+            r.back().push_back(p);
+            open = true;
+        }
+    }
+    return r;
+}
+
+TEST(DBTest, SplitDeleted){
+    auto c = xor_test_chunk(120);
+    auto all = chunk_samples(c->chunk);
+    vector<tombstone::Intervals> cases({
+        // The first sample.
+        {{all[0].first, all[0].first}},
+        // The last sample.
+        {{all.back().first, all.back().first}},
+        // Within a window and across window starts.
+        {{all[53].first, all[56].first}},
+        {{all[45].first, all[71].first}},
+        // Several intervals, one past the end.
+        {{all[0].first - 100, all[1].first}, {all[10].first, all[12].first}, {all[40].first, all[40].first}, {all[80].first, all[95].first}, {all[118].first, all[119].first + 100000}},
+        // Every other sample.
+        {{all[1].first, all[1].first}, {all[3].first, all[3].first}, {all[5].first, all[5].first}, {all[7].first, all[7].first}},
+    });
+    for(auto & itvls: cases){
+        auto r = chunk::split_deleted(c, itvls);
+        ASSERT_FALSE(r.second);
+        auto runs = surviving_runs(all, itvls);
+        ASSERT_EQ(r.first.size(), runs.size());
+        for(int k = 0; k < runs.size(); ++ k){
+            shared_ptr<chunk::ChunkInterface> ref = encode_samples(runs[k]);
+            ASSERT_EQ(r.first[k]->min_time, runs[k].front().first);
+            ASSERT_EQ(r.first[k]->max_time, runs[k].back().first);
+            ASSERT_EQ(r.first[k]->chunk->num_samples(), ref->num_samples());
+            ASSERT_EQ(chunk_samples(r.first[k]->chunk), runs[k]);
+            // A leading run keeps the original bits, which re-encode the same.
+            if(runs[k].front() == all.front()){
+                ASSERT_EQ(r.first[k]->chunk->size(), ref->size());
+                ASSERT_EQ(memcmp(r.first[k]->chunk->bytes(), ref->bytes(), ref->size()), 0);
+            }
+        }
+    }
+
+    // Nothing deleted between the samples.
+    tombstone::Intervals between({{all[5].first + 1, all[6].first - 1}});
+    auto r = chunk::split_deleted(c, between);
+    ASSERT_FALSE(r.second);
+    ASSERT_EQ(r.first.size(), 1);
+    ASSERT_TRUE(r.first[0] == c);
+
+    // Everything deleted.
+    tombstone::Intervals everything({{all.front().first, all.back().first}});
+    r = chunk::split_deleted(c, everything);
+    ASSERT_FALSE(r.second);
+    ASSERT_TRUE(r.first.empty());
+}
+
+TEST(DBTest, HeadDeleteMasking){
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+    pool->start(1);
+    shared_ptr<head::Head> h(new head::Head(3600 * 1000, nullptr, pool));
+    ASSERT_FALSE(h->init(0));
+    auto append = [&h](int64_t mint, int64_t maxt){
+        for(int64_t t = mint; t < maxt; t += 1000){
+            auto app = h->appender();
+            for(int i = 0; i < 2; ++ i)
+                ASSERT_FALSE(app->add(i, t, test_value(i, t)));
+            ASSERT_FALSE(app->commit());
+        }
+    };
+    append(0, 100000);
+
+    auto stones = h->tombstones().first;
+    ASSERT_TRUE(h->tombstones().first == stones);
+    ASSERT_FALSE(h->del(20000, 30000, {0}));
+    // Clamped to the newest sample of the series.
+    ASSERT_FALSE(h->del(90000, 200000, {1}));
+    auto after = h->tombstones().first;
+    ASSERT_TRUE(after != stones);
+    ASSERT_TRUE(h->tombstones().first == after);
+    // Earlier snapshots are left as they were.
+    ASSERT_EQ(stones->total(), 0);
+    ASSERT_EQ(after->total(), 2);
+
+    // Samples appended after the deletes are not masked, even within the
+    // deleted range of series 1.
+    append(100000, 150000);
+    ASSERT_TRUE(h->tombstones().first == after);
+
+    unordered_set<tagtree::TSID> l({0, 1});
+    querier::BlockQuerier q(h, 0, 200000);
+    auto m = collect(q.select(l));
+    ASSERT_EQ(m.size(), 2);
+    for(tagtree::TSID tsid = 0; tsid < 2; ++ tsid){
+        vector<pair<int64_t, double>> expected;
+        for(int64_t t = 0; t < 150000; t += 1000){
+            if(tsid == 0 && t >= 20000 && t <= 30000)
+                continue;
+            if(tsid == 1 && t >= 90000 && t <= 99000)
+                continue;
+            expected.emplace_back(t, test_value(tsid, t));
+        }
+        ASSERT_EQ(m[tsid], expected);
+    }
+    pool->stop();
+}
+
+// The rate/increase cases of Prometheus' functions.test, 5m apart from 0:
+// foo 0+10x10, bar 0+10x5 0+10x5, dings 10+10x10, bumms 1+10x10.
+TEST(DBTest, RangeFunctions){
+    const int64_t m = 60 * 1000;
+    vector<vector<double>> values(4);
+    for(int i = 0; i <= 10; ++ i){
+        values[0].push_back(10 * i);
+        values[2].push_back(10 + 10 * i);
+        values[3].push_back(1 + 10 * i);
+    }
+    for(int i = 0; i < 12; ++ i)
+        values[1].push_back(10 * (i % 6));
+
+    TestSeriesSet ss;
+    for(int s = 0; s < 4; ++ s){
+        shared_ptr<vector<pair<int64_t, double>>> samples(new vector<pair<int64_t, double>>());
+        for(size_t i = 0; i < values[s].size(); ++ i)
+            samples->emplace_back(static_cast<int64_t>(i) * 5 * m, values[s][i]);
+        ss.series.emplace_back(new querier::PrefetchedSeries(s, samples));
+    }
+
+    // increase at 50m over [50m] and [100m].
+    vector<double> want50 = {100, 800.0 / 9, 100, 100};
+    vector<double> want100 = {100, 90, 105, 101};
+    for(int s = 0; s < 4; ++ s){
+        querier::RangeFunctionIterator it50(ss.series[s]->iterator(), querier::RANGE_INCREASE, 50 * m, 50 * m, 50 * m, 1);
+        ASSERT_TRUE(it50.next());
+        ASSERT_EQ(50 * m, it50.at().first);
+        ASSERT_NEAR(want50[s], it50.at().second, 1e-9);
+        ASSERT_FALSE(it50.next());
+
+        querier::RangeFunctionIterator it100(ss.series[s]->iterator(), querier::RANGE_INCREASE, 100 * m, 50 * m, 50 * m, 1);
+        ASSERT_TRUE(it100.next());
+        ASSERT_NEAR(want100[s], it100.at().second, 1e-9);
+
+        querier::RangeFunctionIterator rate(ss.series[s]->iterator(), querier::RANGE_RATE, 50 * m, 50 * m, 50 * m, 1);
+        ASSERT_TRUE(rate.next());
+        ASSERT_NEAR(want50[s] / 3000, rate.at().second, 1e-12);
+    }
+
+    // A window with a single sample has no rate.
+    querier::RangeFunctionIterator single(ss.series[0]->iterator(), querier::RANGE_RATE, 5 * m, 50 * m, 50 * m, 1);
+    ASSERT_FALSE(single.next());
+
+    // The same through the aggregation pushdown, one group per series, and
+    // sum over all of them.
+    querier::AggregateRequest req;
+    for(int s = 0; s < 4; ++ s)
+        req.groups[s] = s;
+    req.num_groups = 4;
+    req.start = 50 * m;
+    req.end = 55 * m;
+    req.step = 5 * m;
+    req.range = 50 * m;
+    req.range_func = querier::RANGE_INCREASE;
+    querier::AggregateResult result;
+    ss.i = -1;
+    ASSERT_FALSE(querier::aggregate_series_set(shared_ptr<querier::SeriesSetInterface>(new TestSeriesSet(ss)), req, &result));
+    ASSERT_EQ(4, static_cast<int>(result.columns.size()));
+    for(int s = 0; s < 4; ++ s)
+        ASSERT_NEAR(want50[s], result.columns[s][0], 1e-9);
+
+    // At 55m foo ends 5m before the window end and is extrapolated on both
+    // sides, bar was reset at 30m: 50 - 20 + 50 over 45m.
+    ASSERT_NEAR(100, result.columns[0][1], 1e-9);
+    ASSERT_NEAR(800.0 / 9, result.columns[1][1], 1e-9);
+
+    for(int s = 0; s < 4; ++ s)
+        req.groups[s] = 0;
+    req.num_groups = 1;
+    req.end = 50 * m;
+    querier::AggregateResult sum;
+    ASSERT_FALSE(querier::aggregate_series_set(shared_ptr<querier::SeriesSetInterface>(new TestSeriesSet(ss)), req, &sum));
+    ASSERT_NEAR(want50[0] + want50[1] + want50[2] + want50[3], sum.columns[0][0], 1e-9);
+
+    // The chunk pushdown of a block agrees with the iterator.
+    boost::filesystem::remove_all("db_test/range_functions");
+    int64_t range = 3600 * 1000;
+    int num_series = 5;
+    shared_ptr<block::Block> b = write_test_block("db_test/range_functions", 0, range, num_series);
+    querier::BlockQuerier q(b, 0, range);
+    querier::AggregateRequest breq;
+    unordered_set<tagtree::TSID> l;
+    for(int i = 0; i < num_series; ++ i){
+        breq.groups[i] = i;
+        l.insert(i);
+    }
+    breq.num_groups = num_series;
+    breq.start = 5 * m;
+    breq.end = range;
+    breq.step = 7 * m;
+    breq.range = 10 * m;
+    for(querier::RangeFunction f: {querier::RANGE_RATE, querier::RANGE_MAX_OVER_TIME, querier::RANGE_COUNT_OVER_TIME}){
+        breq.range_func = f;
+        querier::AggregateResult got;
+        ASSERT_FALSE(q.aggregate(breq, &got));
+        auto sset = q.select(l);
+        while(sset->next()){
+            auto s = sset->at();
+            querier::RangeFunctionIterator it(s->iterator(), f, breq.range, breq.start, breq.end, breq.step);
+            int k = 0;
+            while(it.next()){
+                for(; breq.start + k * breq.step < it.at().first; ++ k)
+                    ASSERT_TRUE(std::isnan(got.columns[s->tsid()][k]));
+                ASSERT_DOUBLE_EQ(it.at().second, got.columns[s->tsid()][k]);
+                ++ k;
+            }
+            ASSERT_GT(k, 0);
+        }
+    }
+}
+
+// Compacting with TSID partitions gives the same block as populate_blocks().
+TEST(DBTest, PartitionedCompaction){
+    boost::filesystem::remove_all("db_test/partitions");
+    int64_t range = 600 * 1000;
+    int num_series = 3 * compact::COMPACTION_MIN_PARTITION_SERIES + 100;
+    vector<shared_ptr<block::Block>> blocks;
+    deque<string> dirs;
+    for(int i = 0; i < 2; ++ i){
+        blocks.push_back(write_test_block("db_test/partitions", i * range, (i + 1) * range, num_series, 60 * 1000));
+        dirs.push_back(blocks.back()->dir());
+    }
+    ASSERT_FALSE(blocks[0]->del(120 * 1000, 300 * 1000, 5000));
+    for(auto & b: blocks)
+        ASSERT_FALSE(b->del(0, 2 * range, 7));
+
+    vector<shared_ptr<block::Block>> out;
+    for(int concurrency: {1, 3}){
+        compact::LeveledCompactor c({2 * range}, shared_ptr<base::Channel<char>>(new base::Channel<char>()), concurrency);
+        auto r = c.compact("db_test/partitions/out" + to_string(concurrency), dirs, nullptr);
+        ASSERT_FALSE(r.second);
+        out.emplace_back(new block::Block(tsdbutil::filepath_join("db_test/partitions/out" + to_string(concurrency), ulid::Marshal(r.first))));
+    }
+    ASSERT_EQ(out[0]->meta().stats.num_series, out[1]->meta().stats.num_series);
+    ASSERT_EQ(out[0]->meta().stats.num_chunks, out[1]->meta().stats.num_chunks);
+    ASSERT_EQ(out[0]->meta().stats.num_samples, out[1]->meta().stats.num_samples);
+    ASSERT_EQ(num_series - 1, static_cast<int>(out[1]->meta().stats.num_series));
+    // The chunk files of the partitions were moved into chunks/.
+    ASSERT_TRUE(boost::filesystem::exists(out[1]->dir() + "/chunks/000000"));
+    ASSERT_FALSE(boost::filesystem::exists(out[1]->dir() + "/chunks.0"));
+
+    unordered_set<tagtree::TSID> l;
+    for(int i = 0; i < num_series; ++ i)
+        l.insert(i);
+    querier::BlockQuerier q0(out[0], 0, 2 * range);
+    querier::BlockQuerier q1(out[1], 0, 2 * range);
+    auto css0 = q0.chunk_select(l);
+    auto css1 = q1.chunk_select(l);
+    int n = 0;
+    while(css0->next()){
+        ASSERT_TRUE(css1->next());
+        auto & a = css0->at();
+        auto & b = css1->at();
+        ASSERT_EQ(a->tsid, b->tsid);
+        ASSERT_EQ(a->chunks.size(), b->chunks.size());
+        for(size_t i = 0; i < a->chunks.size(); ++ i){
+            ASSERT_EQ(a->chunks[i]->min_time, b->chunks[i]->min_time);
+            ASSERT_EQ(a->chunks[i]->max_time, b->chunks[i]->max_time);
+            ASSERT_EQ(a->chunks[i]->chunk->size(), b->chunks[i]->chunk->size());
+            ASSERT_EQ(0, memcmp(a->chunks[i]->chunk->bytes(), b->chunks[i]->chunk->bytes(), a->chunks[i]->chunk->size()));
+        }
+        ++ n;
+    }
+    ASSERT_FALSE(css1->next());
+    ASSERT_EQ(num_series - 1, n);
+}
+
+TEST(DBTest, RateLimiter){
+    int64_t rate = 10 << 20;
+    base::RateLimiter limiter(rate, rate / 10);
+
+    // The burst passes without waiting, the debt of the next request is slept
+    // off at rate.
+    limiter.request(rate / 10);
+    ASSERT_EQ(0, limiter.waited_us());
+    base::TimeStamp start = base::TimeStamp::now();
+    limiter.request(rate / 4);
+    ASSERT_GE(base::timeDifference(base::TimeStamp::now(), start), 0.2);
+    ASSERT_GE(limiter.waited_us(), 240000);
+    ASSERT_LE(limiter.waited_us(), 260000);
+    ASSERT_EQ(rate / 10 + rate / 4, limiter.bytes());
+
+    // AIMD between rate / 16 and rate.
+    for(int i = 0; i < 10; ++ i)
+        limiter.adapt(true);
+    ASSERT_EQ(rate / 16, limiter.rate());
+    limiter.adapt(false);
+    ASSERT_EQ(rate / 8, limiter.rate());
+    for(int i = 0; i < 20; ++ i)
+        limiter.adapt(false);
+    ASSERT_EQ(rate, limiter.rate());
+}
+
+TEST(DBTest, CompactionRateAdapts){
+    boost::filesystem::remove_all("db_test_adapt");
+    {
+        db::Options opts = db::DefaultOptions;
+        opts.compaction_bytes_per_sec = 16 << 20;
+        opts.compaction_target_commit_latency_us = 1000;
+        db::DB db("db_test_adapt", opts);
+        ASSERT_FALSE(db.error());
+        ASSERT_TRUE(db.observes_commit_latency());
+        int64_t rate = opts.compaction_bytes_per_sec;
+        auto limiter = db.compaction_limiter();
+
+        // Slow commits halve the rate at most every adapt interval, down to
+        // rate / 16.
+        int64_t last = rate;
+        for(int i = 0; i < 6; ++ i){
+            usleep(db::COMPACTION_ADAPT_INTERVAL_US + 10000);
+            db.observe_commit_latency(100000);
+            ASSERT_LE(limiter->rate(), last);
+            ASSERT_GE(limiter->rate(), rate / 16);
+            last = limiter->rate();
+        }
+        ASSERT_EQ(rate / 16, limiter->rate());
+
+        // Fast commits pull the moving average under the target and the rate
+        // grows back to rate.
+        for(int i = 0; i < 50; ++ i)
+            db.observe_commit_latency(10);
+        for(int i = 0; i < 20; ++ i){
+            usleep(db::COMPACTION_ADAPT_INTERVAL_US + 10000);
+            db.observe_commit_latency(10);
+            ASSERT_GE(limiter->rate(), last);
+            ASSERT_LE(limiter->rate(), rate);
+            last = limiter->rate();
+        }
+        ASSERT_EQ(rate, limiter->rate());
+    }
+    boost::filesystem::remove_all("db_test_adapt");
+}
+
+// Compacting a single block without tombstones copies the raw chunk entries,
+// the chunk files are identical.
+TEST(DBTest, RawChunkPassthrough){
+    boost::filesystem::remove_all("db_test/passthrough");
+    int64_t range = 3600 * 1000;
+    shared_ptr<block::Block> b = write_test_block("db_test/passthrough", 0, range, 50);
+    compact::LeveledCompactor c({range}, shared_ptr<base::Channel<char>>(new base::Channel<char>()));
+    auto r = c.compact("db_test/passthrough/out", deque<string>({b->dir()}), nullptr);
+    ASSERT_FALSE(r.second);
+    string out = tsdbutil::filepath_join("db_test/passthrough/out", ulid::Marshal(r.first));
+
+    std::ifstream f0(b->dir() + "/chunks/000000", std::ios::binary);
+    std::ifstream f1(out + "/chunks/000000", std::ios::binary);
+    string s0((std::istreambuf_iterator<char>(f0)), std::istreambuf_iterator<char>());
+    string s1((std::istreambuf_iterator<char>(f1)), std::istreambuf_iterator<char>());
+    ASSERT_GT(s0.size(), 8);
+    ASSERT_TRUE(s0 == s1);
+    ASSERT_FALSE(boost::filesystem::exists(out + "/chunks/000001"));
+
+    // Adjacent raw chunks are written as one run, the run ends with the call.
+    auto cr = b->chunks();
+    ASSERT_TRUE(cr.second);
+    auto c0 = cr.first->raw_chunk(0, 8);
+    ASSERT_TRUE(c0.second);
+    ASSERT_TRUE(c0.first->entry().first != NULL);
+    int len0 = c0.first->entry().second;
+    auto c1 = cr.first->raw_chunk(1, 8 + len0);
+    ASSERT_TRUE(c1.second);
+    ASSERT_TRUE(c1.first->entry().first == c0.first->entry().first + len0);
+    vector<shared_ptr<chunk::ChunkMeta>> metas;
+    metas.emplace_back(new chunk::ChunkMeta(c0.first, 0, 0));
+    metas.emplace_back(new chunk::ChunkMeta(c1.first, 0, 0));
+    {
+        chunk::ChunkWriter w("db_test/passthrough/raw");
+        w.write_chunks(metas);
+        ASSERT_EQ(8, static_cast<int>(metas[0]->ref & 0xffffffff));
+        ASSERT_EQ(8 + len0, static_cast<int>(metas[1]->ref & 0xffffffff));
+        w.write_chunks(metas);
+    }
+    std::ifstream f2("db_test/passthrough/raw/000000", std::ios::binary);
+    string s2((std::istreambuf_iterator<char>(f2)), std::istreambuf_iterator<char>());
+    int len = len0 + c1.first->entry().second;
+    ASSERT_EQ(8 + 2 * len, static_cast<int>(s2.size()));
+    ASSERT_TRUE(s2.compare(8, len, s0, 8, len) == 0);
+    ASSERT_TRUE(s2.compare(8 + len, len, s0, 8, len) == 0);
+}
+
+// n samples from t on, 1s apart.
+shared_ptr<chunk::ChunkMeta> rechunk_test_chunk(int64_t t, int n){
+    vector<pair<int64_t, double>> samples;
+    for(int i = 0; i < n; ++ i)
+        samples.emplace_back(t + i * 1000, (t / 1000 + i) % 13 * 0.5);
+    return shared_ptr<chunk::ChunkMeta>(new chunk::ChunkMeta(encode_samples(samples), t, t + (n - 1) * 1000));
+}
+
+vector<pair<int64_t, double>> chunks_samples(const vector<shared_ptr<chunk::ChunkMeta>> & chunks){
+    vector<pair<int64_t, double>> r;
+    for(auto & c: chunks){
+        auto s = chunk_samples(c->chunk);
+        r.insert(r.end(), s.begin(), s.end());
+    }
+    return r;
+}
+
+TEST(DBTest, Rechunk){
+    vector<shared_ptr<chunk::ChunkMeta>> small;
+    for(int i = 0; i < 10; ++ i)
+        small.push_back(rechunk_test_chunk(i * 30 * 1000, 30));
+    auto all = chunks_samples(small);
+
+    // Runs of up to 4 chunks fit in 120 samples.
+    auto r = chunk::rechunk(small, 120);
+    ASSERT_FALSE(r.second);
+    ASSERT_EQ(3, static_cast<int>(r.first.size()));
+    int want_samples[] = {120, 120, 60};
+    for(int i = 0; i < 3; ++ i){
+        ASSERT_EQ(want_samples[i], r.first[i]->chunk->num_samples());
+        ASSERT_EQ(small[4 * i]->min_time, r.first[i]->min_time);
+        ASSERT_EQ(small[std::min(4 * i + 3, 9)]->max_time, r.first[i]->max_time);
+    }
+    ASSERT_TRUE(all == chunks_samples(r.first));
+
+    // The byte limit keeps pairs of chunks.
+    uint64_t size = small[0]->chunk->size() + small[1]->chunk->size();
+    for(auto & c: small)
+        size = std::max(size, c->chunk->size() * 2);
+    r = chunk::rechunk(small, 120, static_cast<int>(size));
+    ASSERT_FALSE(r.second);
+    ASSERT_EQ(5, static_cast<int>(r.first.size()));
+    ASSERT_TRUE(all == chunks_samples(r.first));
+
+    // A single chunk and chunks too large to merge are returned untouched.
+    r = chunk::rechunk(vector<shared_ptr<chunk::ChunkMeta>>({small[0]}), 120);
+    ASSERT_TRUE(r.first[0] == small[0]);
+    r = chunk::rechunk(small, 59);
+    ASSERT_EQ(10, static_cast<int>(r.first.size()));
+    for(int i = 0; i < 10; ++ i)
+        ASSERT_TRUE(r.first[i] == small[i]);
+
+    // The number of samples of a XORChunk is stored in 16 bits, the merged
+    // chunks stay below 65536 samples whatever max_samples is.
+    vector<shared_ptr<chunk::ChunkMeta>> large;
+    for(int i = 0; i < 3; ++ i)
+        large.push_back(rechunk_test_chunk(i * 30000 * 1000, 30000));
+    r = chunk::rechunk(large, 1 << 20);
+    ASSERT_FALSE(r.second);
+    ASSERT_EQ(2, static_cast<int>(r.first.size()));
+    ASSERT_EQ(60000, r.first[0]->chunk->num_samples());
+    ASSERT_TRUE(r.first[1] == large[2]);
+    ASSERT_TRUE(chunks_samples(large) == chunks_samples(r.first));
+
+    large[2] = rechunk_test_chunk(60000 * 1000, 5535);
+    r = chunk::rechunk(large, 1 << 20);
+    ASSERT_EQ(1, static_cast<int>(r.first.size()));
+    ASSERT_EQ(65535, r.first[0]->chunk->num_samples());
+    ASSERT_TRUE(chunks_samples(large) == chunks_samples(r.first));
+
+    large[2] = rechunk_test_chunk(60000 * 1000, 5536);
+    r = chunk::rechunk(large, 1 << 20);
+    ASSERT_EQ(2, static_cast<int>(r.first.size()));
+    ASSERT_EQ(60000, r.first[0]->chunk->num_samples());
+    ASSERT_TRUE(r.first[1] == large[2]);
+    ASSERT_TRUE(chunks_samples(large) == chunks_samples(r.first));
+}
+
+// The samples of every series of b.
+map<tagtree::TSID, vector<pair<int64_t, double>>> block_samples(const shared_ptr<block::Block> & b, int num_series){
+    unordered_set<tagtree::TSID> l;
+    for(int i = 0; i < num_series; ++ i)
+        l.insert(i);
+    querier::BlockQuerier q(b, b->MinTime(), b->MaxTime());
+    return collect(q.select(l));
+}
+
+TEST(DBTest, RewriteAfterDeletes){
+    boost::filesystem::remove_all("db_test/rewrite");
+    int64_t range = 3600 * 1000;
+    int num_series = 40;
+    shared_ptr<block::Block> b = write_test_block("db_test/rewrite", 0, range, num_series);
+    compact::LeveledCompactor c({range}, shared_ptr<base::Channel<char>>(new base::Channel<char>()));
+
+    // Rewrite b and write it in full, both give the same samples. Returns the
+    // rewritten block.
+    auto rewrite = [&](const shared_ptr<block::Block> & b) -> shared_ptr<block::Block> {
+        shared_ptr<block::BlockMeta> parent(new block::BlockMeta(b->meta()));
+        auto r = c.rewrite("db_test/rewrite", b, parent);
+        EXPECT_FALSE(r.second);
+        auto w = c.write("db_test/rewrite/full", b, b->MinTime(), b->MaxTime(), parent);
+        EXPECT_FALSE(w.second);
+        shared_ptr<block::Block> rb(new block::Block(tsdbutil::filepath_join("db_test/rewrite", ulid::Marshal(r.first))));
+        shared_ptr<block::Block> wb(new block::Block(tsdbutil::filepath_join("db_test/rewrite/full", ulid::Marshal(w.first))));
+        EXPECT_TRUE(block_samples(rb, num_series) == block_samples(wb, num_series));
+        EXPECT_EQ(wb->meta().stats.num_samples, rb->meta().stats.num_samples);
+        EXPECT_EQ(wb->meta().stats.num_series, rb->meta().stats.num_series);
+        EXPECT_EQ(0u, wb->meta().stats.num_dead_bytes);
+        return rb;
+    };
+
+    // A part of the first chunk of some series.
+    for(int i = 0; i < 16; ++ i)
+        ASSERT_FALSE(b->del(600 * 1000, 1200 * 1000, i));
+    auto b1 = rewrite(b);
+    uint64_t dead1 = b1->meta().stats.num_dead_bytes;
+    ASSERT_GT(dead1, 0u);
+    ASSERT_EQ(num_series, static_cast<int>(b1->meta().stats.num_series));
+
+    // Half of the series, the dead bytes add up and outweigh the live ones.
+    for(int i = 16; i < 36; ++ i)
+        ASSERT_FALSE(b1->del(0, range, i));
+    auto b2 = rewrite(b1);
+    ASSERT_GT(b2->meta().stats.num_dead_bytes, dead1);
+    ASSERT_EQ(num_series - 20, static_cast<int>(b2->meta().stats.num_series));
+    ASSERT_GT(b2->meta().stats.num_dead_bytes, b2->chunks().first->size() / 2);
+
+    // So the next rewrite writes the block in full.
+    ASSERT_FALSE(b2->del(0, 60 * 1000, 39));
+    auto b3 = rewrite(b2);
+    ASSERT_EQ(0u, b3->meta().stats.num_dead_bytes);
+    ASSERT_LT(b3->chunks().first->size(), b2->chunks().first->size() / 2);
+}
+
+// The types of the records of the segments of dir.
+map<int, int> wal_record_types(const string & dir){
+    map<int, int> types;
+    wal::SegmentReader r(dir);
+    while(r.next())
+        ++ types[r.record().first[0]];
+    EXPECT_FALSE(r.error());
+    return types;
+}
+
+// A head over the WAL under dir, its samples are appended with
+// append(mint, maxt) and read with samples().
+class WALTestHead{
+    public:
+        shared_ptr<base::ThreadPool> pool;
+        shared_ptr<head::Head> h;
+
+        WALTestHead(const string & dir, bool compress_samples = false, int segment_size = wal::SEGMENT_SIZE): pool(new base::ThreadPool("test")){
+            pool->start(2);
+            h.reset(new head::Head(3600 * 1000, unique_ptr<wal::WAL>(new wal::WAL(dir, pool, segment_size)), pool, compress_samples));
+            EXPECT_FALSE(h->init(0));
+        }
+
+        // Series [0, 10) every second, the odd series are counters with
+        // repeated values and the series 4 has a NaN every 7 samples.
+        void append(int64_t mint, int64_t maxt){
+            for(int64_t t = mint; t < maxt; t += 1000){
+                auto app = h->appender();
+                for(int i = 0; i < 10; ++ i)
+                    EXPECT_FALSE(app->add(i, t, WALTestHead::value(i, t)));
+                EXPECT_FALSE(app->commit());
+            }
+        }
+
+        static double value(tagtree::TSID tsid, int64_t t){
+            if(tsid == 4 && t / 1000 % 7 == 0)
+                return std::numeric_limits<double>::quiet_NaN();
+            if(tsid % 2)
+                return static_cast<double>(t / 10000);
+            return test_value(tsid, t);
+        }
+
+        map<tagtree::TSID, vector<pair<int64_t, double>>> samples(){
+            unordered_set<tagtree::TSID> l;
+            for(int i = 0; i < 10; ++ i)
+                l.insert(i);
+            querier::BlockQuerier q(h, 0, 3600 * 1000);
+            return collect(q.select(l));
+        }
+
+        ~WALTestHead(){
+            h.reset();
+            pool->stop();
+        }
+};
+
+// The samples of WALTestHead::append(mint, maxt), NaNs compared as their bits.
+bool wal_test_samples_equal(const map<tagtree::TSID, vector<pair<int64_t, double>>> & m, int64_t mint, int64_t maxt){
+    if(m.size() != 10)
+        return false;
+    for(auto & p: m){
+        if(static_cast<int64_t>(p.second.size()) != (maxt - mint) / 1000)
+            return false;
+        for(size_t i = 0; i < p.second.size(); ++ i){
+            int64_t t = mint + static_cast<int64_t>(i) * 1000;
+            if(p.second[i].first != t || base::encode_double(p.second[i].second) != base::encode_double(WALTestHead::value(p.first, t)))
+                return false;
+        }
+    }
+    return true;
+}
+
+TEST(DBTest, WALCompressedSamples){
+    // Unsorted TSIDs, negative time deltas within and across series, repeated
+    // values and NaNs.
+    vector<tsdbutil::RefSample> in;
+    tagtree::TSID tsids[] = {5, 1, 5, 3, 1, 1000000007, 0, 3};
+    double values[] = {1.5, 1.5, std::numeric_limits<double>::quiet_NaN(), base::decode_double(0x7ff0000000000002ull), -0.0, std::numeric_limits<double>::infinity(), 4.9e-324, 1e300};
+    for(int i = 0; i < 200; ++ i){
+        int64_t t = (i % 5 == 0 ? -1 : 1) * static_cast<int64_t>(i) * 997 + (i % 3) * 1000000000000LL;
+        in.emplace_back(tsids[i % 8], t, values[(i / 3) % 8]);
+    }
+    vector<uint8_t> rec;
+    tsdbutil::RecordEncoder::compressed_samples(in, rec);
+    ASSERT_EQ(tsdbutil::RECORD_COMPRESSED_SAMPLES, tsdbutil::RecordDecoder::type(rec));
+    vector<uint8_t> plain;
+    tsdbutil::RecordEncoder::samples(in, plain);
+    ASSERT_LT(rec.size(), plain.size());
+
+    // Decoded sorted by TSID, the order of the samples of a series kept.
+    vector<tsdbutil::RefSample> want(in);
+    std::stable_sort(want.begin(), want.end(), [](const tsdbutil::RefSample & l, const tsdbutil::RefSample & r){ return l.tsid < r.tsid; });
+    vector<tsdbutil::RefSample> out;
+    ASSERT_FALSE(tsdbutil::RecordDecoder::samples(rec, out));
+    ASSERT_EQ(want.size(), out.size());
+    for(size_t i = 0; i < want.size(); ++ i){
+        ASSERT_EQ(want[i].tsid, out[i].tsid);
+        ASSERT_EQ(want[i].t, out[i].t);
+        ASSERT_EQ(base::encode_double(want[i].v), base::encode_double(out[i].v));
+    }
+
+    // Appended to the samples already there, a cut record is an error.
+    ASSERT_FALSE(tsdbutil::RecordDecoder::samples(rec.data(), static_cast<int>(rec.size()), out));
+    ASSERT_EQ(2 * want.size(), out.size());
+    out.clear();
+    ASSERT_TRUE(tsdbutil::RecordDecoder::samples(rec.data(), static_cast<int>(rec.size()) - 1, out));
+
+    // Records of MIN_COMPRESS_RECORD_SIZE bytes and more are deflated when
+    // that makes them smaller.
+    boost::filesystem::remove_all("db_test/wal_compress");
+    vector<vector<uint8_t>> recs;
+    recs.push_back(plain);
+    recs.push_back(vector<uint8_t>(plain.begin(), plain.begin() + wal::MIN_COMPRESS_RECORD_SIZE - 1));
+    recs.push_back(vector<uint8_t>());
+    for(int i = 0; i < 1000; ++ i)
+        recs.back().push_back(static_cast<uint8_t>(base::GetCrc32c(reinterpret_cast<const uint8_t *>(&i), sizeof(i))));
+    {
+        shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+        pool->start(1);
+        {
+            wal::WAL w("db_test/wal_compress", pool);
+            w.set_compression(true);
+            for(auto & r: recs)
+                ASSERT_FALSE(w.log(r));
+        }
+        pool->stop();
+    }
+    {
+        std::ifstream f(wal::segment_name("db_test/wal_compress", 0), std::ios::binary);
+        string b((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        ASSERT_TRUE(b[0] & wal::RECORD_COMPRESSED);
+        ASSERT_LT(base::get_uint16_big_endian(reinterpret_cast<const uint8_t *>(b.data()) + 1), static_cast<int>(plain.size()) / 2);
+        wal::SegmentReader r("db_test/wal_compress");
+        for(auto & want_rec: recs){
+            ASSERT_TRUE(r.next());
+            ASSERT_TRUE(vector<uint8_t>(r.record().first, r.record().first + r.record().second) == want_rec);
+        }
+        ASSERT_FALSE(r.next());
+        ASSERT_FALSE(r.error());
+    }
+
+    // A WAL with both kinds of sample records replays the same, directly and
+    // through a checkpoint.
+    boost::filesystem::remove_all("db_test/wal_mixed");
+    {
+        WALTestHead h("db_test/wal_mixed");
+        h.append(0, 100000);
+    }
+    {
+        WALTestHead h("db_test/wal_mixed", true);
+        ASSERT_TRUE(wal_test_samples_equal(h.samples(), 0, 100000));
+        h.append(100000, 200000);
+    }
+    map<int, int> types = wal_record_types("db_test/wal_mixed");
+    ASSERT_EQ(100, types[tsdbutil::RECORD_SAMPLES]);
+    ASSERT_EQ(100, types[tsdbutil::RECORD_COMPRESSED_SAMPLES]);
+    {
+        WALTestHead h("db_test/wal_mixed");
+        ASSERT_TRUE(wal_test_samples_equal(h.samples(), 0, 200000));
+    }
+
+    {
+        shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+        pool->start(2);
+        {
+            wal::WAL w("db_test/wal_mixed", pool);
+            auto segs = w.segments(w.dir());
+            ASSERT_FALSE(segs.second);
+            auto ckp = wal::checkpoint(&w, segs.first.first, segs.first.second, [](tagtree::TSID){ return true; }, 0);
+            ASSERT_FALSE(ckp.second);
+            ASSERT_EQ(200 * 10, ckp.first.total_samples);
+            ASSERT_EQ(0, ckp.first.dropped_samples);
+        }
+        pool->stop();
+    }
+    auto cp = wal::last_checkpoint("db_test/wal_mixed");
+    ASSERT_FALSE(cp.second);
+    types = wal_record_types(cp.first.first);
+    ASSERT_EQ(100, types[tsdbutil::RECORD_SAMPLES]);
+    ASSERT_EQ(100, types[tsdbutil::RECORD_COMPRESSED_SAMPLES]);
+    {
+        WALTestHead h("db_test/wal_mixed");
+        ASSERT_TRUE(wal_test_samples_equal(h.samples(), 0, 200000));
+    }
+}
+
+TEST(DBTest, SegmentWriter){
+    boost::filesystem::remove_all("db_test/segment_writer");
+    boost::filesystem::create_directories("db_test/segment_writer");
+    int64_t prealloc = 16 * wal::PAGE_SIZE;
+    vector<uint8_t> data;
+    for(int i = 0; i < 3 * wal::PAGE_SIZE + 100; ++ i)
+        data.push_back(static_cast<uint8_t>(i * 31 + i / 7));
+
+    for(bool uring: {true, false}){
+        string name = "db_test/segment_writer/" + string(uring ? "uring" : "pwrite");
+        int fd = ::open(name.c_str(), O_WRONLY | O_CREAT, 0666);
+        ASSERT_GE(fd, 0);
+        struct stat st;
+        {
+            wal::SegmentWriter w(fd, 0, prealloc, uring);
+            if(!uring)
+                ASSERT_FALSE(w.uses_ring());
+            // Buffered until a page worth of bytes is appended.
+            ASSERT_FALSE(w.append(data.data(), 100));
+            ASSERT_EQ(0, stat(name.c_str(), &st));
+            ASSERT_EQ(0, st.st_size);
+            ASSERT_FALSE(w.append(data.data() + 100, wal::PAGE_SIZE));
+            ASSERT_EQ(0, stat(name.c_str(), &st));
+            ASSERT_EQ(wal::PAGE_SIZE + 100, st.st_size);
+            ASSERT_FALSE(w.append(data.data() + wal::PAGE_SIZE + 100, wal::PAGE_SIZE));
+            ASSERT_FALSE(w.flush(false));
+            ASSERT_FALSE(w.append(data.data() + 2 * wal::PAGE_SIZE + 100, wal::PAGE_SIZE));
+            ASSERT_FALSE(w.flush(true));
+            ASSERT_EQ(static_cast<int64_t>(data.size()), w.size());
+
+            // The preallocated blocks are past the end of the file.
+            ASSERT_EQ(0, stat(name.c_str(), &st));
+            ASSERT_EQ(static_cast<int64_t>(data.size()), st.st_size);
+            ASSERT_FALSE(w.close());
+        }
+        ASSERT_EQ(0, stat(name.c_str(), &st));
+        ASSERT_EQ(static_cast<int64_t>(data.size()), st.st_size);
+        // close() gave back the blocks reserved past the end.
+        ASSERT_LT(static_cast<int64_t>(st.st_blocks) * 512, prealloc);
+        std::ifstream f(name, std::ios::binary);
+        string b((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        ASSERT_TRUE(b == string(data.begin(), data.end()));
+    }
+
+    // The preallocated tail of a segment is never read back as records, while
+    // the WAL is open or after it is closed.
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+    pool->start(1);
+    string dir = "db_test/segment_writer/wal";
+    vector<vector<uint8_t>> recs;
+    for(int i = 0; i < 20; ++ i)
+        recs.push_back(vector<uint8_t>(data.begin() + i * 997, data.begin() + i * 997 + 50 + i * 1500));
+    auto check = [&](){
+        wal::SegmentReader r(dir);
+        for(auto & rec: recs){
+            ASSERT_TRUE(r.next());
+            ASSERT_TRUE(vector<uint8_t>(r.record().first, r.record().first + r.record().second) == rec);
+        }
+        ASSERT_FALSE(r.next());
+        ASSERT_FALSE(r.error());
+    };
+    {
+        wal::WAL w(dir, pool, 64 * wal::PAGE_SIZE);
+        w.set_sync(true);
+        for(auto & rec: recs)
+            ASSERT_FALSE(w.log(rec));
+        struct stat st;
+        ASSERT_EQ(0, stat(wal::segment_name(dir, 0).c_str(), &st));
+        ASSERT_LT(st.st_size, 64 * wal::PAGE_SIZE);
+        check();
+    }
+    check();
+    pool->stop();
+}
+
+TEST(DBTest, ParallelCheckpoint){
+    string dir = "db_test/wal_checkpoint";
+    boost::filesystem::remove_all(dir);
+    int64_t mint = 1000000, maxt = 2000000;
+    std::function<bool(tagtree::TSID)> keep = [](tagtree::TSID tsid){ return tsid % 5 != 0; };
+    unordered_set<tagtree::TSID> kept, dropped;
+    for(int i = 0; i < 10; ++ i)
+        (keep(i) ? kept : dropped).insert(i);
+
+    map<tagtree::TSID, vector<pair<int64_t, double>>> want;
+    {
+        WALTestHead h(dir, false, wal::PAGE_SIZE);
+        h.append(0, maxt);
+        // Below mint, of a dropped series and across mint.
+        ASSERT_FALSE(h.h->del(100000, 200000, {1, 2}));
+        ASSERT_FALSE(h.h->del(1100000, 1200000, {3, 5}));
+        ASSERT_FALSE(h.h->del(900000, 1100000, {4}));
+        querier::BlockQuerier q(h.h, mint, maxt + 10000);
+        want = collect(q.select(kept));
+    }
+    ASSERT_EQ(kept.size(), want.size());
+
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+    pool->start(2);
+    string cpdir;
+    {
+        wal::WAL w(dir, pool, wal::PAGE_SIZE);
+        auto segs = w.segments(w.dir());
+        ASSERT_FALSE(segs.second);
+        ASSERT_GT(segs.first.second - segs.first.first + 1, 2 * wal::CHECKPOINT_CONCURRENCY);
+
+        // A checkpoint left behind half written is not appended to.
+        cpdir = tsdbutil::filepath_join(dir, (boost::format(wal::CHECKPOINT_PREFIX + "%06d") % segs.first.second).str());
+        {
+            wal::WAL stale(cpdir + ".tmp", pool);
+            vector<uint8_t> rec;
+            tsdbutil::RecordEncoder::samples({tsdbutil::RefSample(1, maxt + 5000, 1)}, rec);
+            ASSERT_FALSE(stale.log(rec));
+        }
+
+        auto ckp = wal::checkpoint(&w, segs.first.first, segs.first.second, keep, mint);
+        ASSERT_FALSE(ckp.second);
+        ASSERT_EQ(10, ckp.first.total_series);
+        ASSERT_EQ(2, ckp.first.dropped_series);
+        ASSERT_EQ(2000 * 10, ckp.first.total_samples);
+        ASSERT_EQ(2000 * 2 + 1000 * 8, ckp.first.dropped_samples);
+        ASSERT_EQ(5, ckp.first.total_tombstones);
+        ASSERT_EQ(3, ckp.first.dropped_tombstones);
+    }
+    pool->stop();
+    ASSERT_TRUE(boost::filesystem::exists(cpdir));
+    ASSERT_FALSE(boost::filesystem::exists(cpdir + ".tmp"));
+
+    // The checkpoint replays to the same head, without the segments it covers.
+    auto segs = wal::list_segments(dir);
+    ASSERT_FALSE(segs.second);
+    for(auto & ref: segs.first)
+        boost::filesystem::remove(wal::segment_name(dir, ref.index));
+    {
+        WALTestHead h(dir, false, wal::PAGE_SIZE);
+        querier::BlockQuerier q(h.h, 0, maxt + 10000);
+        auto got = collect(q.select(kept));
+        ASSERT_EQ(want.size(), got.size());
+        for(auto & p: want){
+            ASSERT_EQ(p.second.size(), got[p.first].size());
+            for(size_t i = 0; i < p.second.size(); ++ i){
+                ASSERT_EQ(p.second[i].first, got[p.first][i].first);
+                ASSERT_EQ(base::encode_double(p.second[i].second), base::encode_double(got[p.first][i].second));
+            }
+        }
+        ASSERT_TRUE(collect(q.select(dropped)).empty());
+    }
+}
+
+// Bitwise CRC-32C register update, the reference for extend_crc32c().
+uint32_t crc32c_bitwise(uint32_t crc, const uint8_t * p, size_t size){
+    for(size_t i = 0; i < size; ++ i){
+        crc ^= p[i];
+        for(int k = 0; k < 8; ++ k)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+    }
+    return crc;
+}
+
+TEST(DBTest, CRC32C){
+    ASSERT_EQ(0xe3069283u, base::GetCrc32c(reinterpret_cast<const uint8_t *>("123456789"), 9));
+
+    vector<uint8_t> data(2 * 3 * 8192 + 64);
+    uint64_t x = 88172645463325252ull;
+    for(auto & b: data){
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        b = static_cast<uint8_t>(x);
+    }
+
+    // Around the 256 and 8192 byte streams of the interleaved implementation
+    // and the blocks of three of them, from unaligned starts.
+    vector<int> sizes;
+    for(int n: {0, 8, 256, 3 * 256, 2 * 3 * 256, 8192, 3 * 8192, 2 * 3 * 8192})
+        for(int d = -9; d <= 9; ++ d)
+            if(n + d >= 0)
+                sizes.push_back(n + d);
+    for(int off = 0; off < 8; ++ off){
+        for(int n: sizes){
+            const uint8_t * p = data.data() + off;
+            ASSERT_EQ(~crc32c_bitwise(0xffffffff, p, n), base::GetCrc32c(p, n)) << base::crc32c_implementation() << " offset " << off << " size " << n;
+        }
+    }
+
+    // Extended piece by piece.
+    int n = 3 * 8192 + 3 * 256 + 5;
+    uint32_t want = crc32c_bitwise(0xffffffff, data.data() + 3, n);
+    for(int k: {1, 255, 3 * 256, 8193, 3 * 8192}){
+        uint32_t crc = base::extend_crc32c(0xffffffff, data.data() + 3, k);
+        ASSERT_EQ(want, base::extend_crc32c(crc, data.data() + 3 + k, n - k));
+    }
+}
+
+string read_test_file(const string & name){
+    std::ifstream f(name, std::ios::binary);
+    return string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+}
+
+void write_test_file(const string & name, const string & s){
+    std::ofstream f(name, std::ios::binary | std::ios::trunc);
+    f.write(s.data(), s.size());
+}
+
+uint8_t * test_bytes(string & s, size_t off){
+    return reinterpret_cast<uint8_t *>(&s[off]);
+}
+
+// Walks the entries of the chunk file name, checking their CRC-32C when
+// castagnoli, otherwise rewriting the file as chunk format V1.
+bool walk_chunk_file(const string & name, bool castagnoli){
+    string s = read_test_file(name);
+    if(!castagnoli)
+        base::put_uint32_big_endian(test_bytes(s, 4), chunk::CHUNK_FORMAT_V1);
+    size_t pos = 8;
+    while(pos < s.size()){
+        int decoded = 0;
+        uint64_t l = base::decode_unsigned_varint(test_bytes(s, pos), decoded, base::MAX_VARINT_LEN_32);
+        const uint8_t * data = test_bytes(s, pos + decoded + 1);
+        uint8_t * crc = test_bytes(s, pos + decoded + 1 + l);
+        if(!castagnoli)
+            base::put_uint32_big_endian(crc, base::GetCrc32(data, l));
+        else if(base::get_uint32_big_endian(crc) != base::GetCrc32c(data, l))
+            return false;
+        pos += decoded + 1 + l + 4;
+    }
+    if(!castagnoli)
+        write_test_file(name, s);
+    return pos == s.size();
+}
+
+// Rewrites the index file name as index V1, only the version when
+// checksums is false.
+void write_index_v1(const string & name, bool checksums){
+    string s = read_test_file(name);
+    s[4] = index::INDEX_VERSION_V1;
+    if(checksums){
+        size_t toc = s.size() - 20;
+        uint64_t table = base::get_uint64_big_endian(test_bytes(s, toc + 8));
+        uint32_t len = base::get_uint32_big_endian(test_bytes(s, table));
+        base::put_uint32_big_endian(test_bytes(s, table + 4 + len), base::GetCrc32(test_bytes(s, table + 4), len));
+        tsdbutil::DecBuf d(test_bytes(s, table + 8), len - 4);
+        for(uint32_t i = 0; i < base::get_uint32_big_endian(test_bytes(s, table + 4)); ++ i){
+            d.get_tsid();
+            size_t ref = d.get_unsigned_variant() * 16;
+            int decoded = 0;
+            uint64_t l = base::decode_unsigned_varint(test_bytes(s, ref), decoded, base::MAX_VARINT_LEN_64);
+            base::put_uint32_big_endian(test_bytes(s, ref + decoded + l), base::GetCrc32(test_bytes(s, ref + decoded), l));
+        }
+        base::put_uint32_big_endian(test_bytes(s, toc + 16), base::GetCrc32(test_bytes(s, toc), 16));
+    }
+    write_test_file(name, s);
+}
+
+// Rewrites the fragments of the WAL segment name with CRC-32 and without the
+// RECORD_CRC32C flag.
+void write_segment_crc32(const string & name){
+    string s = read_test_file(name);
+    for(size_t page = 0; page < s.size(); page += wal::PAGE_SIZE){
+        size_t end = std::min(s.size(), page + wal::PAGE_SIZE);
+        size_t pos = page;
+        while(pos + wal::HEADER_SIZE < end && s[pos] != 0){
+            EXPECT_TRUE(s[pos] & wal::RECORD_CRC32C);
+            s[pos] &= ~wal::RECORD_CRC32C;
+            int l = base::get_uint16_big_endian(test_bytes(s, pos + 1));
+            base::put_uint32_big_endian(test_bytes(s, pos + 3), base::GetCrc32(test_bytes(s, pos + wal::HEADER_SIZE), l));
+            pos += wal::HEADER_SIZE + l;
+        }
+    }
+    write_test_file(name, s);
+}
+
+TEST(DBTest, OldChecksumFormats){
+    boost::filesystem::remove_all("db_test/old_formats");
+    int64_t range = 3600 * 1000;
+    int num_series = 20;
+    shared_ptr<block::Block> b = write_test_block("db_test/old_formats", 0, range, num_series);
+    ASSERT_FALSE(b->del(600 * 1000, 1200 * 1000, 3));
+    auto want = block_samples(b, num_series);
+    string dir = b->dir();
+    b.reset();
+
+    // Chunk format V1, index V1 and tombstone format V1, all with CRC-32.
+    deque<string> chunk_files = chunk::sequence_files(tsdbutil::filepath_join(dir, "chunks"));
+    ASSERT_FALSE(chunk_files.empty());
+    for(auto & name: chunk_files){
+        ASSERT_TRUE(walk_chunk_file(name, true));
+        ASSERT_TRUE(walk_chunk_file(name, false));
+    }
+    string index_name = tsdbutil::filepath_join(dir, "index");
+    string index_v3 = read_test_file(index_name);
+    write_index_v1(index_name, false);
+    ASSERT_TRUE(index::IndexReader(index_name).error());
+    write_test_file(index_name, index_v3);
+    write_index_v1(index_name, true);
+    ASSERT_FALSE(index::IndexReader(index_name).error());
+    string stones_name = tsdbutil::filepath_join(dir, "tombstones");
+    string stones = read_test_file(stones_name);
+    ASSERT_EQ(tombstone::TOMBSTONE_FORMAT_V2, static_cast<uint8_t>(stones[4]));
+    stones[4] = tombstone::TOMBSTONE_FORMAT_V1;
+    write_test_file(stones_name, stones);
+    ASSERT_FALSE(tombstone::read_tombstones(dir).first);
+    base::put_uint32_big_endian(test_bytes(stones, stones.size() - 4), base::GetCrc32(test_bytes(stones, 5), stones.size() - 9));
+    write_test_file(stones_name, stones);
+    ASSERT_TRUE(tombstone::read_tombstones(dir).first);
+
+    b.reset(new block::Block(dir));
+    ASSERT_TRUE(block_samples(b, num_series) == want);
+
+    // Chunks copied out of V1 files get CRC-32C.
+    compact::LeveledCompactor c({range}, shared_ptr<base::Channel<char>>(new base::Channel<char>()));
+    shared_ptr<block::BlockMeta> parent(new block::BlockMeta(b->meta()));
+    auto w = c.write("db_test/old_formats/new", b, b->MinTime(), b->MaxTime(), parent);
+    ASSERT_FALSE(w.second);
+    string new_dir = tsdbutil::filepath_join("db_test/old_formats/new", ulid::Marshal(w.first));
+    for(auto & name: chunk::sequence_files(tsdbutil::filepath_join(new_dir, "chunks")))
+        ASSERT_TRUE(walk_chunk_file(name, true));
+    shared_ptr<block::Block> nb(new block::Block(new_dir));
+    ASSERT_TRUE(block_samples(nb, num_series) == want);
+
+    // A WAL with CRC-32 fragments.
+    string wal_dir = "db_test/old_formats/wal";
+    {
+        WALTestHead h(wal_dir);
+        h.append(0, 100000);
+    }
+    auto segs = wal::list_segments(wal_dir);
+    ASSERT_FALSE(segs.second);
+    for(auto & ref: segs.first)
+        write_segment_crc32(wal::segment_name(wal_dir, ref.index));
+    {
+        WALTestHead h(wal_dir);
+        ASSERT_TRUE(wal_test_samples_equal(h.samples(), 0, 100000));
+    }
+}
+
+// A record of n bytes, the bytes of record i take at most 1 << bits values.
+vector<uint8_t> wal_test_record(int i, int n, int bits = 8){
+    vector<uint8_t> r(n);
+    uint64_t x = 88172645463325252ull + i;
+    for(auto & b: r){
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        b = static_cast<uint8_t>(x & ((1 << bits) - 1));
+    }
+    return r;
+}
+
+// Reads the records of dir and compares them to recs, each view is the same
+// until the next call to next().
+void check_wal_records(const string & dir, const vector<vector<uint8_t>> & recs){
+    wal::SegmentReader r(dir);
+    for(auto & rec: recs){
+        ASSERT_TRUE(r.next());
+        pair<const uint8_t *, int> v = r.record();
+        ASSERT_TRUE(vector<uint8_t>(v.first, v.first + v.second) == rec);
+        ASSERT_TRUE(r.record() == v);
+    }
+    ASSERT_FALSE(r.next());
+    ASSERT_FALSE(r.error());
+    ASSERT_EQ(0, r.record().second);
+}
+
+TEST(DBTest, SegmentReader){
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool("test"));
+    pool->start(1);
+    boost::filesystem::remove_all("db_test/segment_reader");
+
+    // Records of one fragment between records of FIRST, MIDDLE and LAST
+    // fragments over pages, the segments only fit a few of them.
+    string dir = "db_test/segment_reader/fragments";
+    vector<vector<uint8_t>> recs;
+    {
+        wal::WAL w(dir, pool, 5 * wal::PAGE_SIZE);
+        for(int i = 0; i < 12; ++ i){
+            recs.push_back(wal_test_record(i, i % 2 ? 100 + i : 2 * wal::PAGE_SIZE + 1000 * i));
+            ASSERT_FALSE(w.log(recs.back()));
+        }
+    }
+    auto segs = wal::list_segments(dir);
+    ASSERT_FALSE(segs.second);
+    ASSERT_GT(segs.first.size(), 2u);
+    string b = read_test_file(wal::segment_name(dir, 0));
+    ASSERT_EQ(wal::RECORD_FIRST, b[0] & 7);
+    ASSERT_EQ(wal::RECORD_MIDDLE, b[wal::PAGE_SIZE] & 7);
+    ASSERT_EQ(wal::RECORD_LAST, b[2 * wal::PAGE_SIZE] & 7);
+    check_wal_records(dir, recs);
+
+    // A compressed record over pages.
+    string cdir = "db_test/segment_reader/compressed";
+    vector<vector<uint8_t>> crecs;
+    crecs.push_back(wal_test_record(0, 6 * wal::PAGE_SIZE, 4));
+    crecs.push_back(wal_test_record(1, 100));
+    {
+        wal::WAL w(cdir, pool);
+        w.set_compression(true);
+        for(auto & rec: crecs)
+            ASSERT_FALSE(w.log(rec));
+    }
+    b = read_test_file(wal::segment_name(cdir, 0));
+    ASSERT_EQ(wal::RECORD_FIRST | wal::RECORD_COMPRESSED, b[0] & (7 | wal::RECORD_COMPRESSED));
+    check_wal_records(cdir, crecs);
+
+    // The last segment cut after its last record, its last page is short.
+    {
+        wal::SegmentReader r(dir);
+        int end = 0;
+        while(r.next())
+            end = r.offset();
+        ASSERT_FALSE(r.error());
+        ASSERT_EQ(segs.first.back().index, r.segment());
+        ASSERT_NE(0, end % wal::PAGE_SIZE);
+        boost::filesystem::resize_file(wal::segment_name(dir, r.segment()), end);
+    }
+    check_wal_records(dir, recs);
+
+    // A record torn at the end of a segment that is not the last one.
+    string tdir = "db_test/segment_reader/torn";
+    vector<vector<uint8_t>> trecs;
+    {
+        wal::WAL w(tdir, pool);
+        for(int i = 0; i < 5; ++ i){
+            trecs.push_back(wal_test_record(i, 100));
+            ASSERT_FALSE(w.log(trecs.back()));
+        }
+        ASSERT_FALSE(w.log(wal_test_record(5, 3 * wal::PAGE_SIZE)));
+        ASSERT_FALSE(w.next_segment());
+        ASSERT_FALSE(w.log(wal_test_record(6, 100)));
+    }
+    int end = 0;
+    {
+        wal::SegmentReader r(tdir);
+        for(size_t i = 0; i < trecs.size(); ++ i)
+            ASSERT_TRUE(r.next());
+        end = r.offset();
+        ASSERT_EQ(5 * (wal::HEADER_SIZE + 100), end);
+    }
+    // Only the FIRST fragment of the record is left.
+    boost::filesystem::resize_file(wal::segment_name(tdir, 0), wal::PAGE_SIZE);
+    {
+        wal::SegmentReader r(tdir);
+        for(size_t i = 0; i < trecs.size(); ++ i)
+            ASSERT_TRUE(r.next());
+        ASSERT_FALSE(r.next());
+        ASSERT_EQ("last record of segment is torn", r.error().error());
+        wal::CorruptionError cerr = r.cerror();
+        ASSERT_TRUE(cerr);
+        ASSERT_EQ(0, cerr.segment);
+        ASSERT_EQ(static_cast<uint64_t>(wal::PAGE_SIZE), cerr.offset);
+
+        // Repaired up to the torn record.
+        wal::WAL w(tdir, pool);
+        ASSERT_FALSE(w.repair(cerr));
+    }
+    check_wal_records(tdir, trecs);
+    pool->stop();
+}
+
+// Blocks a worker of the pool until release is counted down.
+void block_worker(base::CountDownLatch * started, base::CountDownLatch * release){
+    started->countDown();
+    while(release->getCount() > 0)
+        release->wait();
+}
+
+void record_task(base::MutexLock * mutex, vector<int> * order, int i){
+    base::MutexLockGuard lock(*mutex);
+    order->push_back(i);
+}
+
+TEST(DBTest, ThreadPoolPriorities){
+    base::ThreadPool pool("test");
+    pool.start(1);
+    base::CountDownLatch started(1), release(1);
+    pool.run(boost::bind(&block_worker, &started, &release));
+    started.wait();
+
+    // Queued behind the blocked task, they run by priority and then in
+    // submission order.
+    base::MutexLock mutex;
+    vector<int> order;
+    int priorities[] = {base::TASK_PRIORITY_LOW, base::TASK_PRIORITY_NORMAL, base::TASK_PRIORITY_HIGH};
+    for(int i = 0; i < 9; ++ i)
+        pool.run(boost::bind(&record_task, &mutex, &order, i), priorities[i % 3]);
+    release.countDown();
+    while(pool.queueSize() > 0)
+        usleep(1000);
+    pool.stop();
+    ASSERT_TRUE(order == vector<int>({2, 5, 8, 1, 4, 7, 0, 3, 6}));
+}
+
+// Queues n tasks on its own worker, lets the worker blocked on release go and
+// waits for the tasks, they can only run on the other worker.
+void steal_tasks(base::ThreadPool * pool, base::CountDownLatch * release, base::MutexLock * mutex, vector<int> * order, vector<std::thread::id> * ids, int n){
+    base::CountDownLatch done(n);
+    for(int i = 0; i < n; ++ i){
+        pool->run([=, &done](){
+            {
+                base::MutexLockGuard lock(*mutex);
+                order->push_back(i);
+                ids->push_back(std::this_thread::get_id());
+            }
+            done.countDown();
+        });
+    }
+    release->countDown();
+    while(done.getCount() > 0)
+        done.wait();
+    base::MutexLockGuard lock(*mutex);
+    ids->push_back(std::this_thread::get_id());
+}
+
+TEST(DBTest, ThreadPoolStealing){
+    base::ThreadPool pool("test");
+    pool.start(2);
+    base::MutexLock mutex;
+    vector<int> order;
+    vector<std::thread::id> ids;
+    base::CountDownLatch started(1), release(1), finished(1);
+    pool.run(boost::bind(&block_worker, &started, &release));
+    started.wait();
+    pool.run([&](){
+        steal_tasks(&pool, &release, &mutex, &order, &ids, 10);
+        finished.countDown();
+    });
+    while(finished.getCount() > 0)
+        finished.wait();
+    pool.stop();
+
+    // The thief takes the newest task first.
+    ASSERT_TRUE(order == vector<int>({9, 8, 7, 6, 5, 4, 3, 2, 1, 0}));
+    ASSERT_EQ(11u, ids.size());
+    for(int i = 0; i < 10; ++ i){
+        ASSERT_EQ(ids[0], ids[i]);
+        ASSERT_NE(ids[10], ids[i]);
+    }
+}
+
+TEST(DBTest, ThreadPoolParallelFor){
+    base::ThreadPool pool("test");
+    pool.start(1);
+    base::CountDownLatch started(1), release(1);
+    pool.run(boost::bind(&block_worker, &started, &release));
+    started.wait();
+
+    // With the worker busy, the calling thread runs every index.
+    vector<int> visits(100, 0);
+    vector<std::thread::id> ids(100);
+    pool.parallel_for(3, 100, [&](int i){
+        ++ visits[i];
+        ids[i] = std::this_thread::get_id();
+    }, 7);
+    for(int i = 0; i < 100; ++ i){
+        ASSERT_EQ(i < 3 ? 0 : 1, visits[i]);
+        if(i >= 3)
+            ASSERT_EQ(std::this_thread::get_id(), ids[i]);
+    }
+    release.countDown();
+
+    // From a task of the pool, its only worker takes part.
+    base::AtomicInt sum;
+    base::CountDownLatch finished(1);
+    pool.run([&](){
+        pool.parallel_for(0, 1000, [&](int i){ sum.getAndAdd(i); }, 10);
+        finished.countDown();
+    });
+    while(finished.getCount() > 0)
+        finished.wait();
+    ASSERT_EQ(999 * 1000 / 2, sum.get());
+    pool.stop();
+}
+
+// A move-only callable, Size bytes of padding decide whether it is kept in
+// place by base::Task.
+template <int Size>
+struct MoveOnlyCallable{
+    unique_ptr<int> value;
+    int * out;
+    char padding[Size];
+
+    MoveOnlyCallable(int v, int * out): value(new int(v)), out(out){}
+    MoveOnlyCallable(MoveOnlyCallable && c): value(std::move(c.value)), out(c.out){}
+    void operator()(){ *out = *value; }
+};
+
+TEST(DBTest, TaskMoveOnly){
+    int out = 0;
+    base::Task t(MoveOnlyCallable<1>(1, &out));
+    base::Task u(std::move(t));
+    ASSERT_FALSE(t);
+    ASSERT_TRUE(u);
+    u();
+    ASSERT_EQ(1, out);
+
+    // Too big to be kept in place.
+    base::Task h(MoveOnlyCallable<128>(2, &out));
+    t = std::move(h);
+    ASSERT_FALSE(h);
+    t();
+    ASSERT_EQ(2, out);
+    t.reset();
+    ASSERT_FALSE(t);
+
+    // Destroyed with the task when it never runs.
+    shared_ptr<int> alive(new int(0));
+    {
+        base::Task d([alive](){});
+        ASSERT_EQ(2, alive.use_count());
+        base::Task e(std::move(d));
+        ASSERT_EQ(2, alive.use_count());
+    }
+    ASSERT_EQ(1, alive.use_count());
+
+    base::ThreadPool pool("test");
+    pool.start(1);
+    base::CountDownLatch done(2);
+    int a = 0, b = 0;
+    pool.run(MoveOnlyCallable<1>(3, &a));
+    pool.run(MoveOnlyCallable<128>(4, &b));
+    pool.run(boost::bind(&base::CountDownLatch::countDown, &done));
+    pool.run(boost::bind(&base::CountDownLatch::countDown, &done));
+    while(done.getCount() > 0)
+        done.wait();
+    pool.stop();
+    ASSERT_EQ(3, a);
+    ASSERT_EQ(4, b);
+}
@@ -2,11 +2,19 @@
 // #include <google/profiler.h>
 
 void db_bench();
+void block_cold_query_bench();
+void chunk_cache_bench();
+void vertical_bench();
+void compaction_write_amp_bench();
 void xorchunk_bench();
 
 int main(int argc, char *argv[]){
     ::testing::InitGoogleTest(&argc, argv);
     ::testing::GTEST_FLAG(filter) = "DBTest*";
     // db_bench();
+    // block_cold_query_bench();
+    // chunk_cache_bench();
+    // vertical_bench();
+    // compaction_write_amp_bench();
     return RUN_ALL_TESTS();
 }
\ No newline at end of file
@@ -13,11 +13,12 @@ namespace tsdb {
 namespace tombstone {
 
 const uint32_t MAGIC_TOMBSTONE = 0xA1ECA1EC;
-const uint8_t TOMBSTONE_FORMAT = 1;
+const uint8_t TOMBSTONE_FORMAT_V1 = 1;
+const uint8_t TOMBSTONE_FORMAT_V2 = 2;
 
 // NOTICE
 // boost::bind will still make a copy for reference
-void write_ts_helper(FILE* f, tsdbutil::EncBuf& enc_buf, base::CRC32& crc32,
+void write_ts_helper(FILE* f, tsdbutil::EncBuf& enc_buf, base::CRC32C& crc32,
                      tagtree::TSID tsid, const Intervals& itvs)
 {
     for (const Interval& itvl : itvs) {
@@ -37,13 +38,13 @@ bool write_tombstones(const std::string& dir, TombstoneReaderInterface* tr)
     FILE* f;
     if (!(f = fopen(tmp_path.c_str(), "wb"))) return false;
 
-    // CRC32 object.
-    base::CRC32 crc32;
+    // CRC32C object.
+    base::CRC32C crc32;
 
     // Write header.
     tsdbutil::EncBuf enc_buf(3 * base::MAX_VARINT_LEN_64);
     enc_buf.put_BE_uint32(MAGIC_TOMBSTONE);
-    enc_buf.put_byte(TOMBSTONE_FORMAT);
+    enc_buf.put_byte(TOMBSTONE_FORMAT_V2);
     fwrite(enc_buf.get().first, 1, 5, f);
     enc_buf.reset();
 
@@ -73,13 +74,13 @@ bool write_tombstones(const std::string& dir,
     FILE* f;
     if (!(f = fopen(tmp_path.c_str(), "wb"))) return false;
 
-    // CRC32 object.
-    base::CRC32 crc32;
+    // CRC32C object.
+    base::CRC32C crc32;
 
     // Write header.
     tsdbutil::EncBuf enc_buf(3 * base::MAX_VARINT_LEN_64);
     enc_buf.put_BE_uint32(MAGIC_TOMBSTONE);
-    enc_buf.put_byte(TOMBSTONE_FORMAT);
+    enc_buf.put_byte(TOMBSTONE_FORMAT_V2);
     fwrite(enc_buf.get().first, 1, 5, f);
     enc_buf.reset();
 
@@ -123,11 +124,15 @@ read_tombstones(const std::string& dir)
     if (base::get_uint32_big_endian(start.first) != MAGIC_TOMBSTONE)
         return std::make_pair(std::shared_ptr<TombstoneReaderInterface>(), 0);
     // Check version
-    if (*(start.first + 4) != 1)
+    uint8_t version = *(start.first + 4);
+    if (version != TOMBSTONE_FORMAT_V1 && version != TOMBSTONE_FORMAT_V2)
         return std::make_pair(std::shared_ptr<TombstoneReaderInterface>(), 0);
     // Check checksum
     uint32_t crc32 = base::get_uint32_big_endian(start.first + start.second);
-    if (base::GetCrc32(start.first + 5, start.second - 5) != crc32)
+    uint32_t actual = version == TOMBSTONE_FORMAT_V2
+                          ? base::GetCrc32c(start.first + 5, start.second - 5)
+                          : base::GetCrc32(start.first + 5, start.second - 5);
+    if (actual != crc32)
         return std::make_pair(std::shared_ptr<TombstoneReaderInterface>(), 0);
 
     std::shared_ptr<TombstoneReaderInterface> stones =
@@ -11,11 +11,12 @@ namespace tsdb {
 namespace tombstone {
 
 extern const uint32_t MAGIC_TOMBSTONE;
-extern const uint8_t TOMBSTONE_FORMAT;
+extern const uint8_t TOMBSTONE_FORMAT_V1; // CRC-32 checksum.
+extern const uint8_t TOMBSTONE_FORMAT_V2; // CRC-32C checksum.
 
 // NOTICE
 // boost::bind will still make a copy for reference
-void write_ts_helper(FILE* f, tsdbutil::EncBuf& enc_buf, base::CRC32& crc32,
+void write_ts_helper(FILE* f, tsdbutil::EncBuf& enc_buf, base::CRC32C& crc32,
                      tagtree::TSID tsid, const Intervals& itvs);
 
 bool write_tombstones(const std::string& dir, TombstoneReaderInterface* tr);
@@ -0,0 +1,106 @@
+#include <boost/functional/hash.hpp>
+#include <stdlib.h>
+
+#include "tsdbutil/BufferCache.hpp"
+
+namespace tsdb {
+namespace tsdbutil {
+
+Buffer::Buffer() : data(nullptr), len(0)
+{
+    void* p = nullptr;
+    if (posix_memalign(&p, BUFFER_ALIGNMENT, BUFFER_BLOCK_SIZE) == 0)
+        data = reinterpret_cast<uint8_t*>(p);
+}
+
+Buffer::~Buffer() { free(data); }
+
+size_t BufferCache::KeyHash::operator()(const Key& k) const
+{
+    size_t seed = 0;
+    boost::hash_combine(seed, k.first);
+    boost::hash_combine(seed, k.second);
+    return seed;
+}
+
+BufferCache::BufferCache(uint64_t capacity) : capacity(capacity), usage(0) {}
+
+std::shared_ptr<Buffer> BufferCache::get(uint64_t file_id, uint64_t block,
+                                         int priority)
+{
+    base::MutexLockGuard lock(mutex_);
+    auto it = index.find(Key(file_id, block));
+    if (it == index.end()) {
+        misses_[priority].increment();
+        return nullptr;
+    }
+    hits_[priority].increment();
+    LRUList& l = lru[it->second->priority];
+    l.splice(l.begin(), l, it->second);
+    return it->second->buf;
+}
+
+std::shared_ptr<Buffer>
+BufferCache::insert(uint64_t file_id, uint64_t block, int priority,
+                    const std::shared_ptr<Buffer>& buf)
+{
+    Key k(file_id, block);
+    base::MutexLockGuard lock(mutex_);
+    auto it = index.find(k);
+    if (it != index.end()) return it->second->buf;
+    if (BUFFER_BLOCK_SIZE > capacity) return buf;
+
+    // Make room from the highest priority class downwards, never evicting a
+    // class more important than the inserted block while a less important
+    // one is cached.
+    int victim = NUM_BUFFER_PRIORITIES - 1;
+    while (usage + BUFFER_BLOCK_SIZE > capacity) {
+        while (victim > 0 && lru[victim].empty())
+            --victim;
+        if (lru[victim].empty()) break;
+        if (victim < priority) {
+            // Only more important blocks are cached, do not cache buf.
+            return buf;
+        }
+        Entry& e = lru[victim].back();
+        index.erase(e.key);
+        lru[victim].pop_back();
+        usage -= BUFFER_BLOCK_SIZE;
+        evictions_[victim].increment();
+    }
+
+    lru[priority].push_front(Entry{k, buf, priority});
+    index[k] = lru[priority].begin();
+    usage += BUFFER_BLOCK_SIZE;
+    return buf;
+}
+
+void BufferCache::erase_file(uint64_t file_id, uint64_t num_blocks)
+{
+    base::MutexLockGuard lock(mutex_);
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        auto it = index.find(Key(file_id, i));
+        if (it == index.end()) continue;
+        lru[it->second->priority].erase(it->second);
+        index.erase(it);
+        usage -= BUFFER_BLOCK_SIZE;
+    }
+}
+
+BufferCacheStats BufferCache::stats()
+{
+    BufferCacheStats st;
+    for (int i = 0; i < NUM_BUFFER_PRIORITIES; i++) {
+        st.hits[i] = hits_[i].get();
+        st.misses[i] = misses_[i].get();
+        st.evictions[i] = evictions_[i].get();
+    }
+    st.read_bytes = read_bytes_.get();
+    base::MutexLockGuard lock(mutex_);
+    for (int i = 0; i < NUM_BUFFER_PRIORITIES; i++)
+        st.bytes[i] = lru[i].size() * BUFFER_BLOCK_SIZE;
+    return st;
+}
+
+} // namespace tsdbutil
+} // namespace tsdb
@@ -0,0 +1,108 @@
+#ifndef BUFFERCACHE_H
+#define BUFFERCACHE_H
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "base/Atomic.hpp"
+#include "base/Mutex.hpp"
+
+namespace tsdb {
+namespace tsdbutil {
+
+// Eviction order of the cached blocks, the highest class is evicted first.
+enum BufferPriority {
+    BUFFER_PRIORITY_INDEX = 0,
+    BUFFER_PRIORITY_RECENT = 1, // Chunks of blocks not compacted yet.
+    BUFFER_PRIORITY_OLD = 2,    // Chunks of compacted blocks.
+    NUM_BUFFER_PRIORITIES = 3
+};
+
+// Size of a cached block, a multiple of the logical block size required by
+// O_DIRECT.
+const int BUFFER_BLOCK_SIZE = 32 * 1024;
+const int BUFFER_ALIGNMENT = 4096;
+
+// Buffer owns an aligned block of a file.
+class Buffer {
+public:
+    uint8_t* data;
+    int len; // Smaller than BUFFER_BLOCK_SIZE at the end of a file.
+
+    Buffer();
+    ~Buffer();
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+};
+
+struct BufferCacheStats {
+    int64_t hits[NUM_BUFFER_PRIORITIES];
+    int64_t misses[NUM_BUFFER_PRIORITIES];
+    int64_t evictions[NUM_BUFFER_PRIORITIES];
+    int64_t bytes[NUM_BUFFER_PRIORITIES];
+    int64_t read_bytes; // Read from the files.
+};
+
+// BufferCache is a bounded cache of file blocks shared by the DirectSlices of
+// a DB. Each priority class is an LRU list and a class is only evicted when
+// all lower priority classes are empty, so a large scan over old chunks
+// cannot push out the index or the recent blocks.
+//
+// Buffers handed out stay valid while referenced even after they
+// are evicted, so the memory in use may exceed capacity by the pinned blocks.
+class BufferCache {
+private:
+    typedef std::pair<uint64_t, uint64_t> Key; // (file id, block index).
+    struct KeyHash {
+        size_t operator()(const Key& k) const;
+    };
+    struct Entry {
+        Key key;
+        std::shared_ptr<Buffer> buf;
+        int priority;
+    };
+    typedef std::list<Entry> LRUList;
+
+    uint64_t capacity;
+    uint64_t usage;
+
+    base::MutexLock mutex_;
+    LRUList lru[NUM_BUFFER_PRIORITIES]; // Most recently used at the front.
+    std::unordered_map<Key, LRUList::iterator, KeyHash> index;
+
+    base::AtomicUInt64 file_id_;
+    base::AtomicInt64 hits_[NUM_BUFFER_PRIORITIES];
+    base::AtomicInt64 misses_[NUM_BUFFER_PRIORITIES];
+    base::AtomicInt64 evictions_[NUM_BUFFER_PRIORITIES];
+    base::AtomicInt64 read_bytes_;
+
+public:
+    BufferCache(uint64_t capacity);
+
+    // Unique id of a newly opened file.
+    uint64_t new_file_id() { return file_id_.incrementAndGet(); }
+
+    // Return nullptr when missing.
+    std::shared_ptr<Buffer> get(uint64_t file_id, uint64_t block,
+                                int priority);
+
+    // Return the cached buffer if another reader inserted it first.
+    std::shared_ptr<Buffer> insert(uint64_t file_id, uint64_t block,
+                                   int priority,
+                                   const std::shared_ptr<Buffer>& buf);
+
+    // Drop the blocks of a closed file.
+    void erase_file(uint64_t file_id, uint64_t num_blocks);
+
+    void add_read_bytes(int64_t n) { read_bytes_.add(n); }
+
+    BufferCacheStats stats();
+};
+
+} // namespace tsdbutil
+} // namespace tsdb
+
+#endif
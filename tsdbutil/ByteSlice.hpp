@@ -11,6 +11,15 @@ class ByteSlice{
     public:
         virtual int len() const=0;
         virtual std::pair<const uint8_t *, int> range(int begin, int end) const=0;  // (pointer, size)
+        // Whether the pointers returned by range() stay valid as long as the
+        // slice, otherwise only until the next range() of the same thread.
+        virtual bool stable() const{ return true; }
+        // Changes whenever pointers returned by range() of an unstable slice
+        // may have been invalidated, so a reader can assert that it kept to
+        // the contract of stable(). Always 0 for stable slices.
+        virtual uint64_t generation() const{ return 0; }
+        // Hint that [begin, end) is going to be read soon.
+        virtual void will_need(int begin, int end) const{}
         virtual ~ByteSlice(){}
 };
 
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "base/Logging.hpp"
+#include "tsdbutil/DirectSlice.hpp"
+
+namespace tsdb {
+namespace tsdbutil {
+
+namespace {
+
+// The block pinned by the last range() of this thread.
+thread_local std::shared_ptr<Buffer> pinned;
+// Holds ranges spanning several blocks.
+thread_local std::vector<uint8_t> spanned;
+// Bumped by every range() of this thread, see generation().
+thread_local uint64_t ranges = 0;
+
+} // namespace
+
+DirectSlice::DirectSlice(const std::string& path,
+                         const std::shared_ptr<BufferCache>& cache,
+                         int priority)
+    : cache(cache), priority(priority), fd(-1), direct(true), len_(-1),
+      file_id(cache->new_file_id())
+{
+    fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+        // tmpfs and some other file systems reject O_DIRECT.
+        direct = false;
+        fd = ::open(path.c_str(), O_RDONLY);
+    }
+    if (fd < 0) {
+        LOG_ERROR << "msg=\"cannot open file\" path=" << path
+                  << " err=" << strerror(errno);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LOG_ERROR << "msg=\"cannot stat file\" path=" << path
+                  << " err=" << strerror(errno);
+        return;
+    }
+    len_ = st.st_size;
+}
+
+std::shared_ptr<Buffer> DirectSlice::block(uint64_t i) const
+{
+    std::shared_ptr<Buffer> buf = cache->get(file_id, i, priority);
+    if (buf) return buf;
+
+    buf.reset(new Buffer());
+    if (!buf->data) return nullptr;
+    off_t offset = static_cast<off_t>(i) * BUFFER_BLOCK_SIZE;
+    int want = std::min(static_cast<int64_t>(BUFFER_BLOCK_SIZE),
+                        static_cast<int64_t>(len_) - offset);
+    // O_DIRECT needs the length to be aligned too, the last block of a file
+    // simply comes back short.
+    int aligned = (want + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT *
+                  BUFFER_ALIGNMENT;
+    while (buf->len < want) {
+        ssize_t n = pread(fd, buf->data + buf->len,
+                          (direct ? aligned : want) - buf->len,
+                          offset + buf->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            LOG_ERROR << "msg=\"cannot read block\" offset=" << offset
+                      << " err=" << strerror(errno);
+            return nullptr;
+        }
+        buf->len += n;
+    }
+    if (buf->len > want) buf->len = want;
+    cache->add_read_bytes(buf->len);
+    return cache->insert(file_id, i, priority, buf);
+}
+
+std::pair<const uint8_t*, int> DirectSlice::range(int begin, int end) const
+{
+    ranges++;
+    if (len_ == -1 || end <= begin)
+        return std::make_pair<const uint8_t*, int>(nullptr, 0);
+    if (begin < 0) begin = 0;
+    if (end > len_) end = len_;
+
+    uint64_t first = begin / BUFFER_BLOCK_SIZE;
+    uint64_t last = (end - 1) / BUFFER_BLOCK_SIZE;
+    if (first == last) {
+        std::shared_ptr<Buffer> buf = block(first);
+        if (!buf) return std::make_pair<const uint8_t*, int>(nullptr, 0);
+        pinned = buf;
+        return std::make_pair<const uint8_t*, int>(
+            buf->data + begin - first * BUFFER_BLOCK_SIZE, end - begin);
+    }
+
+    spanned.resize(end - begin);
+    int copied = 0;
+    for (uint64_t i = first; i <= last; i++) {
+        std::shared_ptr<Buffer> buf = block(i);
+        if (!buf) return std::make_pair<const uint8_t*, int>(nullptr, 0);
+        int from = std::max(static_cast<int64_t>(begin),
+                            static_cast<int64_t>(i * BUFFER_BLOCK_SIZE)) -
+                   i * BUFFER_BLOCK_SIZE;
+        int to = std::min(static_cast<int64_t>(end),
+                          static_cast<int64_t>((i + 1) * BUFFER_BLOCK_SIZE)) -
+                 i * BUFFER_BLOCK_SIZE;
+        memcpy(&spanned[copied], buf->data + from, to - from);
+        copied += to - from;
+    }
+    pinned.reset();
+    return std::make_pair<const uint8_t*, int>(spanned.data(), end - begin);
+}
+
+uint64_t DirectSlice::generation() const { return ranges; }
+
+void DirectSlice::will_need(int begin, int end) const
+{
+    if (len_ == -1 || end <= begin) return;
+    if (begin < 0) begin = 0;
+    if (end > len_) end = len_;
+    for (uint64_t i = begin / BUFFER_BLOCK_SIZE;
+         i <= (end - 1) / BUFFER_BLOCK_SIZE; i++)
+        block(i);
+}
+
+DirectSlice::~DirectSlice()
+{
+    if (fd >= 0) ::close(fd);
+    if (len_ > 0)
+        cache->erase_file(file_id,
+                          (len_ + BUFFER_BLOCK_SIZE - 1) / BUFFER_BLOCK_SIZE);
+}
+
+} // namespace tsdbutil
+} // namespace tsdb
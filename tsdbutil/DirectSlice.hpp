@@ -0,0 +1,56 @@
+#ifndef DIRECTSLICE_H
+#define DIRECTSLICE_H
+
+#include <string>
+
+#include "tsdbutil/BufferCache.hpp"
+#include "tsdbutil/ByteSlice.hpp"
+
+namespace tsdb{
+namespace tsdbutil{
+
+// DirectSlice reads a file with pread, bypassing the kernel page cache with
+// O_DIRECT when the file system supports it, and keeps the blocks read in a
+// BufferCache shared by the DB.
+//
+// The pointer returned by range() is only valid until the same thread calls
+// range() on any DirectSlice again, see stable(). A reader holding it across
+// other calls must copy the data first, and may check with generation() that
+// no range() ran in between.
+class DirectSlice: public ByteSlice{
+    private:
+        std::shared_ptr<BufferCache> cache;
+        int priority;
+        int fd;
+        bool direct;
+        int len_;
+        uint64_t file_id;
+
+        // Return nullptr on error.
+        std::shared_ptr<Buffer> block(uint64_t i) const;
+
+    public:
+        DirectSlice(const std::string & path, const std::shared_ptr<BufferCache> & cache, int priority);
+
+        int len() const{
+            return len_;
+        }
+
+        std::pair<const uint8_t *, int> range(int begin, int end) const;
+
+        // Loads the blocks of [begin, end) into the cache.
+        void will_need(int begin, int end) const;
+
+        bool stable() const{
+            return false;
+        }
+
+        // The number of range() calls of the current thread.
+        uint64_t generation() const;
+
+        ~DirectSlice();
+};
+
+}}
+
+#endif
@@ -2,6 +2,8 @@
 #define MMAPSLICE_H
 
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "tsdbutil/ByteSlice.hpp"
 
@@ -41,6 +43,21 @@ class MMapSlice: public ByteSlice{
             return std::make_pair<const uint8_t *, int>(reinterpret_cast<const uint8_t*>(file.data()) + begin, end - begin);
         }
 
+        // Asynchronous read-ahead of the pages of [begin, end).
+        void will_need(int begin, int end) const{
+            if(len_ == -1 || end <= begin)
+                return;
+            if(begin < 0)
+                begin = 0;
+            if(end > len_)
+                end = len_;
+            uintptr_t page = sysconf(_SC_PAGESIZE);
+            uintptr_t b = reinterpret_cast<uintptr_t>(file.data()) + begin;
+            uintptr_t e = reinterpret_cast<uintptr_t>(file.data()) + end;
+            b &= ~(page - 1);
+            madvise(reinterpret_cast<void*>(b), e - b, MADV_WILLNEED);
+        }
+
         ~MMapSlice(){
             if(len_ >= 0)
                 file.close();
@@ -3,11 +3,43 @@
 namespace tsdb {
 namespace tsdbutil {
 
+namespace {
+
+error::Error compressed_samples(tsdbutil::DecBuf& decbuf,
+                                std::vector<RefSample>& refsamples)
+{
+    uint64_t n = decbuf.get_unsigned_variant();
+    int64_t base_time = decbuf.get_signed_variant();
+    uint64_t tsid = 0;
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < n && decbuf.error() == NO_ERR; i++) {
+        tsid += decbuf.get_unsigned_variant();
+        int64_t time_delta = decbuf.get_signed_variant();
+        uint8_t ctrl = decbuf.get_byte();
+        int leading = ctrl >> 4;
+        int trailing = ctrl & 0xf;
+        if (leading + trailing > 8) return error::Error("invalid xor value");
+        uint64_t x = 0;
+        for (int j = 7 - leading; j >= trailing; j--)
+            x |= static_cast<uint64_t>(decbuf.get_byte()) << (8 * j);
+        value ^= x;
+        refsamples.emplace_back(tsid, base_time + time_delta,
+                                base::decode_double(value));
+    }
+    if (decbuf.error() != NO_ERR) return error::Error(decbuf.error_str());
+    if (decbuf.len() > 0)
+        return error::Error("unexpected " + std::to_string(decbuf.len()) +
+                            " bytes left in entry");
+    return error::Error();
+}
+
+} // namespace
+
 RECORD_ENTRY_TYPE RecordDecoder::type(const std::vector<uint8_t>& rec)
 {
     if (rec.empty()) return RECORD_INVALID;
     if (rec[0] != RECORD_SERIES && rec[0] != RECORD_SAMPLES &&
-        rec[0] != RECORD_TOMBSTONES)
+        rec[0] != RECORD_TOMBSTONES && rec[0] != RECORD_COMPRESSED_SAMPLES)
         return RECORD_INVALID;
     return rec[0];
 }
@@ -15,7 +47,7 @@ RECORD_ENTRY_TYPE RecordDecoder::type(const uint8_t* rec, int length)
 {
     if (length < 1) return RECORD_INVALID;
     if (rec[0] != RECORD_SERIES && rec[0] != RECORD_SAMPLES &&
-        rec[0] != RECORD_TOMBSTONES)
+        rec[0] != RECORD_TOMBSTONES && rec[0] != RECORD_COMPRESSED_SAMPLES)
         return RECORD_INVALID;
     return rec[0];
 }
@@ -189,8 +221,10 @@ error::Error RecordDecoder::samples(const std::vector<uint8_t>& rec,
 {
     tsdbutil::DecBuf decbuf(&(rec[0]), rec.size());
 
-    if (decbuf.get_byte() != RECORD_SAMPLES)
-        return error::Error("invalid record type");
+    uint8_t type = decbuf.get_byte();
+    if (type == RECORD_COMPRESSED_SAMPLES)
+        return compressed_samples(decbuf, refsamples);
+    if (type != RECORD_SAMPLES) return error::Error("invalid record type");
     if (decbuf.len() == 0) return error::Error();
 
     tagtree::TSID tsid = decbuf.get_tsid();
@@ -216,8 +250,10 @@ error::Error RecordDecoder::samples(const uint8_t* rec, int length,
 {
     tsdbutil::DecBuf decbuf(rec, length);
 
-    if (decbuf.get_byte() != RECORD_SAMPLES)
-        return error::Error("invalid record type");
+    uint8_t type = decbuf.get_byte();
+    if (type == RECORD_COMPRESSED_SAMPLES)
+        return compressed_samples(decbuf, refsamples);
+    if (type != RECORD_SAMPLES) return error::Error("invalid record type");
     if (decbuf.len() == 0) return error::Error();
 
     auto tsid = decbuf.get_tsid();
@@ -344,10 +380,11 @@ error::Error RecordDecoder::tombstones(const std::vector<uint8_t>& rec,
         return error::Error("invalid record type");
 
     while (decbuf.len() > 0 && decbuf.error() == NO_ERR) {
-        stones.emplace_back(
-            decbuf.get_tsid(),
-            tombstone::Intervals(
-                {{decbuf.get_signed_variant(), decbuf.get_signed_variant()}}));
+        // Read in order, the arguments of a call are not sequenced.
+        tagtree::TSID tsid = decbuf.get_tsid();
+        int64_t mint = decbuf.get_signed_variant();
+        int64_t maxt = decbuf.get_signed_variant();
+        stones.emplace_back(tsid, tombstone::Intervals({{mint, maxt}}));
     }
 
     if (decbuf.error() != NO_ERR) return error::Error(decbuf.error_str());
@@ -365,10 +402,11 @@ error::Error RecordDecoder::tombstones(const uint8_t* rec, int length,
         return error::Error("invalid record type");
 
     while (decbuf.len() > 0 && decbuf.error() == NO_ERR) {
-        stones.emplace_back(
-            decbuf.get_tsid(),
-            tombstone::Intervals(
-                {{decbuf.get_signed_variant(), decbuf.get_signed_variant()}}));
+        // Read in order, the arguments of a call are not sequenced.
+        tagtree::TSID tsid = decbuf.get_tsid();
+        int64_t mint = decbuf.get_signed_variant();
+        int64_t maxt = decbuf.get_signed_variant();
+        stones.emplace_back(tsid, tombstone::Intervals({{mint, maxt}}));
     }
 
     if (decbuf.error() != NO_ERR) return error::Error(decbuf.error_str());
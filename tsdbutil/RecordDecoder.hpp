@@ -77,7 +77,9 @@ public:
     // │                              . . .                               │
     // └──────────────────────────────────────────────────────────────────┘
     //
-    // Samples appends samples in rec to the given slice.
+    // Samples appends samples in rec to the given slice. rec may also be a
+    // type 7 record, see RecordEncoder::compressed_samples(), whose samples
+    // are appended in the order they were encoded.
     static error::Error samples(const std::vector<uint8_t>& rec,
                                 std::vector<RefSample>& refsamples);
     static error::Error samples(const uint8_t* rec, int length,
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <numeric>
+
 #include "tsdbutil/RecordEncoder.hpp"
 
 namespace tsdb {
@@ -199,6 +202,47 @@ void RecordEncoder::samples(const std::vector<RefSample>& refsamples,
 //
 // Tombstones appends the encoded tombstones to b and returns the resulting
 // slice.
+void RecordEncoder::compressed_samples(
+    const std::vector<RefSample>& refsamples, std::vector<uint8_t>& rec)
+{
+    if (refsamples.empty()) return;
+    std::vector<int> order(refsamples.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&refsamples](int l, int r) {
+        return refsamples[l].tsid < refsamples[r].tsid;
+    });
+
+    tsdbutil::EncBuf encbuf(6 * refsamples.size() + 16);
+    encbuf.put_byte(RECORD_COMPRESSED_SAMPLES);
+    encbuf.put_unsigned_variant(refsamples.size());
+    int64_t base_time = refsamples[order[0]].t;
+    encbuf.put_signed_variant(base_time);
+
+    uint64_t last_tsid = 0;
+    uint64_t last_value = 0;
+    for (int i : order) {
+        const RefSample& s = refsamples[i];
+        encbuf.put_unsigned_variant(static_cast<uint64_t>(s.tsid) - last_tsid);
+        last_tsid = static_cast<uint64_t>(s.tsid);
+        encbuf.put_signed_variant(s.t - base_time);
+
+        uint64_t value = base::encode_double(s.v);
+        uint64_t x = value ^ last_value;
+        last_value = value;
+        if (x == 0) {
+            encbuf.put_byte(static_cast<uint8_t>(0x80));
+            continue;
+        }
+        int leading = __builtin_clzll(x) / 8;
+        int trailing = __builtin_ctzll(x) / 8;
+        encbuf.put_byte(static_cast<uint8_t>((leading << 4) | trailing));
+        for (int j = 7 - leading; j >= trailing; j--)
+            encbuf.put_byte(static_cast<uint8_t>(x >> (8 * j)));
+    }
+
+    rec.insert(rec.end(), encbuf.b.begin(), encbuf.b.begin() + encbuf.index);
+}
+
 void RecordEncoder::tombstones(const std::vector<Stone>& stones,
                                std::vector<uint8_t>& rec)
 {
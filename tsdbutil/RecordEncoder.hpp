@@ -73,6 +73,30 @@ public:
     static void samples(const std::vector<RefSample>& refsamples,
                         std::vector<uint8_t>& rec);
 
+    // ┌──────────────────────────────────────────────────────────────────┐
+    // │ type = 7 <1b>                                                    │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ ┌───────────────────────────────┬──────────────────────────────┐ │
+    // │ │ n = len(samples) <uvarint>    │ base_timestamp <varint>      │ │
+    // │ └───────────────────────────────┴──────────────────────────────┘ │
+    // │ ┌────────────────────┬───────────────────────────┬─────────────┐ │
+    // │ │ id_delta <uvarint> │ timestamp_delta <varint>  │ value <xor> │ │
+    // │ └────────────────────┴───────────────────────────┴─────────────┘ │
+    // │                              . . .                               │
+    // └──────────────────────────────────────────────────────────────────┘
+    //
+    // The samples are sorted by id, the order of the samples of a series is
+    // kept, and id_delta is the difference to the id of the previous sample.
+    // Each value is XORed with the value of the previous sample, i.e. the
+    // previous value of the same series or of the neighbouring series, and
+    // written as one byte holding the number of leading and trailing zero
+    // bytes of the result, 4 bits each, followed by the bytes in between.
+    //
+    // CompressedSamples appends the encoded samples to rec, usually taking 3
+    // to 6 bytes per sample instead of 17 with samples().
+    static void compressed_samples(const std::vector<RefSample>& refsamples,
+                                   std::vector<uint8_t>& rec);
+
     // ┌──────────────────────────────────────────────────────────────────────┐
     // │ type = 5 <1b>                                                        │
     // ├──────────────────────────────────────────────────────────────────────┤
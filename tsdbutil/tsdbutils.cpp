@@ -1,4 +1,12 @@
+#include <algorithm>
 #include <boost/filesystem.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "tsdbutil/tsdbutils.hpp"
 
@@ -15,6 +23,84 @@ bool is_number(const std::string& s){
     return !s.empty() && it == s.end();
 }
 
+namespace{
+
+// Copy the remaining bytes of in to out, return false on error.
+bool copy_fd(int in, int out, off_t len){
+#ifdef SYS_copy_file_range
+    bool kernel = true;
+#else
+    bool kernel = false;
+#endif
+    char buf[64 * 1024];
+    while(len > 0){
+        ssize_t n = -1;
+#ifdef SYS_copy_file_range
+        if(kernel){
+            n = syscall(SYS_copy_file_range, in, NULL, out, NULL, static_cast<size_t>(len), 0);
+            if(n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)){
+                kernel = false;
+                continue;
+            }
+        }
+#endif
+        if(!kernel){
+            n = read(in, buf, std::min(static_cast<off_t>(sizeof(buf)), len));
+            if(n > 0){
+                ssize_t written = 0;
+                while(written < n){
+                    ssize_t w = write(out, buf + written, n - written);
+                    if(w < 0 && errno == EINTR)
+                        continue;
+                    if(w <= 0)
+                        return false;
+                    written += w;
+                }
+            }
+        }
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        len -= n;
+    }
+    return true;
+}
+
+}
+
+bool clone_file(const std::string & src, const std::string & dst){
+    if(link(src.c_str(), dst.c_str()) == 0)
+        return true;
+
+    int in = open(src.c_str(), O_RDONLY);
+    if(in < 0)
+        return false;
+    struct stat st;
+    if(fstat(in, &st) != 0){
+        close(in);
+        return false;
+    }
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0){
+        close(in);
+        return false;
+    }
+    bool ok = false;
+#ifdef FICLONE
+    ok = ioctl(out, FICLONE, in) == 0;
+#endif
+    if(!ok)
+        ok = copy_fd(in, out, st.st_size);
+    if(ok)
+        ok = fsync(out) == 0;
+    close(in);
+    close(out);
+    if(!ok)
+        unlink(dst.c_str());
+    return ok;
+}
+
 std::pair<int64_t, int64_t> clamp_interval(int64_t a, int64_t b, int64_t mint, int64_t maxt){
     if(a < mint)
         a = mint;
@@ -31,5 +117,6 @@ const RECORD_ENTRY_TYPE RECORD_TOMBSTONES = 3;
 const RECORD_ENTRY_TYPE RECORD_GROUP_SERIES = 4;
 const RECORD_ENTRY_TYPE RECORD_GROUP_SAMPLES = 5;
 const RECORD_ENTRY_TYPE RECORD_GROUP_TOMBSTONES = 6;
+const RECORD_ENTRY_TYPE RECORD_COMPRESSED_SAMPLES = 7;
 
 }}
\ No newline at end of file
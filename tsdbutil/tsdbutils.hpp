@@ -16,6 +16,12 @@ std::string filepath_join(const std::string& f1, const std::string& f2);
 
 bool is_number(const std::string& s);
 
+// clone_file creates dst with the content of src, sharing the data blocks of
+// src when the file system can: a hard link first, then a reflink, then an
+// in-kernel copy_file_range(), and a plain read/write copy as the last resort.
+// Only meant for immutable files like the chunk files of a block.
+bool clone_file(const std::string& src, const std::string& dst);
+
 std::pair<int64_t, int64_t> clamp_interval(int64_t a, int64_t b, int64_t mint,
                                            int64_t maxt);
 
@@ -118,6 +124,7 @@ extern const RECORD_ENTRY_TYPE RECORD_TOMBSTONES;
 extern const RECORD_ENTRY_TYPE RECORD_GROUP_SERIES;
 extern const RECORD_ENTRY_TYPE RECORD_GROUP_SAMPLES;
 extern const RECORD_ENTRY_TYPE RECORD_GROUP_TOMBSTONES;
+extern const RECORD_ENTRY_TYPE RECORD_COMPRESSED_SAMPLES;
 
 } // namespace tsdbutil
 } // namespace tsdb
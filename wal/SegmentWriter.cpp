@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+#include "base/Logging.hpp"
+#include "wal/SegmentWriter.hpp"
+#include "wal/WALUtils.hpp"
+
+namespace tsdb{
+namespace wal{
+
+#ifdef __NR_io_uring_setup
+
+// IoUring is a minimal submission/completion ring driven by the raw system
+// calls, only used by one writer thread at a time.
+class IoUring: boost::noncopyable{
+    private:
+        int fd_;
+        void * sq_ptr;
+        size_t sq_len;
+        void * cq_ptr;
+        size_t cq_len;
+        struct io_uring_sqe * sqes;
+        size_t sqes_len;
+
+        unsigned * sq_tail;
+        unsigned * sq_mask;
+        unsigned * sq_array;
+        unsigned * cq_head;
+        unsigned * cq_tail;
+        unsigned * cq_mask;
+        struct io_uring_cqe * cqes;
+
+        struct io_uring_sqe * next_sqe(unsigned * tail){
+            unsigned i = *tail & *sq_mask;
+            struct io_uring_sqe * sqe = &sqes[i];
+            memset(sqe, 0, sizeof(*sqe));
+            sq_array[i] = i;
+            ++ *tail;
+            return sqe;
+        }
+
+    public:
+        IoUring(): fd_(-1), sq_ptr(MAP_FAILED), sq_len(0), cq_ptr(MAP_FAILED), cq_len(0), sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED)), sqes_len(0){}
+
+        bool init(unsigned entries){
+            struct io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            fd_ = syscall(__NR_io_uring_setup, entries, &p);
+            if(fd_ < 0)
+                return false;
+
+            sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+            bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+            if(single)
+                sq_len = cq_len = std::max(sq_len, cq_len);
+            sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+            if(sq_ptr == MAP_FAILED)
+                return false;
+            if(single)
+                cq_ptr = sq_ptr;
+            else{
+                cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+                if(cq_ptr == MAP_FAILED)
+                    return false;
+            }
+            sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+            sqes = static_cast<struct io_uring_sqe *>(mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+            if(sqes == MAP_FAILED)
+                return false;
+
+            char * sq = static_cast<char *>(sq_ptr);
+            char * cq = static_cast<char *>(cq_ptr);
+            sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+            sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+            cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+            cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+            cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+            cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+            return true;
+        }
+
+        // Write [p, p + length) at offset of fd, followed by a linked
+        // fdatasync() when sync is true, and wait for both. Return false if the
+        // ring itself failed, otherwise the results are in written and synced
+        // as bytes or -errno.
+        bool write(int fd, const uint8_t * p, int length, int64_t offset, bool sync, int * written, int * synced){
+            struct iovec iov;
+            iov.iov_base = const_cast<uint8_t *>(p);
+            iov.iov_len = length;
+
+            unsigned tail = *sq_tail;
+            struct io_uring_sqe * sqe = next_sqe(&tail);
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->fd = fd;
+            sqe->off = offset;
+            sqe->addr = reinterpret_cast<uint64_t>(&iov);
+            sqe->len = 1;
+            sqe->user_data = 0;
+            if(sync){
+                sqe->flags = IOSQE_IO_LINK;
+                sqe = next_sqe(&tail);
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = fd;
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                sqe->user_data = 1;
+            }
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+            unsigned n = sync ? 2 : 1;
+            unsigned submit = n;
+            unsigned done = 0;
+            *synced = 0;
+            while(done < n){
+                int r = syscall(__NR_io_uring_enter, fd_, submit, n - done, IORING_ENTER_GETEVENTS, NULL, 0);
+                if(r < 0){
+                    if(errno == EINTR)
+                        continue;
+                    return false;
+                }
+                submit -= std::min(submit, static_cast<unsigned>(r));
+                unsigned head = *cq_head;
+                while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+                    struct io_uring_cqe * cqe = &cqes[head & *cq_mask];
+                    if(cqe->user_data == 0)
+                        *written = cqe->res;
+                    else
+                        *synced = cqe->res;
+                    ++ head;
+                    ++ done;
+                }
+                __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            }
+            return true;
+        }
+
+        ~IoUring(){
+            if(sqes != MAP_FAILED)
+                munmap(sqes, sqes_len);
+            if(cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+                munmap(cq_ptr, cq_len);
+            if(sq_ptr != MAP_FAILED)
+                munmap(sq_ptr, sq_len);
+            if(fd_ >= 0)
+                ::close(fd_);
+        }
+};
+
+#else
+
+class IoUring{};
+
+#endif
+
+SegmentWriter::SegmentWriter(int fd, int64_t size, int64_t prealloc, bool uring): fd(fd), offset(size), prealloc(prealloc){
+    if(prealloc > size && fallocate(fd, FALLOC_FL_KEEP_SIZE, size, prealloc - size) != 0)
+        this->prealloc = 0;
+#ifdef __NR_io_uring_setup
+    if(uring){
+        ring.reset(new IoUring());
+        if(!ring->init(4))
+            ring.reset();
+    }
+#endif
+    buf.reserve(PAGE_SIZE * 2);
+}
+
+error::Error SegmentWriter::append(const uint8_t * p, int length){
+    buf.insert(buf.end(), p, p + length);
+    if(static_cast<int>(buf.size()) >= PAGE_SIZE)
+        return write_out(false);
+    return error::Error();
+}
+
+error::Error SegmentWriter::write_out(bool sync){
+    int done = 0;
+#ifdef __NR_io_uring_setup
+    if(ring && !buf.empty()){
+        int written = 0, synced = 0;
+        if(ring->write(fd, &(buf[0]), buf.size(), offset, sync, &written, &synced)){
+            if(written < 0)
+                return error::Error(std::string("error write segment: ") + strerror(-written));
+            done = written;
+            // A short write cancels the linked sync, the rest goes through
+            // pwrite() below.
+            if(done == static_cast<int>(buf.size())){
+                offset += done;
+                buf.clear();
+                if(sync && synced < 0)
+                    return error::Error(std::string("error sync segment: ") + strerror(-synced));
+                return error::Error();
+            }
+        }
+        else{
+            LOG_WARN << "msg=\"io_uring failed, falling back to pwrite\" err=" << strerror(errno);
+            ring.reset();
+        }
+    }
+#endif
+    while(done < static_cast<int>(buf.size())){
+        ssize_t n = pwrite(fd, &(buf[done]), buf.size() - done, offset + done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return error::Error(std::string("error write segment: ") + strerror(errno));
+        done += n;
+    }
+    offset += done;
+    buf.clear();
+    if(sync && fdatasync(fd) != 0)
+        return error::Error(std::string("error sync segment: ") + strerror(errno));
+    return error::Error();
+}
+
+error::Error SegmentWriter::flush(bool sync){
+    if(buf.empty() && !sync)
+        return error::Error();
+    return write_out(sync);
+}
+
+error::Error SegmentWriter::close(){
+    if(fd < 0)
+        return error::Error();
+    error::Error err = flush(true);
+    // Truncating to the current size frees the blocks reserved past it.
+    if(prealloc > offset && !err && ftruncate(fd, offset) != 0)
+        err.set(std::string("error release preallocation: ") + strerror(errno));
+    if(::close(fd) != 0 && !err)
+        err.set(std::string("error close segment: ") + strerror(errno));
+    fd = -1;
+    ring.reset();
+    return err;
+}
+
+SegmentWriter::~SegmentWriter(){
+    close();
+}
+
+}}
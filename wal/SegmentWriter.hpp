@@ -0,0 +1,60 @@
+#ifndef SEGMENTWRITER_H
+#define SEGMENTWRITER_H
+
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "base/Error.hpp"
+
+namespace tsdb{
+namespace wal{
+
+class IoUring;
+
+// SegmentWriter writes a segment file sequentially. The bytes appended are
+// buffered and written at their offset with pwrite(), or through an io_uring
+// when the kernel allows it, in which case the write and the fdatasync() of a
+// synced flush are submitted together as linked requests.
+//
+// The blocks up to prealloc bytes are reserved with fallocate() without
+// changing the file size, so readers still see the bytes written only, and
+// the reservation past the end is given back by close().
+class SegmentWriter: boost::noncopyable{
+    private:
+        int fd;
+        int64_t offset; // Of the first byte of buf in the file.
+        int64_t prealloc;
+        std::vector<uint8_t> buf;
+        std::unique_ptr<IoUring> ring;
+
+        error::Error write_out(bool sync);
+
+    public:
+        // fd is owned by the writer, size is where the writes start. Only
+        // pwrite() is used when uring is false.
+        SegmentWriter(int fd, int64_t size, int64_t prealloc, bool uring=true);
+
+        int64_t size() const{ return offset + buf.size(); }
+
+        // Whether the writes go through an io_uring.
+        bool uses_ring() const{ return static_cast<bool>(ring); }
+
+        // Written out once a page worth of bytes is buffered.
+        error::Error append(const uint8_t * p, int length);
+
+        // flush writes the buffered bytes to the file, and waits for them to
+        // reach the disk when sync is true.
+        error::Error flush(bool sync);
+
+        // close flushes with sync, releases the preallocated blocks and
+        // closes the file.
+        error::Error close();
+
+        ~SegmentWriter();
+};
+
+}}
+
+#endif
@@ -4,13 +4,17 @@
 #include <boost/format.hpp>
 #include <chrono>
 #include <cstdio>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 // #include <boost/algorithm/string/predicate.hpp>
 #include <iostream>
 #include <vector>
+#include <zlib.h>
 
 #include "base/Checksum.hpp"
 #include "base/Endian.hpp"
@@ -31,21 +35,22 @@ void close_segment(std::shared_ptr<Segment> segment){
     if(segment->get_close())
         LOG_WARN << "msg=\"segment " << segment->index() << " already closed\"";
     else{
-        if(fsync(fileno(segment->f)) != 0)
-            LOG_ERROR << "msg=\"sync previous segment " << segment->index() << "\" err=" << strerror(errno);
-        if(fclose(segment->f) != 0)
-            LOG_ERROR << "msg=\"close previous segment " << segment->index() << "\" err=" << strerror(errno);
-        segment->set_closed(true);
+        error::Error err = segment->close();
+        if(err)
+            LOG_ERROR << "msg=\"close previous segment " << segment->index() << "\" err=" << err.error();
     }
     LOG_INFO << "close segment: " << segment_name(segment->dir_, segment->index_)
         << ", duration: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - t0).count() << "ms";
 }
 
-Segment::Segment(const std::string & dir, int index, bool write): dir_(dir), index_(index), closed(true) {
+Segment::Segment(const std::string & dir, int index, bool write, int64_t prealloc): dir_(dir), index_(index), f(NULL), closed(true) {
     std::string name = segment_name(dir, index);
     if(write){
-        f = fopen(name.c_str(), "ab");
-        if(!f){
+        int fd = ::open(name.c_str(), O_WRONLY | O_CREAT, 0666);
+        struct stat st;
+        if(fd < 0 || fstat(fd, &st) != 0){
+            if(fd >= 0)
+                ::close(fd);
             err_.set("Cannot open segment file: " + name);
             return;
         }
@@ -55,17 +60,19 @@ Segment::Segment(const std::string & dir, int index, bool write): dir_(dir), ind
         // will just pad the page and everything will be fine.
         // If it was torn mid-record, a full read (which the caller should do anyway
         // to ensure integrity) will detect it as a corruption by the end.
-        int size_ = ftell(f);
-        if((size_ = size_ % PAGE_SIZE) != 0){
+        int64_t size_ = st.st_size;
+        if(size_ % PAGE_SIZE != 0){
             LOG_WARN << "msg=\"last page of the wal is torn, filling it with zeros\""
-                << " segment=", name;
-            std::vector<char> pad_zero(PAGE_SIZE - size_, 0);
-            if(fwrite(&(pad_zero[0]), 1, PAGE_SIZE - size_, f) != PAGE_SIZE - size_){
-                fclose(f);
+                << " segment=" << name;
+            std::vector<char> pad_zero(PAGE_SIZE - size_ % PAGE_SIZE, 0);
+            if(pwrite(fd, &(pad_zero[0]), pad_zero.size(), size_) != static_cast<ssize_t>(pad_zero.size())){
+                ::close(fd);
                 err_.set("error zero-padding torn page");
                 return;
             }
+            size_ += pad_zero.size();
         }
+        writer.reset(new SegmentWriter(fd, size_, prealloc));
     }
     else{
         f = fopen(name.c_str(), "rb");
@@ -77,7 +84,7 @@ Segment::Segment(const std::string & dir, int index, bool write): dir_(dir), ind
     closed = false;
 }
 
-Segment::Segment(const std::string & filename): closed(true) {
+Segment::Segment(const std::string & filename): f(NULL), closed(true) {
     boost::filesystem::path p(filename);
     if(!tsdbutil::is_number(p.filename().string())){
         err_.set("invalid segment filename");
@@ -93,7 +100,7 @@ Segment::Segment(const std::string & filename): closed(true) {
     closed = false;
 }
 
-Segment::Segment(const std::string & filename, const std::string & dir, int index): dir_(dir), index_(index), closed(true) {
+Segment::Segment(const std::string & filename, const std::string & dir, int index): dir_(dir), index_(index), f(NULL), closed(true) {
     f = fopen(filename.c_str(), "rb");
     if(!f){
         err_.set("Cannot open segment file: " + filename);
@@ -148,7 +155,35 @@ std::pair<std::vector<SegmentRef>, error::Error> list_segments(const std::string
     return {r, error::Error()};
 }
 
-WAL::WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool_, int segment_size): dir_(dir), pool_(pool_), segment_size(segment_size), done_pages(0){
+namespace{
+
+// Deflate a record into out as its length <uvarint> followed by the zlib
+// stream, return false when that is not smaller than the record.
+bool deflate_record(const uint8_t * p, int length, std::vector<uint8_t> & out){
+    uLongf len = compressBound(length);
+    out.resize(base::MAX_VARINT_LEN_64 + len);
+    int n = base::encode_unsigned_varint(&(out[0]), length);
+    if(compress2(&(out[n]), &len, p, length, Z_BEST_SPEED) != Z_OK)
+        return false;
+    out.resize(n + len);
+    return static_cast<int>(out.size()) < length;
+}
+
+bool inflate_record(const uint8_t * p, int size, std::vector<uint8_t> & out){
+    int n = 0;
+    uint64_t length = base::decode_unsigned_varint(p, n, size);
+    if(n <= 0 || length > static_cast<uint64_t>(SEGMENT_SIZE) * 8)
+        return false;
+    out.resize(length);
+    uLongf len = length;
+    if(uncompress(&(out[0]), &len, p + n, size - n) != Z_OK || len != length)
+        return false;
+    return true;
+}
+
+}
+
+WAL::WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool_, int segment_size): dir_(dir), pool_(pool_), segment_size(segment_size), done_pages(0), compress_(false), sync_(false){
     if(!boost::filesystem::create_directories(dir)){
         LOG_INFO << "WAL Directory existed: " << dir;
     }
@@ -164,7 +199,7 @@ WAL::WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool
 
     page = std::unique_ptr<Page>(new Page());
 
-    std::shared_ptr<Segment> segment_(new Segment(dir, rp.first.second));
+    std::shared_ptr<Segment> segment_(new Segment(dir, rp.first.second, true, segment_size));
     if(segment_->err_){
         err_.set(segment_->err_);
         return;
@@ -184,12 +219,7 @@ std::pair<std::pair<int, int>, error::Error> WAL::segments(const std::string & d
 
 error::Error WAL::set_segment(const std::shared_ptr<Segment> & s){
     segment = s;
-    if(fseek(s->f, 0L, SEEK_END) != 0)
-        return error::Error("error seek");
-    int size_ = ftell(s->f);
-    if(fseek(s->f, 0L, SEEK_SET) != 0)
-        return error::Error("error seek");
-    done_pages = size_ / PAGE_SIZE;
+    done_pages = s->writer->size() / PAGE_SIZE;
     return error::Error();
 }
 
@@ -202,7 +232,7 @@ error::Error WAL::next_segment(){
             return err;
     }
     // std::cerr << "segment->index_ " << segment->index_ << std::endl;
-    std::shared_ptr<Segment> next(new Segment(dir_, segment->index_ + 1));
+    std::shared_ptr<Segment> next(new Segment(dir_, segment->index_ + 1, true, segment_size));
     if(next->err_)
         return error::wrap(next->err_, "create new segment file");
     
@@ -227,8 +257,9 @@ error::Error WAL::flush_page(bool clear){
         page->alloc = PAGE_SIZE; // Write till end of page.
     }
     int to_write = page->alloc - page->flushed;
-    if(fwrite(page->buf_ + page->flushed, 1, to_write, segment->f) != to_write)
-        return error::Error("error fwrite");
+    error::Error err = segment->writer->append(page->buf_ + page->flushed, to_write);
+    if(err)
+        return err;
     page->flushed += to_write;
 
     // We flushed an entire page, prepare a new one.
@@ -243,68 +274,7 @@ error::Error WAL::flush_page(bool clear){
 // the final record of a batch, the record is bigger than the page size or
 // the current page is full.
 error::Error WAL::log(const std::vector<uint8_t> & rec, bool final){
-    base::RWLockGuard lock(mutex_, 1);
-
-    // If the record is too big to fit within the active page in the current
-    // segment, terminate the active segment and advance to the next one.
-    // This ensures that records do not cross segment boundaries.
-    int available = page->remaining() - HEADER_SIZE + (PAGE_SIZE - HEADER_SIZE) * (segment_size / PAGE_SIZE - done_pages - 1);
-    // std::cerr << "done_pages: " << done_pages << " page->remaining(): " << page->remaining() << " available: " << available << " rec.size(): " << rec.size() << std::endl;
-    // NOTICE(Alec), Here need to cast to int first because available may be negative.
-    if(static_cast<int>(rec.size()) > available){
-        error::Error err = next_segment();
-        if(err)
-            return err;
-    }
-
-    // Populate as many pages as necessary to fit the record.
-    // Be careful to always do one pass to ensure we write zero-length records.
-    int i = 0;
-    int remaining = rec.size();
-    const uint8_t * index = &(rec[0]);
-    while(i == 0 || remaining > 0){
-        // If page cannot fit the whole header, continue next page.
-        if((PAGE_SIZE - page->alloc) - HEADER_SIZE <= 0){
-            error::Error err = flush_page(true);
-            if(err)
-                return err;
-        }
-        int l = std::min(remaining, (PAGE_SIZE - page->alloc) - HEADER_SIZE);
-        RECORD_TYPE type;
-        if(i == 0 && l == remaining)
-            type = RECORD_FULL;
-        else if(l == remaining)
-            type = RECORD_LAST;
-        else if(i == 0)
-            type = RECORD_FIRST;
-        else
-            type = RECORD_MIDDLE;
-        // LOG_INFO << "type: " << type << "remaining: " << remaining;
-        page->buf_[page->alloc ++] = type;
-        base::put_uint16_big_endian(page->buf_ + page->alloc, l);
-        page->alloc += 2;
-        uint32_t crc = base::GetCrc32(index, l);
-        base::put_uint32_big_endian(page->buf_ + page->alloc, crc);
-        page->alloc += 4;
-        // LOG_DEBUG << "remaining:" << remaining << " page->alloc:" << page->alloc << " l:" << l;
-        memcpy(page->buf_ + page->alloc, index, l);
-        // LOG_DEBUG << "after memcpy";
-        index += l;
-        remaining -= l;
-        page->alloc += l;
-
-        // By definition when a record is split it means its size is bigger than
-        // the page boundary so the current page would be full and needs to be flushed.
-        // On contrary if we wrote a full record, we can fit more records of the batch
-        // into the page before flushing it.
-        if(final || type != RECORD_FULL || page->full()){
-            error::Error err = flush_page(false);
-            if(err)
-                return err;
-        }
-        ++ i;
-    }
-    return error::Error();
+    return log(rec.data(), rec.size(), final);
 }
 
 error::Error WAL::log(const std::vector<std::vector<uint8_t>> & recs){
@@ -319,6 +289,13 @@ error::Error WAL::log(const std::vector<std::vector<uint8_t>> & recs){
 error::Error WAL::log(const uint8_t * p, int length, bool final){
     base::RWLockGuard lock(mutex_, 1);
 
+    RECORD_TYPE flag = 0;
+    if(compress_ && length >= MIN_COMPRESS_RECORD_SIZE && deflate_record(p, length, compressed)){
+        p = &(compressed[0]);
+        length = compressed.size();
+        flag = RECORD_COMPRESSED;
+    }
+
     // If the record is too big to fit within the active page in the current
     // segment, terminate the active segment and advance to the next one.
     // This ensures that records do not cross segment boundaries.
@@ -349,10 +326,10 @@ error::Error WAL::log(const uint8_t * p, int length, bool final){
             type = RECORD_FIRST;
         else
             type = RECORD_MIDDLE;
-        page->buf_[page->alloc ++] = type;
+        page->buf_[page->alloc ++] = type | flag | RECORD_CRC32C;
         base::put_uint16_big_endian(page->buf_ + page->alloc, l);
         page->alloc += 2;
-        uint32_t crc = base::GetCrc32(p, l);
+        uint32_t crc = base::GetCrc32c(p, l);
         base::put_uint32_big_endian(page->buf_ + page->alloc, crc);
         page->alloc += 4;
         memcpy(page->buf_ + page->alloc, p, l);
@@ -371,6 +348,9 @@ error::Error WAL::log(const uint8_t * p, int length, bool final){
         }
         ++ i;
     }
+    // Hand the whole batch to the kernel at once.
+    if(final)
+        return segment->writer->flush(sync_);
     return error::Error();
 }
 
@@ -417,7 +397,7 @@ error::Error WAL::repair(const CorruptionError & cerr){
     std::string temp_file = corrupted_file + ".repair";
     boost::filesystem::rename(corrupted_file, temp_file);
     // Create a clean segment and make it the active one.
-    std::shared_ptr<Segment> s(new Segment(dir_, cerr.segment));
+    std::shared_ptr<Segment> s(new Segment(dir_, cerr.segment, true, segment_size));
     if(s->err_)
         return s->err_;
     error::Error err = set_segment(s);
@@ -468,11 +448,11 @@ error::Error WAL::truncate(int i){
 }
 
 void WAL::sync(){
-    if(segment){
-        // flush data from user space to kernel space.
-        fflush(segment->f);
-        // flush data from kernel space to disk.
-        fsync(fileno(segment->f));
+    base::RWLockGuard lock(mutex_, 1);
+    if(segment && !segment->get_close()){
+        error::Error err = segment->writer->flush(true);
+        if(err)
+            LOG_ERROR << "msg=\"sync segment " << segment->index() << "\" err=" << err.error();
     }
 }
 
@@ -506,7 +486,7 @@ error::Error validate_record(int i, RECORD_TYPE type){
     }
 }
 
-SegmentReader::SegmentReader(const std::string & dir, bool directory): segment_index(0), segment_offset(0), offset_reset(false), page_offset(0), eof(false){
+SegmentReader::SegmentReader(const std::string & dir, bool directory): segment_index(0), map_(NULL), map_len(0), page_start(0), page(NULL), page_len(0), page_offset(0), eof(false), compressed(false){
     if(directory){
         std::pair<std::vector<SegmentRef>, error::Error> sp = list_segments(dir);
         if(sp.second){
@@ -538,7 +518,7 @@ SegmentReader::SegmentReader(const std::string & dir, bool directory): segment_i
     record_.reserve(PAGE_SIZE / 2);
 }
 
-SegmentReader::SegmentReader(const SegmentRef & ref): segment_index(0), segment_offset(0), offset_reset(false), page_offset(0), eof(false){
+SegmentReader::SegmentReader(const SegmentRef & ref): segment_index(0), map_(NULL), map_len(0), page_start(0), page(NULL), page_len(0), page_offset(0), eof(false), compressed(false){
     segments.emplace_back(new Segment(ref.name));
     if(segments.back()->err_){
         err_.set(segments.back()->err_);
@@ -553,7 +533,7 @@ SegmentReader::SegmentReader(const SegmentRef & ref): segment_index(0), segment_
     record_.reserve(PAGE_SIZE / 2);
 }
 
-SegmentReader::SegmentReader(const std::string & name, const std::string & dir, int index): segment_index(0), segment_offset(0), offset_reset(false), page_offset(0), eof(false){
+SegmentReader::SegmentReader(const std::string & name, const std::string & dir, int index): segment_index(0), map_(NULL), map_len(0), page_start(0), page(NULL), page_len(0), page_offset(0), eof(false), compressed(false){
     segments.emplace_back(new Segment(name, dir, index));
     if(segments.back()->err_){
         err_.set(segments.back()->err_);
@@ -568,7 +548,7 @@ SegmentReader::SegmentReader(const std::string & name, const std::string & dir,
     record_.reserve(PAGE_SIZE / 2);
 }
 
-SegmentReader::SegmentReader(const std::deque<SegmentRange> & segs): segment_index(0), segment_offset(0), offset_reset(false), page_offset(0), eof(false){
+SegmentReader::SegmentReader(const std::deque<SegmentRange> & segs): segment_index(0), map_(NULL), map_len(0), page_start(0), page(NULL), page_len(0), page_offset(0), eof(false), compressed(false){
     for(const SegmentRange & seg: segs){
         std::pair<std::vector<SegmentRef>, error::Error> sp = list_segments(seg.dir);
         if(sp.second){
@@ -599,44 +579,85 @@ SegmentReader::SegmentReader(const std::deque<SegmentRange> & segs): segment_ind
     record_.reserve(PAGE_SIZE / 2);
 }
 
-// Read one page from current segment.
-// Pad zeros if page size < PAGE_SIZE.
-bool SegmentReader::read_page(){
-    if(segment_index == segments.size()){
-        eof = true;
+bool SegmentReader::map_segment(){
+    int fd = fileno(segments[segment_index]->f);
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        err_.set(std::string("error stat segment: ") + strerror(errno));
         return false;
     }
-    if(offset_reset){
-        offset_reset = false;
-        segment_offset = 0;
+    map_len = st.st_size;
+    if(map_len == 0)
+        return true;
+    void * p = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED){
+        map_len = 0;
+        err_.set(std::string("error mmap segment: ") + strerror(errno));
+        return false;
     }
-    int read = fread(buf, 1, PAGE_SIZE, segments[segment_index]->f);
+    madvise(p, map_len, MADV_SEQUENTIAL);
+    map_ = static_cast<const uint8_t *>(p);
+    return true;
+}
+
+void SegmentReader::unmap_segment(){
+    if(map_ != NULL)
+        munmap(const_cast<uint8_t *>(map_), map_len);
+    map_ = NULL;
+    map_len = 0;
+    page = NULL;
+    page_len = 0;
+}
+
+// Move to the next page, mapping the next segment when the current one is
+// exhausted.
+bool SegmentReader::read_page(){
     page_offset = 0;
-    if(read != PAGE_SIZE){
-        if(feof(segments[segment_index]->f)){
-            offset_reset = true;
-            ++ segment_index;
-            if(read == 0)
-                return read_page();
-            memset(buf + read, 0, PAGE_SIZE - read);
+    while(true){
+        if(page == NULL){
+            if(segment_index >= static_cast<int>(segments.size())){
+                eof = true;
+                return false;
+            }
+            if(!map_segment())
+                return false;
+            page_start = 0;
+        }
+        else
+            page_start += PAGE_SIZE;
+        if(page_start < map_len){
+            page = map_ + page_start;
+            page_len = std::min(map_len - page_start, static_cast<size_t>(PAGE_SIZE));
+            return true;
         }
-        else{
-            err_.set("error fread");
+        // Stay on the last segment at the end so that segment() and cerror()
+        // remain valid.
+        if(segment_index + 1 >= static_cast<int>(segments.size())){
+            eof = true;
             return false;
         }
+        unmap_segment();
+        ++ segment_index;
     }
-    return true;
 }
 
 bool SegmentReader::next(){
     if(err_ || eof)
         return false;
     record_.clear();
+    view = std::pair<const uint8_t *, int>(NULL, 0);
 
     int i = 0;
     while(true){
         // If the remaining space of the page cannot fit the whole header, continue next page.
-        if(page_offset + HEADER_SIZE >= PAGE_SIZE){
+        // The bytes missing from a short last page count as zero padding.
+        if(page_offset + HEADER_SIZE >= PAGE_SIZE || page_offset >= page_len){
+            // Records are never split across segments, the writer stopped
+            // in the middle of this one.
+            if(i > 0 && page_start + PAGE_SIZE >= map_len){
+                err_.set("last record of segment is torn");
+                return false;
+            }
             if(!read_page()){ // EOF or error.
                 if(err_)
                     err_.set("read_page()");
@@ -644,54 +665,77 @@ bool SegmentReader::next(){
             }
         }
 
-        record_type = buf[page_offset ++];
+        record_type = page[page_offset ++];
         // std::cerr << "type: " << record_type << std::endl;
         if(record_type == RECORD_PAGE_TERM){
-            if(page_offset == PAGE_SIZE)
-                continue;
-
             // We are pedantic and check whether the zeros are actually up
             // to a page boundary.
             // It's not strictly necessary but may catch sketchy state early.
-            for(; page_offset < PAGE_SIZE; ++ page_offset){
-                if(buf[page_offset] != 0){
+            for(; page_offset < page_len; ++ page_offset){
+                if(page[page_offset] != 0){
                     err_.set("unexpected non-zero byte in padded page");
                     return false;
                 }
             }
+            page_offset = PAGE_SIZE;
             continue;
         }
 
+        if(i == 0)
+            compressed = record_type & RECORD_COMPRESSED;
+        else if(compressed != static_cast<bool>(record_type & RECORD_COMPRESSED)){
+            err_.set("unexpected compression flag of record fragment");
+            return false;
+        }
+        bool castagnoli = record_type & RECORD_CRC32C;
+        record_type &= ~(RECORD_COMPRESSED | RECORD_CRC32C);
         err_ = validate_record(i, record_type);
         if(err_)
             return false;
 
-        int length = base::get_uint16_big_endian(buf + page_offset);
+        if(page_offset + HEADER_SIZE - 1 > page_len){
+            err_.set("unexpected end of segment in record header");
+            return false;
+        }
+        int length = base::get_uint16_big_endian(page + page_offset);
         page_offset += 2;
-        uint32_t crc32 = base::get_uint32_big_endian(buf + page_offset);
+        uint32_t crc32 = base::get_uint32_big_endian(page + page_offset);
         page_offset += 4;
 
         // fix error of empty record.
         if(length == 0)
             return next();
-        if(length + page_offset > PAGE_SIZE){
-            err_.set("invalid record size " + std::to_string(length) + ", expected " + std::to_string(PAGE_SIZE - page_offset));
+        if(length + page_offset > page_len){
+            err_.set("invalid record size " + std::to_string(length) + ", expected " + std::to_string(page_len - page_offset));
             return false;
         }
 
-        uint32_t validate_crc32 = base::GetCrc32(buf + page_offset, length);
+        const uint8_t * fragment = page + page_offset;
+        uint32_t validate_crc32 = castagnoli ? base::GetCrc32c(fragment, length) : base::GetCrc32(fragment, length);
         if(crc32 != validate_crc32){
             err_.set("invalid checksum " + std::to_string(validate_crc32) + ", expected " + std::to_string(crc32));
             return false;
         }
-        for(int j = page_offset; j < page_offset + length; ++ j)
-            record_.push_back(buf[j]);
         page_offset += length;
 
-        segment_offset += HEADER_SIZE + length;
-
-        if(record_type == RECORD_FULL || record_type == RECORD_LAST)
+        if(record_type == RECORD_FULL || record_type == RECORD_LAST){
+            if(record_type == RECORD_LAST){
+                record_.insert(record_.end(), fragment, fragment + length);
+                view = std::pair<const uint8_t *, int>(record_.data(), record_.size());
+            }
+            else
+                view = std::pair<const uint8_t *, int>(fragment, length);
+            if(compressed){
+                if(!inflate_record(view.first, view.second, inflated)){
+                    err_.set("cannot decompress record");
+                    return false;
+                }
+                record_.swap(inflated);
+                view = std::pair<const uint8_t *, int>(record_.data(), record_.size());
+            }
             return true;
+        }
+        record_.insert(record_.end(), fragment, fragment + length);
         // Only increment i for non-zero records since we use it
         // to determine valid content record sequences.
         ++ i;
@@ -703,14 +747,15 @@ error::Error SegmentReader::error(){
 }
 
 CorruptionError SegmentReader::cerror(){
-    if(err_)
-        return CorruptionError(segments[segment_index]->dir_, segments[segment_index]->index_, segment_offset, err_);
+    if(err_ && !segments.empty())
+        return CorruptionError(segments[segment_index]->dir_, segments[segment_index]->index_, offset(), err_);
     return CorruptionError();
 }
 
 // <ptr, length>.
-std::pair<uint8_t *, int> SegmentReader::record(){
-    return std::make_pair(&(record_[0]), record_.size());
+// <ptr, length>, valid until the next call to next().
+std::pair<const uint8_t *, int> SegmentReader::record(){
+    return view;
 }
 
 int SegmentReader::segment(){
@@ -720,12 +765,19 @@ int SegmentReader::segment(){
 }
 
 int SegmentReader::offset(){
-    return segment_offset;
+    if(page == NULL)
+        return 0;
+    return page_start + page_offset;
 }
 
 // Close all Segments.
 void SegmentReader::clear(){
+    unmap_segment();
     segments.clear();
 }
 
+SegmentReader::~SegmentReader(){
+    unmap_segment();
+}
+
 }}
\ No newline at end of file
@@ -2,11 +2,15 @@
 #define WAL_H
 #include <boost/noncopyable.hpp>
 #include <cstring>
+#include <deque>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "base/Error.hpp"
 #include "base/Mutex.hpp"
 #include "base/ThreadPool.hpp"
+#include "wal/SegmentWriter.hpp"
 #include "wal/WALUtils.hpp"
 
 namespace tsdb{
@@ -21,8 +25,7 @@ class Page: boost::noncopyable{
         uint8_t buf_[32 * 1024];
 
         Page(){
-            alloc = 0;
-            flushed = 0;
+            reset(true);
         }
 
         bool full(){
@@ -46,12 +49,14 @@ class Segment: boost::noncopyable{
     public:
         std::string dir_;
         int index_;
-        FILE * f;
+        FILE * f; // Read only.
+        std::unique_ptr<SegmentWriter> writer; // Write only.
         error::Error err_;
         bool closed;
         
     public:
-        Segment(const std::string & dir, int index, bool write=true); // Read/Write.
+        // When writing, the segment reserves prealloc bytes of disk up front.
+        Segment(const std::string & dir, int index, bool write=true, int64_t prealloc=0); // Read/Write.
         Segment(const std::string & filename); //Read.
         Segment(const std::string & filename, const std::string & dir, int index); // Read.
 
@@ -65,12 +70,14 @@ class Segment: boost::noncopyable{
 
         bool get_close(){ return closed; }
         void set_closed(bool c){ closed = c; }
-        void close(){
-            if(!closed){
-                fsync(fileno(f));
-                fclose(f);
-                closed = true;
-            }
+        error::Error close(){
+            if(closed)
+                return error::Error();
+            closed = true;
+            if(writer)
+                return writer->close();
+            fclose(f);
+            return error::Error();
         }
 
         ~Segment(){
@@ -128,6 +135,13 @@ class WAL: boost::noncopyable{
         std::shared_ptr<base::ThreadPool> pool_;
         error::Error err_;
 
+        // Compress the records with zlib before splitting them into pages.
+        bool compress_;
+        std::vector<uint8_t> compressed;
+
+        // fdatasync() the segment at the end of each batch.
+        bool sync_;
+
     public:
         WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool_, int segment_size=SEGMENT_SIZE);
         std::string dir(){ return dir_; }
@@ -159,6 +173,17 @@ class WAL: boost::noncopyable{
 
         std::shared_ptr<base::ThreadPool> pool(){ return pool_; }
 
+        // When set, records of at least MIN_COMPRESS_RECORD_SIZE bytes are
+        // deflated at the fastest level and their fragments are flagged with
+        // RECORD_COMPRESSED, unless that does not make them smaller. Readers
+        // handle both kinds of records whatever the setting.
+        void set_compression(bool compress){ compress_ = compress; }
+        bool compression(){ return compress_; }
+
+        // When set, log() only returns after the last record of a batch is on
+        // disk. The write and the fdatasync() go out as one submission.
+        void set_sync(bool sync){ sync_ = sync; }
+
         void sync();
 
         error::Error error(){ return err_; }
@@ -167,20 +192,31 @@ class WAL: boost::noncopyable{
 
 error::Error validate_record(int i, RECORD_TYPE type);
 
-class SegmentReader{
+// SegmentReader maps the segments one at a time and walks their pages in
+// place. A record held by a single fragment is returned as a view into the
+// mapping, only fragmented or compressed records are copied out.
+class SegmentReader: boost::noncopyable{
     private:
         std::vector<std::shared_ptr<Segment> > segments;
         int segment_index;
-        int segment_offset;
-        bool offset_reset;
         error::Error err_;
 
         RECORD_TYPE record_type;
-        uint8_t buf[32 * 1024];
+        const uint8_t * map_; // Of segments[segment_index].
+        size_t map_len;
+        size_t page_start; // Of the current page in map_.
+        const uint8_t * page;
+        int page_len; // Smaller than PAGE_SIZE for the last page of a segment.
         int page_offset;
 
-        std::vector<uint8_t> record_;
+        std::vector<uint8_t> record_; // Fragments of the record being read.
+        std::pair<const uint8_t *, int> view;
         bool eof;
+        bool compressed; // Of the record being read.
+        std::vector<uint8_t> inflated;
+
+        bool map_segment();
+        void unmap_segment();
 
     public:
         SegmentReader(const std::string & dir, bool directory=true);
@@ -188,8 +224,8 @@ class SegmentReader{
         SegmentReader(const std::string & name, const std::string & dir, int index);
         SegmentReader(const std::deque<SegmentRange> & segs);
 
-        // Read one page from current segment.
-        // Pad zeros if page size < PAGE_SIZE.
+        // Move to the next page, mapping the next segment when the current
+        // one is exhausted.
         bool read_page();
 
         bool next();
@@ -198,15 +234,19 @@ class SegmentReader{
 
         CorruptionError cerror();
 
-        // <ptr, length>.
-        std::pair<uint8_t *, int> record();
+        // <ptr, length>, valid until the next call to next().
+        std::pair<const uint8_t *, int> record();
 
         int segment();
 
+        // Position in the file of segment() after the last record read, or
+        // where the error was found.
         int offset();
 
         // Close all Segments.
         void clear();
+
+        ~SegmentReader();
 };
 
 
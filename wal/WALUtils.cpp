@@ -9,8 +9,10 @@ const RECORD_TYPE RECORD_FULL = 1;
 const RECORD_TYPE RECORD_FIRST = 2;
 const RECORD_TYPE RECORD_MIDDLE = 3;
 const RECORD_TYPE RECORD_LAST = 4;
+const RECORD_TYPE RECORD_COMPRESSED = 8;
+const RECORD_TYPE RECORD_CRC32C = 16;
 std::string record_type_string(RECORD_TYPE type_){
-    switch(type_){
+    switch(type_ & ~(RECORD_COMPRESSED | RECORD_CRC32C)){
         case 0:
             return "zero";
         case 1:
@@ -30,5 +32,6 @@ std::string record_type_string(RECORD_TYPE type_){
 const int SEGMENT_SIZE = 128 * 1024 * 1024;
 const int PAGE_SIZE = 32 * 1024;
 const int HEADER_SIZE = 7;
+const int MIN_COMPRESS_RECORD_SIZE = 256;
 
 }}
\ No newline at end of file
@@ -14,12 +14,19 @@ extern const RECORD_TYPE RECORD_FULL;
 extern const RECORD_TYPE RECORD_FIRST;
 extern const RECORD_TYPE RECORD_MIDDLE;
 extern const RECORD_TYPE RECORD_LAST;
+// Flag bit of the fragments of a record compressed by the WAL.
+extern const RECORD_TYPE RECORD_COMPRESSED;
+// Flag bit of the fragments checksummed with CRC-32C instead of CRC-32, set on
+// all fragments written since. Readers accept both.
+extern const RECORD_TYPE RECORD_CRC32C;
 std::string record_type_string(RECORD_TYPE type_);
 
 // WAL meta.
 extern const int SEGMENT_SIZE;
 extern const int PAGE_SIZE;
 extern const int HEADER_SIZE;
+// Records shorter than this are not worth compressing.
+extern const int MIN_COMPRESS_RECORD_SIZE;
 
 }}
 
@@ -1,8 +1,11 @@
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/range/iterator_range.hpp>
 // #include <iostream>
+#include <memory>
 
+#include "base/CountDownLatch.hpp"
 #include "tsdbutil/RecordDecoder.hpp"
 #include "tsdbutil/RecordEncoder.hpp"
 #include "tsdbutil/tsdbutils.hpp"
@@ -12,6 +15,7 @@ namespace tsdb {
 namespace wal {
 
 const std::string CHECKPOINT_PREFIX = "checkpoint.";
+const int CHECKPOINT_CONCURRENCY = 4;
 
 // last_checkpoint returns the directory name and index of the most recent
 // checkpoint. If dir does not contain any checkpoints, ErrNotFound is returned.
@@ -78,6 +82,238 @@ error::Error delete_checkpoints(const std::string& dir, int max_index)
         boost::filesystem::remove_all(s);
     return error::Error();
 }
+namespace {
+
+// Filtered records of one segment, filled by a pool thread.
+class CheckpointSegment {
+public:
+    SegmentRange range;
+    std::vector<std::vector<uint8_t>> recs;
+    CheckpointStats stats;
+    error::Error err;
+    base::CountDownLatch done;
+
+    CheckpointSegment(const std::string& dir, int index)
+        : range(dir, index, index), done(1)
+    {}
+};
+
+// filter_records re-encodes the records of reader that are still needed
+// into recs.
+error::Error filter_records(SegmentReader* reader,
+                            const std::function<bool(tagtree::TSID)>& keep,
+                            int64_t mint,
+                            std::vector<std::vector<uint8_t>>* recs,
+                            CheckpointStats* stats)
+{
+    std::vector<tsdbutil::RefSeries> series;
+    std::vector<tsdbutil::RefSample> samples;
+    std::vector<tsdbutil::Stone> stones;
+    // std::deque<tsdbutil::RefGroupSeries> group_series;
+    // std::deque<tsdbutil::RefGroupSample> group_samples;
+
+    while (reader->next()) {
+        series.clear();
+        samples.clear();
+        stones.clear();
+
+        std::pair<const uint8_t*, int> rec = reader->record();
+        tsdbutil::RECORD_ENTRY_TYPE type =
+            tsdbutil::RecordDecoder::type(rec.first, rec.second);
+        // std::cerr << "type: " << (int)(rec.first[0]) << ", " <<
+        // (int)(type) << std::endl;
+        if (type == tsdbutil::RECORD_SERIES) {
+            error::Error err = tsdbutil::RecordDecoder::series(
+                rec.first, rec.second, series);
+            if (err)
+                return error::wrap(err, "decode series");
+            stats->total_series += series.size();
+            int rm_count = 0;
+            auto it = series.begin();
+            while (it != series.end()) {
+                if (!keep(it->tsid)) {
+                    ++rm_count;
+                    it = series.erase(it);
+                } else
+                    ++it;
+            }
+            if (!series.empty()) {
+                recs->push_back(std::vector<uint8_t>());
+                tsdbutil::RecordEncoder::series(series, recs->back());
+            }
+            stats->dropped_series += rm_count;
+        }
+        // else if(type == tsdbutil::RECORD_GROUP_SERIES){
+        //     error::Error err =
+        //     tsdbutil::RecordDecoder::group_series(rec.first, rec.second,
+        //     group_series); if(err)
+        //         return {CheckpointStats(), error::wrap(err, "decode group
+        //         series")};
+        //     for(auto const& rgs: group_series)
+        //         stats->total_series += rgs.series.size();
+        //     int rm_count = 0;
+        //     auto it = group_series.begin();
+        //     while(it != group_series.end()){
+        //         if(!keep(it->group_ref)){
+        //             rm_count += it->series.size();
+        //             it = group_series.erase(it);
+        //         }
+        //         else
+        //             ++ it;
+        //     }
+        //     if(!group_series.empty()){
+        //         recs->push_back(std::vector<uint8_t>());
+        //         tsdbutil::RecordEncoder::group_series(group_series,
+        //         recs->back()); count += recs->back().size();
+        //     }
+        //     stats->dropped_series += rm_count;
+        // }
+        else if (type == tsdbutil::RECORD_SAMPLES ||
+                 type == tsdbutil::RECORD_COMPRESSED_SAMPLES) {
+            error::Error err = tsdbutil::RecordDecoder::samples(
+                rec.first, rec.second, samples);
+            if (err)
+                return error::wrap(err, "decode samples");
+            stats->total_samples += samples.size();
+            int rm_count = 0;
+            auto it = samples.begin();
+            while (it != samples.end()) {
+                if (!keep(it->tsid) || it->t < mint) {
+                    ++rm_count;
+                    it = samples.erase(it);
+                } else
+                    ++it;
+            }
+            if (!samples.empty()) {
+                recs->push_back(std::vector<uint8_t>());
+                // Keep the encoding of the record.
+                if (type == tsdbutil::RECORD_COMPRESSED_SAMPLES)
+                    tsdbutil::RecordEncoder::compressed_samples(
+                        samples, recs->back());
+                else
+                    tsdbutil::RecordEncoder::samples(samples,
+                                                     recs->back());
+            }
+            stats->dropped_samples += rm_count;
+        }
+        // else if(type == tsdbutil::RECORD_GROUP_SAMPLES){
+        //     error::Error err =
+        //     tsdbutil::RecordDecoder::group_samples(rec.first, rec.second,
+        //     group_samples); if(err)
+        //         return {CheckpointStats(), error::wrap(err, "decode group
+        //         samples")};
+        //     for(auto const& rgs: group_samples)
+        //         stats->total_samples += rgs.samples.size();
+        //     int rm_count = 0;
+        //     auto it = group_samples.begin();
+        //     while(it != group_samples.end()){
+        //         if(!keep(it->group_ref) || it->timestamp < mint){
+        //             rm_count += it->samples.size();
+        //             it = group_samples.erase(it);
+        //         }
+        //         else
+        //             ++ it;
+        //     }
+        //     if(!group_samples.empty()){
+        //         recs->push_back(std::vector<uint8_t>());
+        //         tsdbutil::RecordEncoder::group_samples(group_samples,
+        //         recs->back()); count += recs->back().size();
+        //     }
+        //     stats->dropped_samples += rm_count;
+        // }
+        else if (type == tsdbutil::RECORD_TOMBSTONES) {
+            error::Error err = tsdbutil::RecordDecoder::tombstones(
+                rec.first, rec.second, stones);
+            if (err)
+                return error::wrap(err, "decode tombstones");
+            stats->total_tombstones += stones.size();
+            int rm_count = 0;
+            auto it = stones.begin();
+            while (it != stones.end()) {
+                if (!keep(it->tsid)) {
+                    ++rm_count;
+                    it = stones.erase(it);
+                    continue;
+                }
+                bool cover = false;
+                for (auto const& itvl : it->itvls) {
+                    if (itvl.max_time >= mint) {
+                        cover = true;
+                        break;
+                    }
+                }
+                if (!cover) {
+                    ++rm_count;
+                    it = stones.erase(it);
+                } else
+                    ++it;
+            }
+            if (!stones.empty()) {
+                recs->push_back(std::vector<uint8_t>());
+                tsdbutil::RecordEncoder::tombstones(stones, recs->back());
+            }
+            stats->dropped_tombstones += rm_count;
+        }
+        // else if(type == tsdbutil::RECORD_GROUP_TOMBSTONES){
+        //     error::Error err =
+        //     tsdbutil::RecordDecoder::group_tombstones(rec.first,
+        //     rec.second, stones); if(err)
+        //         return {CheckpointStats(), error::wrap(err, "decode group
+        //         tombstones")};
+        //     stats->total_tombstones += stones.size();
+        //     int rm_count = 0;
+        //     auto it = stones.begin();
+        //     while(it != stones.end()){
+        //         if(!keep(it->ref)){
+        //             ++ rm_count;
+        //             it = stones.erase(it);
+        //             continue;
+        //         }
+        //         bool cover = false;
+        //         for(auto const& itvl: it->itvls){
+        //             if(itvl.max_time >= mint){
+        //                 cover = true;
+        //                 break;
+        //             }
+        //         }
+        //         if(!cover){
+        //             ++ rm_count;
+        //             it = stones.erase(it);
+        //         }
+        //         else
+        //             ++ it;
+        //     }
+        //     if(!stones.empty()){
+        //         recs->push_back(std::vector<uint8_t>());
+        //         tsdbutil::RecordEncoder::group_tombstones(stones,
+        //         recs->back()); count += recs->back().size();
+        //     }
+        //     stats->dropped_tombstones += rm_count;
+        // }
+        else
+            return error::Error("invalid record type");
+
+    }
+    // If we hit any corruption during checkpointing, repairing is not an
+    // option. The head won't know which series records are lost.
+    if (reader->error()) return error::wrap(reader->error(), "read segments");
+    return error::Error();
+}
+
+void filter_segment(CheckpointSegment* seg,
+                    const std::function<bool(tagtree::TSID)>* keep,
+                    int64_t mint)
+{
+    SegmentReader reader(std::deque<SegmentRange>(1, seg->range));
+    if (reader.error())
+        seg->err = error::wrap(reader.error(), "create segment reader");
+    else
+        seg->err = filter_records(&reader, *keep, mint, &seg->recs,
+                                  &seg->stats);
+    seg->done.countDown();
+}
+
+} // namespace
 
 // checkpoint creates a compacted checkpoint of segments in range [first, last]
 // in the given WAL. It includes the most recent checkpoint if it exists. All
@@ -87,12 +323,17 @@ error::Error delete_checkpoints(const std::string& dir, int max_index)
 // segmented format as the original WAL itself.
 // This makes it easy to read it through the WAL package and concatenate
 // it with the original WAL.
+//
+// Each segment is decoded and filtered by its own task on the pool of the WAL,
+// with up to CHECKPOINT_CONCURRENCY of them ahead of the writer. The results
+// are written in segment order as soon as they are ready, so only the
+// segments in flight are held in memory.
 std::pair<CheckpointStats, error::Error>
 checkpoint(WAL* wal, int from, int to,
            const std::function<bool(tagtree::TSID)>& keep, int64_t mint)
 {
     CheckpointStats stats;
-    std::deque<SegmentRange> seg_ranges;
+    std::vector<std::unique_ptr<CheckpointSegment>> segs;
     std::pair<std::pair<std::string, int>, error::Error> lp =
         last_checkpoint(wal->dir());
     if (lp.second && lp.second != "not found")
@@ -109,225 +350,80 @@ checkpoint(WAL* wal, int from, int to,
         // Ignore WAL files below the checkpoint. They shouldn't exist to begin
         // with.
         from = last;
-        seg_ranges.emplace_back(lp.first.first, -1, -1);
+        std::pair<std::vector<SegmentRef>, error::Error> cp_segs =
+            list_segments(lp.first.first);
+        if (cp_segs.second)
+            return {CheckpointStats(),
+                    error::wrap(cp_segs.second, "list last checkpoint")};
+        for (const SegmentRef& ref : cp_segs.first)
+            segs.emplace_back(
+                new CheckpointSegment(lp.first.first, ref.index));
     }
-    seg_ranges.emplace_back(wal->dir(), from, to);
-    SegmentReader reader(seg_ranges);
-    if (reader.error())
+    std::pair<std::vector<SegmentRef>, error::Error> wal_segs =
+        list_segments(wal->dir());
+    if (wal_segs.second)
         return {CheckpointStats(),
-                error::wrap(reader.error(), "create segment reader")};
+                error::wrap(wal_segs.second, "list segments")};
+    for (const SegmentRef& ref : wal_segs.first) {
+        if (ref.index >= from && ref.index <= to)
+            segs.emplace_back(new CheckpointSegment(wal->dir(), ref.index));
+    }
 
     std::string cpdir = tsdbutil::filepath_join(
         wal->dir(), (boost::format(CHECKPOINT_PREFIX + "%06d") % to).str());
     std::string cpdirtmp = cpdir + ".tmp";
 
+    // The tasks in flight reference segs and keep.
+    int submitted = 0;
+    auto wait_submitted = [&segs, &submitted](int i) {
+        for (; i < submitted; ++i)
+            segs[i]->done.wait();
+    };
+
+    // Leftovers of an earlier checkpoint that failed or crashed would be
+    // reopened and appended to.
+    boost::filesystem::remove_all(cpdirtmp);
+    error::Error err;
     {
         WAL cp_wal(cpdirtmp, wal->pool());
         if (cp_wal.error())
-            return {CheckpointStats(),
-                    error::wrap(cp_wal.error(), "open checkpoint")};
-
-        std::vector<tsdbutil::RefSeries> series;
-        std::vector<tsdbutil::RefSample> samples;
-        std::vector<tsdbutil::Stone> stones;
-        // std::deque<tsdbutil::RefGroupSeries> group_series;
-        // std::deque<tsdbutil::RefGroupSample> group_samples;
+            err = error::wrap(cp_wal.error(), "open checkpoint");
+        else
+            cp_wal.set_compression(wal->compression());
 
-        int count = 0;
-        std::vector<std::vector<uint8_t>> recs;
-        while (reader.next()) {
-            series.clear();
-            samples.clear();
-            stones.clear();
-
-            std::pair<uint8_t*, int> rec = reader.record();
-            tsdbutil::RECORD_ENTRY_TYPE type =
-                tsdbutil::RecordDecoder::type(rec.first, rec.second);
-            // std::cerr << "type: " << (int)(rec.first[0]) << ", " <<
-            // (int)(type) << std::endl;
-            if (type == tsdbutil::RECORD_SERIES) {
-                error::Error err = tsdbutil::RecordDecoder::series(
-                    rec.first, rec.second, series);
-                if (err)
-                    return {CheckpointStats(),
-                            error::wrap(err, "decode series")};
-                stats.total_series += series.size();
-                int rm_count = 0;
-                auto it = series.begin();
-                while (it != series.end()) {
-                    if (!keep(it->tsid)) {
-                        ++rm_count;
-                        it = series.erase(it);
-                    } else
-                        ++it;
-                }
-                if (!series.empty()) {
-                    recs.push_back(std::vector<uint8_t>());
-                    tsdbutil::RecordEncoder::series(series, recs.back());
-                    count += recs.back().size();
-                }
-                stats.dropped_series += rm_count;
-            }
-            // else if(type == tsdbutil::RECORD_GROUP_SERIES){
-            //     error::Error err =
-            //     tsdbutil::RecordDecoder::group_series(rec.first, rec.second,
-            //     group_series); if(err)
-            //         return {CheckpointStats(), error::wrap(err, "decode group
-            //         series")};
-            //     for(auto const& rgs: group_series)
-            //         stats.total_series += rgs.series.size();
-            //     int rm_count = 0;
-            //     auto it = group_series.begin();
-            //     while(it != group_series.end()){
-            //         if(!keep(it->group_ref)){
-            //             rm_count += it->series.size();
-            //             it = group_series.erase(it);
-            //         }
-            //         else
-            //             ++ it;
-            //     }
-            //     if(!group_series.empty()){
-            //         recs.push_back(std::vector<uint8_t>());
-            //         tsdbutil::RecordEncoder::group_series(group_series,
-            //         recs.back()); count += recs.back().size();
-            //     }
-            //     stats.dropped_series += rm_count;
-            // }
-            else if (type == tsdbutil::RECORD_SAMPLES) {
-                error::Error err = tsdbutil::RecordDecoder::samples(
-                    rec.first, rec.second, samples);
-                if (err)
-                    return {CheckpointStats(),
-                            error::wrap(err, "decode samples")};
-                stats.total_samples += samples.size();
-                int rm_count = 0;
-                auto it = samples.begin();
-                while (it != samples.end()) {
-                    if (!keep(it->tsid) || it->t < mint) {
-                        ++rm_count;
-                        it = samples.erase(it);
-                    } else
-                        ++it;
-                }
-                if (!samples.empty()) {
-                    recs.push_back(std::vector<uint8_t>());
-                    tsdbutil::RecordEncoder::samples(samples, recs.back());
-                    count += recs.back().size();
-                }
-                stats.dropped_samples += rm_count;
+        for (int i = 0; !err && i < static_cast<int>(segs.size()); ++i) {
+            for (; submitted < static_cast<int>(segs.size()) &&
+                   submitted < i + CHECKPOINT_CONCURRENCY;
+                 ++submitted)
+                wal->pool()->run(boost::bind(&filter_segment,
+                                             segs[submitted].get(), &keep,
+                                             mint),
+                                 base::TASK_PRIORITY_LOW);
+            segs[i]->done.wait();
+            err = segs[i]->err;
+            if (!err && !segs[i]->recs.empty()) {
+                err = cp_wal.log(segs[i]->recs);
+                if (err) err = error::wrap(err, "flush records");
             }
-            // else if(type == tsdbutil::RECORD_GROUP_SAMPLES){
-            //     error::Error err =
-            //     tsdbutil::RecordDecoder::group_samples(rec.first, rec.second,
-            //     group_samples); if(err)
-            //         return {CheckpointStats(), error::wrap(err, "decode group
-            //         samples")};
-            //     for(auto const& rgs: group_samples)
-            //         stats.total_samples += rgs.samples.size();
-            //     int rm_count = 0;
-            //     auto it = group_samples.begin();
-            //     while(it != group_samples.end()){
-            //         if(!keep(it->group_ref) || it->timestamp < mint){
-            //             rm_count += it->samples.size();
-            //             it = group_samples.erase(it);
-            //         }
-            //         else
-            //             ++ it;
-            //     }
-            //     if(!group_samples.empty()){
-            //         recs.push_back(std::vector<uint8_t>());
-            //         tsdbutil::RecordEncoder::group_samples(group_samples,
-            //         recs.back()); count += recs.back().size();
-            //     }
-            //     stats.dropped_samples += rm_count;
-            // }
-            else if (type == tsdbutil::RECORD_TOMBSTONES) {
-                error::Error err = tsdbutil::RecordDecoder::tombstones(
-                    rec.first, rec.second, stones);
-                if (err)
-                    return {CheckpointStats(),
-                            error::wrap(err, "decode tombstones")};
-                stats.total_tombstones += stones.size();
-                int rm_count = 0;
-                auto it = stones.begin();
-                while (it != stones.end()) {
-                    if (!keep(it->tsid)) {
-                        ++rm_count;
-                        it = stones.erase(it);
-                        continue;
-                    }
-                    bool cover = false;
-                    for (auto const& itvl : it->itvls) {
-                        if (itvl.max_time >= mint) {
-                            cover = true;
-                            break;
-                        }
-                    }
-                    if (!cover) {
-                        ++rm_count;
-                        it = stones.erase(it);
-                    } else
-                        ++it;
-                }
-                if (!stones.empty()) {
-                    recs.push_back(std::vector<uint8_t>());
-                    tsdbutil::RecordEncoder::tombstones(stones, recs.back());
-                    count += recs.back().size();
-                }
-                stats.dropped_tombstones += rm_count;
+            if (err) {
+                wait_submitted(i + 1);
+                break;
             }
-            // else if(type == tsdbutil::RECORD_GROUP_TOMBSTONES){
-            //     error::Error err =
-            //     tsdbutil::RecordDecoder::group_tombstones(rec.first,
-            //     rec.second, stones); if(err)
-            //         return {CheckpointStats(), error::wrap(err, "decode group
-            //         tombstones")};
-            //     stats.total_tombstones += stones.size();
-            //     int rm_count = 0;
-            //     auto it = stones.begin();
-            //     while(it != stones.end()){
-            //         if(!keep(it->ref)){
-            //             ++ rm_count;
-            //             it = stones.erase(it);
-            //             continue;
-            //         }
-            //         bool cover = false;
-            //         for(auto const& itvl: it->itvls){
-            //             if(itvl.max_time >= mint){
-            //                 cover = true;
-            //                 break;
-            //             }
-            //         }
-            //         if(!cover){
-            //             ++ rm_count;
-            //             it = stones.erase(it);
-            //         }
-            //         else
-            //             ++ it;
-            //     }
-            //     if(!stones.empty()){
-            //         recs.push_back(std::vector<uint8_t>());
-            //         tsdbutil::RecordEncoder::group_tombstones(stones,
-            //         recs.back()); count += recs.back().size();
-            //     }
-            //     stats.dropped_tombstones += rm_count;
-            // }
-            else
-                return {CheckpointStats(), error::Error("invalid record type")};
 
-            if (count > 1 * 1024 * 1024) {
-                error::Error err = cp_wal.log(recs);
-                if (err)
-                    return {CheckpointStats(),
-                            error::wrap(err, "flush records")};
-                count = 0;
-                recs.clear();
-            }
+            const CheckpointStats& s = segs[i]->stats;
+            stats.dropped_series += s.dropped_series;
+            stats.dropped_samples += s.dropped_samples;
+            stats.dropped_tombstones += s.dropped_tombstones;
+            stats.total_series += s.total_series;
+            stats.total_samples += s.total_samples;
+            stats.total_tombstones += s.total_tombstones;
+            segs[i].reset();
         }
-        // If we hit any corruption during checkpointing, repairing is not an
-        // option. The head won't know which series records are lost.
-        error::Error err = cp_wal.log(recs);
-        if (err) return {CheckpointStats(), error::wrap(err, "flush records")};
+    }
+    // cp_wal is closed, a partial checkpoint must not be picked up later.
+    if (err) {
+        boost::filesystem::remove_all(cpdirtmp);
+        return {CheckpointStats(), err};
     }
     boost::filesystem::rename(cpdirtmp, cpdir);
 
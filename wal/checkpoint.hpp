@@ -25,6 +25,9 @@ public:
 
 extern const std::string CHECKPOINT_PREFIX;
 
+// The most segments filtered ahead of the checkpoint writer.
+extern const int CHECKPOINT_CONCURRENCY;
+
 // last_checkpoint returns the directory name and index of the most recent
 // checkpoint. If dir does not contain any checkpoints, ErrNotFound is returned.
 std::pair<std::pair<std::string, int>, error::Error>
@@ -42,6 +45,9 @@ error::Error delete_checkpoints(const std::string& dir, int max_index);
 // segmented format as the original WAL itself.
 // This makes it easy to read it through the WAL package and concatenate
 // it with the original WAL.
+//
+// The segments are filtered in parallel on the pool of wal, keep must be
+// safe to call concurrently.
 std::pair<CheckpointStats, error::Error>
 checkpoint(WAL* wal, int from, int to,
            const std::function<bool(tagtree::TSID)>& keep, int64_t mint);